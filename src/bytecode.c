@@ -0,0 +1,1399 @@
+/**
+ * @file bytecode.c
+ * @brief Saving compiled functions to `.loxc` files and loading them back.
+ *
+ * Saving walks the function tree depth-first and writes each function right
+ * where it appears in its parent's constant pool. Loading reads the file in
+ * the same order. Code bytes are never copied: a loaded chunk points into the
+ * mapped file and is marked as not owning its code, so `freeChunk` leaves it
+ * alone. Line tables are run-length encoded in the file and expanded on load.
+ *
+ * While a function is being loaded it sits on the VM stack, so the garbage
+ * collector, which may run on any allocation, sees it and its constants.
+ *
+ * Snapshots are written in two passes: a breadth-first walk from the globals
+ * numbers every reachable object, then the objects are written by number.
+ * Restoring allocates all objects from their shells before filling in any
+ * reference, which is what lets cycles between objects be restored.
+ */
+
+#include "bytecode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "map.h"
+#include "memory.h"
+#include "vm.h"
+
+// the length that marks a missing function name
+#define NO_NAME UINT32_MAX
+
+// functions nested deeper than this are rejected instead of recursed into
+#define MAX_FUNCTION_DEPTH 256
+
+//-----------------------------------------------------------------------------
+//- Saving
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Writes a 32-bit integer in little-endian order.
+ * @param file The file to write to.
+ * @param value The integer to write.
+ */
+static void writeU32(FILE* file, uint32_t value) {
+    uint8_t bytes[4];
+    for (int32_t i = 0; i < 4; i++) bytes[i] = (uint8_t)(value >> (8 * i));
+    fwrite(bytes, 1, sizeof(bytes), file);
+}
+
+/**
+ * @brief Writes a 64-bit integer in little-endian order.
+ * @param file The file to write to.
+ * @param value The integer to write.
+ */
+static void writeU64(FILE* file, uint64_t value) {
+    writeU32(file, (uint32_t)value);
+    writeU32(file, (uint32_t)(value >> 32));
+}
+
+/**
+ * @brief Writes a length-prefixed string.
+ * @param file The file to write to.
+ * @param chars The characters of the string.
+ * @param length The length of the string.
+ */
+static void writeName(FILE* file, const char* chars, int32_t length) {
+    writeU32(file, (uint32_t)length);
+    fwrite(chars, 1, length, file);
+}
+
+/**
+ * @brief Writes the code and the run-length encoded line table of a chunk.
+ * @param file The file to write to.
+ * @param chunk The chunk to write.
+ */
+static void writeCode(FILE* file, const Chunk* chunk) {
+    writeU32(file, (uint32_t)chunk->count);
+    fwrite(chunk->code, 1, chunk->count, file);
+
+    // lines change rarely, so store them as (line, length) runs
+    int32_t runCount = 0;
+    for (int32_t i = 0; i < chunk->count; i++) {
+        if (i == 0 || chunk->lines[i] != chunk->lines[i - 1]) runCount++;
+    }
+    writeU32(file, (uint32_t)runCount);
+    for (int32_t start = 0; start < chunk->count;) {
+        int32_t end = start + 1;
+        while (end < chunk->count && chunk->lines[end] == chunk->lines[start]) {
+            end++;
+        }
+        writeU32(file, (uint32_t)chunk->lines[start]);
+        writeU32(file, (uint32_t)(end - start));
+        start = end;
+    }
+}
+
+static bool writeFunction(FILE* file, const ObjectFunction* function);
+
+/**
+ * @brief Writes a constant with its tag.
+ * @param file The file to write to.
+ * @param value The constant.
+ * @return bool False if the constant has a type the format cannot hold.
+ */
+static bool writeConstant(FILE* file, Value value) {
+    if (IS_INT(value)) {
+        fputc(BYTECODE_INT, file);
+        writeU32(file, (uint32_t)AS_INT(value));
+    } else if (IS_NUMBER(value)) {
+        double number = AS_NUMBER(value);
+        uint64_t bits;
+        memcpy(&bits, &number, sizeof(bits));
+        fputc(BYTECODE_NUMBER, file);
+        writeU64(file, bits);
+    } else if (IS_SHORT_STRING(value)) {
+        StringView view;
+        viewString(value, &view);
+        fputc(BYTECODE_SHORT_STRING, file);
+        writeName(file, view.chars, view.length);
+    } else if (IS_STRING_OBJECT(value)) {
+        fputc(BYTECODE_STRING, file);
+        writeName(file, AS_STRING(value)->chars, AS_STRING(value)->length);
+    } else if (IS_FUNCTION(value)) {
+        fputc(BYTECODE_FUNCTION, file);
+        return writeFunction(file, AS_FUNCTION(value));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Writes a function and, through its constants, its nested functions.
+ * @param file The file to write to.
+ * @param function The function to write.
+ * @return bool False if a function is an uncompiled stub or a constant could
+ * not be written.
+ */
+static bool writeFunction(FILE* file, const ObjectFunction* function) {
+    if (function->lazy != NULL) return false;
+    writeU32(file, (uint32_t)function->arity);
+    writeU32(file, (uint32_t)function->upvalueCount);
+    if (function->name == NULL) {
+        writeU32(file, NO_NAME);
+    } else {
+        writeName(file, function->name->chars, function->name->length);
+    }
+
+    const Chunk* chunk = &function->chunk;
+    writeCode(file, chunk);
+
+    writeU32(file, (uint32_t)chunk->constants.count);
+    for (int32_t i = 0; i < chunk->constants.count; i++) {
+        if (!writeConstant(file, chunk->constants.values[i])) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Writes a compiled script to a bytecode file.
+ *
+ * Reports any error to stderr.
+ *
+ * @param function The top-level function returned by `compile`.
+ * @param path The path of the file to write.
+ * @return bool True if the file was written, false otherwise.
+ */
+bool saveBytecode(const ObjectFunction* function, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        return false;
+    }
+
+    fwrite("LOXC", 1, 4, file);
+    writeU32(file, BYTECODE_VERSION);
+    writeU32(file, BYTECODE_FLAGS);
+    bool written = writeFunction(file, function);
+
+    if (ferror(file)) written = false;
+    if (fclose(file) != 0) written = false;
+    if (!written) {
+        fprintf(stderr, "Could not write file \"%s\".\n", path);
+        remove(path);
+    }
+    return written;
+}
+
+//-----------------------------------------------------------------------------
+//- Loading
+//-----------------------------------------------------------------------------
+
+// A cursor over the bytes of a loaded file.
+typedef struct {
+    const uint8_t* current;  ///< The next byte to read.
+    const uint8_t* end;      ///< The end of the file.
+    bool failed;             ///< Whether a read ran past the end.
+} Reader;
+
+/**
+ * @brief Reads a run of bytes.
+ * @param reader The reader.
+ * @param length The number of bytes.
+ * @return const uint8_t* The bytes, or NULL if the file is too short.
+ */
+static const uint8_t* readBytes(Reader* reader, uint32_t length) {
+    if (reader->failed || (size_t)(reader->end - reader->current) < length) {
+        reader->failed = true;
+        return NULL;
+    }
+    const uint8_t* bytes = reader->current;
+    reader->current += length;
+    return bytes;
+}
+
+/**
+ * @brief Reads a single byte.
+ * @param reader The reader.
+ * @return uint8_t The byte, or 0 if the file is too short.
+ */
+static uint8_t readU8(Reader* reader) {
+    const uint8_t* bytes = readBytes(reader, 1);
+    return bytes == NULL ? 0 : bytes[0];
+}
+
+/**
+ * @brief Reads a little-endian 32-bit integer.
+ * @param reader The reader.
+ * @return uint32_t The integer, or 0 if the file is too short.
+ */
+static uint32_t readU32(Reader* reader) {
+    const uint8_t* bytes = readBytes(reader, 4);
+    if (bytes == NULL) return 0;
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 |
+           (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+/**
+ * @brief Reads a little-endian 64-bit integer.
+ * @param reader The reader.
+ * @return uint64_t The integer, or 0 if the file is too short.
+ */
+static uint64_t readU64(Reader* reader) {
+    uint64_t low = readU32(reader);
+    return low | (uint64_t)readU32(reader) << 32;
+}
+
+/**
+ * @brief Reads a count that must fit in an `int32_t`.
+ * @param reader The reader.
+ * @return int32_t The count, or -1 if it is out of range.
+ */
+static int32_t readCount(Reader* reader) {
+    uint32_t count = readU32(reader);
+    if (reader->failed || count > INT32_MAX) return -1;
+    return (int32_t)count;
+}
+
+/**
+ * @brief Reads the code and line table of a function.
+ *
+ * The chunk borrows the code from the file instead of copying it.
+ *
+ * @param vm The virtual machine.
+ * @param reader The reader.
+ * @param function The function receiving the code.
+ * @return bool False if the code or the line table is malformed.
+ */
+static bool readCode(VM* vm, Reader* reader, ObjectFunction* function) {
+    int32_t count = readCount(reader);
+    if (count < 0) return false;
+    const uint8_t* code = readBytes(reader, count);
+    if (code == NULL) return false;
+
+    int32_t* lines = ALLOCATE(vm, int32_t, count);
+    Chunk* chunk = &function->chunk;
+    chunk->code = (uint8_t*)code;
+    chunk->lines = lines;
+    chunk->count = count;
+    chunk->capacity = count;
+    chunk->ownsCode = false;
+
+    int32_t runCount = readCount(reader);
+    int32_t filled = 0;
+    for (int32_t i = 0; i < runCount; i++) {
+        int32_t line = readCount(reader);
+        int32_t length = readCount(reader);
+        if (line < 0 || length < 0 || length > count - filled) return false;
+        for (int32_t j = 0; j < length; j++) lines[filled++] = line;
+    }
+    return runCount >= 0 && filled == count;
+}
+
+static ObjectFunction* readFunction(VM* vm, Reader* reader, int32_t depth);
+
+/**
+ * @brief Reads a tagged constant.
+ * @param vm The virtual machine.
+ * @param reader The reader.
+ * @param depth The nesting depth of the function owning the constant.
+ * @param value A pointer where the constant will be stored.
+ * @return bool False if the constant is malformed.
+ */
+static bool readConstant(VM* vm, Reader* reader, int32_t depth, Value* value) {
+    uint8_t tag = readU8(reader);
+    switch (tag) {
+        case BYTECODE_NUMBER: {
+            uint64_t bits = readU64(reader);
+            double number;
+            memcpy(&number, &bits, sizeof(number));
+            *value = NUMBER_VAL(number);
+            break;
+        }
+        case BYTECODE_INT:
+            *value = INT_VAL((int32_t)readU32(reader));
+            break;
+        case BYTECODE_STRING:
+        case BYTECODE_SHORT_STRING: {
+            int32_t length = readCount(reader);
+            if (length < 0) return false;
+            const char* chars = (const char*)readBytes(reader, length);
+            if (chars == NULL) return false;
+            // names must stay ObjectStrings, whatever their length
+            *value = tag == BYTECODE_STRING
+                         ? OBJECT_VAL(copyString(vm, chars, length))
+                         : copyStringValue(vm, chars, length);
+            break;
+        }
+        case BYTECODE_FUNCTION: {
+            ObjectFunction* function = readFunction(vm, reader, depth + 1);
+            if (function == NULL) return false;
+            *value = OBJECT_VAL(function);
+            break;
+        }
+        default:
+            return false;
+    }
+    return !reader->failed;
+}
+
+/**
+ * @brief Reads a function and its nested functions.
+ * @param vm The virtual machine.
+ * @param reader The reader.
+ * @param depth The nesting depth of the function.
+ * @return ObjectFunction* The function, or NULL if it is malformed.
+ */
+static ObjectFunction* readFunction(VM* vm, Reader* reader, int32_t depth) {
+    if (depth > MAX_FUNCTION_DEPTH) return NULL;
+
+    ObjectFunction* function = newFunction(vm);
+    push(vm, OBJECT_VAL(function));  // GC guard while the function is filled in
+
+    uint32_t arity = readU32(reader);
+    uint32_t upvalueCount = readU32(reader);
+    if (arity > UINT8_MAX || upvalueCount > UINT8_COUNT) goto fail;
+    function->arity = (int32_t)arity;
+    function->upvalueCount = (int32_t)upvalueCount;
+
+    uint32_t nameLength = readU32(reader);
+    if (nameLength != NO_NAME) {
+        if (nameLength > INT32_MAX) goto fail;
+        const char* name = (const char*)readBytes(reader, nameLength);
+        if (name == NULL) goto fail;
+        function->name = copyString(vm, name, (int32_t)nameLength);
+    }
+
+    if (!readCode(vm, reader, function)) goto fail;
+
+    int32_t constantCount = readCount(reader);
+    if (constantCount < 0 || constantCount > UINT8_COUNT) goto fail;
+    for (int32_t i = 0; i < constantCount; i++) {
+        Value value;
+        if (!readConstant(vm, reader, depth, &value)) goto fail;
+        addConstant(vm, &function->chunk, value);
+    }
+    function->maxSlots = checkCode(vm, &function->chunk, function->arity,
+                                   function->upvalueCount);
+    if (function->maxSlots < 0) goto fail;
+
+    pop(vm);
+    return function;
+
+fail:
+    pop(vm);
+    return NULL;
+}
+
+/**
+ * @brief Reads a whole file into memory, mapping it where possible.
+ *
+ * The contents are not NUL-terminated. An empty file gives an image with no
+ * data. The image must be released with `closeImage` unless it is handed to
+ * the VM, which releases it in `freeLoadedImages`.
+ *
+ * @param path The path of the file.
+ * @return LoadedImage* The image, or NULL if the file could not be read.
+ */
+LoadedImage* openImage(const char* path) {
+    LoadedImage* image = (LoadedImage*)malloc(sizeof(LoadedImage));
+    if (image == NULL) return NULL;
+
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        if (fd >= 0) close(fd);
+        free(image);
+        return NULL;
+    }
+
+    image->size = (size_t)info.st_size;
+    if (image->size == 0) {
+        // mmap rejects empty mappings
+        close(fd);
+        image->data = NULL;
+        return image;
+    }
+    image->data =
+        (uint8_t*)mmap(NULL, image->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // the mapping stays valid without the descriptor
+    if (image->data == MAP_FAILED) {
+        free(image);
+        return NULL;
+    }
+#else
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        free(image);
+        return NULL;
+    }
+    fseek(file, 0L, SEEK_END);
+    image->size = (size_t)ftell(file);
+    rewind(file);
+    image->data = (uint8_t*)malloc(image->size);
+    if ((image->data == NULL && image->size > 0) ||
+        fread(image->data, 1, image->size, file) < image->size) {
+        fclose(file);
+        free(image->data);
+        free(image);
+        return NULL;
+    }
+    fclose(file);
+#endif
+
+    return image;
+}
+
+/**
+ * @brief Releases the memory of an image read by `openImage`.
+ * @param image The image to release.
+ */
+void closeImage(LoadedImage* image) {
+#ifndef _WIN32
+    if (image->size > 0) munmap(image->data, image->size);
+#else
+    free(image->data);
+#endif
+    free(image);
+}
+
+/**
+ * @brief Reads and checks the header of a bytecode file or snapshot.
+ *
+ * Reports any mismatch to stderr.
+ *
+ * @param reader The reader, positioned at the start of the file.
+ * @param magic The four bytes the file must start with.
+ * @param kind The kind of file expected, for error messages.
+ * @param path The path of the file, for error messages.
+ * @return bool True if the header matches this build.
+ */
+static bool readHeader(Reader* reader, const char* magic, const char* kind,
+                       const char* path) {
+    const uint8_t* bytes = readBytes(reader, 4);
+    if (bytes == NULL || memcmp(bytes, magic, 4) != 0) {
+        fprintf(stderr, "\"%s\" is not a %s file.\n", path, kind);
+        return false;
+    }
+    uint32_t version = readU32(reader);
+    if (version != BYTECODE_VERSION) {
+        fprintf(stderr, "\"%s\" has %s version %u, expected %d.\n", path,
+                kind, version, BYTECODE_VERSION);
+        return false;
+    }
+    if (readU32(reader) != BYTECODE_FLAGS) {
+        fprintf(stderr, "\"%s\" was written by an incompatible build.\n",
+                path);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Loads a compiled script from a bytecode file.
+ *
+ * The file stays mapped until `freeLoadedImages` is called, since the code of
+ * the loaded functions points into it. The structure of the file, the
+ * operands of every instruction and the stack depth at every instruction are
+ * checked (see `checkCode`), so damaged code is rejected before it runs. The
+ * types of the values on the stack are left to the instructions, which raise
+ * a runtime error when they get a value of the wrong type. Reports any error
+ * to stderr.
+ *
+ * @param vm The virtual machine.
+ * @param path The path of the file to load.
+ * @return ObjectFunction* The top-level function, or NULL on error.
+ */
+ObjectFunction* loadBytecode(VM* vm, const char* path) {
+    LoadedImage* image = openImage(path);
+    if (image == NULL) {
+        fprintf(stderr, "Could not read file \"%s\".\n", path);
+        return NULL;
+    }
+
+    Reader reader = {image->data, image->data + image->size, false};
+    if (!readHeader(&reader, "LOXC", "bytecode", path)) {
+        closeImage(image);
+        return NULL;
+    }
+
+    ObjectFunction* function = readFunction(vm, &reader, 0);
+    if (function == NULL || reader.current != reader.end) {
+        // functions read so far are unreachable and never run, so the
+        // mapping can go even though their chunks still point into it
+        fprintf(stderr, "\"%s\" is a corrupt bytecode file.\n", path);
+        closeImage(image);
+        return NULL;
+    }
+
+    image->next = vm->images;
+    vm->images = image;
+    return function;
+}
+
+//-----------------------------------------------------------------------------
+//- Saving Snapshots
+//-----------------------------------------------------------------------------
+
+// the object number that marks a missing name or superclass
+#define NO_OBJECT UINT32_MAX
+
+// The state of a snapshot being written.
+typedef struct {
+    FILE* file;          ///< The file being written.
+    Map numbers;         ///< The number of every object found so far.
+    ValueArray objects;  ///< The objects found so far, by number.
+} SnapshotWriter;
+
+/**
+ * @brief Adds an object to the snapshot unless it is already part of it.
+ * @param vm The virtual machine.
+ * @param writer The snapshot writer.
+ * @param object The object, or NULL.
+ */
+static void addObject(VM* vm, SnapshotWriter* writer, Object* object) {
+    if (object == NULL) return;
+    Value number;
+    if (mapGet(&writer->numbers, OBJECT_VAL(object), &number)) return;
+    mapSet(vm, &writer->numbers, OBJECT_VAL(object),
+           INT_VAL(writer->objects.count));
+    writeValueArray(vm, &writer->objects, OBJECT_VAL(object));
+}
+
+/**
+ * @brief Adds the object a value refers to, if any, to the snapshot.
+ * @param vm The virtual machine.
+ * @param writer The snapshot writer.
+ * @param value The value.
+ */
+static void addValue(VM* vm, SnapshotWriter* writer, Value value) {
+    if (IS_OBJECT(value)) addObject(vm, writer, AS_OBJECT(value));
+}
+
+/**
+ * @brief Adds the keys and values of a table to the snapshot.
+ * @param vm The virtual machine.
+ * @param writer The snapshot writer.
+ * @param table The table.
+ */
+static void addTable(VM* vm, SnapshotWriter* writer, const Table* table) {
+    for (int32_t i = 0; i <= table->capacity; i++) {
+        if (table->entries[i].key == NULL) continue;
+        addObject(vm, writer, (Object*)table->entries[i].key);
+        addValue(vm, writer, table->entries[i].value);
+    }
+}
+
+/**
+ * @brief Adds every object an object refers to to the snapshot.
+ * @param vm The virtual machine.
+ * @param writer The snapshot writer.
+ * @param object The object.
+ */
+static void traceObject(VM* vm, SnapshotWriter* writer, Object* object) {
+    switch (object->type) {
+        case OBJECT_BOUND_METHOD: {
+            ObjectBoundMethod* bound = (ObjectBoundMethod*)object;
+            addValue(vm, writer, bound->receiver);
+            addObject(vm, writer, (Object*)bound->method);
+            break;
+        }
+        case OBJECT_INSTANCE: {
+            ObjectInstance* instance = (ObjectInstance*)object;
+            addObject(vm, writer, (Object*)instance->klass);
+            addTable(vm, writer, &instance->fields);
+            break;
+        }
+        case OBJECT_CLASS: {
+            // a shared method table belongs to one of the superclasses
+            ObjectClass* klass = (ObjectClass*)object;
+            addObject(vm, writer, (Object*)klass->name);
+            addObject(vm, writer, (Object*)klass->superclass);
+            addTable(vm, writer, &klass->ownMethods);
+            break;
+        }
+        case OBJECT_CLOSURE: {
+            ObjectClosure* closure = (ObjectClosure*)object;
+            addObject(vm, writer, (Object*)closure->function);
+            for (int32_t i = 0; i < closure->upvalueCount; i++) {
+                addObject(vm, writer, (Object*)closure->upvalues[i]);
+            }
+            break;
+        }
+        case OBJECT_UPVALUE:
+            addValue(vm, writer, *((ObjectUpvalue*)object)->location);
+            break;
+        case OBJECT_FUNCTION: {
+            ObjectFunction* function = (ObjectFunction*)object;
+            addObject(vm, writer, (Object*)function->name);
+            for (int32_t i = 0; i < function->chunk.constants.count; i++) {
+                addValue(vm, writer, function->chunk.constants.values[i]);
+            }
+            break;
+        }
+        case OBJECT_LIST: {
+            ValueArray* items = &((ObjectList*)object)->items;
+            for (int32_t i = 0; i < items->count; i++) {
+                addValue(vm, writer, items->values[i]);
+            }
+            break;
+        }
+        case OBJECT_MAP: {
+            Map* table = &((ObjectMap*)object)->table;
+            for (int32_t i = 0; i <= table->capacity; i++) {
+                if (IS_NIL(table->entries[i].key)) continue;
+                addValue(vm, writer, table->entries[i].key);
+                addValue(vm, writer, table->entries[i].value);
+            }
+            break;
+        }
+        // no outgoing references
+        case OBJECT_FLOAT64_ARRAY:
+        case OBJECT_NATIVE:
+        case OBJECT_STRING:
+        case OBJECT_CHANNEL:
+        case OBJECT_WORKER:
+        case OBJECT_COROUTINE:
+        case OBJECT_FOREIGN:
+            break;
+    }
+}
+
+/**
+ * @brief Writes the number of an object.
+ * @param writer The snapshot writer.
+ * @param object The object, which must be part of the snapshot, or NULL.
+ */
+static void writeReference(SnapshotWriter* writer, Object* object) {
+    Value number = INT_VAL(0);
+    if (object == NULL) {
+        writeU32(writer->file, NO_OBJECT);
+        return;
+    }
+    mapGet(&writer->numbers, OBJECT_VAL(object), &number);
+    writeU32(writer->file, (uint32_t)AS_INT(number));
+}
+
+/**
+ * @brief Writes a value with its tag.
+ * @param writer The snapshot writer.
+ * @param value The value.
+ */
+static void writeHeapValue(SnapshotWriter* writer, Value value) {
+    if (IS_NIL(value)) {
+        fputc(BYTECODE_NIL, writer->file);
+    } else if (IS_BOOL(value)) {
+        fputc(AS_BOOL(value) ? BYTECODE_TRUE : BYTECODE_FALSE, writer->file);
+    } else if (IS_OBJECT(value)) {
+        fputc(BYTECODE_OBJECT, writer->file);
+        writeReference(writer, AS_OBJECT(value));
+    } else {
+        // numbers and short strings are stored like constants
+        writeConstant(writer->file, value);
+    }
+}
+
+/**
+ * @brief Writes the entries of a table.
+ * @param writer The snapshot writer.
+ * @param table The table.
+ */
+static void writeTable(SnapshotWriter* writer, const Table* table) {
+    writeU32(writer->file, (uint32_t)table->count);
+    for (int32_t i = 0; i <= table->capacity; i++) {
+        if (table->entries[i].key == NULL) continue;
+        writeReference(writer, (Object*)table->entries[i].key);
+        writeHeapValue(writer, table->entries[i].value);
+    }
+}
+
+/**
+ * @brief Tells why an object cannot be written to a snapshot.
+ * @param object The object.
+ * @return const char* What kind of object it is, such as "a coroutine", or
+ * NULL if it can be written.
+ */
+static const char* describeUnsaved(Object* object) {
+    switch (object->type) {
+        case OBJECT_NATIVE:
+            if (getNativeName(((ObjectNative*)object)->spec) != NULL) break;
+            return "a native defined by the host";
+        case OBJECT_FUNCTION:
+            if (((ObjectFunction*)object)->lazy == NULL) break;
+            return "a function not compiled yet";
+        case OBJECT_CLOSURE: {
+            ObjectClosure* closure = (ObjectClosure*)object;
+            for (int32_t i = 0; i < closure->upvalueCount; i++) {
+                if (closure->upvalues[i] == NULL) {
+                    return "an unfinished closure";
+                }
+            }
+            break;
+        }
+        case OBJECT_CLASS: {
+            ObjectClass* klass = (ObjectClass*)object;
+            ObjectClass* owner = klass;
+            while (owner != NULL && klass->methods != &owner->ownMethods) {
+                owner = owner->superclass;
+            }
+            if (owner != NULL) break;
+            return "a class sharing methods of no superclass";
+        }
+        // other threads are on the far end
+        case OBJECT_CHANNEL:
+            return "a channel";
+        case OBJECT_WORKER:
+            return "a worker";
+        case OBJECT_COROUTINE:
+            // a suspended stack holds raw pointers into the heap and the code
+            return "a coroutine";
+        case OBJECT_FOREIGN:
+            // the data belongs to the host of this process
+            return "a foreign object";
+        default:
+            break;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Reports which global holds or refers to an object that cannot be
+ * written to a snapshot.
+ * @param vm The virtual machine.
+ * @param object The object.
+ * @param kind What kind of object it is.
+ */
+static void reportUnsaved(VM* vm, Object* object, const char* kind) {
+    for (int32_t i = 0; i <= vm->globals.capacity; i++) {
+        const Entry* entry = &vm->globals.entries[i];
+        if (entry->key == NULL) continue;
+
+        // only reached again to report the error, so it may be slow
+        SnapshotWriter reached;
+        initMap(&reached.numbers);
+        initValueArray(&reached.objects);
+        addValue(vm, &reached, entry->value);
+        for (int32_t j = 0; j < reached.objects.count; j++) {
+            traceObject(vm, &reached, AS_OBJECT(reached.objects.values[j]));
+        }
+        Value number;
+        bool found = mapGet(&reached.numbers, OBJECT_VAL(object), &number);
+        freeMap(vm, &reached.numbers);
+        freeValueArray(vm, &reached.objects);
+
+        if (found) {
+            bool holds = IS_OBJECT(entry->value) &&
+                         AS_OBJECT(entry->value) == object;
+            fprintf(stderr, "Can't save global '%s' in a snapshot: it %s %s.\n",
+                    entry->key->chars, holds ? "holds" : "refers to", kind);
+            return;
+        }
+    }
+    fprintf(stderr, "Can't save %s in a snapshot.\n", kind);
+}
+
+/**
+ * @brief Writes what is needed to allocate an object.
+ * @param writer The snapshot writer.
+ * @param object The object, which `describeUnsaved` accepts.
+ */
+static void writeShell(SnapshotWriter* writer, Object* object) {
+    FILE* file = writer->file;
+    fputc(object->type, file);
+    switch (object->type) {
+        case OBJECT_STRING: {
+            ObjectString* string = (ObjectString*)object;
+            writeName(file, string->chars, string->length);
+            break;
+        }
+        case OBJECT_NATIVE: {
+            const char* name = getNativeName(((ObjectNative*)object)->spec);
+            writeName(file, name, (int32_t)strlen(name));
+            break;
+        }
+        case OBJECT_FUNCTION: {
+            ObjectFunction* function = (ObjectFunction*)object;
+            writeU32(file, (uint32_t)function->arity);
+            writeU32(file, (uint32_t)function->upvalueCount);
+            writeCode(file, &function->chunk);
+            break;
+        }
+        case OBJECT_FLOAT64_ARRAY: {
+            ObjectFloat64Array* array = (ObjectFloat64Array*)object;
+            writeU32(file, (uint32_t)array->count);
+            for (int32_t i = 0; i < array->count; i++) {
+                uint64_t bits;
+                memcpy(&bits, &array->values[i], sizeof(bits));
+                writeU64(file, bits);
+            }
+            break;
+        }
+        case OBJECT_CLOSURE:
+            writeReference(writer, (Object*)((ObjectClosure*)object)->function);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Writes the references of an object.
+ * @param writer The snapshot writer.
+ * @param object The object, which `describeUnsaved` accepts.
+ */
+static void writeBody(SnapshotWriter* writer, Object* object) {
+    FILE* file = writer->file;
+    switch (object->type) {
+        case OBJECT_FUNCTION: {
+            ObjectFunction* function = (ObjectFunction*)object;
+            writeReference(writer, (Object*)function->name);
+            const ValueArray* constants = &function->chunk.constants;
+            writeU32(file, (uint32_t)constants->count);
+            for (int32_t i = 0; i < constants->count; i++) {
+                writeHeapValue(writer, constants->values[i]);
+            }
+            break;
+        }
+        case OBJECT_CLOSURE: {
+            ObjectClosure* closure = (ObjectClosure*)object;
+            for (int32_t i = 0; i < closure->upvalueCount; i++) {
+                writeReference(writer, (Object*)closure->upvalues[i]);
+            }
+            break;
+        }
+        case OBJECT_UPVALUE:
+            writeHeapValue(writer, *((ObjectUpvalue*)object)->location);
+            break;
+        case OBJECT_CLASS: {
+            ObjectClass* klass = (ObjectClass*)object;
+            ObjectClass* owner = klass;
+            while (klass->methods != &owner->ownMethods) {
+                owner = owner->superclass;
+            }
+
+            writeReference(writer, (Object*)klass->name);
+            writeReference(writer, (Object*)klass->superclass);
+            writeReference(writer, (Object*)owner);
+            writeTable(writer, &klass->ownMethods);
+            break;
+        }
+        case OBJECT_INSTANCE: {
+            ObjectInstance* instance = (ObjectInstance*)object;
+            writeReference(writer, (Object*)instance->klass);
+            writeTable(writer, &instance->fields);
+            break;
+        }
+        case OBJECT_BOUND_METHOD: {
+            ObjectBoundMethod* bound = (ObjectBoundMethod*)object;
+            writeHeapValue(writer, bound->receiver);
+            writeReference(writer, (Object*)bound->method);
+            break;
+        }
+        case OBJECT_LIST: {
+            const ValueArray* items = &((ObjectList*)object)->items;
+            writeU32(file, (uint32_t)items->count);
+            for (int32_t i = 0; i < items->count; i++) {
+                writeHeapValue(writer, items->values[i]);
+            }
+            break;
+        }
+        case OBJECT_MAP: {
+            const Map* table = &((ObjectMap*)object)->table;
+            writeU32(file, (uint32_t)table->count);
+            for (int32_t i = 0; i <= table->capacity; i++) {
+                if (IS_NIL(table->entries[i].key)) continue;
+                writeHeapValue(writer, table->entries[i].key);
+                writeHeapValue(writer, table->entries[i].value);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Writes a snapshot of the global variables and every object reachable
+ * from them.
+ *
+ * Meant to be called between scripts, when no function is running and every
+ * upvalue is closed. Reports any error to stderr.
+ *
+ * @param vm The virtual machine.
+ * @param path The path of the file to write.
+ * @return bool True if the file was written, false otherwise.
+ */
+bool saveSnapshot(VM* vm, const char* path) {
+    // everything found is reachable from the globals, so the collections
+    // that finding it may trigger leave it alone
+    SnapshotWriter writer;
+    initMap(&writer.numbers);
+    initValueArray(&writer.objects);
+    addTable(vm, &writer, &vm->globals);
+    for (int32_t i = 0; i < writer.objects.count; i++) {
+        traceObject(vm, &writer, AS_OBJECT(writer.objects.values[i]));
+    }
+
+    // what cannot be written is reported before the file is created
+    for (int32_t i = 0; i < writer.objects.count; i++) {
+        Object* object = AS_OBJECT(writer.objects.values[i]);
+        const char* kind = describeUnsaved(object);
+        if (kind != NULL) {
+            reportUnsaved(vm, object, kind);
+            freeMap(vm, &writer.numbers);
+            freeValueArray(vm, &writer.objects);
+            return false;
+        }
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        freeMap(vm, &writer.numbers);
+        freeValueArray(vm, &writer.objects);
+        return false;
+    }
+    writer.file = file;
+
+    // number the closures last, so that loading allocates every function
+    // before the closures wrapping it
+    ValueArray ordered;
+    initValueArray(&ordered);
+    for (int32_t pass = 0; pass < 2; pass++) {
+        for (int32_t i = 0; i < writer.objects.count; i++) {
+            Value object = writer.objects.values[i];
+            if (IS_CLOSURE(object) != (pass == 1)) continue;
+            mapSet(vm, &writer.numbers, object, INT_VAL(ordered.count));
+            writeValueArray(vm, &ordered, object);
+        }
+    }
+    freeValueArray(vm, &writer.objects);
+    writer.objects = ordered;
+
+    fwrite("LOXS", 1, 4, file);
+    writeU32(file, BYTECODE_VERSION);
+    writeU32(file, BYTECODE_FLAGS);
+    writeU32(file, (uint32_t)writer.objects.count);
+    for (int32_t i = 0; i < writer.objects.count; i++) {
+        writeShell(&writer, AS_OBJECT(writer.objects.values[i]));
+    }
+    for (int32_t i = 0; i < writer.objects.count; i++) {
+        writeBody(&writer, AS_OBJECT(writer.objects.values[i]));
+    }
+    writeTable(&writer, &vm->globals);
+
+    freeMap(vm, &writer.numbers);
+    freeValueArray(vm, &writer.objects);
+
+    bool written = !ferror(file);
+    if (fclose(file) != 0) written = false;
+    if (!written) {
+        fprintf(stderr, "Could not write file \"%s\".\n", path);
+        remove(path);
+    }
+    return written;
+}
+
+//-----------------------------------------------------------------------------
+//- Restoring Snapshots
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Appends an object to the table of restored objects.
+ *
+ * The table is allocated with room for every object up front, so this never
+ * allocates.
+ *
+ * @param objects The restored objects, by number.
+ * @param object The object.
+ */
+static void appendObject(ObjectList* objects, Object* object) {
+    objects->items.values[objects->items.count++] = OBJECT_VAL(object);
+}
+
+/**
+ * @brief Looks up a restored object by number, checking its type.
+ * @param objects The restored objects, by number.
+ * @param number The number of the object.
+ * @param type The type the object must have.
+ * @return Object* The object, or NULL if there is no such object.
+ */
+static Object* getObject(const ObjectList* objects, uint32_t number,
+                         ObjectType type) {
+    if (number >= (uint32_t)objects->items.count) return NULL;
+    Object* object = AS_OBJECT(objects->items.values[number]);
+    return object->type == type ? object : NULL;
+}
+
+/**
+ * @brief Reads an object number and looks up the object.
+ * @param reader The reader.
+ * @param objects The restored objects, by number.
+ * @param type The type the object must have.
+ * @return Object* The object, or NULL if the number is invalid.
+ */
+static Object* readReference(Reader* reader, const ObjectList* objects,
+                             ObjectType type) {
+    return getObject(objects, readU32(reader), type);
+}
+
+/**
+ * @brief Reads a tagged value.
+ * @param vm The virtual machine.
+ * @param reader The reader.
+ * @param objects The restored objects, by number.
+ * @param value A pointer where the value will be stored.
+ * @return bool False if the value is malformed.
+ */
+static bool readHeapValue(VM* vm, Reader* reader, const ObjectList* objects,
+                          Value* value) {
+    uint8_t tag = readU8(reader);
+    switch (tag) {
+        case BYTECODE_NIL:
+            *value = NIL_VAL;
+            break;
+        case BYTECODE_FALSE:
+            *value = BOOL_VAL(false);
+            break;
+        case BYTECODE_TRUE:
+            *value = BOOL_VAL(true);
+            break;
+        case BYTECODE_OBJECT: {
+            uint32_t number = readU32(reader);
+            if (number >= (uint32_t)objects->items.count) return false;
+            *value = objects->items.values[number];
+            if (OBJECT_TYPE(*value) == OBJECT_UPVALUE) return false;
+            break;
+        }
+        case BYTECODE_NUMBER:
+        case BYTECODE_INT:
+        case BYTECODE_SHORT_STRING:
+            reader->current--;  // let the constant reader see the tag
+            return readConstant(vm, reader, 0, value);
+        default:
+            return false;
+    }
+    return !reader->failed;
+}
+
+/**
+ * @brief Reads the entries of a table of methods or fields.
+ * @param vm The virtual machine.
+ * @param reader The reader.
+ * @param objects The restored objects, by number.
+ * @param table The table receiving the entries.
+ * @return bool False if the entries are malformed.
+ */
+static bool readTable(VM* vm, Reader* reader, const ObjectList* objects,
+                      Table* table) {
+    int32_t count = readCount(reader);
+    if (count < 0) return false;
+    for (int32_t i = 0; i < count; i++) {
+        ObjectString* name =
+            (ObjectString*)readReference(reader, objects, OBJECT_STRING);
+        Value value;
+        if (name == NULL || !readHeapValue(vm, reader, objects, &value)) {
+            return false;
+        }
+        tableSet(vm, table, name, value);
+    }
+    return true;
+}
+
+/**
+ * @brief Reads an object's shell and allocates the object.
+ *
+ * The object is appended to `objects` as soon as it exists, so it is safe from
+ * the collector while the rest of its shell is read.
+ *
+ * @param vm The virtual machine.
+ * @param reader The reader.
+ * @param objects The restored objects, by number.
+ * @return bool False if the shell is malformed.
+ */
+static bool readShell(VM* vm, Reader* reader, ObjectList* objects) {
+    uint8_t type = readU8(reader);
+    if (reader->failed) return false;
+
+    switch (type) {
+        case OBJECT_STRING:
+        case OBJECT_NATIVE: {
+            int32_t length = readCount(reader);
+            if (length < 0) return false;
+            const char* chars = (const char*)readBytes(reader, length);
+            if (chars == NULL) return false;
+            if (type == OBJECT_STRING) {
+                appendObject(objects, (Object*)copyString(vm, chars, length));
+                break;
+            }
+            const NativeSpec* spec = lookupNative(chars, length);
+            if (spec == NULL) return false;
+            appendObject(objects, (Object*)newNative(vm, spec));
+            break;
+        }
+        case OBJECT_FUNCTION: {
+            ObjectFunction* function = newFunction(vm);
+            appendObject(objects, (Object*)function);
+            uint32_t arity = readU32(reader);
+            uint32_t upvalueCount = readU32(reader);
+            if (arity > UINT8_MAX || upvalueCount > UINT8_COUNT) return false;
+            function->arity = (int32_t)arity;
+            function->upvalueCount = (int32_t)upvalueCount;
+            return readCode(vm, reader, function);
+        }
+        case OBJECT_FLOAT64_ARRAY: {
+            int32_t count = readCount(reader);
+            if (count < 0 || (size_t)(reader->end - reader->current) / 8 <
+                                 (size_t)count) {
+                return false;
+            }
+            ObjectFloat64Array* array = newFloat64Array(vm, count);
+            appendObject(objects, (Object*)array);
+            for (int32_t i = 0; i < count; i++) {
+                uint64_t bits = readU64(reader);
+                memcpy(&array->values[i], &bits, sizeof(bits));
+            }
+            break;
+        }
+        case OBJECT_CLOSURE: {
+            ObjectFunction* function = (ObjectFunction*)readReference(
+                reader, objects, OBJECT_FUNCTION);
+            if (function == NULL) return false;
+            appendObject(objects, (Object*)newClosure(vm, function));
+            break;
+        }
+        case OBJECT_UPVALUE: {
+            ObjectUpvalue* upvalue = newUpvalue(vm, NULL);
+            upvalue->location = &upvalue->closed;
+            appendObject(objects, (Object*)upvalue);
+            break;
+        }
+        case OBJECT_CLASS:
+            appendObject(objects, (Object*)newClass(vm, NULL));
+            break;
+        case OBJECT_INSTANCE:
+            appendObject(objects, (Object*)newInstance(vm, NULL));
+            break;
+        case OBJECT_BOUND_METHOD:
+            appendObject(objects, (Object*)newBoundMethod(vm, NIL_VAL, NULL));
+            break;
+        case OBJECT_LIST:
+            appendObject(objects, (Object*)newList(vm));
+            break;
+        case OBJECT_MAP:
+            appendObject(objects, (Object*)newMap(vm));
+            break;
+        default:
+            return false;
+    }
+    return !reader->failed;
+}
+
+/**
+ * @brief Reads the references of an object and fills them in.
+ * @param vm The virtual machine.
+ * @param reader The reader.
+ * @param objects The restored objects, by number.
+ * @param object The object, allocated from its shell.
+ * @return bool False if the references are malformed.
+ */
+static bool readBody(VM* vm, Reader* reader, const ObjectList* objects,
+                     Object* object) {
+    switch (object->type) {
+        case OBJECT_FUNCTION: {
+            ObjectFunction* function = (ObjectFunction*)object;
+            uint32_t name = readU32(reader);
+            if (name != NO_OBJECT) {
+                function->name =
+                    (ObjectString*)getObject(objects, name, OBJECT_STRING);
+                if (function->name == NULL) return false;
+            }
+            int32_t constantCount = readCount(reader);
+            if (constantCount < 0 || constantCount > UINT8_COUNT) return false;
+            for (int32_t i = 0; i < constantCount; i++) {
+                Value value;
+                if (!readHeapValue(vm, reader, objects, &value)) return false;
+                addConstant(vm, &function->chunk, value);
+            }
+            function->maxSlots =
+                checkCode(vm, &function->chunk, function->arity,
+                          function->upvalueCount);
+            if (function->maxSlots < 0) return false;
+            break;
+        }
+        case OBJECT_CLOSURE: {
+            ObjectClosure* closure = (ObjectClosure*)object;
+            for (int32_t i = 0; i < closure->upvalueCount; i++) {
+                closure->upvalues[i] = (ObjectUpvalue*)readReference(
+                    reader, objects, OBJECT_UPVALUE);
+                if (closure->upvalues[i] == NULL) return false;
+            }
+            break;
+        }
+        case OBJECT_UPVALUE:
+            return readHeapValue(vm, reader, objects,
+                                 &((ObjectUpvalue*)object)->closed);
+        case OBJECT_CLASS: {
+            ObjectClass* klass = (ObjectClass*)object;
+            klass->name =
+                (ObjectString*)readReference(reader, objects, OBJECT_STRING);
+            uint32_t superclass = readU32(reader);
+            if (superclass != NO_OBJECT) {
+                klass->superclass =
+                    (ObjectClass*)getObject(objects, superclass, OBJECT_CLASS);
+                if (klass->superclass == NULL) return false;
+            }
+            ObjectClass* owner =
+                (ObjectClass*)readReference(reader, objects, OBJECT_CLASS);
+            if (klass->name == NULL || owner == NULL) return false;
+            klass->methods = &owner->ownMethods;
+            return readTable(vm, reader, objects, &klass->ownMethods);
+        }
+        case OBJECT_INSTANCE: {
+            ObjectInstance* instance = (ObjectInstance*)object;
+            instance->klass =
+                (ObjectClass*)readReference(reader, objects, OBJECT_CLASS);
+            if (instance->klass == NULL) return false;
+            return readTable(vm, reader, objects, &instance->fields);
+        }
+        case OBJECT_BOUND_METHOD: {
+            ObjectBoundMethod* bound = (ObjectBoundMethod*)object;
+            if (!readHeapValue(vm, reader, objects,
+                               &bound->receiver)) return false;
+            bound->method =
+                (ObjectClosure*)readReference(reader, objects, OBJECT_CLOSURE);
+            return bound->method != NULL;
+        }
+        case OBJECT_LIST: {
+            ObjectList* list = (ObjectList*)object;
+            int32_t count = readCount(reader);
+            if (count < 0) return false;
+            for (int32_t i = 0; i < count; i++) {
+                Value value;
+                if (!readHeapValue(vm, reader, objects, &value)) return false;
+                writeValueArray(vm, &list->items, value);
+            }
+            break;
+        }
+        case OBJECT_MAP: {
+            ObjectMap* map = (ObjectMap*)object;
+            int32_t count = readCount(reader);
+            if (count < 0) return false;
+            for (int32_t i = 0; i < count; i++) {
+                Value key;
+                Value value;
+                if (!readHeapValue(vm, reader, objects, &key) ||
+                    !readHeapValue(vm, reader, objects,
+                                   &value) || IS_NIL(key)) {
+                    return false;
+                }
+                mapSet(vm, &map->table, key, value);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return !reader->failed;
+}
+
+/**
+ * @brief Restores a snapshot written by `saveSnapshot` into the VM.
+ *
+ * The objects of the snapshot are recreated and its global variables defined,
+ * replacing globals of the same name. Like a bytecode file, the snapshot stays
+ * mapped until `freeLoadedImages` is called. Reports any error to stderr.
+ *
+ * @param vm The virtual machine.
+ * @param path The path of the file to load.
+ * @return bool True if the snapshot was restored, false otherwise.
+ */
+bool loadSnapshot(VM* vm, const char* path) {
+    LoadedImage* image = openImage(path);
+    if (image == NULL) {
+        fprintf(stderr, "Could not read file \"%s\".\n", path);
+        return false;
+    }
+
+    Reader reader = {image->data, image->data + image->size, false};
+    if (!readHeader(&reader, "LOXS", "snapshot", path)) {
+        closeImage(image);
+        return false;
+    }
+
+    ObjectList* objects = newList(vm);
+    push(vm, OBJECT_VAL(objects));  // GC guard for everything restored
+
+    // every shell takes at least one byte, which bounds the table
+    int32_t count = readCount(&reader);
+    if (count < 0 || (size_t)(reader.end - reader.current) < (size_t)count) {
+        goto fail;
+    }
+    if (count > 0) {
+        objects->items.values = ALLOCATE(vm, Value, count);
+        objects->items.capacity = count;
+    }
+
+    // allocate everything first, so that the bodies can refer to any object
+    for (int32_t i = 0; i < count; i++) {
+        if (!readShell(vm, &reader, objects)) goto fail;
+    }
+    for (int32_t i = 0; i < count; i++) {
+        if (!readBody(vm, &reader, objects,
+                      AS_OBJECT(objects->items.values[i]))) {
+            goto fail;
+        }
+    }
+
+    // check the globals before defining any, so that a corrupt snapshot
+    // leaves the VM as it was
+    const uint8_t* globals = reader.current;
+    Table check;
+    initTable(&check);
+    bool valid = readTable(vm, &reader, objects, &check);
+    freeTable(vm, &check);
+    if (!valid || reader.current != reader.end) goto fail;
+    reader.current = globals;
+    readTable(vm, &reader, objects, &vm->globals);
+
+    pop(vm);
+    image->next = vm->images;
+    vm->images = image;
+    return true;
+
+fail:
+    // as with bytecode files, nothing restored so far can run anymore
+    pop(vm);
+    fprintf(stderr, "\"%s\" is a corrupt snapshot.\n", path);
+    closeImage(image);
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+//- Loaded Images
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Unmaps every bytecode file and snapshot loaded by the VM.
+ *
+ * Must only be called once no loaded function can run anymore.
+ *
+ * @param vm The virtual machine.
+ */
+void freeLoadedImages(VM* vm) {
+    while (vm->images != NULL) {
+        LoadedImage* next = vm->images->next;
+        closeImage(vm->images);
+        vm->images = next;
+    }
+}
@@ -13,8 +13,15 @@
 #include <stdlib.h>
 
 #include "memory.h"
+#include "object.h"
 #include "vm.h"
 
+// the stack depth of an instruction no path has reached yet
+#define UNREACHED -1
+
+// the stack depth recorded for the operand bytes of instructions
+#define NO_INSTRUCTION -2
+
 /**
  * @brief Initializes a new, empty chunk.
  * @param chunk A pointer to the Chunk struct to initialize.
@@ -24,17 +31,22 @@ void initChunk(Chunk* chunk) {
     chunk->capacity = 0;
     chunk->code = NULL;
     chunk->lines = NULL;
+    chunk->ownsCode = true;
     initValueArray(&chunk->constants);
 }
 
 /**
  * @brief Frees all memory associated with a chunk.
+ *
+ * Code borrowed from a bytecode file is left to the file's mapping.
+ *
+ * @param vm The virtual machine.
  * @param chunk A pointer to the Chunk struct to free.
  */
-void freeChunk(Chunk* chunk) {
-    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(int32_t, chunk->lines, chunk->capacity);
-    freeValueArray(&chunk->constants);
+void freeChunk(VM* vm, Chunk* chunk) {
+    if (chunk->ownsCode) FREE_ARRAY(vm, uint8_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(vm, int32_t, chunk->lines, chunk->capacity);
+    freeValueArray(vm, &chunk->constants);
     initChunk(chunk);
 }
 
@@ -43,18 +55,19 @@ void freeChunk(Chunk* chunk) {
  *
  * If the chunk's capacity is insufficient, it will be grown automatically.
  *
+ * @param vm The virtual machine.
  * @param chunk A pointer to the chunk.
  * @param byte The byte to write.
  * @param line The source line number corresponding to this byte.
  */
-void writeChunk(Chunk* chunk, uint8_t byte, int32_t line) {
+void writeChunk(VM* vm, Chunk* chunk, uint8_t byte, int32_t line) {
     if (chunk->capacity < chunk->count + 1) {
         int32_t oldCapacity = chunk->capacity;
         chunk->capacity = GROW_CAPACITY(oldCapacity);
         chunk->code =
-            GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
+            GROW_ARRAY(vm, uint8_t, chunk->code, oldCapacity, chunk->capacity);
         chunk->lines =
-            GROW_ARRAY(int32_t, chunk->lines, oldCapacity, chunk->capacity);
+            GROW_ARRAY(vm, int32_t, chunk->lines, oldCapacity, chunk->capacity);
     }
     chunk->code[chunk->count] = byte;
     chunk->lines[chunk->count] = line;
@@ -64,15 +77,322 @@ void writeChunk(Chunk* chunk, uint8_t byte, int32_t line) {
 /**
  * @brief Adds a constant value to the chunk's constant pool.
  *
+ * @param vm The virtual machine.
  * @param chunk A pointer to the chunk.
  * @param value The value to add to the constant pool.
  * @return int32_t The index of the added constant in the pool.
  */
-int32_t addConstant(Chunk* chunk, Value value) {
+int32_t addConstant(VM* vm, Chunk* chunk, Value value) {
     // push/pop the value to ensure the GC knows it's reachable while the
     // value array might be reallocated during the write
-    push(value);
-    writeValueArray(&chunk->constants, value);
-    pop();
+    push(vm, value);
+    writeValueArray(vm, &chunk->constants, value);
+    pop(vm);
     return chunk->constants.count - 1;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Checks whether a constant of a chunk is a name.
+ *
+ * Instructions that look up names read their operand as an `ObjectString`.
+ *
+ * @param chunk The chunk.
+ * @param index The index of the constant.
+ * @return bool True if the constant exists and is a string object.
+ */
+static bool isName(const Chunk* chunk, uint8_t index) {
+    return index < chunk->constants.count &&
+           IS_STRING_OBJECT(chunk->constants.values[index]);
+}
+
+/**
+ * @brief Checks the operands of an instruction.
+ *
+ * Jump targets are checked by `checkCode` once every instruction is known.
+ *
+ * @param chunk The chunk holding the instruction.
+ * @param upvalueCount The number of upvalues of the function owning it.
+ * @param offset The offset of the instruction in the code.
+ * @return int32_t The length of the instruction, or 0 if it is not a valid
+ * instruction or an operand is out of range.
+ */
+static int32_t checkInstruction(const Chunk* chunk, int32_t upvalueCount,
+                                int32_t offset) {
+    const uint8_t* operands = chunk->code + offset + 1;
+    int32_t room = chunk->count - offset - 1;
+
+    switch (chunk->code[offset]) {
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_POP:
+        case OP_GET_INDEX:
+        case OP_SET_INDEX:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_PRINT:
+        case OP_CLOSE_UPVALUE:
+        case OP_RETURN:
+        case OP_INHERIT:
+        case OP_YIELD:
+        case OP_RESUME:
+            return 1;
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_CALL:
+        case OP_BUILD_LIST:
+        case OP_BUILD_MAP:
+            return room >= 1 ? 2 : 0;
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+            return room >= 1 && operands[0] < upvalueCount ? 2 : 0;
+        case OP_CONSTANT:
+            return room >= 1 && operands[0] < chunk->constants.count ? 2 : 0;
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_GET_SUPER:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_CLASS:
+        case OP_METHOD:
+            return room >= 1 && isName(chunk, operands[0]) ? 2 : 0;
+        case OP_INVOKE:
+        case OP_SUPER_INVOKE:
+            return room >= 2 && isName(chunk, operands[0]) ? 3 : 0;
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+            return room >= 2 ? 3 : 0;
+        case OP_CLOSURE: {
+            if (room < 1 || operands[0] >= chunk->constants.count ||
+                !IS_FUNCTION(chunk->constants.values[operands[0]])) {
+                return 0;
+            }
+            // an (isLocal, index) pair follows for each captured variable
+            const ObjectFunction* nested =
+                AS_FUNCTION(chunk->constants.values[operands[0]]);
+            int32_t length = 2 + 2 * nested->upvalueCount;
+            if (room < length - 1) return 0;
+            for (int32_t i = 0; i < nested->upvalueCount; i++) {
+                uint8_t isLocal = operands[1 + 2 * i];
+                uint8_t index = operands[2 + 2 * i];
+                if (isLocal > 1) return 0;
+                if (!isLocal && index >= upvalueCount) return 0;
+            }
+            return length;
+        }
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Works out the stack depth after an instruction.
+ *
+ * The instruction's operands must already have been checked.
+ *
+ * @param chunk The chunk holding the instruction.
+ * @param offset The offset of the instruction in the code.
+ * @param depth The number of values in the frame before the instruction,
+ * counting the callee in slot 0.
+ * @return int32_t The number of values after the instruction, or -1 if it
+ * pops more values than there are or refers to a slot above them.
+ */
+static int32_t stackDepthAfter(const Chunk* chunk, int32_t offset,
+                               int32_t depth) {
+    const uint8_t* operands = chunk->code + offset + 1;
+    int32_t popped = 0;
+    int32_t pushed = 0;
+
+    switch (chunk->code[offset]) {
+        case OP_CONSTANT:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_UPVALUE:
+        case OP_GET_GLOBAL:
+        case OP_CLASS:
+            pushed = 1;
+            break;
+        case OP_GET_LOCAL:
+            if (operands[0] >= depth) return -1;
+            pushed = 1;
+            break;
+        case OP_SET_LOCAL:
+            if (operands[0] >= depth) return -1;
+            popped = pushed = 1;
+            break;
+        case OP_POP:
+        case OP_DEFINE_GLOBAL:
+        case OP_PRINT:
+        case OP_CLOSE_UPVALUE:
+        case OP_RETURN:
+            popped = 1;
+            break;
+        case OP_GET_PROPERTY:
+        case OP_SET_UPVALUE:
+        case OP_SET_GLOBAL:
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_JUMP_IF_FALSE:
+        case OP_YIELD:
+            popped = pushed = 1;
+            break;
+        case OP_SET_PROPERTY:
+        case OP_GET_INDEX:
+        case OP_GET_SUPER:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_RESUME:
+        case OP_INHERIT:
+        case OP_METHOD:
+            popped = 2;
+            pushed = 1;
+            break;
+        case OP_SET_INDEX:
+            popped = 3;
+            pushed = 1;
+            break;
+        case OP_CALL:
+            popped = operands[0] + 1;
+            pushed = 1;
+            break;
+        case OP_INVOKE:
+            popped = operands[1] + 1;
+            pushed = 1;
+            break;
+        case OP_SUPER_INVOKE:
+            popped = operands[1] + 2;  // the superclass is on top
+            pushed = 1;
+            break;
+        case OP_BUILD_LIST:
+            popped = operands[0];
+            pushed = 1;
+            break;
+        case OP_BUILD_MAP:
+            popped = operands[0] * 2;
+            pushed = 1;
+            break;
+        case OP_CLOSURE: {
+            const ObjectFunction* nested =
+                AS_FUNCTION(chunk->constants.values[operands[0]]);
+            for (int32_t i = 0; i < nested->upvalueCount; i++) {
+                bool isLocal = operands[1 + 2 * i];
+                if (isLocal && operands[2 + 2 * i] >= depth) return -1;
+            }
+            pushed = 1;
+            break;
+        }
+        default:  // OP_JUMP and OP_LOOP
+            break;
+    }
+    return popped > depth ? -1 : depth - popped + pushed;
+}
+
+/**
+ * @brief Records the stack depth an instruction is reached with.
+ * @param depths The depth at each offset reached so far.
+ * @param pending The offsets whose successors are still to be followed.
+ * @param pendingCount The number of pending offsets.
+ * @param offset The offset of the instruction.
+ * @param depth The stack depth it is reached with.
+ * @return bool False if the instruction is reached with another depth.
+ */
+static bool reachInstruction(int32_t* depths, int32_t* pending,
+                             int32_t* pendingCount, int32_t offset,
+                             int32_t depth) {
+    if (depths[offset] == UNREACHED) {
+        depths[offset] = depth;
+        pending[(*pendingCount)++] = offset;
+        return true;
+    }
+    return depths[offset] == depth;
+}
+
+/**
+ * @brief Checks the code of a function and measures the stack it needs.
+ *
+ * Every instruction must be known and have its operands inside the chunk,
+ * constant operands must exist and have the type the instruction expects,
+ * and upvalue operands must exist. Following every path from the start,
+ * jumps must land on the start of an instruction, no path may run off the
+ * end of the code, every instruction must be reached with the same stack
+ * depth on all paths, and no instruction may pop more values than its frame
+ * holds or refer to a local slot above them. The types of the values on the
+ * stack are not tracked: the instructions check them when they run.
+ *
+ * @param vm The virtual machine.
+ * @param chunk The chunk, with its code and constants.
+ * @param arity The number of parameters of the function.
+ * @param upvalueCount The number of upvalues of the function.
+ * @return int32_t The most values its frame ever holds, counting the callee
+ * in slot 0, or -1 if the code is not safe to decode.
+ */
+int32_t checkCode(VM* vm, const Chunk* chunk, int32_t arity,
+                  int32_t upvalueCount) {
+    if (chunk->count == 0) return -1;
+
+    // the depth each instruction is reached with; the operand bytes are no
+    // instructions and so never valid jump targets
+    int32_t* depths = ALLOCATE(vm, int32_t, chunk->count);
+    int32_t* pending = ALLOCATE(vm, int32_t, chunk->count);
+    bool valid = true;
+    for (int32_t offset = 0; valid && offset < chunk->count;) {
+        int32_t length = checkInstruction(chunk, upvalueCount, offset);
+        valid = length > 0;
+        depths[offset] = UNREACHED;
+        for (int32_t i = 1; i < length && offset + i < chunk->count; i++) {
+            depths[offset + i] = NO_INSTRUCTION;
+        }
+        offset += length;
+    }
+
+    // the callee and the arguments are in the frame when the code starts
+    int32_t pendingCount = 0;
+    int32_t maxDepth = arity + 1;
+    valid = valid &&
+            reachInstruction(depths, pending, &pendingCount, 0, maxDepth);
+    while (valid && pendingCount > 0) {
+        int32_t offset = pending[--pendingCount];
+        uint8_t instruction = chunk->code[offset];
+        int32_t depth = stackDepthAfter(chunk, offset, depths[offset]);
+        int32_t next = offset + checkInstruction(chunk, upvalueCount, offset);
+        valid = depth >= 0;
+        if (depth > maxDepth) maxDepth = depth;
+
+        if (valid && (instruction == OP_JUMP ||
+                      instruction == OP_JUMP_IF_FALSE ||
+                      instruction == OP_LOOP)) {
+            int32_t jump =
+                chunk->code[offset + 1] << 8 | chunk->code[offset + 2];
+            int32_t target = next + (instruction == OP_LOOP ? -jump : jump);
+            valid = target >= 0 && target < chunk->count &&
+                    depths[target] != NO_INSTRUCTION &&
+                    reachInstruction(depths, pending, &pendingCount, target,
+                                     depth);
+        }
+        if (valid && instruction != OP_RETURN && instruction != OP_JUMP &&
+            instruction != OP_LOOP) {
+            valid = next < chunk->count &&
+                    reachInstruction(depths, pending, &pendingCount, next,
+                                     depth);
+        }
+    }
+
+    FREE_ARRAY(vm, int32_t, pending, chunk->count);
+    FREE_ARRAY(vm, int32_t, depths, chunk->count);
+    return valid ? maxDepth : -1;
+}
@@ -22,23 +22,58 @@
 #include "debug.h"
 #endif
 
+// the bytes of source per interned name that compile() sizes the string
+// table for; scripts intern a new name every 12 to 40 bytes or so, since
+// repeated names and short string literals take no new entry
+#define SOURCE_BYTES_PER_NAME 16
+
+// the most names compile() reserves room for up front; past that, a source
+// may be mostly long literals or comments, so the table grows as names come
+#define MAX_RESERVED_NAMES 16384
+
 //-----------------------------------------------------------------------------
 //- Compiler State and Structures
 //-----------------------------------------------------------------------------
 
-// Global parser state, holds current/previous tokens and error flags.
-Parser parser;
-// Points to the Compiler struct for the function currently being compiled.
-Compiler* current = NULL;
-// Points to the ClassCompiler struct for the class currently being compiled.
-ClassCompiler* currentClass = NULL;
+/**
+ * @brief Initializes a parser for compiling code in the given VM.
+ *
+ * The parser is registered with the VM so the garbage collector can reach
+ * the functions under construction, until `finishParser` is called.
+ * @param parser The parser to initialize.
+ * @param vm The virtual machine the code is compiled for.
+ * @param lazySource The source when function bodies are compiled lazily, or
+ * NULL.
+ */
+static void initParser(Parser* parser, VM* vm, ObjectString* lazySource) {
+    parser->vm = vm;
+    parser->compiler = NULL;
+    parser->currentClass = NULL;
+    parser->lazySource = lazySource;
+    parser->hadError = false;
+    parser->panicMode = false;
+    parser->previous.line = 0;
+    parser->enclosing = vm->parser;
+    vm->parser = parser;
+}
+
+/**
+ * @brief Unregisters a parser from its VM once compilation is over.
+ * @param parser The parser.
+ */
+static void finishParser(Parser* parser) {
+    parser->vm->parser = parser->enclosing;
+}
 
 /**
  * @brief Retrieves the bytecode chunk for the function currently being
  * compiled.
+ * @param parser The parser.
  * @return Chunk* A pointer to the current chunk.
  */
-static Chunk* currentChunk() { return &current->function->chunk; }
+static Chunk* currentChunk(Parser* parser) {
+    return &parser->compiler->function->chunk;
+}
 
 //-----------------------------------------------------------------------------
 //- Error Handling
@@ -46,14 +81,17 @@ static Chunk* currentChunk() { return &current->function->chunk; }
 
 /**
  * @brief Reports an error at a specific token's location.
+ * @param parser The parser.
  * @param token The token where the error occurred.
  * @param message The error message to display.
  */
-static void errorAt(const Token* token, const char* message) {
+static void errorAt(Parser* parser, const Token* token, const char* message) {
     // in panic mode suppress further errors to avoid cascades
-    if (parser.panicMode) return;
-    parser.panicMode = true;
+    if (parser->panicMode) return;
+    parser->panicMode = true;
 
+    // a body compiled lazily fails while the script runs, after its output
+    flushOutput(&parser->vm->output);
     fprintf(stderr, "[line %d] Error", token->line);
 
     if (token->type == TOKEN_EOF) {
@@ -65,36 +103,41 @@ static void errorAt(const Token* token, const char* message) {
     }
 
     fprintf(stderr, ": %s\n", message);
-    parser.hadError = true;
+    parser->hadError = true;
 }
 
 /**
  * @brief Reports an error at the location of the current token.
+ * @param parser The parser.
  * @param message The error message.
  */
-static void errorAtCurrent(const char* message) {
-    errorAt(&parser.current, message);
+static void errorAtCurrent(Parser* parser, const char* message) {
+    errorAt(parser, &parser->current, message);
 }
 
 /**
  * @brief Reports an error at the location of the previous token.
+ * @param parser The parser.
  * @param message The error message.
  */
-static void error(const char* message) { errorAt(&parser.previous, message); }
+static void error(Parser* parser, const char* message) {
+    errorAt(parser, &parser->previous, message);
+}
 
-static void advance();  // forward declaration
+static void advance(Parser* parser);  // forward declaration
 /**
  * @brief Resynchronizes the parser after an error.
  *
  * Skips tokens until it finds a statement boundary, which helps the parser
  * continue after a syntax error to find subsequent errors.
+ * @param parser The parser.
  */
-static void synchronize() {
-    parser.panicMode = false;
+static void synchronize(Parser* parser) {
+    parser->panicMode = false;
 
-    while (parser.current.type != TOKEN_EOF) {
-        if (parser.previous.type == TOKEN_SEMICOLON) return;
-        switch (parser.current.type) {
+    while (parser->current.type != TOKEN_EOF) {
+        if (parser->previous.type == TOKEN_SEMICOLON) return;
+        switch (parser->current.type) {
             case TOKEN_CLASS:
             case TOKEN_FUN:
             case TOKEN_VAR:
@@ -106,7 +149,7 @@ static void synchronize() {
                 return;
             default:;  // do nothing
         }
-        advance();
+        advance(parser);
     }
 }
 
@@ -116,14 +159,15 @@ static void synchronize() {
 
 /**
  * @brief Advances the parser to the next token from the scanner.
+ * @param parser The parser.
  */
-static void advance() {
-    parser.previous = parser.current;
+static void advance(Parser* parser) {
+    parser->previous = parser->current;
 
     for (;;) {
-        parser.current = scanToken();
-        if (parser.current.type != TOKEN_ERROR) break;
-        errorAtCurrent(parser.current.start);
+        parser->current = scanToken(&parser->scanner);
+        if (parser->current.type != TOKEN_ERROR) break;
+        errorAtCurrent(parser, parser->current.start);
     }
 }
 
@@ -131,32 +175,36 @@ static void advance() {
  * @brief Consumes the current token if it has the expected type.
  *
  * If the token type does not match, it reports an error.
+ * @param parser The parser.
  * @param type The expected token type.
  * @param message The error message to show if the type doesn't match.
  */
-static void consume(TokenType type, const char* message) {
-    if (parser.current.type == type) {
-        advance();
+static void consume(Parser* parser, TokenType type, const char* message) {
+    if (parser->current.type == type) {
+        advance(parser);
         return;
     }
-    errorAtCurrent(message);
+    errorAtCurrent(parser, message);
 }
 
 /**
  * @brief Checks if the current token has the given type without consuming it.
+ * @param parser The parser.
  * @param type The token type to check for.
  * @return bool True if the current token matches the type.
  */
-static bool check(TokenType type) { return parser.current.type == type; }
+static bool check(Parser* parser,
+                  TokenType type) { return parser->current.type == type; }
 
 /**
  * @brief Matches the current token against a type. If it matches, consumes it.
+ * @param parser The parser.
  * @param type The token type to match.
  * @return bool True if the token was matched and consumed.
  */
-static bool match(TokenType type) {
-    if (!check(type)) return false;
-    advance();
+static bool match(Parser* parser, TokenType type) {
+    if (!check(parser, type)) return false;
+    advance(parser);
     return true;
 }
 
@@ -166,36 +214,39 @@ static bool match(TokenType type) {
 
 /**
  * @brief Emits a single byte to the current chunk.
+ * @param parser The parser.
  * @param byte The byte to write.
  */
-static void emitByte(uint8_t byte) {
-    Chunk* chunk = currentChunk();
-    writeChunk(chunk, byte, parser.previous.line);
+static void emitByte(Parser* parser, uint8_t byte) {
+    Chunk* chunk = currentChunk(parser);
+    writeChunk(parser->vm, chunk, byte, parser->previous.line);
 }
 
 /**
  * @brief Emits two bytes to the current chunk.
+ * @param parser The parser.
  * @param byte1 The first byte.
  * @param byte2 The second byte.
  */
-static void emitBytes(uint8_t byte1, uint8_t byte2) {
-    emitByte(byte1);
-    emitByte(byte2);
+static void emitBytes(Parser* parser, uint8_t byte1, uint8_t byte2) {
+    emitByte(parser, byte1);
+    emitByte(parser, byte2);
 }
 
 /**
  * @brief Emits a jump instruction with a placeholder offset.
  *
  * The placeholder will be filled in later by `patchJump`.
+ * @param parser The parser.
  * @param instruction The jump opcode (`OP_JUMP` or `OP_JUMP_IF_FALSE`).
  * @return int32_t The offset of the placeholder in the bytecode.
  */
-static int32_t emitJump(uint8_t instruction) {
-    emitByte(instruction);
+static int32_t emitJump(Parser* parser, uint8_t instruction) {
+    emitByte(parser, instruction);
     // placeholder for the 16-bit jump offset
-    emitByte(0xff);
-    emitByte(0xff);
-    return currentChunk()->count - 2;
+    emitByte(parser, 0xff);
+    emitByte(parser, 0xff);
+    return currentChunk(parser)->count - 2;
 }
 
 /**
@@ -203,43 +254,46 @@ static int32_t emitJump(uint8_t instruction) {
  *
  * Calculates the distance to jump and writes it into the placeholder
  * emitted by `emitJump`.
+ * @param parser The parser.
  * @param offset The bytecode offset of the placeholder to patch.
  */
-static void patchJump(int32_t offset) {
+static void patchJump(Parser* parser, int32_t offset) {
     // -2 to adjust for the bytecode for the jump offset itself
-    int32_t jump = currentChunk()->count - offset - 2;
+    int32_t jump = currentChunk(parser)->count - offset - 2;
 
     if (jump > UINT16_MAX) {
-        error("Too much code to jump over.");
+        error(parser, "Too much code to jump over.");
     }
 
-    currentChunk()->code[offset] = (jump >> 8) & 0xff;
-    currentChunk()->code[offset + 1] = jump & 0xff;
+    currentChunk(parser)->code[offset] = (jump >> 8) & 0xff;
+    currentChunk(parser)->code[offset + 1] = jump & 0xff;
 }
 
 /**
  * @brief Emits a loop instruction (OP_LOOP).
+ * @param parser The parser.
  * @param loopStart The bytecode offset of the beginning of the loop.
  */
-static void emitLoop(int32_t loopStart) {
-    emitByte(OP_LOOP);
+static void emitLoop(Parser* parser, int32_t loopStart) {
+    emitByte(parser, OP_LOOP);
 
-    int32_t offset = currentChunk()->count - loopStart + 2;
-    if (offset > UINT16_MAX) error("Loop body too large.");
+    int32_t offset = currentChunk(parser)->count - loopStart + 2;
+    if (offset > UINT16_MAX) error(parser, "Loop body too large.");
 
-    emitByte((offset >> 8) & 0xff);
-    emitByte(offset & 0xff);
+    emitByte(parser, (offset >> 8) & 0xff);
+    emitByte(parser, offset & 0xff);
 }
 
 /**
  * @brief Adds a value to the current chunk's constant table.
+ * @param parser The parser.
  * @param value The value to add.
  * @return uint8_t The index of the added constant.
  */
-static uint8_t makeConstant(Value value) {
-    int32_t constant = addConstant(currentChunk(), value);
+static uint8_t makeConstant(Parser* parser, Value value) {
+    int32_t constant = addConstant(parser->vm, currentChunk(parser), value);
     if (constant > UINT8_MAX) {
-        error("Too many constants ine one chunk.");
+        error(parser, "Too many constants ine one chunk.");
         return 0;
     }
     return (uint8_t)constant;
@@ -247,10 +301,11 @@ static uint8_t makeConstant(Value value) {
 
 /**
  * @brief Emits an OP_CONSTANT instruction.
+ * @param parser The parser.
  * @param value The value to be loaded from the constant table.
  */
-static void emitConstant(Value value) {
-    emitBytes(OP_CONSTANT, makeConstant(value));
+static void emitConstant(Parser* parser, Value value) {
+    emitBytes(parser, OP_CONSTANT, makeConstant(parser, value));
 }
 
 /**
@@ -258,14 +313,15 @@ static void emitConstant(Value value) {
  *
  * For initializers (`init`), it implicitly returns `this`. For other functions,
  * it implicitly returns `nil`.
+ * @param parser The parser.
  */
-static void emitReturn() {
-    if (current->type == TYPE_INITIALIZER) {
-        emitBytes(OP_GET_LOCAL, 0);
+static void emitReturn(Parser* parser) {
+    if (parser->compiler->type == TYPE_INITIALIZER) {
+        emitBytes(parser, OP_GET_LOCAL, 0);
     } else {
-        emitByte(OP_NIL);
+        emitByte(parser, OP_NIL);
     }
-    emitByte(OP_RETURN);
+    emitByte(parser, OP_RETURN);
 }
 
 //-----------------------------------------------------------------------------
@@ -274,26 +330,32 @@ static void emitReturn() {
 
 /**
  * @brief Initializes a new Compiler instance for a function or script.
+ * @param parser The parser.
  * @param compiler A pointer to the compiler instance to initialize.
  * @param type The type of code being compiled (script, function, method).
+ * @param function The stub whose body is compiled, or NULL to compile a new
+ * function.
  */
-static void initCompiler(Compiler* compiler, FunctionType type) {
-    compiler->enclosing = current;
+static void initCompiler(Parser* parser, Compiler* compiler, FunctionType type,
+                         ObjectFunction* function) {
+    compiler->enclosing = parser->compiler;
     compiler->function = NULL;
     compiler->type = type;
     compiler->localCount = 0;
     compiler->scopeDepth = 0;
-    compiler->function = newFunction();
-    current = compiler;
-
-    if (type != TYPE_SCRIPT) {
-        current->function->name =
-            copyString(parser.previous.start, parser.previous.length);
+    compiler->lazy = NULL;
+    compiler->function = function != NULL ? function : newFunction(parser->vm);
+    parser->compiler = compiler;
+
+    if (function == NULL && type != TYPE_SCRIPT) {
+        parser->compiler->function->name =
+            copyString(parser->vm, parser->previous.start,
+                       parser->previous.length);
     }
 
     // The first local slot is reserved for internal use by the VM. For methods,
     // it holds 'this'. For functions, it's unnamed.
-    Local* local = &current->locals[current->localCount++];
+    Local* local = &parser->compiler->locals[parser->compiler->localCount++];
     local->depth = 0;
     local->isCaptured = 0;
     if (type != TYPE_FUNCTION) {
@@ -308,23 +370,31 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
 /**
  * @brief Finalizes the compilation of the current function.
  *
- * Emits a return instruction, optionally disassembles the bytecode, and
- * restores the enclosing compiler's state.
+ * Emits a return instruction, measures the stack the function needs,
+ * optionally disassembles the bytecode, and restores the enclosing
+ * compiler's state.
+ * @param parser The parser.
  * @return ObjectFunction* The compiled function object.
  */
-static ObjectFunction* endCompiler() {
-    emitReturn();
-    ObjectFunction* function = current->function;
+static ObjectFunction* endCompiler(Parser* parser) {
+    emitReturn(parser);
+    ObjectFunction* function = parser->compiler->function;
+    if (!parser->hadError) {
+        function->maxSlots =
+            checkCode(parser->vm, &function->chunk, function->arity,
+                      function->upvalueCount);
+        if (function->maxSlots < 0) error(parser, "Invalid bytecode.");
+    }
 
 #ifdef DEBUG_PRINT_CODE
-    if (!parser.hadError) {
-        disassembleChunk(currentChunk(), function->name != NULL
+    if (!parser->hadError) {
+        disassembleChunk(currentChunk(parser), function->name != NULL
                                              ? function->name->chars
                                              : "<script>");
     }
 #endif
 
-    current = current->enclosing;
+    parser->compiler = parser->compiler->enclosing;
     return function;
 }
 
@@ -334,28 +404,31 @@ static ObjectFunction* endCompiler() {
 
 /**
  * @brief Enters a new lexical scope.
+ * @param parser The parser.
  */
-static void beginScope() { current->scopeDepth++; }
+static void beginScope(Parser* parser) { parser->compiler->scopeDepth++; }
 
 /**
  * @brief Exits the current lexical scope.
  *
  * Emits OP_POP or OP_CLOSE_UPVALUE for each local variable declared in the
  * scope.
+ * @param parser The parser.
  */
-static void endScope() {
-    current->scopeDepth--;
+static void endScope(Parser* parser) {
+    Compiler* compiler = parser->compiler;
+    compiler->scopeDepth--;
 
     // walk backwards poping variables from the scope
-    while (current->localCount > 0 &&
-           current->locals[current->localCount - 1].depth >
-               current->scopeDepth) {
-        if (current->locals[current->localCount - 1].isCaptured) {
-            emitByte(OP_CLOSE_UPVALUE);
+    while (compiler->localCount > 0 &&
+           compiler->locals[compiler->localCount - 1].depth >
+               compiler->scopeDepth) {
+        if (compiler->locals[compiler->localCount - 1].isCaptured) {
+            emitByte(parser, OP_CLOSE_UPVALUE);
         } else {
-            emitByte(OP_POP);
+            emitByte(parser, OP_POP);
         }
-        current->localCount--;
+        compiler->localCount--;
     }
 }
 
@@ -369,14 +442,15 @@ static bool identifiersEqual(const Token* a, const Token* b) {
 
 /**
  * @brief Adds a local variable to the current compiler's scope.
+ * @param parser The parser.
  * @param name The token containing the variable's name.
  */
-static void addLocal(Token name) {
-    if (current->localCount == UINT8_COUNT) {
-        error("Too many local variables in function.");
+static void addLocal(Parser* parser, Token name) {
+    if (parser->compiler->localCount == UINT8_COUNT) {
+        error(parser, "Too many local variables in function.");
         return;
     }
-    Local* local = &current->locals[current->localCount++];
+    Local* local = &parser->compiler->locals[parser->compiler->localCount++];
     local->name = name;
     local->depth = -1;  // to indicate unintialized state
     local->isCaptured = false;
@@ -388,55 +462,61 @@ static void addLocal(Token name) {
  * For local scopes, it adds the variable to the compiler's list of locals
  * and checks for redeclarations within the same scope. Globals are handled
  * at runtime, so this is a no-op for the global scope.
+ * @param parser The parser.
  */
-static void declareVariable() {
+static void declareVariable(Parser* parser) {
     // global variables are late bound and implicitly declared
-    if (current->scopeDepth == 0) return;
+    if (parser->compiler->scopeDepth == 0) return;
 
     // redeclaring a local variable is not permitted
-    const Token* name = &parser.previous;
-    for (int32_t i = current->localCount - 1; i >= 0; i--) {
-        Local* local = &current->locals[i];
+    const Token* name = &parser->previous;
+    for (int32_t i = parser->compiler->localCount - 1; i >= 0; i--) {
+        Local* local = &parser->compiler->locals[i];
         // if a variable is owned by another (higher) scope,
         // we know we've checked all of the existing variables in the scope
-        if (local->depth != -1 && local->depth < current->scopeDepth) {
+        if (local->depth != -1 && local->depth < parser->compiler->scopeDepth) {
             break;
         }
         if (identifiersEqual(name, &local->name)) {
-            error("Already variable with this name in this scope.");
+            error(parser, "Already variable with this name in this scope.");
         }
     }
 
-    addLocal(*name);
+    addLocal(parser, *name);
 }
 
 /**
  * @brief Creates a constant for an identifier's name.
+ * @param parser The parser.
  */
-static uint8_t identifierConstant(const Token* name) {
-    return makeConstant(OBJECT_VAL(copyString(name->start, name->length)));
+static uint8_t identifierConstant(Parser* parser, const Token* name) {
+    return makeConstant(parser, OBJECT_VAL(copyString(parser->vm, name->start,
+                                                      name->length)));
 }
 
 /**
  * @brief Parses a variable name and adds it to the appropriate scope.
+ * @param parser The parser.
  * @param errorMessage The error message to show if an identifier isn't found.
  * @return uint8_t The constant table index for a global, or 0 for a local.
  */
-static uint8_t parseVariable(const char* errorMessage) {
-    consume(TOKEN_IDENTIFIER, errorMessage);
+static uint8_t parseVariable(Parser* parser, const char* errorMessage) {
+    consume(parser, TOKEN_IDENTIFIER, errorMessage);
 
-    declareVariable();
-    if (current->scopeDepth > 0) return 0;
+    declareVariable(parser);
+    if (parser->compiler->scopeDepth > 0) return 0;
 
-    return identifierConstant(&parser.previous);
+    return identifierConstant(parser, &parser->previous);
 }
 
 /**
  * @brief Marks the most recently declared local variable as initialized.
+ * @param parser The parser.
  */
-static void markInitialized() {
-    if (current->scopeDepth == 0) return;
-    current->locals[current->localCount - 1].depth = current->scopeDepth;
+static void markInitialized(Parser* parser) {
+    Compiler* compiler = parser->compiler;
+    if (compiler->scopeDepth == 0) return;
+    compiler->locals[compiler->localCount - 1].depth = compiler->scopeDepth;
 }
 
 /**
@@ -444,29 +524,33 @@ static void markInitialized() {
  *
  * For globals, emits OP_DEFINE_GLOBAL. For locals, this simply marks the
  * variable as initialized.
+ * @param parser The parser.
  * @param global The constant table index of the global variable's name.
  */
-static void defineVariable(uint8_t global) {
-    if (current->scopeDepth > 0) {
-        markInitialized();
+static void defineVariable(Parser* parser, uint8_t global) {
+    if (parser->compiler->scopeDepth > 0) {
+        markInitialized(parser);
         return;
     }
 
-    emitBytes(OP_DEFINE_GLOBAL, global);
+    emitBytes(parser, OP_DEFINE_GLOBAL, global);
 }
 
 /**
  * @brief Resolves a local variable by name in the current function's scopes.
+ * @param parser The parser.
  * @param compiler The current compiler.
  * @param name The token for the variable's name.
  * @return int32_t The stack slot of the local, or -1 if not found.
  */
-static int32_t resolveLocal(Compiler* compiler, const Token* name) {
+static int32_t resolveLocal(Parser* parser, Compiler* compiler,
+                            const Token* name) {
     for (int32_t i = compiler->localCount - 1; i >= 0; i--) {
         Local* local = &compiler->locals[i];
         if (identifiersEqual(name, &local->name)) {
             if (local->depth == -1) {
-                error("Can't read local variable in its own initializer.");
+                error(parser,
+                      "Can't read local variable in its own initializer.");
             }
             return i;
         }
@@ -480,13 +564,15 @@ static int32_t resolveLocal(Compiler* compiler, const Token* name) {
  * An upvalue is a local variable from an enclosing function that is "closed
  * over" by an inner function.
  *
+ * @param parser The parser.
  * @param compiler The current compiler.
  * @param index The index of the upvalue.
  * @param isLocal True if the upvalue captures a local variable from the
  * enclosing function; false if it captures another upvalue.
  * @return int32_t The index of the new upvalue.
  */
-static int32_t addUpvalue(Compiler* compiler, uint8_t index, bool isLocal) {
+static int32_t addUpvalue(Parser* parser, Compiler* compiler, uint8_t index,
+                          bool isLocal) {
     int32_t upvalueCount = compiler->function->upvalueCount;
 
     // reuse an existing upvalue if it captures the same variable
@@ -498,7 +584,7 @@ static int32_t addUpvalue(Compiler* compiler, uint8_t index, bool isLocal) {
     }
 
     if (upvalueCount == UINT8_COUNT) {
-        error("Too many closure variables in function.");
+        error(parser, "Too many closure variables in function.");
         return 0;
     }
 
@@ -507,28 +593,52 @@ static int32_t addUpvalue(Compiler* compiler, uint8_t index, bool isLocal) {
     return compiler->function->upvalueCount++;
 }
 
+/**
+ * @brief Resolves an identifier as one of the upvalues captured by a stub.
+ *
+ * When a stub's body is compiled, the functions it was nested in are gone, so
+ * the variables it captured are found by the names recorded in the stub.
+ * @param compiler The compiler of the stub's body.
+ * @param name The token for the variable's name.
+ * @return int32_t The index of the upvalue, or -1 if not found.
+ */
+static int32_t resolveLazyUpvalue(const Compiler* compiler, const Token* name) {
+    const ValueArray* names = &compiler->lazy->upvalueNames;
+    for (int32_t i = 0; i < names->count; i++) {
+        const ObjectString* string = AS_STRING(names->values[i]);
+        if (string->length == name->length &&
+            memcmp(string->chars, name->start, name->length) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
 /**
  * @brief Resolves an identifier as an upvalue.
  *
  * Recursively walks up the chain of enclosing functions to find the variable.
+ * @param parser The parser.
  * @param compiler The current compiler.
  * @param name The token for the variable's name.
  * @return int32_t The index of the upvalue, or -1 if not found.
  */
-static int32_t resolveUpvalue(Compiler* compiler, Token* name) {
-    if (compiler->enclosing == NULL) return -1;
+static int32_t resolveUpvalue(Parser* parser, Compiler* compiler, Token* name) {
+    if (compiler->enclosing == NULL) {
+        return compiler->lazy != NULL ? resolveLazyUpvalue(compiler, name) : -1;
+    }
 
     // try to resolve as a local in the enclosing function
-    int32_t local = resolveLocal(compiler->enclosing, name);
+    int32_t local = resolveLocal(parser, compiler->enclosing, name);
     if (local != -1) {
         compiler->enclosing->locals[local].isCaptured = true;
-        return addUpvalue(compiler, (uint8_t)local, true);
+        return addUpvalue(parser, compiler, (uint8_t)local, true);
     }
 
     // try to resolve as an upvalue in the enclosing function (recursively)
-    int32_t upvalue = resolveUpvalue(compiler->enclosing, name);
+    int32_t upvalue = resolveUpvalue(parser, compiler->enclosing, name);
     if (upvalue != -1) {
-        return addUpvalue(compiler, (uint8_t)upvalue, false);
+        return addUpvalue(parser, compiler, (uint8_t)upvalue, false);
     }
 
     return -1;
@@ -537,12 +647,12 @@ static int32_t resolveUpvalue(Compiler* compiler, Token* name) {
 //-----------------------------------------------------------------------------
 //- Forward Declarations for Parsing
 //-----------------------------------------------------------------------------
-static void expression();
-static void declaration();
-static void statement();
-static void namedVariable(Token name, bool canAssign);
+static void expression(Parser* parser);
+static void declaration(Parser* parser);
+static void statement(Parser* parser);
+static void namedVariable(Parser* parser, Token name, bool canAssign);
 static ParseRule* getRule(TokenType type);
-static void parsePrecedence(Precedence precedence);
+static void parsePrecedence(Parser* parser, Precedence precedence);
 
 //-----------------------------------------------------------------------------
 //- Pratt Parser: Expression Parsing Rules
@@ -553,32 +663,33 @@ static void parsePrecedence(Precedence precedence);
  *
  * It parses an expression with a given precedence level, handling both
  * prefix and infix operators correctly.
+ * @param parser The parser.
  * @param precedence The minimum precedence level to parse.
  */
-static void parsePrecedence(Precedence precedence) {
-    advance();
-    ParseFn prefixRule = getRule(parser.previous.type)->prefix;
+static void parsePrecedence(Parser* parser, Precedence precedence) {
+    advance(parser);
+    ParseFn prefixRule = getRule(parser->previous.type)->prefix;
     // the first token is always going to belong to some kind of prefix
     // expression
     if (prefixRule == NULL) {
-        error("Expected expression.");
+        error(parser, "Expected expression.");
         return;
     }
 
     bool canAssign = precedence <= PREC_ASSIGNMENT;
-    prefixRule(canAssign);
+    prefixRule(parser, canAssign);
 
     // after parsing prefixRule(), we look for an infix parser for the next
     // token
-    while (precedence <= getRule(parser.current.type)->precedence) {
-        advance();
-        ParseFn infixRule = getRule(parser.previous.type)->infix;
-        infixRule(canAssign);
+    while (precedence <= getRule(parser->current.type)->precedence) {
+        advance(parser);
+        ParseFn infixRule = getRule(parser->previous.type)->infix;
+        infixRule(parser, canAssign);
     }
 
-    if (canAssign && match(TOKEN_EQUAL)) {
+    if (canAssign && match(parser, TOKEN_EQUAL)) {
         // this catches cases like `a * b = c`, which is not a valid assignment
-        error("Invalid assignment target.");
+        error(parser, "Invalid assignment target.");
     }
 }
 
@@ -590,8 +701,11 @@ static ParseRule* getRule(TokenType type) { return &rules[type]; }
 
 /**
  * @brief Wrapper for `parsePrecedence(PREC_ASSIGNMENT)`.
+ * @param parser The parser.
  */
-static void expression() { parsePrecedence(PREC_ASSIGNMENT); }
+static void expression(Parser* parser) {
+    parsePrecedence(parser, PREC_ASSIGNMENT);
+}
 
 //-----------------------------------------------------------------------------
 //- Expression Parsing Functions
@@ -599,28 +713,30 @@ static void expression() { parsePrecedence(PREC_ASSIGNMENT); }
 
 /**
  * @brief Parses a grouping expression, like `(1 + 2)`.
+ * @param parser The parser.
  */
-static void grouping(bool canAssign __attribute__((unused))) {
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expected ')' after expression.");
+static void grouping(Parser* parser, bool canAssign __attribute__((unused))) {
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expected ')' after expression.");
 }
 
 /**
  * @brief Parses a unary operator expression, like `-x` or `!y`.
+ * @param parser The parser.
  */
-static void unary(bool canAssign __attribute__((unused))) {
-    TokenType operatorType = parser.previous.type;
+static void unary(Parser* parser, bool canAssign __attribute__((unused))) {
+    TokenType operatorType = parser->previous.type;
 
     // compile the operand
-    parsePrecedence(PREC_UNARY);
+    parsePrecedence(parser, PREC_UNARY);
 
     // emit the operator intruction
     switch (operatorType) {
         case TOKEN_BANG:
-            emitByte(OP_NOT);
+            emitByte(parser, OP_NOT);
             break;
         case TOKEN_MINUS:
-            emitByte(OP_NEGATE);
+            emitByte(parser, OP_NEGATE);
             break;
         default:
             return;  // unreachable
@@ -629,48 +745,49 @@ static void unary(bool canAssign __attribute__((unused))) {
 
 /**
  * @brief Parses a binary operator expression, like `a + b`.
+ * @param parser The parser.
  */
-static void binary(bool canAssign __attribute__((unused))) {
+static void binary(Parser* parser, bool canAssign __attribute__((unused))) {
     // remember the operator
-    TokenType operatorType = parser.previous.type;
+    TokenType operatorType = parser->previous.type;
 
     // compile the right operand
     const ParseRule* rule = getRule(operatorType);
     // compile the right operand with one higher precedence to handle
     // left-associativity (5 - 3 - 1 is parsed as (5 - 3) - 1).
-    parsePrecedence((Precedence)(rule->precedence + 1));
+    parsePrecedence(parser, (Precedence)(rule->precedence + 1));
 
     // emit the operator instruction
     switch (operatorType) {
         case TOKEN_BANG_EQUAL:
-            emitBytes(OP_EQUAL, OP_NOT);
+            emitBytes(parser, OP_EQUAL, OP_NOT);
             break;
         case TOKEN_EQUAL_EQUAL:
-            emitByte(OP_EQUAL);
+            emitByte(parser, OP_EQUAL);
             break;
         case TOKEN_GREATER:
-            emitByte(OP_GREATER);
+            emitByte(parser, OP_GREATER);
             break;
         case TOKEN_GREATER_EQUAL:
-            emitBytes(OP_LESS, OP_NOT);
+            emitBytes(parser, OP_LESS, OP_NOT);
             break;
         case TOKEN_LESS:
-            emitByte(OP_LESS);
+            emitByte(parser, OP_LESS);
             break;
         case TOKEN_LESS_EQUAL:
-            emitBytes(OP_GREATER, OP_NOT);
+            emitBytes(parser, OP_GREATER, OP_NOT);
             break;
         case TOKEN_PLUS:
-            emitByte(OP_ADD);
+            emitByte(parser, OP_ADD);
             break;
         case TOKEN_MINUS:
-            emitByte(OP_SUBTRACT);
+            emitByte(parser, OP_SUBTRACT);
             break;
         case TOKEN_STAR:
-            emitByte(OP_MULTIPLY);
+            emitByte(parser, OP_MULTIPLY);
             break;
         case TOKEN_SLASH:
-            emitByte(OP_DIVIDE);
+            emitByte(parser, OP_DIVIDE);
             break;
         default:
             return;  // unreachable
@@ -679,98 +796,165 @@ static void binary(bool canAssign __attribute__((unused))) {
 
 /**
  * @brief Parses a logical AND expression. Uses short-circuiting.
+ * @param parser The parser.
  */
-static void and_(bool canAssign __attribute__((unused))) {
+static void and_(Parser* parser, bool canAssign __attribute__((unused))) {
     // if the left side is false, jump over the right side
-    int32_t endJump = emitJump(OP_JUMP_IF_FALSE);
+    int32_t endJump = emitJump(parser, OP_JUMP_IF_FALSE);
 
     // clean up the stack -> statements are required to have zero stack effect
-    emitByte(OP_POP);
-    parsePrecedence(PREC_AND);
+    emitByte(parser, OP_POP);
+    parsePrecedence(parser, PREC_AND);
 
-    patchJump(endJump);
+    patchJump(parser, endJump);
 }
 
 /**
  * @brief Parses a logical OR expression. Uses short-circuiting.
+ * @param parser The parser.
  */
-static void or_(bool canAssign __attribute__((unused))) {
+static void or_(Parser* parser, bool canAssign __attribute__((unused))) {
     // if the left side is false, jump to evaluate the right side
-    int32_t elseJump = emitJump(OP_JUMP_IF_FALSE);
+    int32_t elseJump = emitJump(parser, OP_JUMP_IF_FALSE);
     // if the left side is true, jump over the right side
-    int32_t endJump = emitJump(OP_JUMP);
+    int32_t endJump = emitJump(parser, OP_JUMP);
 
-    patchJump(elseJump);
+    patchJump(parser, elseJump);
     // to clean up the stack
-    emitByte(OP_POP);
+    emitByte(parser, OP_POP);
 
-    parsePrecedence(PREC_OR);
-    patchJump(endJump);
+    parsePrecedence(parser, PREC_OR);
+    patchJump(parser, endJump);
 }
 
 /**
  * @brief Parses an argument list for a function call.
+ * @param parser The parser.
  * @return uint8_t The number of arguments parsed.
  */
-static uint8_t argumentList() {
+static uint8_t argumentList(Parser* parser) {
     uint8_t argCount = 0;
-    if (!check(TOKEN_RIGHT_PAREN)) {
+    if (!check(parser, TOKEN_RIGHT_PAREN)) {
         do {
-            expression();
+            expression(parser);
             if (argCount == 255) {
-                error("Can't have more than 255 arguments.");
+                error(parser, "Can't have more than 255 arguments.");
             }
             argCount++;
-        } while (match(TOKEN_COMMA));
+        } while (match(parser, TOKEN_COMMA));
     }
 
-    consume(TOKEN_RIGHT_PAREN, "Expected ')' after arguments.");
+    consume(parser, TOKEN_RIGHT_PAREN, "Expected ')' after arguments.");
     return argCount;
 }
 
 /**
  * @brief Parses a function call expression, like `myFunc(a, b)`.
+ * @param parser The parser.
  */
-static void call(bool canAssign __attribute__((unused))) {
-    uint8_t argCount = argumentList();
-    emitBytes(OP_CALL, argCount);
+static void call(Parser* parser, bool canAssign __attribute__((unused))) {
+    uint8_t argCount = argumentList(parser);
+    emitBytes(parser, OP_CALL, argCount);
 }
 
 /**
  * @brief Parses a dot operator for property access/assignment or method calls.
+ * @param parser The parser.
  */
-static void dot(bool canAssign) {
-    consume(TOKEN_IDENTIFIER, "Expected property name after '.'.");
-    uint8_t name = identifierConstant(&parser.previous);
+static void dot(Parser* parser, bool canAssign) {
+    consume(parser, TOKEN_IDENTIFIER, "Expected property name after '.'.");
+    uint8_t name = identifierConstant(parser, &parser->previous);
 
-    if (canAssign && match(TOKEN_EQUAL)) {
+    if (canAssign && match(parser, TOKEN_EQUAL)) {
         // property assignment -> obj.prop = value
-        expression();
-        emitBytes(OP_SET_PROPERTY, name);
-    } else if (match(TOKEN_LEFT_PAREN)) {
+        expression(parser);
+        emitBytes(parser, OP_SET_PROPERTY, name);
+    } else if (match(parser, TOKEN_LEFT_PAREN)) {
         // method call -> obj.method(args)
-        uint8_t argCount = argumentList();
-        emitBytes(OP_INVOKE, name);
-        emitByte(argCount);
+        uint8_t argCount = argumentList(parser);
+        emitBytes(parser, OP_INVOKE, name);
+        emitByte(parser, argCount);
     } else {
         // property access -> obj.prop
-        emitBytes(OP_GET_PROPERTY, name);
+        emitBytes(parser, OP_GET_PROPERTY, name);
+    }
+}
+
+/**
+ * @brief Parses an index operator for element access/assignment, like
+ * `list[i]` or `list[i] = value`.
+ * @param parser The parser.
+ */
+static void subscript(Parser* parser, bool canAssign) {
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_BRACKET, "Expected ']' after index.");
+
+    if (canAssign && match(parser, TOKEN_EQUAL)) {
+        expression(parser);
+        emitByte(parser, OP_SET_INDEX);
+    } else {
+        emitByte(parser, OP_GET_INDEX);
     }
 }
 
+/**
+ * @brief Parses a list literal, like `[1, 2, 3]`.
+ * @param parser The parser.
+ */
+static void list(Parser* parser, bool canAssign __attribute__((unused))) {
+    uint8_t itemCount = 0;
+    if (!check(parser, TOKEN_RIGHT_BRACKET)) {
+        do {
+            expression(parser);
+            if (itemCount == 255) {
+                error(parser,
+                      "Can't have more than 255 items in a list literal.");
+            }
+            itemCount++;
+        } while (match(parser, TOKEN_COMMA));
+    }
+
+    consume(parser, TOKEN_RIGHT_BRACKET, "Expected ']' after list items.");
+    emitBytes(parser, OP_BUILD_LIST, itemCount);
+}
+
+/**
+ * @brief Parses a map literal, like `{"a": 1, 2: "b"}`.
+ * @param parser The parser.
+ */
+static void map(Parser* parser, bool canAssign __attribute__((unused))) {
+    uint8_t entryCount = 0;
+    if (!check(parser, TOKEN_RIGHT_BRACE)) {
+        do {
+            expression(parser);
+            consume(parser, TOKEN_COLON, "Expected ':' after map key.");
+            expression(parser);
+            if (entryCount == 255) {
+                error(parser,
+                      "Can't have more than 255 entries in a map literal.");
+            }
+            entryCount++;
+        } while (match(parser, TOKEN_COMMA));
+    }
+
+    consume(parser, TOKEN_RIGHT_BRACE, "Expected '}' after map entries.");
+    emitBytes(parser, OP_BUILD_MAP, entryCount);
+}
+
 /**
  * @brief Parses a literal value (`true`, `false`, `nil`).
+ * @param parser The parser.
  */
-static void literal(bool canAssign __attribute__((unused))) {
-    switch (parser.previous.type) {
+static void literal(Parser* parser, bool canAssign __attribute__((unused))) {
+    switch (parser->previous.type) {
         case TOKEN_FALSE:
-            emitByte(OP_FALSE);
+            emitByte(parser, OP_FALSE);
             break;
         case TOKEN_TRUE:
-            emitByte(OP_TRUE);
+            emitByte(parser, OP_TRUE);
             break;
         case TOKEN_NIL:
-            emitByte(OP_NIL);
+            emitByte(parser, OP_NIL);
             break;
         default:
             return;  // unreachable
@@ -779,18 +963,36 @@ static void literal(bool canAssign __attribute__((unused))) {
 
 /**
  * @brief Parses a number literal.
- */
-static void number(bool canAssign __attribute__((unused))) {
-    double value = strtod(parser.previous.start, NULL);
-    emitConstant(NUMBER_VAL(value));
+ * @param parser The parser.
+ */
+static void number(Parser* parser, bool canAssign __attribute__((unused))) {
+    // the source may be a mapped file without a terminating NUL, so strtod
+    // reads a copy of the token
+    char buffer[64];
+    int32_t length = parser->previous.length;
+    char* text = length < (int32_t)sizeof(buffer)
+                     ? buffer
+                     : ALLOCATE(parser->vm, char, length + 1);
+    memcpy(text, parser->previous.start, length);
+    text[length] = '\0';
+    double value = strtod(text, NULL);
+    if (text != buffer) FREE_ARRAY(parser->vm, char, text, length + 1);
+
+    // integral literals become immediate integers for the VM's fast paths
+    if (value <= INT32_MAX && (int32_t)value == value) {
+        emitConstant(parser, INT_VAL((int32_t)value));
+    } else {
+        emitConstant(parser, NUMBER_VAL(value));
+    }
 }
 
 /**
  * @brief Parses a string literal.
+ * @param parser The parser.
  */
-static void string(bool canAssign __attribute__((unused))) {
-    emitConstant(OBJECT_VAL(
-        copyString(parser.previous.start + 1, parser.previous.length - 2)));
+static void string(Parser* parser, bool canAssign __attribute__((unused))) {
+    emitConstant(parser, copyStringValue(parser->vm, parser->previous.start + 1,
+                                         parser->previous.length - 2));
 }
 
 /**
@@ -798,87 +1000,127 @@ static void string(bool canAssign __attribute__((unused))) {
  *
  * Determines if the variable is local, an upvalue, or global, and emits
  * the corresponding get/set instruction.
+ * @param parser The parser.
  * @param name The token of the variable's name.
  * @param canAssign Whether the context allows assignment.
  */
-static void namedVariable(Token name, bool canAssign) {
+static void namedVariable(Parser* parser, Token name, bool canAssign) {
     uint8_t getOp, setOp;
-    int32_t arg = resolveLocal(current, &name);
+    int32_t arg = resolveLocal(parser, parser->compiler, &name);
     if (arg != -1) {
         getOp = OP_GET_LOCAL;
         setOp = OP_SET_LOCAL;
-    } else if ((arg = resolveUpvalue(current, &name)) != -1) {
+    } else if ((arg = resolveUpvalue(parser, parser->compiler, &name)) != -1) {
         getOp = OP_GET_UPVALUE;
         setOp = OP_SET_UPVALUE;
     } else {
-        arg = identifierConstant(&name);
+        arg = identifierConstant(parser, &name);
         getOp = OP_GET_GLOBAL;
         setOp = OP_SET_GLOBAL;
     }
 
-    if (canAssign && match(TOKEN_EQUAL)) {
-        expression();
-        emitBytes(setOp, arg);
+    if (canAssign && match(parser, TOKEN_EQUAL)) {
+        expression(parser);
+        emitBytes(parser, setOp, arg);
     } else {
-        emitBytes(getOp, arg);
+        emitBytes(parser, getOp, arg);
     }
 }
 
 /**
  * @brief Parses a variable expression using the previously consumed identifier.
+ * @param parser The parser.
  */
-static void variable(bool canAssign) {
-    namedVariable(parser.previous, canAssign);
+static void variable(Parser* parser, bool canAssign) {
+    namedVariable(parser, parser->previous, canAssign);
 }
 
 /**
  * @brief Parses the `this` keyword.
+ * @param parser The parser.
  */
-static void this_(bool canAssign __attribute__((unused))) {
-    if (currentClass == NULL) {
-        error("Can't use 'this' outside of a class.");
+static void this_(Parser* parser, bool canAssign __attribute__((unused))) {
+    if (parser->currentClass == NULL) {
+        error(parser, "Can't use 'this' outside of a class.");
         return;
     }
-    variable(false);  // treat 'this' as a read-only local variable
+    variable(parser, false);  // treat 'this' as a read-only local variable
 }
 
 /**
  * @brief Creates a token with the given text.
  * Used internally for keywords like `this` and `super`.
+ * @param parser The parser.
  */
-static Token syntheticToken(const char* text) {
+static Token syntheticToken(Parser* parser, const char* text) {
     Token token;
     token.start = text;
     token.length = (int32_t)strlen(text);
     token.type = TOKEN_SYNTHETIC;
-    token.line = parser.previous.line;
+    token.line = parser->previous.line;
     return token;
 }
 
 /**
  * @brief Parses the `super` keyword for superclass method access.
+ * @param parser The parser.
  */
-static void super_(bool canAssign __attribute__((unused))) {
-    if (currentClass == NULL) {
-        error("Can't use 'super' outside of a class.");
-    } else if (!currentClass->hasSuperclass) {
-        error("Can't use 'super' in a class with no superclass.");
+static void super_(Parser* parser, bool canAssign __attribute__((unused))) {
+    if (parser->currentClass == NULL) {
+        error(parser, "Can't use 'super' outside of a class.");
+    } else if (!parser->currentClass->hasSuperclass) {
+        error(parser, "Can't use 'super' in a class with no superclass.");
     }
 
-    consume(TOKEN_DOT, "Expected '.' after 'super'.");
-    consume(TOKEN_IDENTIFIER, "Expected superclass method name.");
-    uint8_t name = identifierConstant(&parser.previous);
+    consume(parser, TOKEN_DOT, "Expected '.' after 'super'.");
+    consume(parser, TOKEN_IDENTIFIER, "Expected superclass method name.");
+    uint8_t name = identifierConstant(parser, &parser->previous);
+
+    namedVariable(parser, syntheticToken(parser, "this"), false);
+    if (match(parser, TOKEN_LEFT_PAREN)) {
+        uint8_t argCount = argumentList(parser);
+        namedVariable(parser, syntheticToken(parser, "super"), false);
+        emitBytes(parser, OP_SUPER_INVOKE, name);
+        emitByte(parser, argCount);
+    } else {
+        namedVariable(parser, syntheticToken(parser, "super"), false);
+        emitBytes(parser, OP_GET_SUPER, name);
+    }
+}
+
+/**
+ * @brief Parses a `yield` expression, like `yield value`.
+ *
+ * The value is optional and defaults to nil. The expression evaluates to the
+ * value the coroutine is resumed with.
+ * @param parser The parser.
+ */
+static void yield(Parser* parser, bool canAssign __attribute__((unused))) {
+    if (getRule(parser->current.type)->prefix == NULL) {
+        emitByte(parser, OP_NIL);
+    } else {
+        expression(parser);
+    }
+    emitByte(parser, OP_YIELD);
+}
 
-    namedVariable(syntheticToken("this"), false);
-    if (match(TOKEN_LEFT_PAREN)) {
-        uint8_t argCount = argumentList();
-        namedVariable(syntheticToken("super"), false);
-        emitBytes(OP_SUPER_INVOKE, name);
-        emitByte(argCount);
+/**
+ * @brief Parses a `resume` expression, like `resume(coroutine, value)`.
+ *
+ * The value is optional and defaults to nil. The expression evaluates to the
+ * value the coroutine yields or returns.
+ * @param parser The parser.
+ */
+static void resume(Parser* parser, bool canAssign __attribute__((unused))) {
+    consume(parser, TOKEN_LEFT_PAREN, "Expected '(' after 'resume'.");
+    expression(parser);
+    if (match(parser, TOKEN_COMMA)) {
+        expression(parser);
     } else {
-        namedVariable(syntheticToken("super"), false);
-        emitBytes(OP_GET_SUPER, name);
+        emitByte(parser, OP_NIL);
     }
+    consume(parser, TOKEN_RIGHT_PAREN, "Expected ')' after resume arguments.");
+    emitByte(parser, OP_RESUME);
 }
 
 // Table for Pratt parser. For each token type, it specifies a function to
@@ -890,8 +1132,11 @@ ParseRule rules[] = {
     // token type             prefix fun.   infix fun.  precedence
     [TOKEN_LEFT_PAREN]      = {grouping,    call,       PREC_CALL},
     [TOKEN_RIGHT_PAREN]     = {NULL,        NULL,       PREC_NONE},
-    [TOKEN_LEFT_BRACE]      = {NULL,        NULL,       PREC_NONE},
+    [TOKEN_LEFT_BRACE]      = {map,         NULL,       PREC_NONE},
     [TOKEN_RIGHT_BRACE]     = {NULL,        NULL,       PREC_NONE},
+    [TOKEN_LEFT_BRACKET]    = {list,        subscript,  PREC_CALL},
+    [TOKEN_RIGHT_BRACKET]   = {NULL,        NULL,       PREC_NONE},
+    [TOKEN_COLON]           = {NULL,        NULL,       PREC_NONE},
     [TOKEN_COMMA]           = {NULL,        NULL,       PREC_NONE},
     [TOKEN_DOT]             = {NULL,        dot,        PREC_CALL},
     [TOKEN_MINUS]           = {unary,       binary,     PREC_TERM},
@@ -920,12 +1165,14 @@ ParseRule rules[] = {
     [TOKEN_NIL]             = {literal,     NULL,       PREC_NONE},
     [TOKEN_OR]              = {NULL,        or_,        PREC_OR},
     [TOKEN_PRINT]           = {NULL,        NULL,       PREC_NONE},
+    [TOKEN_RESUME]          = {resume,      NULL,       PREC_NONE},
     [TOKEN_RETURN]          = {NULL,        NULL,       PREC_NONE},
     [TOKEN_SUPER]           = {super_,      NULL,       PREC_NONE},
     [TOKEN_THIS]            = {this_,       NULL,       PREC_NONE},
     [TOKEN_TRUE]            = {literal,     NULL,       PREC_NONE},
     [TOKEN_VAR]             = {NULL,        NULL,       PREC_NONE},
     [TOKEN_WHILE]           = {NULL,        NULL,       PREC_NONE},
+    [TOKEN_YIELD]           = {yield,       NULL,       PREC_NONE},
     [TOKEN_ERROR]           = {NULL,        NULL,       PREC_NONE},
     [TOKEN_EOF]             = {NULL,        NULL,       PREC_NONE},
 };
@@ -937,225 +1184,329 @@ ParseRule rules[] = {
 
 /**
  * @brief Parses a block of statements enclosed in `{}`.
+ * @param parser The parser.
  */
-static void block() {
-    while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
-        declaration();
+static void block(Parser* parser) {
+    while (!check(parser, TOKEN_RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
+        declaration(parser);
     }
-    consume(TOKEN_RIGHT_BRACE, "Expected '}' after block.");
+    consume(parser, TOKEN_RIGHT_BRACE, "Expected '}' after block.");
 }
 
 /**
- * @brief Parses a function's definition (name, parameters, and body).
+ * @brief Parses a function's parameter list and declares the parameters.
+ * @param parser The parser.
  */
-static void function(FunctionType type) {
-    Compiler compiler;
-    initCompiler(&compiler, type);
-    beginScope();
-
-    // compile the parameter list
-    consume(TOKEN_LEFT_PAREN, "Expected '(' after function name.");
-    if (!check(TOKEN_RIGHT_PAREN)) {
+static void parameterList(Parser* parser) {
+    consume(parser, TOKEN_LEFT_PAREN, "Expected '(' after function name.");
+    if (!check(parser, TOKEN_RIGHT_PAREN)) {
         do {
-            current->function->arity++;
-            if (current->function->arity > 255) {
-                errorAtCurrent("Can't have more than 255 parameters.");
+            parser->compiler->function->arity++;
+            if (parser->compiler->function->arity > 255) {
+                errorAtCurrent(parser, "Can't have more than 255 parameters.");
             }
 
-            uint8_t paramConstant = parseVariable("Expected parameter name.");
-            defineVariable(paramConstant);
-        } while (match(TOKEN_COMMA));
+            uint8_t paramConstant = parseVariable(parser,
+                                                  "Expected parameter name.");
+            defineVariable(parser, paramConstant);
+        } while (match(parser, TOKEN_COMMA));
     }
-    consume(TOKEN_RIGHT_PAREN, "Expected ')' after parameters.");
+    consume(parser, TOKEN_RIGHT_PAREN, "Expected ')' after parameters.");
+}
+
+/**
+ * @brief Captures the variable a name in a skipped body may refer to.
+ *
+ * Names of the stub's own parameters and of globals are left alone.
+ * @param parser The parser.
+ * @param name The token for the name.
+ */
+static void captureName(Parser* parser, Token* name) {
+    if (resolveLocal(parser, parser->compiler, name) != -1) return;
+
+    int32_t count = parser->compiler->function->upvalueCount;
+    if (resolveUpvalue(parser, parser->compiler, name) != count ||
+        parser->compiler->function->upvalueCount == count) {
+        return;  // not a variable of an enclosing function, or captured already
+    }
+
+    Value string = OBJECT_VAL(copyString(parser->vm, name->start,
+                                         name->length));
+    push(parser->vm, string);  // GC guard while the array grows
+    writeValueArray(parser->vm, &parser->compiler->function->lazy->upvalueNames,
+                    string);
+    pop(parser->vm);
+}
+
+/**
+ * @brief Skips a function's body, leaving the function as a stub that is
+ * compiled on its first call.
+ *
+ * The body is only scanned, to find its closing brace. Every identifier in it
+ * that names a variable of an enclosing function is captured, since the body
+ * might use it; this can capture more variables than the compiled body needs,
+ * but never fewer.
+ * @param parser The parser.
+ * @param parameters The token opening the parameter list.
+ * @return ObjectFunction* The stub.
+ */
+static ObjectFunction* skipBody(Parser* parser, const Token* parameters) {
+    ObjectFunction* function = parser->compiler->function;
+    LazyBody* lazy = ALLOCATE(parser->vm, LazyBody, 1);
+    lazy->source = parser->lazySource;
+    lazy->start = (int32_t)(parameters->start - parser->lazySource->chars);
+    lazy->line = parameters->line;
+    lazy->type = (uint8_t)parser->compiler->type;
+    lazy->inClass = parser->currentClass != NULL;
+    lazy->hasSuperclass =
+        parser->currentClass != NULL && parser->currentClass->hasSuperclass;
+    initValueArray(&lazy->upvalueNames);
+    function->lazy = lazy;
+
+    TokenType before = TOKEN_LEFT_BRACE;
+    int32_t depth = 1;
+    while (!check(parser, TOKEN_EOF)) {
+        advance(parser);
+        Token token = parser->previous;
+        if (token.type == TOKEN_LEFT_BRACE) {
+            depth++;
+        } else if (token.type == TOKEN_RIGHT_BRACE) {
+            if (--depth == 0) break;
+        } else if (token.type == TOKEN_IDENTIFIER ||
+                   token.type == TOKEN_THIS || token.type == TOKEN_SUPER) {
+            // property names are never variables
+            if (before != TOKEN_DOT) captureName(parser, &token);
+            // `super` reads `this` too, without naming it
+            if (token.type == TOKEN_SUPER) {
+                Token self = syntheticToken(parser, "this");
+                captureName(parser, &self);
+            }
+        }
+        before = token.type;
+    }
+    if (depth > 0) errorAtCurrent(parser, "Expected '}' after block.");
+
+    parser->compiler = parser->compiler->enclosing;
+    return function;
+}
+
+/**
+ * @brief Parses a function's definition (name, parameters, and body).
+ * @param parser The parser.
+ */
+static void function(Parser* parser, FunctionType type) {
+    Compiler compiler;
+    initCompiler(parser, &compiler, type, NULL);
+    beginScope(parser);
 
-    // compile the body
-    consume(TOKEN_LEFT_BRACE, "Expected '{' before function body.");
-    block();
+    Token parameters = parser->current;
+    parameterList(parser);
 
-    // create the function object and emit OP_CLOSURE
-    ObjectFunction* functionObj = endCompiler();
-    emitBytes(OP_CLOSURE, makeConstant(OBJECT_VAL(functionObj)));
+    // compile the body, or skip it when compiling lazily
+    consume(parser, TOKEN_LEFT_BRACE, "Expected '{' before function body.");
+    ObjectFunction* functionObj;
+    if (parser->lazySource != NULL) {
+        functionObj = skipBody(parser, &parameters);
+    } else {
+        block(parser);
+        functionObj = endCompiler(parser);
+    }
+
+    // emit OP_CLOSURE for the function object
+    emitBytes(parser, OP_CLOSURE, makeConstant(parser,
+                                               OBJECT_VAL(functionObj)));
 
     // emit bytecode for each upvalue captured by the closure
     for (int32_t i = 0; i < functionObj->upvalueCount; i++) {
-        emitByte(compiler.upvalues[i].isLocal ? 1 : 0);
-        emitByte(compiler.upvalues[i].index);
+        emitByte(parser, compiler.upvalues[i].isLocal ? 1 : 0);
+        emitByte(parser, compiler.upvalues[i].index);
     }
 }
 
 /**
  * @brief Parses a function declaration statement.
+ * @param parser The parser.
  */
-static void functionDeclaration() {
-    uint8_t global = parseVariable("Expected function name.");
-    markInitialized();
-    function(TYPE_FUNCTION);
-    defineVariable(global);
+static void functionDeclaration(Parser* parser) {
+    uint8_t global = parseVariable(parser, "Expected function name.");
+    markInitialized(parser);
+    function(parser, TYPE_FUNCTION);
+    defineVariable(parser, global);
 }
 
 /**
  * @brief Parses a method definition within a class.
+ * @param parser The parser.
  */
-static void method() {
-    consume(TOKEN_IDENTIFIER, "Expected method name.");
-    uint8_t constant = identifierConstant(&parser.previous);
+static void method(Parser* parser) {
+    consume(parser, TOKEN_IDENTIFIER, "Expected method name.");
+    uint8_t constant = identifierConstant(parser, &parser->previous);
 
     FunctionType type = TYPE_METHOD;
-    if (parser.previous.length == 4 &&
-        memcmp(parser.previous.start, "init", 4) == 0) {
+    if (parser->previous.length == 4 &&
+        memcmp(parser->previous.start, "init", 4) == 0) {
         type = TYPE_INITIALIZER;
     }
 
-    function(type);
-    emitBytes(OP_METHOD, constant);
+    function(parser, type);
+    emitBytes(parser, OP_METHOD, constant);
 }
 
 /**
  * @brief Parses a class declaration.
+ * @param parser The parser.
  */
-static void classDeclaration() {
-    consume(TOKEN_IDENTIFIER, "Expected class name.");
-    Token className = parser.previous;
-    uint8_t nameConstant = identifierConstant(&parser.previous);
-    declareVariable();
+static void classDeclaration(Parser* parser) {
+    consume(parser, TOKEN_IDENTIFIER, "Expected class name.");
+    Token className = parser->previous;
+    uint8_t nameConstant = identifierConstant(parser, &parser->previous);
+    declareVariable(parser);
 
-    emitBytes(OP_CLASS, nameConstant);
-    defineVariable(nameConstant);
+    emitBytes(parser, OP_CLASS, nameConstant);
+    defineVariable(parser, nameConstant);
 
     ClassCompiler classCompiler;
-    classCompiler.name = parser.previous;
+    classCompiler.name = parser->previous;
     classCompiler.hasSuperclass = false;
-    classCompiler.enclosing = currentClass;
-    currentClass = &classCompiler;
+    classCompiler.enclosing = parser->currentClass;
+    parser->currentClass = &classCompiler;
 
     // handle inheritance
-    if (match(TOKEN_LESS)) {
-        consume(TOKEN_IDENTIFIER, "Expected superclass name.");
-        variable(false);
+    if (match(parser, TOKEN_LESS)) {
+        consume(parser, TOKEN_IDENTIFIER, "Expected superclass name.");
+        variable(parser, false);
 
-        if (identifiersEqual(&className, &parser.previous)) {
-            error("A class can't inherit from itself.");
+        if (identifiersEqual(&className, &parser->previous)) {
+            error(parser, "A class can't inherit from itself.");
         }
 
         // create a new scope for 'super'
-        beginScope();
-        addLocal(syntheticToken("super"));
-        defineVariable(0);
+        beginScope(parser);
+        addLocal(parser, syntheticToken(parser, "super"));
+        defineVariable(parser, 0);
 
-        namedVariable(className, false);
-        emitByte(OP_INHERIT);
+        namedVariable(parser, className, false);
+        emitByte(parser, OP_INHERIT);
         classCompiler.hasSuperclass = true;
     }
 
-    namedVariable(className, false);
-    consume(TOKEN_LEFT_BRACE, "Expected '{' before class body.");
-    while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
-        method();
+    namedVariable(parser, className, false);
+    consume(parser, TOKEN_LEFT_BRACE, "Expected '{' before class body.");
+    while (!check(parser, TOKEN_RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
+        method(parser);
     }
-    consume(TOKEN_RIGHT_BRACE, "Expected '}' after class body.");
-    emitByte(OP_POP);  // pop the class from the stack
+    consume(parser, TOKEN_RIGHT_BRACE, "Expected '}' after class body.");
+    emitByte(parser, OP_POP);  // pop the class from the stack
 
     if (classCompiler.hasSuperclass) {
-        endScope();  // close the 'super' scope
+        endScope(parser);  // close the 'super' scope
     }
 
-    currentClass = currentClass->enclosing;
+    parser->currentClass = parser->currentClass->enclosing;
 }
 
 /**
  * @brief Parses a variable declaration (`var name [ = initializer ];`).
+ * @param parser The parser.
  */
-static void variableDeclaration() {
-    uint8_t global = parseVariable("Expected variable name.");
+static void variableDeclaration(Parser* parser) {
+    uint8_t global = parseVariable(parser, "Expected variable name.");
 
-    if (match(TOKEN_EQUAL)) {
-        expression();
+    if (match(parser, TOKEN_EQUAL)) {
+        expression(parser);
     } else {
-        emitByte(OP_NIL);  // the compiler desugars 'var a;' to 'var a = nil;'
+        emitByte(parser,
+                 OP_NIL);  // the compiler desugars 'var a;' to 'var a = nil;'
     }
-    consume(TOKEN_SEMICOLON, "Expected ';' after variable declaration.");
+    consume(parser, TOKEN_SEMICOLON,
+            "Expected ';' after variable declaration.");
 
-    defineVariable(global);
+    defineVariable(parser, global);
 }
 
 /**
  * @brief Parses an expression statement.
+ * @param parser The parser.
  */
-static void expressionStatement() {
-    expression();
-    consume(TOKEN_SEMICOLON, "Expected ';' after value.");
-    emitByte(OP_POP);
+static void expressionStatement(Parser* parser) {
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expected ';' after value.");
+    emitByte(parser, OP_POP);
 }
 
 /**
  * @brief Parses a `print` statement.
+ * @param parser The parser.
  */
-static void printStatement() {
-    expression();
-    consume(TOKEN_SEMICOLON, "Expected ';' after value;");
-    emitByte(OP_PRINT);
+static void printStatement(Parser* parser) {
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expected ';' after value;");
+    emitByte(parser, OP_PRINT);
 }
 
 /**
  * @brief Parses a `return` statement.
+ * @param parser The parser.
  */
-static void returnStatement() {
-    if (current->type == TYPE_SCRIPT) {
-        error("Can't return from top-level code.");
+static void returnStatement(Parser* parser) {
+    if (parser->compiler->type == TYPE_SCRIPT) {
+        error(parser, "Can't return from top-level code.");
     }
 
-    if (match(TOKEN_SEMICOLON)) {
-        emitReturn();  // implicit nil return
+    if (match(parser, TOKEN_SEMICOLON)) {
+        emitReturn(parser);  // implicit nil return
     } else {
-        if (current->type == TYPE_INITIALIZER) {
-            error("Can't return a value from an initializer.");
+        if (parser->compiler->type == TYPE_INITIALIZER) {
+            error(parser, "Can't return a value from an initializer.");
         }
-        expression();
-        consume(TOKEN_SEMICOLON, "Expected ';' after return value.");
-        emitByte(OP_RETURN);
+        expression(parser);
+        consume(parser, TOKEN_SEMICOLON, "Expected ';' after return value.");
+        emitByte(parser, OP_RETURN);
     }
 }
 
 /**
  * @brief Parses an `if` statement.
+ * @param parser The parser.
  */
-static void ifStatement() {
-    consume(TOKEN_LEFT_PAREN, "Expected '(' after 'if'.");
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expected ')' after condition.");
+static void ifStatement(Parser* parser) {
+    consume(parser, TOKEN_LEFT_PAREN, "Expected '(' after 'if'.");
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expected ')' after condition.");
 
-    int32_t thenJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP);  // pop condition
-    statement();
+    int32_t thenJump = emitJump(parser, OP_JUMP_IF_FALSE);
+    emitByte(parser, OP_POP);  // pop condition
+    statement(parser);
 
-    int32_t elseJump = emitJump(OP_JUMP);
+    int32_t elseJump = emitJump(parser, OP_JUMP);
 
-    patchJump(thenJump);
-    emitByte(OP_POP);  // pop condition
+    patchJump(parser, thenJump);
+    emitByte(parser, OP_POP);  // pop condition
 
-    if (match(TOKEN_ELSE)) statement();
-    patchJump(elseJump);
+    if (match(parser, TOKEN_ELSE)) statement(parser);
+    patchJump(parser, elseJump);
 }
 
 /**
  * @brief Parses a `while` statement.
+ * @param parser The parser.
  */
-static void whileStatement() {
-    int32_t loopStart = currentChunk()->count;
+static void whileStatement(Parser* parser) {
+    int32_t loopStart = currentChunk(parser)->count;
 
-    consume(TOKEN_LEFT_PAREN, "Expected '(' after 'while'.");
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expected ')' after condition.");
+    consume(parser, TOKEN_LEFT_PAREN, "Expected '(' after 'while'.");
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expected ')' after condition.");
 
-    int32_t exitJump = emitJump(OP_JUMP_IF_FALSE);
+    int32_t exitJump = emitJump(parser, OP_JUMP_IF_FALSE);
 
-    emitByte(OP_POP);
-    statement();
+    emitByte(parser, OP_POP);
+    statement(parser);
 
-    emitLoop(loopStart);
+    emitLoop(parser, loopStart);
 
-    patchJump(exitJump);
-    emitByte(OP_POP);
+    patchJump(parser, exitJump);
+    emitByte(parser, OP_POP);
 }
 
 /**
@@ -1164,96 +1515,99 @@ static void whileStatement() {
  * This is "desugared" into equivalent bytecode using jumps and primitives,
  * effectively behaving like a `while` loop with initializer and increment
  * clauses.
+ * @param parser The parser.
  */
-static void forStatement() {
-    beginScope();
-    consume(TOKEN_LEFT_PAREN, "Expected '(' after 'for'.");
+static void forStatement(Parser* parser) {
+    beginScope(parser);
+    consume(parser, TOKEN_LEFT_PAREN, "Expected '(' after 'for'.");
 
     // initializer clause
-    if (match(TOKEN_SEMICOLON)) {
+    if (match(parser, TOKEN_SEMICOLON)) {
         // no intializer
-    } else if (match(TOKEN_VAR)) {
-        variableDeclaration();
+    } else if (match(parser, TOKEN_VAR)) {
+        variableDeclaration(parser);
     } else {
-        expressionStatement();
+        expressionStatement(parser);
     }
 
-    int32_t loopStart = currentChunk()->count;
+    int32_t loopStart = currentChunk(parser)->count;
 
     // condition clause
     int32_t exitJump = -1;
-    if (!match(TOKEN_SEMICOLON)) {
-        expression();
-        consume(TOKEN_SEMICOLON, "Expected ';' after loop condition.");
+    if (!match(parser, TOKEN_SEMICOLON)) {
+        expression(parser);
+        consume(parser, TOKEN_SEMICOLON, "Expected ';' after loop condition.");
 
         // jump out of the loop if the condition is false
-        exitJump = emitJump(OP_JUMP_IF_FALSE);
-        emitByte(OP_POP);  // condition
+        exitJump = emitJump(parser, OP_JUMP_IF_FALSE);
+        emitByte(parser, OP_POP);  // condition
     }
 
     // increment clause
-    if (!match(TOKEN_RIGHT_PAREN)) {
-        int32_t bodyJump = emitJump(OP_JUMP);
+    if (!match(parser, TOKEN_RIGHT_PAREN)) {
+        int32_t bodyJump = emitJump(parser, OP_JUMP);
 
-        int32_t incrementStart = currentChunk()->count;
-        expression();
-        emitByte(OP_POP);
-        consume(TOKEN_RIGHT_PAREN, "Expected ')' after for clauses.");
+        int32_t incrementStart = currentChunk(parser)->count;
+        expression(parser);
+        emitByte(parser, OP_POP);
+        consume(parser, TOKEN_RIGHT_PAREN, "Expected ')' after for clauses.");
 
-        emitLoop(loopStart);
+        emitLoop(parser, loopStart);
         loopStart = incrementStart;
-        patchJump(bodyJump);
+        patchJump(parser, bodyJump);
     }
 
-    statement();
+    statement(parser);
 
-    emitLoop(loopStart);
+    emitLoop(parser, loopStart);
 
     if (exitJump != -1) {
-        patchJump(exitJump);
-        emitByte(OP_POP);
+        patchJump(parser, exitJump);
+        emitByte(parser, OP_POP);
     }
 
-    endScope();
+    endScope(parser);
 }
 
 /**
  * @brief Parses a statement.
- */
-static void statement() {
-    if (match(TOKEN_PRINT)) {
-        printStatement();
-    } else if (match(TOKEN_IF)) {
-        ifStatement();
-    } else if (match(TOKEN_WHILE)) {
-        whileStatement();
-    } else if (match(TOKEN_FOR)) {
-        forStatement();
-    } else if (match(TOKEN_LEFT_BRACE)) {
-        beginScope();
-        block();
-        endScope();
-    } else if (match(TOKEN_RETURN)) {
-        returnStatement();
+ * @param parser The parser.
+ */
+static void statement(Parser* parser) {
+    if (match(parser, TOKEN_PRINT)) {
+        printStatement(parser);
+    } else if (match(parser, TOKEN_IF)) {
+        ifStatement(parser);
+    } else if (match(parser, TOKEN_WHILE)) {
+        whileStatement(parser);
+    } else if (match(parser, TOKEN_FOR)) {
+        forStatement(parser);
+    } else if (match(parser, TOKEN_LEFT_BRACE)) {
+        beginScope(parser);
+        block(parser);
+        endScope(parser);
+    } else if (match(parser, TOKEN_RETURN)) {
+        returnStatement(parser);
     } else {
-        expressionStatement();
+        expressionStatement(parser);
     }
 }
 
 /**
  * @brief Parses a declaration.
- */
-static void declaration() {
-    if (match(TOKEN_CLASS)) {
-        classDeclaration();
-    } else if (match(TOKEN_FUN)) {
-        functionDeclaration();
-    } else if (match(TOKEN_VAR)) {
-        variableDeclaration();
+ * @param parser The parser.
+ */
+static void declaration(Parser* parser) {
+    if (match(parser, TOKEN_CLASS)) {
+        classDeclaration(parser);
+    } else if (match(parser, TOKEN_FUN)) {
+        functionDeclaration(parser);
+    } else if (match(parser, TOKEN_VAR)) {
+        variableDeclaration(parser);
     } else {
-        statement();
+        statement(parser);
     }
-    if (parser.panicMode) synchronize();
+    if (parser->panicMode) synchronize(parser);
 }
 
 //-----------------------------------------------------------------------------
@@ -1262,26 +1616,99 @@ static void declaration() {
 
 /**
  * @brief Compiles a Clox source string into a function object with bytecode.
- * @param source The null-terminated string of Clox source code.
+ *
+ * The source does not need to be NUL-terminated and is only read during the
+ * call: every name and string literal is copied into the heap.
+ *
+ * @param vm The virtual machine the function will run in.
+ * @param source The Clox source code.
+ * @param length The length of the source in bytes.
  * @return ObjectFunction* The compiled top-level script function, or NULL on
  * error.
  */
-ObjectFunction* compile(const char* source) {
-    initScanner(source);
+ObjectFunction* compile(VM* vm, const char* source, size_t length) {
+    // size the string table from the length instead of scanning twice, so
+    // large scripts do not rehash it over and over while compiling
+    size_t names = length / SOURCE_BYTES_PER_NAME;
+    if (names > MAX_RESERVED_NAMES) names = MAX_RESERVED_NAMES;
+    internTableReserve(vm, &vm->strings, vm->strings.count + (int32_t)names);
+
+    Parser state;
+    Parser* parser = &state;
+    initParser(parser, vm, NULL);
+
+    // stubs point into the source until they are compiled, so lazy
+    // compilation works on a copy owned by the heap; nothing looks the copy
+    // up, so it is neither hashed nor interned
+    if (vm->lazyCompilation) {
+        parser->lazySource = copyUninternedString(vm, source, (int32_t)length);
+        source = parser->lazySource->chars;
+    }
+    initScanner(&parser->scanner, source, length);
 
     Compiler compiler;
-    initCompiler(&compiler, TYPE_SCRIPT);
+    initCompiler(parser, &compiler, TYPE_SCRIPT, NULL);
 
-    parser.hadError = false;
-    parser.panicMode = false;
+    advance(parser);
+    while (!match(parser, TOKEN_EOF)) {
+        declaration(parser);
+    }
+
+    ObjectFunction* functionObj = endCompiler(parser);
+    finishParser(parser);
+    return parser->hadError ? NULL : functionObj;
+}
 
-    advance();
-    while (!match(TOKEN_EOF)) {
-        declaration();
+/**
+ * @brief Compiles the body of a function left as a stub by lazy compilation.
+ *
+ * Reports any compile error in the body to stderr. The function stays a stub
+ * if compilation fails.
+ *
+ * @param vm The virtual machine running the function.
+ * @param function The stub, whose `lazy` field is set.
+ * @return bool True if the body was compiled, false on error.
+ */
+bool compileLazyFunction(VM* vm, ObjectFunction* function) {
+    LazyBody* lazy = function->lazy;
+    const ObjectString* source = lazy->source;
+
+    Parser state;
+    Parser* parser = &state;
+    initParser(parser, vm, lazy->source);
+    initScannerAt(&parser->scanner, source->chars + lazy->start,
+                  source->chars + source->length, lazy->line);
+
+    // the class the function was declared in only matters for errors
+    ClassCompiler classCompiler;
+    classCompiler.enclosing = NULL;
+    classCompiler.name = syntheticToken(parser, "");
+    classCompiler.hasSuperclass = lazy->hasSuperclass;
+    parser->currentClass = lazy->inClass ? &classCompiler : NULL;
+
+    Compiler compiler;
+    initCompiler(parser, &compiler, (FunctionType)lazy->type, function);
+    compiler.lazy = lazy;
+
+    advance(parser);
+    beginScope(parser);
+    function->arity = 0;
+    parameterList(parser);
+    consume(parser, TOKEN_LEFT_BRACE, "Expected '{' before function body.");
+    block(parser);
+    endCompiler(parser);
+    finishParser(parser);
+
+    if (parser->hadError) {
+        freeChunk(vm, &function->chunk);
+        initChunk(&function->chunk);
+        return false;
     }
 
-    ObjectFunction* functionObj = endCompiler();
-    return parser.hadError ? NULL : functionObj;
+    freeValueArray(vm, &lazy->upvalueNames);
+    FREE(vm, LazyBody, lazy);
+    function->lazy = NULL;
+    return true;
 }
 
 /**
@@ -1290,11 +1717,17 @@ ObjectFunction* compile(const char* source) {
  * This function is called by the garbage collector to trace all reachable
  * objects that are still being used by the compiler (like function objects
  * under construction).
- */
-void markCompilerRoots() {
-    Compiler* compiler = current;
-    while (compiler != NULL) {
-        markObject((Object*)compiler->function);
-        compiler = compiler->enclosing;
+ *
+ * @param vm The virtual machine.
+ */
+void markCompilerRoots(VM* vm) {
+    for (Parser* parser = vm->parser; parser != NULL;
+         parser = parser->enclosing) {
+        Compiler* compiler = parser->compiler;
+        while (compiler != NULL) {
+            markObject(vm, (Object*)compiler->function);
+            compiler = compiler->enclosing;
+        }
+        markObject(vm, (Object*)parser->lazySource);
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,659 @@
+/**
+ * @file corelox.c
+ * @brief The C API for embedding coreLox, as built into libcorelox.
+ *
+ * The API is a thin layer over the VM. Handles index the VM's `handles`
+ * array, which the garbage collector marks as a root; released slots are
+ * chained into a free list through the numbers stored in them. Arguments are
+ * pushed straight onto the main stack, and a call slides them up to put the
+ * callee below them, as `interpretCall` expects. A host native is a native
+ * whose spec calls back through `host`; it sees its arguments and sets its
+ * result through the VM while it runs.
+ */
+
+#include "corelox.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compiler.h"
+#include "memory.h"
+#include "object.h"
+#include "vm.h"
+
+//-----------------------------------------------------------------------------
+//- Virtual Machines
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Creates a virtual machine.
+ *
+ * Running out of memory after the VM itself is allocated, for its stack or
+ * anything later, ends the process as it does everywhere in the VM.
+ *
+ * @return LoxVM* The new VM, or NULL if it cannot be allocated.
+ */
+LoxVM* loxNewVM(void) {
+    VM* vm = (VM*)malloc(sizeof(VM));
+    if (vm == NULL) return NULL;
+    initVM(vm);
+    return vm;
+}
+
+/**
+ * @brief Frees a virtual machine and everything in it, handles included.
+ * @param vm The virtual machine.
+ */
+void loxFreeVM(LoxVM* vm) {
+    freeVM(vm);
+    free(vm);
+}
+
+//-----------------------------------------------------------------------------
+//- Handles
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Holds a value in a new handle.
+ * @param vm The virtual machine.
+ * @param value The value, which must be reachable by the GC.
+ * @return LoxHandle The handle.
+ */
+static LoxHandle holdValue(VM* vm, Value value) {
+    if (vm->freeHandle >= 0) {
+        LoxHandle handle = vm->freeHandle;
+        vm->freeHandle = (LoxHandle)AS_NUMBER(vm->handles.values[handle]);
+        vm->handles.values[handle] = value;
+        vm->releasedHandles[handle] = false;
+        return handle;
+    }
+
+    // the flags grow with the array, once the value is in it
+    int32_t capacity = vm->handles.capacity;
+    writeValueArray(vm, &vm->handles, value);
+    if (vm->handles.capacity != capacity) {
+        vm->releasedHandles = GROW_ARRAY(vm, bool, vm->releasedHandles,
+                                         capacity, vm->handles.capacity);
+    }
+    vm->releasedHandles[vm->handles.count - 1] = false;
+    return vm->handles.count - 1;
+}
+
+/**
+ * @brief Checks whether a handle holds a value.
+ * @param vm The virtual machine.
+ * @param handle The handle.
+ * @return bool False for `LOX_NO_HANDLE`, a released handle, or a number
+ * that was never given out.
+ */
+static bool isHeld(VM* vm, LoxHandle handle) {
+    return handle >= 0 && handle < vm->handles.count &&
+           !vm->releasedHandles[handle];
+}
+
+/**
+ * @brief Compiles a script into a function that runs it.
+ *
+ * Calling the function with no arguments runs the script, which defines its
+ * globals; compile errors are reported on stderr.
+ *
+ * @param vm The virtual machine.
+ * @param source The source code, which does not need to be NUL-terminated.
+ * @param length The length of the source in bytes.
+ * @param script A pointer where the handle of the function will be stored.
+ * @return LoxResult `LOX_OK`, or `LOX_COMPILE_ERROR` with `LOX_NO_HANDLE`
+ * stored.
+ */
+LoxResult loxCompile(LoxVM* vm, const char* source, size_t length,
+                     LoxHandle* script) {
+    *script = LOX_NO_HANDLE;
+    ObjectFunction* function = compile(vm, source, length);
+    if (function == NULL) return LOX_COMPILE_ERROR;
+
+    // the function, then the closure, stay on the stack while allocating
+    push(vm, OBJECT_VAL(function));
+    ObjectClosure* closure = newClosure(vm, function);
+    pop(vm);
+    push(vm, OBJECT_VAL(closure));
+    *script = holdValue(vm, OBJECT_VAL(closure));
+    pop(vm);
+    return LOX_OK;
+}
+
+/**
+ * @brief Holds the value of a global variable, such as a function the
+ * script defined.
+ *
+ * The lookup is done once, here: later changes to the variable are not seen
+ * through the handle.
+ *
+ * @param vm The virtual machine.
+ * @param name The name of the variable, NUL-terminated.
+ * @return LoxHandle The handle, or `LOX_NO_HANDLE` if there is no such
+ * variable.
+ */
+LoxHandle loxGetGlobal(LoxVM* vm, const char* name) {
+    ObjectString* key = copyString(vm, name, (int32_t)strlen(name));
+    Value value;
+    if (!tableGet(&vm->globals, key, &value)) return LOX_NO_HANDLE;
+
+    push(vm, value);  // a global can be reassigned while the array grows
+    LoxHandle handle = holdValue(vm, value);
+    pop(vm);
+    return handle;
+}
+
+/**
+ * @brief Holds the result of the last call.
+ * @param vm The virtual machine.
+ * @return LoxHandle The handle.
+ */
+LoxHandle loxHoldResult(LoxVM* vm) { return holdValue(vm, vm->result); }
+
+/**
+ * @brief Releases a handle, letting the garbage collector free its value.
+ *
+ * The handle may be given out again later. Releasing a handle that is not
+ * held does nothing.
+ *
+ * @param vm The virtual machine.
+ * @param handle The handle, or `LOX_NO_HANDLE`.
+ */
+void loxReleaseHandle(LoxVM* vm, LoxHandle handle) {
+    // a second release would put the handle on the free list twice
+    if (!isHeld(vm, handle)) return;
+    vm->releasedHandles[handle] = true;
+    vm->handles.values[handle] = NUMBER_VAL(vm->freeHandle);
+    vm->freeHandle = handle;
+}
+
+//-----------------------------------------------------------------------------
+//- Calls
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Checks whether another argument can be pushed.
+ * @param vm The virtual machine.
+ * @return bool False if as many as a call can take are pushed already, or a
+ * host native is running.
+ */
+static bool hasArgumentRoom(VM* vm) {
+    // a host native runs on the stack the arguments would go on
+    return vm->hostArgs == NULL && vm->pushedArguments < LOX_MAX_ARGUMENTS;
+}
+
+/**
+ * @brief Pushes an argument, unless as many as a call can take are pushed.
+ * @param vm The virtual machine.
+ * @param value The argument.
+ * @return bool False if it was not pushed.
+ */
+static bool pushArgument(VM* vm, Value value) {
+    if (!hasArgumentRoom(vm)) return false;
+    push(vm, value);
+    vm->pushedArguments++;
+    return true;
+}
+
+/**
+ * @brief Pushes `nil` as the next argument of a call.
+ * @param vm The virtual machine.
+ * @return bool False, and nothing is pushed, if `LOX_MAX_ARGUMENTS` arguments
+ * are pushed already.
+ */
+bool loxPushNil(LoxVM* vm) { return pushArgument(vm, NIL_VAL); }
+
+/**
+ * @brief Pushes a boolean as the next argument of a call.
+ * @param vm The virtual machine.
+ * @param value The boolean.
+ * @return bool False, and nothing is pushed, if `LOX_MAX_ARGUMENTS` arguments
+ * are pushed already.
+ */
+bool loxPushBool(LoxVM* vm, bool value) {
+    return pushArgument(vm, BOOL_VAL(value));
+}
+
+/**
+ * @brief Pushes a number as the next argument of a call.
+ * @param vm The virtual machine.
+ * @param value The number.
+ * @return bool False, and nothing is pushed, if `LOX_MAX_ARGUMENTS` arguments
+ * are pushed already.
+ */
+bool loxPushNumber(LoxVM* vm, double value) {
+    return pushArgument(vm, NUMBER_VAL(value));
+}
+
+/**
+ * @brief Pushes a copy of a string as the next argument of a call.
+ * @param vm The virtual machine.
+ * @param chars The characters, which do not need to be NUL-terminated.
+ * @param length The number of characters.
+ * @return bool False, and nothing is pushed, if `LOX_MAX_ARGUMENTS` arguments
+ * are pushed already.
+ */
+bool loxPushString(LoxVM* vm, const char* chars, size_t length) {
+    if (!hasArgumentRoom(vm)) return false;
+    // the arguments pushed before are on the stack while the copy allocates
+    return pushArgument(vm, copyStringValue(vm, chars, (int32_t)length));
+}
+
+/**
+ * @brief Pushes a held value as the next argument of a call.
+ * @param vm The virtual machine.
+ * @param handle The handle.
+ * @return bool False, and nothing is pushed, if `LOX_MAX_ARGUMENTS` arguments
+ * are pushed already or the handle is not held.
+ */
+bool loxPushHandle(LoxVM* vm, LoxHandle handle) {
+    return isHeld(vm, handle) && pushArgument(vm, vm->handles.values[handle]);
+}
+
+/**
+ * @brief Pushes host data as the next argument of a call, without copying
+ * it.
+ *
+ * Scripts see a foreign object, which they can store and pass on like any
+ * other value and whose size `len()` returns; natives read the data in
+ * place.
+ *
+ * @param vm The virtual machine.
+ * @param data The data.
+ * @param size The size of the data in bytes.
+ * @param tag The kind of data, which natives check before reading it.
+ * @param finalize Called with the data once the garbage collector frees the
+ * object, or NULL if the host keeps the data alive for as long as scripts may
+ * hold it.
+ * @return bool False, and nothing is pushed, if `LOX_MAX_ARGUMENTS` arguments
+ * are pushed already: the data then stays the host's.
+ */
+bool loxPushForeign(LoxVM* vm, void* data, size_t size, uint32_t tag,
+                    LoxFinalizer finalize) {
+    // the object is only created once it can be pushed, as it owns the data
+    if (!hasArgumentRoom(vm)) return false;
+    return pushArgument(vm, OBJECT_VAL(newForeign(vm, data, size, tag,
+                                                  finalize, NULL)));
+}
+
+/**
+ * @brief Calls a held function, class or method with the arguments pushed
+ * since the last call, and runs it to completion.
+ *
+ * Runtime errors are reported on stderr. Whatever the outcome, the arguments
+ * are consumed.
+ *
+ * @param vm The virtual machine.
+ * @param function The handle of the value to call.
+ * @param argCount The number of arguments pushed for it.
+ * @return LoxResult `LOX_OK`, with the value it returned as the result,
+ * `LOX_RUNTIME_ERROR`, or `LOX_ARGUMENT_ERROR` if the handle is not held or
+ * `argCount` is not the number of arguments pushed; `nil` is the result of a
+ * failed call.
+ */
+LoxResult loxCall(LoxVM* vm, LoxHandle function, int32_t argCount) {
+    if (vm->hostArgs != NULL) {
+        vm->result = NIL_VAL;  // the stack belongs to the running script
+        return LOX_ARGUMENT_ERROR;
+    }
+
+    int32_t pushed = vm->pushedArguments;
+    vm->pushedArguments = 0;
+    if (argCount != pushed || !isHeld(vm, function)) {
+        vm->result = NIL_VAL;
+        vm->stackTop = vm->stack;
+        return LOX_ARGUMENT_ERROR;
+    }
+
+    // the callee goes below the arguments, and anything pushed before them
+    // is dropped
+    Value* args = vm->stackTop - argCount;
+    memmove(vm->stack + 1, args, sizeof(Value) * argCount);
+    vm->stack[0] = vm->handles.values[function];
+    vm->stackTop = vm->stack + 1 + argCount;
+
+    InterpretResult result = interpretCall(vm, argCount);
+    vm->result = result == INTERPRET_OK ? pop(vm) : NIL_VAL;
+    vm->stackTop = vm->stack;
+    return result == INTERPRET_OK ? LOX_OK : LOX_RUNTIME_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+//- Results
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Returns the API type of a value.
+ * @param value The value.
+ * @return LoxType The type.
+ */
+static LoxType typeOf(Value value) {
+    if (IS_NIL(value)) return LOX_TYPE_NIL;
+    if (IS_BOOL(value)) return LOX_TYPE_BOOL;
+    if (IS_NUMBER(value)) return LOX_TYPE_NUMBER;
+    if (IS_STRING(value)) return LOX_TYPE_STRING;
+    if (IS_FOREIGN(value)) return LOX_TYPE_FOREIGN;
+    return LOX_TYPE_OBJECT;
+}
+
+/**
+ * @brief Returns the characters of a string value, without copying them.
+ * @param value The value.
+ * @param view The view a short string is unpacked into.
+ * @param length A pointer where the number of characters will be stored, or
+ * NULL.
+ * @return const char* The characters, or NULL if the value is not a string.
+ */
+static const char* viewChars(Value value, StringView* view, size_t* length) {
+    if (!IS_STRING(value)) return NULL;
+
+    // a short string is unpacked into the view; a heap string is not copied
+    viewString(value, view);
+    if (length != NULL) *length = (size_t)view->length;
+    return view->chars;
+}
+
+/**
+ * @brief Returns the data of a value, if it is a foreign object of a given
+ * kind.
+ * @param value The value.
+ * @param tag The kind of data expected.
+ * @param size A pointer where the size of the data will be stored, or NULL.
+ * @return void* The data, or NULL if the value is not a foreign object with
+ * that tag.
+ */
+static void* foreignData(Value value, uint32_t tag, size_t* size) {
+    if (!IS_FOREIGN(value) || AS_FOREIGN(value)->tag != tag) return NULL;
+
+    ObjectForeign* foreign = AS_FOREIGN(value);
+    if (size != NULL) *size = foreign->size;
+    return foreign->data;
+}
+
+/**
+ * @brief Returns the type of the result of the last call.
+ * @param vm The virtual machine.
+ * @return LoxType The type.
+ */
+LoxType loxResultType(LoxVM* vm) { return typeOf(vm->result); }
+
+/**
+ * @brief Returns whether the result of the last call is truthy in Lox.
+ * @param vm The virtual machine.
+ * @return bool False for `nil` and `false`, true otherwise.
+ */
+bool loxResultBool(LoxVM* vm) {
+    Value value = vm->result;
+    return !IS_NIL(value) && !(IS_BOOL(value) && !AS_BOOL(value));
+}
+
+/**
+ * @brief Returns the result of the last call as a number.
+ * @param vm The virtual machine.
+ * @return double The number, or 0 if the result is not a number.
+ */
+double loxResultNumber(LoxVM* vm) {
+    return IS_NUMBER(vm->result) ? AS_NUMBER(vm->result) : 0;
+}
+
+/**
+ * @brief Returns the characters of the result of the last call, without
+ * copying them.
+ *
+ * They stay valid until the next call.
+ *
+ * @param vm The virtual machine.
+ * @param length A pointer where the number of characters will be stored, or
+ * NULL.
+ * @return const char* The NUL-terminated characters, or NULL if the result
+ * is not a string.
+ */
+const char* loxResultString(LoxVM* vm, size_t* length) {
+    return viewChars(vm->result, &vm->resultView, length);
+}
+
+/**
+ * @brief Returns the data of the result of the last call, if it is a foreign
+ * object of a given kind.
+ * @param vm The virtual machine.
+ * @param tag The kind of data expected.
+ * @param size A pointer where the size of the data will be stored, or NULL.
+ * @return void* The data, or NULL if the result is not a foreign object with
+ * that tag.
+ */
+void* loxResultForeign(LoxVM* vm, uint32_t tag, size_t* size) {
+    return foreignData(vm->result, tag, size);
+}
+
+//-----------------------------------------------------------------------------
+//- Natives
+//-----------------------------------------------------------------------------
+
+// The native types of the API's parameter types, in the same order.
+static const NativeType parameterTypes[] = {
+    NATIVE_ANY,  NATIVE_NUMBER, NATIVE_STRING,
+    NATIVE_LIST, NATIVE_MAP,    NATIVE_FOREIGN,
+};
+
+/**
+ * @brief Defines a native function as a global variable.
+ *
+ * The VM checks the number of arguments and the declared parameter types
+ * before each call, and raises a runtime error if they do not match.
+ *
+ * @param vm The virtual machine.
+ * @param name The name of the global, NUL-terminated; it is copied.
+ * @param arity The number of arguments it takes, or `LOX_VARIADIC`.
+ * @param types The types required of its first arguments, or NULL.
+ * @param typeCount The number of types, at most `LOX_MAX_TYPED_PARAMETERS`.
+ * @param function The function.
+ * @return bool False, and nothing is defined, if the arity or the number of
+ * types is out of range.
+ */
+bool loxDefineNative(LoxVM* vm, const char* name, int32_t arity,
+                     const LoxParameterType* types, int32_t typeCount,
+                     LoxNativeFunction function) {
+    bool variadic = arity == LOX_VARIADIC;
+    if ((!variadic && (arity < 0 || arity > LOX_MAX_ARGUMENTS)) ||
+        typeCount < 0 || typeCount > LOX_MAX_TYPED_PARAMETERS) {
+        return false;
+    }
+    for (int32_t i = 0; i < typeCount; i++) {
+        if ((uint32_t)types[i] >= sizeof(parameterTypes) / sizeof(NativeType)) {
+            return false;
+        }
+    }
+
+    // the spec must outlive the VM, so the VM owns a copy of it
+    HostNative* native = calloc(1, sizeof(HostNative));
+    char* copy = malloc(strlen(name) + 1);
+    if (native == NULL || copy == NULL) exit(1);
+    strcpy(copy, name);
+
+    native->spec.name = copy;
+    native->spec.arity = variadic ? NATIVE_VARIADIC : arity;
+    for (int32_t i = 0; i < typeCount; i++) {
+        native->spec.types[i] = parameterTypes[types[i]];
+    }
+    native->spec.host = function;
+    native->next = vm->hostNatives;
+    vm->hostNatives = native;
+    defineNative(vm, &native->spec);
+    return true;
+}
+
+/**
+ * @brief Reports a runtime error from a host native.
+ *
+ * The error is reported with a stack trace, and the script stops: the native
+ * should return at once.
+ *
+ * @param vm The virtual machine.
+ * @param format A printf-style format string for the error message.
+ * @param ... Arguments for the format string.
+ */
+void loxNativeError(LoxVM* vm, const char* format, ...) {
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    nativeError(vm, "%s", message);
+}
+
+/**
+ * @brief Finds an argument of the running host native.
+ * @param vm The virtual machine.
+ * @param index The index of the argument, from 0.
+ * @return const Value* The argument, or NULL if there is no such argument.
+ */
+static const Value* argument(VM* vm, int32_t index) {
+    if (vm->hostArgs == NULL || index < 0 || index >= vm->hostArgCount) {
+        return NULL;
+    }
+    return &vm->hostArgs[index];
+}
+
+/**
+ * @brief Returns the type of an argument of the running host native.
+ * @param vm The virtual machine.
+ * @param index The index of the argument, from 0.
+ * @return LoxType The type, or `LOX_TYPE_NIL` if there is no such argument.
+ */
+LoxType loxArgumentType(LoxVM* vm, int32_t index) {
+    const Value* value = argument(vm, index);
+    return value == NULL ? LOX_TYPE_NIL : typeOf(*value);
+}
+
+/**
+ * @brief Returns whether an argument of the running host native is truthy in
+ * Lox.
+ * @param vm The virtual machine.
+ * @param index The index of the argument, from 0.
+ * @return bool False for `nil`, `false` and a missing argument, true
+ * otherwise.
+ */
+bool loxArgumentBool(LoxVM* vm, int32_t index) {
+    const Value* value = argument(vm, index);
+    return value != NULL && !IS_NIL(*value) &&
+           !(IS_BOOL(*value) && !AS_BOOL(*value));
+}
+
+/**
+ * @brief Returns an argument of the running host native as a number.
+ * @param vm The virtual machine.
+ * @param index The index of the argument, from 0.
+ * @return double The number, or 0 if the argument is not a number.
+ */
+double loxArgumentNumber(LoxVM* vm, int32_t index) {
+    const Value* value = argument(vm, index);
+    return value != NULL && IS_NUMBER(*value) ? AS_NUMBER(*value) : 0;
+}
+
+/**
+ * @brief Returns the characters of an argument of the running host native,
+ * without copying them.
+ *
+ * They stay valid until the native returns.
+ *
+ * @param vm The virtual machine.
+ * @param index The index of the argument, from 0.
+ * @param length A pointer where the number of characters will be stored, or
+ * NULL.
+ * @return const char* The NUL-terminated characters, or NULL if the argument
+ * is not a string.
+ */
+const char* loxArgumentString(LoxVM* vm, int32_t index, size_t* length) {
+    const Value* value = argument(vm, index);
+    if (value == NULL) return NULL;
+    return viewChars(*value, &vm->argumentViews[index], length);
+}
+
+/**
+ * @brief Holds an argument of the running host native, to pass it back to
+ * Lox later.
+ * @param vm The virtual machine.
+ * @param index The index of the argument, from 0.
+ * @return LoxHandle The handle, or `LOX_NO_HANDLE` if there is no such
+ * argument.
+ */
+LoxHandle loxHoldArgument(LoxVM* vm, int32_t index) {
+    const Value* value = argument(vm, index);
+    return value == NULL ? LOX_NO_HANDLE : holdValue(vm, *value);
+}
+
+/**
+ * @brief Returns the data of an argument of the running host native, if it
+ * is a foreign object of a given kind.
+ *
+ * The data is read in place; declaring the parameter `LOX_PARAMETER_FOREIGN`
+ * makes the VM reject anything but a foreign object before the call.
+ *
+ * @param vm The virtual machine.
+ * @param index The index of the argument, from 0.
+ * @param tag The kind of data expected.
+ * @param size A pointer where the size of the data will be stored, or NULL.
+ * @return void* The data, or NULL if the argument is not a foreign object
+ * with that tag.
+ */
+void* loxArgumentForeign(LoxVM* vm, int32_t index, uint32_t tag,
+                         size_t* size) {
+    const Value* value = argument(vm, index);
+    return value == NULL ? NULL : foreignData(*value, tag, size);
+}
+
+/**
+ * @brief Sets the value the running host native returns to a boolean.
+ * @param vm The virtual machine.
+ * @param value The boolean.
+ */
+void loxReturnBool(LoxVM* vm, bool value) {
+    vm->hostResult = BOOL_VAL(value);
+}
+
+/**
+ * @brief Sets the value the running host native returns to a number.
+ * @param vm The virtual machine.
+ * @param value The number.
+ */
+void loxReturnNumber(LoxVM* vm, double value) {
+    vm->hostResult = NUMBER_VAL(value);
+}
+
+/**
+ * @brief Sets the value the running host native returns to a copy of a
+ * string.
+ * @param vm The virtual machine.
+ * @param chars The characters, which do not need to be NUL-terminated.
+ * @param length The number of characters.
+ */
+void loxReturnString(LoxVM* vm, const char* chars, size_t length) {
+    vm->hostResult = copyStringValue(vm, chars, (int32_t)length);
+}
+
+/**
+ * @brief Sets the value the running host native returns to a held value.
+ * @param vm The virtual machine.
+ * @param handle The handle; the native returns `nil` if it is not held.
+ */
+void loxReturnHandle(LoxVM* vm, LoxHandle handle) {
+    vm->hostResult = isHeld(vm, handle) ? vm->handles.values[handle] : NIL_VAL;
+}
+
+/**
+ * @brief Sets the value the running host native returns to host data, as a
+ * foreign object.
+ * @param vm The virtual machine.
+ * @param data The data, which is not copied.
+ * @param size The size of the data in bytes.
+ * @param tag A number naming the kind of data, for natives to check.
+ * @param finalize Releases the data once no script can reach it, or NULL to
+ * keep it owned by the host.
+ */
+void loxReturnForeign(LoxVM* vm, void* data, size_t size, uint32_t tag,
+                      LoxFinalizer finalize) {
+    vm->hostResult =
+        OBJECT_VAL(newForeign(vm, data, size, tag, finalize, NULL));
+}
@@ -85,6 +85,10 @@ int32_t disassembleInstruction(Chunk* chunk, int32_t offset) {
             return byteInstruction("OP_SET_UPVALUE", chunk, offset);
         case OP_SET_PROPERTY:
             return constantInstruction("OP_SET_PROPERTY", chunk, offset);
+        case OP_GET_INDEX:
+            return simpleInstruction("OP_GET_INDEX", offset);
+        case OP_SET_INDEX:
+            return simpleInstruction("OP_SET_INDEX", offset);
         case OP_SET_GLOBAL:
             return constantInstruction("OP_SET_GLOBAL", chunk, offset);
         case OP_EQUAL:
@@ -147,12 +151,37 @@ int32_t disassembleInstruction(Chunk* chunk, int32_t offset) {
             return simpleInstruction("OP_INHERIT", offset);
         case OP_METHOD:
             return constantInstruction("OP_METHOD", chunk, offset);
+        case OP_BUILD_LIST:
+            return byteInstruction("OP_BUILD_LIST", chunk, offset);
+        case OP_BUILD_MAP:
+            return byteInstruction("OP_BUILD_MAP", chunk, offset);
+        case OP_YIELD:
+            return simpleInstruction("OP_YIELD", offset);
+        case OP_RESUME:
+            return simpleInstruction("OP_RESUME", offset);
         default:
             printf("Unknown opcode %d\n", instruction);
             return offset + 1;
     }
 }
 
+/**
+ * @brief Prints diagnostic statistics about a hash table.
+ * @param name A label for the table to be printed in the header.
+ * @param table The table to inspect.
+ */
+void printTableStats(const char* name, const Table* table) {
+    TableStats stats;
+    tableStats(table, &stats);
+    printf("== table %s ==\n", name);
+    printf("   %d live, %d tombstones, %d slots\n", stats.count,
+           stats.tombstones, stats.capacity);
+    printf("   load %.2f, tombstone ratio %.2f\n", stats.loadFactor,
+           stats.tombstoneRatio);
+    printf("   probe length avg %.2f, max %d\n", stats.averageProbe,
+           stats.maxProbe);
+}
+
 //-----------------------------------------------------------------------------
 //- Disassembler Helpers
 //-----------------------------------------------------------------------------
@@ -0,0 +1,340 @@
+/**
+ * @file frozen.c
+ * @brief Immutable compiled code shared by several virtual machines.
+ *
+ * Frozen objects are allocated outside of any VM, with a NULL VM passed to
+ * the allocator, and are linked into their image instead of a VM's object
+ * list. They are created marked, so `markObject` returns before touching
+ * them and the sweep never sees them: every VM only ever reads them.
+ *
+ * A shared copy is rebuilt from all of its roots whenever one is added, so a
+ * message needs just one image, whichever functions it holds. Twins are
+ * found through a map from each function to its twin and back, which lives
+ * outside the VM heap like the copies.
+ */
+
+#include "frozen.h"
+
+#include <stdatomic.h>
+#include <string.h>
+
+#include "compiler.h"
+#include "memory.h"
+#include "vm.h"
+
+//-----------------------------------------------------------------------------
+//- Freezing
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Initializes the header of a frozen object and links it into the
+ * image.
+ * @param code The frozen image.
+ * @param object The object.
+ * @param type The type of the object.
+ */
+static void initFrozenObject(FrozenCode* code, Object* object,
+                             ObjectType type) {
+    object->type = type;
+    object->isMarked = true;
+    object->isFrozen = true;
+    object->next = code->objects;
+    code->objects = object;
+}
+
+/**
+ * @brief Returns the frozen copy of a string, creating it on first use.
+ * @param code The frozen image.
+ * @param string The string, or NULL.
+ * @return ObjectString* The frozen string, or NULL.
+ */
+static ObjectString* freezeString(FrozenCode* code,
+                                  const ObjectString* string) {
+    if (string == NULL) return NULL;
+
+    ObjectString* frozen = tableFindString(&code->strings, string->chars,
+                                           string->length, string->hash);
+    if (frozen != NULL) return frozen;
+
+    frozen = ALLOCATE(NULL, ObjectString, 1);
+    initFrozenObject(code, (Object*)frozen, OBJECT_STRING);
+    frozen->length = string->length;
+    frozen->hash = string->hash;
+    frozen->chars = ALLOCATE(NULL, char, string->length + 1);
+    memcpy(frozen->chars, string->chars, string->length + 1);
+    internTableAdd(NULL, &code->strings, frozen);
+    return frozen;
+}
+
+/**
+ * @brief Copies a function and the functions nested in it into the image.
+ * @param code The frozen image.
+ * @param function The function.
+ * @param twins The twin of each function copied so far, or NULL to copy
+ * functions every time they are reached.
+ * @return ObjectFunction* The frozen function, or NULL if it or a nested
+ * function is a lazy stub.
+ */
+static ObjectFunction* freezeNested(FrozenCode* code,
+                                    const ObjectFunction* function,
+                                    Map* twins) {
+    if (function->lazy != NULL) return NULL;
+
+    Value twin;
+    if (twins != NULL && mapGet(twins, OBJECT_VAL(function), &twin)) {
+        return AS_FUNCTION(twin);
+    }
+
+    ObjectFunction* frozen = ALLOCATE(NULL, ObjectFunction, 1);
+    initFrozenObject(code, (Object*)frozen, OBJECT_FUNCTION);
+    if (twins != NULL) {
+        mapSet(NULL, twins, OBJECT_VAL(function), OBJECT_VAL(frozen));
+    }
+    frozen->arity = function->arity;
+    frozen->upvalueCount = function->upvalueCount;
+    frozen->maxSlots = function->maxSlots;
+    frozen->lazy = NULL;
+    frozen->name = freezeString(code, function->name);
+
+    // the chunk is copied at its exact size, since it never grows again
+    const Chunk* chunk = &function->chunk;
+    initChunk(&frozen->chunk);
+    frozen->chunk.code = ALLOCATE(NULL, uint8_t, chunk->count);
+    frozen->chunk.lines = ALLOCATE(NULL, int32_t, chunk->count);
+    memcpy(frozen->chunk.code, chunk->code, chunk->count);
+    memcpy(frozen->chunk.lines, chunk->lines, sizeof(int32_t) * chunk->count);
+    frozen->chunk.count = chunk->count;
+    frozen->chunk.capacity = chunk->count;
+
+    for (int32_t i = 0; i < chunk->constants.count; i++) {
+        Value value = chunk->constants.values[i];
+        if (IS_FUNCTION(value)) {
+            ObjectFunction* nested =
+                freezeNested(code, AS_FUNCTION(value), twins);
+            if (nested == NULL) return NULL;
+            value = OBJECT_VAL(nested);
+        } else if (IS_STRING_OBJECT(value)) {
+            value = OBJECT_VAL(freezeString(code, AS_STRING(value)));
+        }
+        writeValueArray(NULL, &frozen->chunk.constants, value);
+    }
+    return frozen;
+}
+
+/**
+ * @brief Creates an empty frozen image, with one reference for its creator.
+ * @return FrozenCode* The image.
+ */
+static FrozenCode* newFrozenCode(void) {
+    FrozenCode* code = ALLOCATE(NULL, FrozenCode, 1);
+    code->function = NULL;
+    code->objects = NULL;
+    initInternTable(&code->strings);
+    atomic_init(&code->references, 1);
+    code->previous = NULL;
+    return code;
+}
+
+/**
+ * @brief Copies a compiled script into a new frozen image.
+ *
+ * The function is left untouched in the VM that compiled it. Functions left
+ * as stubs by lazy compilation cannot be frozen.
+ *
+ * @param function The top-level function returned by `compile`.
+ * @return FrozenCode* The frozen image, or NULL if the script contains a
+ * stub.
+ */
+FrozenCode* freezeFunction(const ObjectFunction* function) {
+    FrozenCode* code = newFrozenCode();
+    code->function = freezeNested(code, function, NULL);
+    if (code->function == NULL) {
+        releaseFrozenCode(code);
+        return NULL;
+    }
+    return code;
+}
+
+/**
+ * @brief Drops a reference to a frozen image, freeing it with the last one.
+ *
+ * The creator of an image calls this once it no longer needs it; each VM it
+ * is attached to does so in `freeVM`, so the image lives as long as any VM
+ * may run it.
+ *
+ * @param code The frozen image.
+ */
+void releaseFrozenCode(FrozenCode* code) {
+    if (atomic_fetch_sub(&code->references, 1) != 1) return;
+
+    Object* object = code->objects;
+    while (object != NULL) {
+        Object* next = object->next;
+        if (object->type == OBJECT_FUNCTION) {
+            freeChunk(NULL, &((ObjectFunction*)object)->chunk);
+            FREE(NULL, ObjectFunction, object);
+        } else {
+            ObjectString* string = (ObjectString*)object;
+            FREE_ARRAY(NULL, char, string->chars, string->length + 1);
+            FREE(NULL, ObjectString, object);
+        }
+        object = next;
+    }
+    freeInternTable(NULL, &code->strings);
+    FREE(NULL, FrozenCode, code);
+}
+
+//-----------------------------------------------------------------------------
+//- Attaching to a VM
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Returns the string a VM should use for the contents of a string.
+ * @param code The frozen image.
+ * @param string The string.
+ * @return ObjectString* The frozen string with the same contents, if there is
+ * one, otherwise the string itself.
+ */
+static ObjectString* canonicalString(FrozenCode* code, ObjectString* string) {
+    ObjectString* frozen = tableFindString(&code->strings, string->chars,
+                                           string->length, string->hash);
+    return frozen != NULL ? frozen : string;
+}
+
+/**
+ * @brief Lets a VM run a frozen image.
+ *
+ * The strings of the image become the VM's interned strings for their
+ * contents, so names in the frozen code resolve to the same globals, fields
+ * and methods as names created by the VM. Must be called before the VM runs
+ * any code; the image is then run with `interpretFunction(vm,
+ * code->function)`. A VM can have only one image attached.
+ *
+ * @param vm The virtual machine.
+ * @param code The frozen image.
+ * @return bool True if the image is attached, false if another one already
+ * is.
+ */
+bool attachFrozenCode(VM* vm, FrozenCode* code) {
+    if (vm->frozen != NULL) return vm->frozen == code;
+    vm->frozen = code;
+    atomic_fetch_add(&code->references, 1);
+
+    // `initVM` already interned "init" and the names of the natives: move
+    // those references over to the frozen twins, and the old strings are left
+    // to the GC
+    vm->initString = canonicalString(code, vm->initString);
+
+    // every key and value stays reachable from the old table while the new
+    // one grows
+    Table globals;
+    initTable(&globals);
+    for (int32_t i = 0; i <= vm->globals.capacity; i++) {
+        Entry* entry = &vm->globals.entries[i];
+        if (entry->key == NULL) continue;
+        tableSet(vm, &globals, canonicalString(code, entry->key), entry->value);
+    }
+    freeTable(vm, &vm->globals);
+    vm->globals = globals;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//- Sharing on Demand
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Compiles the stubs left by lazy compilation in a function and the
+ * functions nested in it.
+ * @param vm The virtual machine that compiled the function.
+ * @param function The function.
+ * @return bool False if a body has a compile error, which is reported.
+ */
+static bool compileStubs(VM* vm, ObjectFunction* function) {
+    if (function->lazy != NULL && !compileLazyFunction(vm, function)) {
+        return false;
+    }
+
+    const ValueArray* constants = &function->chunk.constants;
+    for (int32_t i = 0; i < constants->count; i++) {
+        if (IS_FUNCTION(constants->values[i]) &&
+            !compileStubs(vm, AS_FUNCTION(constants->values[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Finds the frozen twin of a function a VM compiled, in its latest
+ * shared copy, or the function a twin in one of its copies was made from.
+ * @param vm The virtual machine.
+ * @param function The function.
+ * @return ObjectFunction* The twin, or NULL if the function was not copied.
+ */
+ObjectFunction* findTwin(VM* vm, ObjectFunction* function) {
+    Value twin;
+    if (!mapGet(&vm->twins, OBJECT_VAL(function), &twin)) return NULL;
+    return AS_FUNCTION(twin);
+}
+
+/**
+ * @brief Makes a new shared copy of the code a VM compiled, with more
+ * functions in it.
+ *
+ * The copy holds the functions copied before, the new ones and the functions
+ * nested in all of them, with stubs left by lazy compilation compiled first.
+ * It replaces the previous copy for the messages sent from then on; earlier
+ * copies are kept until `freeVM`, so closures over them can come back.
+ *
+ * @param vm The virtual machine, which must not have frozen code attached.
+ * @param functions The functions to add.
+ * @return bool False, and no copy is made, if none of them can be added
+ * because of a compile error in their bodies, which is reported.
+ */
+bool shareFunctions(VM* vm, const ValueArray* functions) {
+    int32_t rootCount = vm->sharedRoots.count;
+    for (int32_t i = 0; i < functions->count; i++) {
+        ObjectFunction* function = AS_FUNCTION(functions->values[i]);
+        if (findTwin(vm, function) == NULL && compileStubs(vm, function)) {
+            writeValueArray(vm, &vm->sharedRoots, functions->values[i]);
+        }
+    }
+    if (vm->sharedRoots.count == rootCount) return false;
+
+    // every root was compiled in full when it was added, so none fails
+    FrozenCode* code = newFrozenCode();
+    Map twins;
+    initMap(&twins);
+    for (int32_t i = 0; i < vm->sharedRoots.count; i++) {
+        freezeNested(code, AS_FUNCTION(vm->sharedRoots.values[i]), &twins);
+    }
+    code->previous = vm->sharedCode;
+    vm->sharedCode = code;
+
+    // the twins in older copies still lead back to their functions
+    for (int32_t i = 0; i <= twins.capacity; i++) {
+        const MapEntry* entry = &twins.entries[i];
+        if (IS_NIL(entry->key)) continue;
+        mapSet(NULL, &vm->twins, entry->key, entry->value);
+        mapSet(NULL, &vm->twins, entry->value, entry->key);
+    }
+    freeMap(NULL, &twins);
+    return true;
+}
+
+/**
+ * @brief Drops the references a VM holds to its shared copies.
+ * @param vm The virtual machine.
+ */
+void freeSharedCode(VM* vm) {
+    FrozenCode* code = vm->sharedCode;
+    while (code != NULL) {
+        FrozenCode* previous = code->previous;
+        releaseFrozenCode(code);
+        code = previous;
+    }
+    vm->sharedCode = NULL;
+    freeMap(NULL, &vm->twins);
+    freeValueArray(vm, &vm->sharedRoots);
+}
@@ -0,0 +1,180 @@
+/**
+ * @file bytecode.h
+ * @brief Saving compiled functions to `.loxc` files and loading them back,
+ * and saving and restoring snapshots of the whole heap.
+ *
+ * A `.loxc` file holds the tree of functions produced by the compiler for one
+ * script: code, line table and constants of every function, with nested
+ * functions stored inline as constants. Loading maps the file into memory and
+ * the loaded chunks execute their code straight from the mapping.
+ *
+ * All multi-byte fields are little-endian:
+ *
+ *     file     = "LOXC" u32:version u32:flags function
+ *     function = u32:arity u32:upvalueCount name
+ *                u32:codeCount u8[codeCount]
+ *                u32:runCount (u32:line u32:length)[runCount]
+ *                u32:constantCount constant[constantCount]
+ *     name     = u32:length u8[length]     (length 0xffffffff for the script)
+ *     constant = u8:tag payload, with the payload depending on the tag:
+ *                BYTECODE_NUMBER u64:bits, BYTECODE_INT u32:value,
+ *                BYTECODE_STRING and BYTECODE_SHORT_STRING name,
+ *                BYTECODE_FUNCTION function
+ *
+ * A heap snapshot holds every object reachable from the global variables,
+ * numbered in the order they are stored. References between objects are
+ * stored as these numbers and relocated to pointers on load, so a snapshot can
+ * be restored at any address:
+ *
+ *     snapshot = "LOXS" u32:version u32:flags u32:objectCount
+ *                shell[objectCount] body[objectCount]
+ *                u32:globalCount (u32:name value)[globalCount]
+ *     shell    = u8:ObjectType payload, enough to allocate the object:
+ *                OBJECT_STRING name, OBJECT_NATIVE name,
+ *                OBJECT_FUNCTION u32:arity u32:upvalueCount code,
+ *                OBJECT_FLOAT64_ARRAY u32:count u64[count],
+ *                OBJECT_CLOSURE u32:function, nothing for the others
+ *     body     = the references of the object, in shell order:
+ *                OBJECT_FUNCTION u32:name u32:constantCount value[...],
+ *                OBJECT_CLOSURE u32:upvalue[upvalueCount],
+ *                OBJECT_UPVALUE value,
+ *                OBJECT_CLASS u32:name u32:superclass u32:methodsOwner
+ *                             u32:methodCount (u32:name value)[...],
+ *                OBJECT_INSTANCE u32:class
+ *                                u32:fieldCount (u32:name value)[...],
+ *                OBJECT_BOUND_METHOD value:receiver u32:method,
+ *                OBJECT_LIST u32:count value[count],
+ *                OBJECT_MAP u32:count (value:key value)[count],
+ *                nothing for the others
+ *     value    = u8:tag payload, using the constant tags plus BYTECODE_NIL,
+ *                BYTECODE_FALSE, BYTECODE_TRUE and BYTECODE_OBJECT u32:number
+ *
+ * `code` is the `codeCount` to `runCount` part of a function in a `.loxc`
+ * file. An object number of 0xffffffff stands for a missing name or
+ * superclass. Natives are stored by the global name they are defined under.
+ */
+
+#ifndef corelox_bytecode_h
+#define corelox_bytecode_h
+
+#include "common.h"
+#include "object.h"
+
+// The format version of bytecode files and snapshots; bump it whenever either
+// format, the instruction set or the `ObjectType` numbering changes, so that
+// stale files are rejected instead of misread.
+#define BYTECODE_VERSION 1
+
+// Header flag set by builds with NaN boxing. Only those store short strings
+// as immediates, so a file is only loaded by a build with the same setting.
+#define BYTECODE_FLAG_NAN_BOXING 1
+
+#ifdef NAN_BOXING
+#define BYTECODE_FLAGS BYTECODE_FLAG_NAN_BOXING
+#else
+#define BYTECODE_FLAGS 0
+#endif
+
+// The tags of constants in a bytecode file and of values in a snapshot.
+typedef enum {
+    BYTECODE_NUMBER,        ///< A double.
+    BYTECODE_INT,           ///< An immediate integer.
+    BYTECODE_STRING,        ///< An ObjectString (names and long literals).
+    BYTECODE_SHORT_STRING,  ///< An immediate string.
+    BYTECODE_FUNCTION,      ///< A nested function.
+    BYTECODE_NIL,           ///< Nil (snapshots only).
+    BYTECODE_FALSE,         ///< False (snapshots only).
+    BYTECODE_TRUE,          ///< True (snapshots only).
+    BYTECODE_OBJECT,        ///< A numbered object (snapshots only).
+} BytecodeTag;
+
+// A file read into memory: a bytecode file or snapshot held for as long as
+// the VM runs, or a source file held while it is compiled.
+typedef struct LoadedImage {
+    struct LoadedImage* next;  ///< The next image loaded by the VM.
+    uint8_t* data;             ///< The contents of the file.
+    size_t size;               ///< The size of the file.
+} LoadedImage;
+
+/**
+ * @brief Reads a whole file into memory, mapping it where possible.
+ *
+ * The contents are not NUL-terminated. An empty file gives an image with no
+ * data. The image must be released with `closeImage` unless it is handed to
+ * the VM, which releases it in `freeLoadedImages`.
+ *
+ * @param path The path of the file.
+ * @return LoadedImage* The image, or NULL if the file could not be read.
+ */
+LoadedImage* openImage(const char* path);
+
+/**
+ * @brief Releases the memory of an image read by `openImage`.
+ * @param image The image to release.
+ */
+void closeImage(LoadedImage* image);
+
+/**
+ * @brief Writes a compiled script to a bytecode file.
+ *
+ * Reports any error to stderr.
+ *
+ * @param function The top-level function returned by `compile`.
+ * @param path The path of the file to write.
+ * @return bool True if the file was written, false otherwise.
+ */
+bool saveBytecode(const ObjectFunction* function, const char* path);
+
+/**
+ * @brief Loads a compiled script from a bytecode file.
+ *
+ * The file stays mapped until `freeLoadedImages` is called, since the code of
+ * the loaded functions points into it. The structure of the file, the
+ * operands of every instruction and the stack depth at every instruction are
+ * checked (see `checkCode`), so damaged code is rejected before it runs. The
+ * types of the values on the stack are left to the instructions, which raise
+ * a runtime error when they get a value of the wrong type. Reports any error
+ * to stderr.
+ *
+ * @param vm The virtual machine.
+ * @param path The path of the file to load.
+ * @return ObjectFunction* The top-level function, or NULL on error.
+ */
+ObjectFunction* loadBytecode(VM* vm, const char* path);
+
+/**
+ * @brief Writes a snapshot of the global variables and every object reachable
+ * from them.
+ *
+ * Meant to be called between scripts, when no function is running and every
+ * upvalue is closed. Reports any error to stderr.
+ *
+ * @param vm The virtual machine.
+ * @param path The path of the file to write.
+ * @return bool True if the file was written, false otherwise.
+ */
+bool saveSnapshot(VM* vm, const char* path);
+
+/**
+ * @brief Restores a snapshot written by `saveSnapshot` into the VM.
+ *
+ * The objects of the snapshot are recreated and its global variables defined,
+ * replacing globals of the same name. Like a bytecode file, the snapshot stays
+ * mapped until `freeLoadedImages` is called. Reports any error to stderr.
+ *
+ * @param vm The virtual machine.
+ * @param path The path of the file to load.
+ * @return bool True if the snapshot was restored, false otherwise.
+ */
+bool loadSnapshot(VM* vm, const char* path);
+
+/**
+ * @brief Unmaps every bytecode file and snapshot loaded by the VM.
+ *
+ * Must only be called once no loaded function can run anymore.
+ *
+ * @param vm The virtual machine.
+ */
+void freeLoadedImages(VM* vm);
+
+#endif
@@ -24,6 +24,8 @@ typedef enum {
     OP_SET_LOCAL,      ///< Set a local variable.
     OP_GET_PROPERTY,   ///< Get a property of an object.
     OP_SET_PROPERTY,   ///< Set a property of an object.
+    OP_GET_INDEX,      ///< Get an element of a list or map by index/key.
+    OP_SET_INDEX,      ///< Set an element of a list or map by index/key.
     OP_GET_UPVALUE,    ///< Get a variable based on upvalue
     OP_SET_UPVALUE,    ///< Set a variable based on upvalue
     OP_GET_SUPER,      ///< Get a property from a superclass.
@@ -53,6 +55,10 @@ typedef enum {
     OP_CLASS,          ///< Define a new class.
     OP_INHERIT,        ///< Inherit methods from a superclass.
     OP_METHOD,         ///< Define a new method for a class.
+    OP_BUILD_LIST,     ///< Create a list from values on the stack.
+    OP_BUILD_MAP,      ///< Create a map from key-value pairs on the stack.
+    OP_YIELD,          ///< Suspend the running coroutine with a value.
+    OP_RESUME,         ///< Resume a coroutine with a value.
 } OpCode;
 
 // A dynamic array that stores a sequence of bytecode instructions.
@@ -61,6 +67,7 @@ typedef struct {
     int32_t capacity;  ///< The allocated capacity of the `code` array.
     uint8_t* code;     ///< The array of bytecode instructions.
     int32_t* lines;  ///< An array storing the source line number for each byte.
+    bool ownsCode;   ///< False if `code` points into a mapped bytecode file.
     ValueArray
         constants;  ///< A pool of constant values used by the instructions.
 } Chunk;
@@ -73,28 +80,56 @@ void initChunk(Chunk* chunk);
 
 /**
  * @brief Frees all memory associated with a chunk.
+ *
+ * Code borrowed from a bytecode file is left to the file's mapping.
+ *
+ * @param vm The virtual machine.
  * @param chunk A pointer to the Chunk struct to free.
  */
-void freeChunk(Chunk* chunk);
+void freeChunk(VM* vm, Chunk* chunk);
 
 /**
  * @brief Appends a byte (instruction or operand) to the end of the chunk.
  *
  * If the chunk's capacity is insufficient, it will be grown automatically.
  *
+ * @param vm The virtual machine.
  * @param chunk A pointer to the chunk.
  * @param byte The byte to write.
  * @param line The source line number corresponding to this byte.
  */
-void writeChunk(Chunk* chunk, uint8_t byte, int32_t line);
+void writeChunk(VM* vm, Chunk* chunk, uint8_t byte, int32_t line);
 
 /**
  * @brief Adds a constant value to the chunk's constant pool.
  *
+ * @param vm The virtual machine.
  * @param chunk A pointer to the chunk.
  * @param value The value to add to the constant pool.
  * @return int32_t The index of the added constant in the pool.
  */
-int32_t addConstant(Chunk* chunk, Value value);
+int32_t addConstant(VM* vm, Chunk* chunk, Value value);
+
+/**
+ * @brief Checks the code of a function and measures the stack it needs.
+ *
+ * Every instruction must be known and have its operands inside the chunk,
+ * constant operands must exist and have the type the instruction expects,
+ * and upvalue operands must exist. Following every path from the start,
+ * jumps must land on the start of an instruction, no path may run off the
+ * end of the code, every instruction must be reached with the same stack
+ * depth on all paths, and no instruction may pop more values than its frame
+ * holds or refer to a local slot above them. The types of the values on the
+ * stack are not tracked: the instructions check them when they run.
+ *
+ * @param vm The virtual machine.
+ * @param chunk The chunk, with its code and constants.
+ * @param arity The number of parameters of the function.
+ * @param upvalueCount The number of upvalues of the function.
+ * @return int32_t The most values its frame ever holds, counting the callee
+ * in slot 0, or -1 if the code is not safe to decode.
+ */
+int32_t checkCode(VM* vm, const Chunk* chunk, int32_t arity,
+                  int32_t upvalueCount);
 
 #endif
\ No newline at end of file
@@ -10,6 +10,7 @@
 // #define DEBUG_TRACE_EXECUTION
 // #define DEBUG_STRESS_GC
 // #define DEBUG_LOG_GC
+// #define PRINT_SHORTEST_NUMBERS
 
 #define UINT8_COUNT (UINT8_MAX + 1)
 
@@ -30,8 +30,10 @@ typedef enum {
     PREC_PRIMARY
 } Precedence;
 
+typedef struct Parser Parser;
+
 // A function pointer type for a parsing function in the Pratt parser.
-typedef void (*ParseFn)(bool canAssign);
+typedef void (*ParseFn)(Parser* parser, bool canAssign);
 
 // A rule in the Pratt parser's table, defining how to parse a token.
 typedef struct {
@@ -73,6 +75,7 @@ typedef struct Compiler {
     int32_t localCount;         ///< The number of locals currently in scope.
     Upvalue upvalues[UINT8_COUNT];  ///< An array to track upvalues.
     int32_t scopeDepth;             ///< The current nesting level of scopes.
+    const LazyBody* lazy;           ///< The stub being compiled, or NULL.
 } Compiler;
 
 // State for compiling a class, linked to the main compiler.
@@ -84,21 +87,47 @@ typedef struct ClassCompiler {
         hasSuperclass;  ///< Flag indicating if the class inherits from another.
 } ClassCompiler;
 
-// The state of the parser, holding tokens and error flags.
-typedef struct {
-    Token current;   ///< The current token being processed.
-    Token previous;  ///< The most recently consumed token.
-    bool hadError;   ///< Flag indicating if a compile error has occurred.
-    bool panicMode;  ///< Flag to prevent error cascades.
-} Parser;
+// The state of the parser, holding tokens and error flags. Each call to
+// `compile` has its own, so several VMs can compile at the same time.
+struct Parser {
+    VM* vm;           ///< The VM the code is compiled for.
+    Scanner scanner;  ///< The scanner producing the tokens.
+    Token current;    ///< The current token being processed.
+    Token previous;   ///< The most recently consumed token.
+    bool hadError;    ///< Flag indicating if a compile error has occurred.
+    bool panicMode;   ///< Flag to prevent error cascades.
+
+    Compiler* compiler;           ///< The compiler for the innermost function.
+    ClassCompiler* currentClass;  ///< The innermost class, or NULL.
+    ObjectString* lazySource;     ///< The source when compiling lazily.
+    struct Parser* enclosing;     ///< The parser active before this one.
+};
 
 /**
  * @brief Compiles a Clox source string into a function object with bytecode.
- * @param source The null-terminated string of Clox source code.
+ *
+ * The source does not need to be NUL-terminated and is only read during the
+ * call: every name and string literal is copied into the heap.
+ *
+ * @param vm The virtual machine the function will run in.
+ * @param source The Clox source code.
+ * @param length The length of the source in bytes.
  * @return ObjectFunction* The compiled top-level script function, or NULL on
  * error.
  */
-ObjectFunction* compile(const char* source);
+ObjectFunction* compile(VM* vm, const char* source, size_t length);
+
+/**
+ * @brief Compiles the body of a function left as a stub by lazy compilation.
+ *
+ * Reports any compile error in the body to stderr. The function stays a stub
+ * if compilation fails.
+ *
+ * @param vm The virtual machine running the function.
+ * @param function The stub, whose `lazy` field is set.
+ * @return bool True if the body was compiled, false on error.
+ */
+bool compileLazyFunction(VM* vm, ObjectFunction* function);
 
 /**
  * @brief Marks all compiler roots for garbage collection.
@@ -106,7 +135,9 @@ ObjectFunction* compile(const char* source);
  * This function is called by the garbage collector to trace all reachable
  * objects that are still being used by the compiler (like function objects
  * under construction).
+ *
+ * @param vm The virtual machine.
  */
-void markCompilerRoots();
+void markCompilerRoots(VM* vm);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,435 @@
+/**
+ * @file corelox.h
+ * @brief The C API for embedding coreLox, as built into libcorelox.
+ *
+ * A host compiles a script once and then calls into it as often as it likes.
+ * Values the host keeps between calls - the compiled script, the functions
+ * it defines, objects returned to the host - are held by handles, which keep
+ * them alive across garbage collections until they are released. Arguments
+ * are pushed one by one before a call, and the result of the call is read
+ * back with the `loxResult` functions, so a call compiles and parses nothing.
+ *
+ * This is the only header a host needs, and the only interface the library
+ * exports. A VM must only be used by one thread at a time.
+ */
+
+#ifndef corelox_h
+#define corelox_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Exports a function from the shared library, which hides everything else.
+#define LOX_API __attribute__((visibility("default")))
+
+// A virtual machine, with its own heap, globals and stack.
+typedef struct VM LoxVM;
+
+// A value held for the host, which the garbage collector will not free.
+typedef int32_t LoxHandle;
+
+// The handle that holds nothing, returned when there is no value to hold.
+#define LOX_NO_HANDLE (-1)
+
+// The most arguments a call can be given.
+#define LOX_MAX_ARGUMENTS 255
+
+// The outcome of compiling or calling.
+typedef enum {
+    LOX_OK,              ///< Success.
+    LOX_COMPILE_ERROR,   ///< The source did not compile.
+    LOX_RUNTIME_ERROR,   ///< The call ended with a runtime error.
+    LOX_ARGUMENT_ERROR,  ///< The call did not match the arguments pushed.
+} LoxResult;
+
+// The type of the result of a call, as seen from C.
+typedef enum {
+    LOX_TYPE_NIL,      ///< `nil`.
+    LOX_TYPE_BOOL,     ///< `true` or `false`.
+    LOX_TYPE_NUMBER,   ///< A number.
+    LOX_TYPE_STRING,   ///< A string.
+    LOX_TYPE_OBJECT,   ///< Any other value: hold it to pass it back to Lox.
+    LOX_TYPE_FOREIGN,  ///< Host data, passed by `loxPushForeign`.
+} LoxType;
+
+// Releases host data passed to scripts once no script can reach it.
+typedef void (*LoxFinalizer)(void* data, size_t size);
+
+// A native function defined by the host. It reads its arguments with the
+// `loxArgument` functions and sets the value it returns, `nil` by default,
+// with the `loxReturn` ones. It must not push arguments or call into Lox.
+typedef void (*LoxNativeFunction)(LoxVM* vm, int32_t argCount);
+
+// The arity of a native that takes any number of arguments.
+#define LOX_VARIADIC (-1)
+
+// The number of leading parameters a native can declare types for.
+#define LOX_MAX_TYPED_PARAMETERS 3
+
+// The type a native can require of a parameter.
+typedef enum {
+    LOX_PARAMETER_ANY,      ///< Any value.
+    LOX_PARAMETER_NUMBER,   ///< A number.
+    LOX_PARAMETER_STRING,   ///< A string.
+    LOX_PARAMETER_LIST,     ///< A list.
+    LOX_PARAMETER_MAP,      ///< A map.
+    LOX_PARAMETER_FOREIGN,  ///< Host data, passed by `loxPushForeign`.
+} LoxParameterType;
+
+//-----------------------------------------------------------------------------
+//- Virtual Machines
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Creates a virtual machine.
+ *
+ * Running out of memory after the VM itself is allocated, for its stack or
+ * anything later, ends the process as it does everywhere in the VM.
+ *
+ * @return LoxVM* The new VM, or NULL if it cannot be allocated.
+ */
+LOX_API LoxVM* loxNewVM(void);
+
+/**
+ * @brief Frees a virtual machine and everything in it, handles included.
+ * @param vm The virtual machine.
+ */
+LOX_API void loxFreeVM(LoxVM* vm);
+
+//-----------------------------------------------------------------------------
+//- Handles
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Compiles a script into a function that runs it.
+ *
+ * Calling the function with no arguments runs the script, which defines its
+ * globals; compile errors are reported on stderr.
+ *
+ * @param vm The virtual machine.
+ * @param source The source code, which does not need to be NUL-terminated.
+ * @param length The length of the source in bytes.
+ * @param script A pointer where the handle of the function will be stored.
+ * @return LoxResult `LOX_OK`, or `LOX_COMPILE_ERROR` with `LOX_NO_HANDLE`
+ * stored.
+ */
+LOX_API LoxResult loxCompile(LoxVM* vm, const char* source, size_t length,
+                             LoxHandle* script);
+
+/**
+ * @brief Holds the value of a global variable, such as a function the
+ * script defined.
+ *
+ * The lookup is done once, here: later changes to the variable are not seen
+ * through the handle.
+ *
+ * @param vm The virtual machine.
+ * @param name The name of the variable, NUL-terminated.
+ * @return LoxHandle The handle, or `LOX_NO_HANDLE` if there is no such
+ * variable.
+ */
+LOX_API LoxHandle loxGetGlobal(LoxVM* vm, const char* name);
+
+/**
+ * @brief Holds the result of the last call.
+ * @param vm The virtual machine.
+ * @return LoxHandle The handle.
+ */
+LOX_API LoxHandle loxHoldResult(LoxVM* vm);
+
+/**
+ * @brief Releases a handle, letting the garbage collector free its value.
+ *
+ * The handle may be given out again later. Releasing a handle that is not
+ * held does nothing.
+ *
+ * @param vm The virtual machine.
+ * @param handle The handle, or `LOX_NO_HANDLE`.
+ */
+LOX_API void loxReleaseHandle(LoxVM* vm, LoxHandle handle);
+
+//-----------------------------------------------------------------------------
+//- Calls
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Pushes `nil` as the next argument of a call.
+ * @param vm The virtual machine.
+ * @return bool False, and nothing is pushed, if `LOX_MAX_ARGUMENTS` arguments
+ * are pushed already.
+ */
+LOX_API bool loxPushNil(LoxVM* vm);
+
+/**
+ * @brief Pushes a boolean as the next argument of a call.
+ * @param vm The virtual machine.
+ * @param value The boolean.
+ * @return bool False, and nothing is pushed, if `LOX_MAX_ARGUMENTS` arguments
+ * are pushed already.
+ */
+LOX_API bool loxPushBool(LoxVM* vm, bool value);
+
+/**
+ * @brief Pushes a number as the next argument of a call.
+ * @param vm The virtual machine.
+ * @param value The number.
+ * @return bool False, and nothing is pushed, if `LOX_MAX_ARGUMENTS` arguments
+ * are pushed already.
+ */
+LOX_API bool loxPushNumber(LoxVM* vm, double value);
+
+/**
+ * @brief Pushes a copy of a string as the next argument of a call.
+ * @param vm The virtual machine.
+ * @param chars The characters, which do not need to be NUL-terminated.
+ * @param length The number of characters.
+ * @return bool False, and nothing is pushed, if `LOX_MAX_ARGUMENTS` arguments
+ * are pushed already.
+ */
+LOX_API bool loxPushString(LoxVM* vm, const char* chars, size_t length);
+
+/**
+ * @brief Pushes a held value as the next argument of a call.
+ * @param vm The virtual machine.
+ * @param handle The handle.
+ * @return bool False, and nothing is pushed, if `LOX_MAX_ARGUMENTS` arguments
+ * are pushed already or the handle is not held.
+ */
+LOX_API bool loxPushHandle(LoxVM* vm, LoxHandle handle);
+
+/**
+ * @brief Pushes host data as the next argument of a call, without copying
+ * it.
+ *
+ * Scripts see a foreign object, which they can store and pass on like any
+ * other value and whose size `len()` returns; natives read the data in
+ * place.
+ *
+ * @param vm The virtual machine.
+ * @param data The data.
+ * @param size The size of the data in bytes.
+ * @param tag The kind of data, which natives check before reading it.
+ * @param finalize Called with the data once the garbage collector frees the
+ * object, or NULL if the host keeps the data alive for as long as scripts may
+ * hold it.
+ * @return bool False, and nothing is pushed, if `LOX_MAX_ARGUMENTS` arguments
+ * are pushed already: the data then stays the host's.
+ */
+LOX_API bool loxPushForeign(LoxVM* vm, void* data, size_t size, uint32_t tag,
+                            LoxFinalizer finalize);
+
+/**
+ * @brief Calls a held function, class or method with the arguments pushed
+ * since the last call, and runs it to completion.
+ *
+ * Runtime errors are reported on stderr. Whatever the outcome, the arguments
+ * are consumed.
+ *
+ * @param vm The virtual machine.
+ * @param function The handle of the value to call.
+ * @param argCount The number of arguments pushed for it.
+ * @return LoxResult `LOX_OK`, with the value it returned as the result,
+ * `LOX_RUNTIME_ERROR`, or `LOX_ARGUMENT_ERROR` if the handle is not held or
+ * `argCount` is not the number of arguments pushed; `nil` is the result of a
+ * failed call.
+ */
+LOX_API LoxResult loxCall(LoxVM* vm, LoxHandle function, int32_t argCount);
+
+//-----------------------------------------------------------------------------
+//- Results
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Returns the type of the result of the last call.
+ * @param vm The virtual machine.
+ * @return LoxType The type.
+ */
+LOX_API LoxType loxResultType(LoxVM* vm);
+
+/**
+ * @brief Returns whether the result of the last call is truthy in Lox.
+ * @param vm The virtual machine.
+ * @return bool False for `nil` and `false`, true otherwise.
+ */
+LOX_API bool loxResultBool(LoxVM* vm);
+
+/**
+ * @brief Returns the result of the last call as a number.
+ * @param vm The virtual machine.
+ * @return double The number, or 0 if the result is not a number.
+ */
+LOX_API double loxResultNumber(LoxVM* vm);
+
+/**
+ * @brief Returns the characters of the result of the last call, without
+ * copying them.
+ *
+ * They stay valid until the next call.
+ *
+ * @param vm The virtual machine.
+ * @param length A pointer where the number of characters will be stored, or
+ * NULL.
+ * @return const char* The NUL-terminated characters, or NULL if the result
+ * is not a string.
+ */
+LOX_API const char* loxResultString(LoxVM* vm, size_t* length);
+
+/**
+ * @brief Returns the data of the result of the last call, if it is a foreign
+ * object of a given kind.
+ * @param vm The virtual machine.
+ * @param tag The kind of data expected.
+ * @param size A pointer where the size of the data will be stored, or NULL.
+ * @return void* The data, or NULL if the result is not a foreign object with
+ * that tag.
+ */
+LOX_API void* loxResultForeign(LoxVM* vm, uint32_t tag, size_t* size);
+
+//-----------------------------------------------------------------------------
+//- Natives
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Defines a native function as a global variable.
+ *
+ * The VM checks the number of arguments and the declared parameter types
+ * before each call, and raises a runtime error if they do not match.
+ *
+ * @param vm The virtual machine.
+ * @param name The name of the global, NUL-terminated; it is copied.
+ * @param arity The number of arguments it takes, or `LOX_VARIADIC`.
+ * @param types The types required of its first arguments, or NULL.
+ * @param typeCount The number of types, at most `LOX_MAX_TYPED_PARAMETERS`.
+ * @param function The function.
+ * @return bool False, and nothing is defined, if the arity or the number of
+ * types is out of range.
+ */
+LOX_API bool loxDefineNative(LoxVM* vm, const char* name, int32_t arity,
+                             const LoxParameterType* types, int32_t typeCount,
+                             LoxNativeFunction function);
+
+/**
+ * @brief Reports a runtime error from a host native.
+ *
+ * The error is reported with a stack trace, and the script stops: the native
+ * should return at once.
+ *
+ * @param vm The virtual machine.
+ * @param format A printf-style format string for the error message.
+ * @param ... Arguments for the format string.
+ */
+LOX_API void loxNativeError(LoxVM* vm, const char* format, ...);
+
+/**
+ * @brief Returns the type of an argument of the running host native.
+ * @param vm The virtual machine.
+ * @param index The index of the argument, from 0.
+ * @return LoxType The type, or `LOX_TYPE_NIL` if there is no such argument.
+ */
+LOX_API LoxType loxArgumentType(LoxVM* vm, int32_t index);
+
+/**
+ * @brief Returns whether an argument of the running host native is truthy in
+ * Lox.
+ * @param vm The virtual machine.
+ * @param index The index of the argument, from 0.
+ * @return bool False for `nil`, `false` and a missing argument, true
+ * otherwise.
+ */
+LOX_API bool loxArgumentBool(LoxVM* vm, int32_t index);
+
+/**
+ * @brief Returns an argument of the running host native as a number.
+ * @param vm The virtual machine.
+ * @param index The index of the argument, from 0.
+ * @return double The number, or 0 if the argument is not a number.
+ */
+LOX_API double loxArgumentNumber(LoxVM* vm, int32_t index);
+
+/**
+ * @brief Returns the characters of an argument of the running host native,
+ * without copying them.
+ *
+ * They stay valid until the native returns.
+ *
+ * @param vm The virtual machine.
+ * @param index The index of the argument, from 0.
+ * @param length A pointer where the number of characters will be stored, or
+ * NULL.
+ * @return const char* The NUL-terminated characters, or NULL if the argument
+ * is not a string.
+ */
+LOX_API const char* loxArgumentString(LoxVM* vm, int32_t index, size_t* length);
+
+/**
+ * @brief Holds an argument of the running host native, to pass it back to
+ * Lox later.
+ * @param vm The virtual machine.
+ * @param index The index of the argument, from 0.
+ * @return LoxHandle The handle, or `LOX_NO_HANDLE` if there is no such
+ * argument.
+ */
+LOX_API LoxHandle loxHoldArgument(LoxVM* vm, int32_t index);
+
+/**
+ * @brief Returns the data of an argument of the running host native, if it
+ * is a foreign object of a given kind.
+ *
+ * The data is read in place; declaring the parameter `LOX_PARAMETER_FOREIGN`
+ * makes the VM reject anything but a foreign object before the call.
+ *
+ * @param vm The virtual machine.
+ * @param index The index of the argument, from 0.
+ * @param tag The kind of data expected.
+ * @param size A pointer where the size of the data will be stored, or NULL.
+ * @return void* The data, or NULL if the argument is not a foreign object
+ * with that tag.
+ */
+LOX_API void* loxArgumentForeign(LoxVM* vm, int32_t index, uint32_t tag,
+                                 size_t* size);
+
+/**
+ * @brief Sets the value the running host native returns to a boolean.
+ * @param vm The virtual machine.
+ * @param value The boolean.
+ */
+LOX_API void loxReturnBool(LoxVM* vm, bool value);
+
+/**
+ * @brief Sets the value the running host native returns to a number.
+ * @param vm The virtual machine.
+ * @param value The number.
+ */
+LOX_API void loxReturnNumber(LoxVM* vm, double value);
+
+/**
+ * @brief Sets the value the running host native returns to a copy of a
+ * string.
+ * @param vm The virtual machine.
+ * @param chars The characters, which do not need to be NUL-terminated.
+ * @param length The number of characters.
+ */
+LOX_API void loxReturnString(LoxVM* vm, const char* chars, size_t length);
+
+/**
+ * @brief Sets the value the running host native returns to a held value.
+ * @param vm The virtual machine.
+ * @param handle The handle; the native returns `nil` if it is not held.
+ */
+LOX_API void loxReturnHandle(LoxVM* vm, LoxHandle handle);
+
+/**
+ * @brief Sets the value the running host native returns to host data, as a
+ * foreign object.
+ * @param vm The virtual machine.
+ * @param data The data, which is not copied.
+ * @param size The size of the data in bytes.
+ * @param tag A number naming the kind of data, for natives to check.
+ * @param finalize Releases the data once no script can reach it, or NULL to
+ * keep it owned by the host.
+ */
+LOX_API void loxReturnForeign(LoxVM* vm, void* data, size_t size, uint32_t tag,
+                              LoxFinalizer finalize);
+
+#endif
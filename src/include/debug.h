@@ -10,6 +10,7 @@
 #define corelox_debug_h
 
 #include "chunk.h"
+#include "table.h"
 
 /**
  * @brief Disassembles all instructions in a given chunk.
@@ -27,4 +28,11 @@ void disassembleChunk(Chunk* chunk, const char* name);
  */
 int32_t disassembleInstruction(Chunk* chunk, int32_t offset);
 
+/**
+ * @brief Prints diagnostic statistics about a hash table.
+ * @param name A label for the table to be printed in the header.
+ * @param table The table to inspect.
+ */
+void printTableStats(const char* name, const Table* table);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,105 @@
+/**
+ * @file frozen.h
+ * @brief Immutable compiled code shared by several virtual machines.
+ *
+ * Freezing copies the tree of functions returned by `compile`, with their
+ * chunks and constant strings, out of the VM heap into memory owned by a
+ * `FrozenCode`. Nothing in it is ever written again: frozen objects are
+ * permanently marked, so no VM's garbage collector traces or frees them, and
+ * any number of VMs, on any number of threads, can run the same code without
+ * compiling or copying it.
+ *
+ * A VM that runs code of its own instead shares it on demand: the functions
+ * it sends to other VMs are frozen into a copy, and each of them is sent as
+ * its frozen twin.
+ */
+
+#ifndef corelox_frozen_h
+#define corelox_frozen_h
+
+#include <stdatomic.h>
+
+#include "common.h"
+#include "object.h"
+#include "table.h"
+
+// A frozen script and every object it refers to.
+typedef struct FrozenCode {
+    ObjectFunction* function;  ///< The top-level script function, or NULL.
+    InternTable strings;       ///< The constant strings, by content.
+    Object* objects;  ///< Every frozen object, linked through `next`.
+    atomic_int references;     ///< The creator and the VMs attached to it.
+    struct FrozenCode* previous;  ///< The shared copy this one replaced.
+} FrozenCode;
+
+/**
+ * @brief Copies a compiled script into a new frozen image.
+ *
+ * The function is left untouched in the VM that compiled it. Functions left
+ * as stubs by lazy compilation cannot be frozen.
+ *
+ * @param function The top-level function returned by `compile`.
+ * @return FrozenCode* The frozen image, or NULL if the script contains a
+ * stub.
+ */
+FrozenCode* freezeFunction(const ObjectFunction* function);
+
+/**
+ * @brief Drops a reference to a frozen image, freeing it with the last one.
+ *
+ * The creator of an image calls this once it no longer needs it; each VM it
+ * is attached to does so in `freeVM`, so the image lives as long as any VM
+ * may run it.
+ *
+ * @param code The frozen image.
+ */
+void releaseFrozenCode(FrozenCode* code);
+
+/**
+ * @brief Lets a VM run a frozen image.
+ *
+ * The strings of the image become the VM's interned strings for their
+ * contents, so names in the frozen code resolve to the same globals, fields
+ * and methods as names created by the VM. Must be called before the VM runs
+ * any code; the image is then run with `interpretFunction(vm,
+ * code->function)`. A VM can have only one image attached.
+ *
+ * @param vm The virtual machine.
+ * @param code The frozen image.
+ * @return bool True if the image is attached, false if another one already
+ * is.
+ */
+bool attachFrozenCode(VM* vm, FrozenCode* code);
+
+/**
+ * @brief Finds the frozen twin of a function a VM compiled, in its latest
+ * shared copy, or the function a twin in one of its copies was made from.
+ * @param vm The virtual machine.
+ * @param function The function.
+ * @return ObjectFunction* The twin, or NULL if the function was not copied.
+ */
+ObjectFunction* findTwin(VM* vm, ObjectFunction* function);
+
+/**
+ * @brief Makes a new shared copy of the code a VM compiled, with more
+ * functions in it.
+ *
+ * The copy holds the functions copied before, the new ones and the functions
+ * nested in all of them, with stubs left by lazy compilation compiled first.
+ * It replaces the previous copy for the messages sent from then on; earlier
+ * copies are kept until `freeVM`, so closures over them can come back.
+ *
+ * @param vm The virtual machine, which must not have frozen code attached.
+ * @param functions The functions to add.
+ * @return bool False, and no copy is made, if none of them can be added
+ * because of a compile error in their bodies, which is reported.
+ */
+bool shareFunctions(VM* vm, const ValueArray* functions);
+
+/**
+ * @brief Drops the references a VM holds to its shared copies.
+ * @param vm The virtual machine.
+ */
+void freeSharedCode(VM* vm);
+
+#endif
@@ -0,0 +1,185 @@
+/**
+ * @file io.h
+ * @brief The event loop: non-blocking I/O and timers for coroutines.
+ *
+ * An I/O native that cannot finish at once leaves the stack that called it
+ * waiting - a coroutine or the main stack - and the VM switches to the next
+ * stack the loop can resume: a task whose turn has come, or a stack whose
+ * I/O has completed. Only when none is ready does the VM block, in
+ * `epoll_wait`, or in `io_uring_enter` when built with `IO_URING` and the
+ * kernel allows it. Each VM has a loop of its own, created by its first I/O.
+ */
+
+#ifndef corelox_io_h
+#define corelox_io_h
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+// The number of descriptor events taken from epoll per wait.
+#ifndef IO_EVENT_BATCH
+#define IO_EVENT_BATCH 64
+#endif
+
+// The number of submission entries of the io_uring backend.
+#ifndef IO_RING_ENTRIES
+#define IO_RING_ENTRIES 256
+#endif
+
+// A VM's event loop (see io.c).
+typedef struct EventLoop EventLoop;
+
+//-----------------------------------------------------------------------------
+//- Event Loop
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Frees a VM's event loop, if it has one.
+ *
+ * Operations still in flight are cancelled first; descriptors opened by the
+ * script are left open.
+ *
+ * @param vm The virtual machine.
+ */
+void freeEventLoop(VM* vm);
+
+/**
+ * @brief Forgets every stack waiting on a VM's event loop, after a runtime
+ * error has reset the VM's stacks.
+ *
+ * Operations in flight are cancelled and the coroutines that waited on them
+ * are done.
+ *
+ * @param vm The virtual machine.
+ */
+void resetEventLoop(VM* vm);
+
+/**
+ * @brief Marks the coroutines waiting on a VM's event loop for garbage
+ * collection.
+ * @param vm The virtual machine.
+ */
+void markEventLoop(VM* vm);
+
+/**
+ * @brief Waits until the event loop can resume a stack and takes it.
+ *
+ * Called after the running stack has started waiting. Print output is
+ * flushed before blocking.
+ *
+ * @param vm The virtual machine.
+ * @param waiter A pointer where the coroutine to resume, or NULL for the main
+ * stack, will be stored.
+ * @param value A pointer where the result of the operation it waited for
+ * will be stored.
+ * @return bool False if nothing is left that could ever complete.
+ */
+bool nextIoEvent(VM* vm, ObjectCoroutine** waiter, Value* value);
+
+/**
+ * @brief Lets a task run when the running stack next waits.
+ *
+ * Tasks are run in the order they are queued, each until it waits, yields
+ * or returns.
+ *
+ * @param vm The virtual machine.
+ * @param task The task, which is either new or the running one yielding.
+ */
+void queueTask(VM* vm, ObjectCoroutine* task);
+
+/**
+ * @brief Makes the running stack wait until no task is ready and no
+ * operation is in flight.
+ * @param vm The virtual machine.
+ */
+void waitForIdle(VM* vm);
+
+//-----------------------------------------------------------------------------
+//- Operations
+//-----------------------------------------------------------------------------
+
+// Each operation that may have to wait returns its result if it completes at
+// once. Otherwise it sets `vm->waitingForIo`, and the result is pushed when
+// the event loop resumes the stack.
+
+/**
+ * @brief Reads up to a number of bytes from a descriptor.
+ * @param vm The virtual machine.
+ * @param fd The descriptor.
+ * @param count The largest number of bytes to read.
+ * @return Value The bytes read, as a string, or nil at the end of the input
+ * or on error.
+ */
+Value ioRead(VM* vm, int fd, int32_t count);
+
+/**
+ * @brief Writes all of a string to a descriptor.
+ * @param vm The virtual machine.
+ * @param fd The descriptor.
+ * @param string The string.
+ * @return Value The number of bytes written, or nil on error.
+ */
+Value ioWrite(VM* vm, int fd, Value string);
+
+/**
+ * @brief Accepts a connection on a listening socket.
+ * @param vm The virtual machine.
+ * @param fd The listening socket.
+ * @return Value The descriptor of the connection, or nil on error.
+ */
+Value ioAccept(VM* vm, int fd);
+
+/**
+ * @brief Waits for a number of milliseconds.
+ * @param vm The virtual machine.
+ * @param milliseconds The time to wait.
+ * @return Value Nil.
+ */
+Value ioSleep(VM* vm, double milliseconds);
+
+/**
+ * @brief Opens a file for non-blocking use.
+ * @param vm The virtual machine.
+ * @param path The path of the file.
+ * @param mode "r" to read, "w" to truncate and write, "a" to append.
+ * @return Value The descriptor, or nil on error.
+ */
+Value ioOpen(VM* vm, Value path, Value mode);
+
+/**
+ * @brief Creates a pipe whose ends do not block.
+ * @param vm The virtual machine.
+ * @return Value A list of the descriptors of the reading and writing ends,
+ * or nil on error.
+ */
+Value ioPipe(VM* vm);
+
+/**
+ * @brief Creates a Unix socket listening on a path.
+ * @param vm The virtual machine.
+ * @param path The path, which is replaced if a socket file exists there.
+ * @return Value The descriptor, or nil on error.
+ */
+Value ioListen(VM* vm, Value path);
+
+/**
+ * @brief Connects a Unix socket to a path.
+ * @param vm The virtual machine.
+ * @param path The path a socket listens on.
+ * @return Value The descriptor, or nil on error.
+ */
+Value ioConnect(VM* vm, Value path);
+
+/**
+ * @brief Closes a descriptor.
+ *
+ * Operations waiting on it fail.
+ *
+ * @param vm The virtual machine.
+ * @param fd The descriptor.
+ * @return Value True if it was closed, false on error.
+ */
+Value ioClose(VM* vm, int fd);
+
+#endif
@@ -0,0 +1,102 @@
+/**
+ * @file map.h
+ * @brief Public interface for the hash map keyed by arbitrary Clox values.
+ *
+ * Unlike `Table`, which only accepts interned `ObjectString*` keys, a `Map`
+ * accepts any non-nil `Value` as a key. It backs the `ObjectMap` type and
+ * follows the same load and shrink policy as `Table`.
+ */
+
+#ifndef corelox_map_h
+#define corelox_map_h
+
+#include "common.h"
+#include "table.h"
+#include "value.h"
+
+// A single key-value entry in the map. A nil key marks an empty slot (nil
+// value) or a tombstone (true value).
+typedef struct {
+    Value key;
+    Value value;
+} MapEntry;
+
+// A hash map from values to values.
+typedef struct {
+    int32_t count;       ///< The number of live entries in the map.
+    int32_t tombstones;  ///< The number of tombstones left by deletions.
+    int32_t capacity;    ///< The capacity mask (`entries` length - 1).
+    MapEntry* entries;   ///< A dynamic array of `MapEntry` structs.
+} Map;
+
+//-----------------------------------------------------------------------------
+//- Map Lifecycle
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Initializes a map.
+ * @param map A pointer to the Map struct to initialize.
+ */
+void initMap(Map* map);
+
+/**
+ * @brief Frees all memory used by a map.
+ * @param vm The virtual machine.
+ * @param map A pointer to the Map struct to free.
+ */
+void freeMap(VM* vm, Map* map);
+
+//-----------------------------------------------------------------------------
+//- Public API
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Retrieves a value from the map by its key.
+ *
+ * Numbers are compared by value, with -0 equal to 0 and all NaNs equal to
+ * each other. Strings are interned, so they are compared by content; other
+ * objects are compared by identity.
+ *
+ * @param map The map to search.
+ * @param key The key to look for.
+ * @param value A pointer where the found value will be stored.
+ * @return bool True if the key was found, false otherwise.
+ */
+bool mapGet(const Map* map, Value key, Value* value);
+
+/**
+ * @brief Adds or updates a key-value pair in the map.
+ *
+ * @param vm The virtual machine.
+ * @param map The map to modify.
+ * @param key The key to set. Must not be nil.
+ * @param value The value to associate with the key.
+ * @return bool True if the key was new, false if it was an update.
+ */
+bool mapSet(VM* vm, Map* map, Value key, Value value);
+
+/**
+ * @brief Deletes a key-value pair from the map.
+ *
+ * Leaves a tombstone behind and shrinks the map when the number of live
+ * entries falls below `TABLE_MIN_LOAD`.
+ *
+ * @param vm The virtual machine.
+ * @param map The map to modify.
+ * @param key The key to delete.
+ * @return bool True if the key was found and deleted, false otherwise.
+ */
+bool mapDelete(VM* vm, Map* map, Value key);
+
+//-----------------------------------------------------------------------------
+//- Garbage Collection Support
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Marks all keys and values in a map for the garbage collector.
+ * @param vm The virtual machine.
+ * @param map The map to mark.
+ */
+void markMap(VM* vm, Map* map);
+
+#endif
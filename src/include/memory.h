@@ -18,20 +18,23 @@
 /**
  * @brief Allocates a block of memory for a given type and count.
  *
+ * @param vm The virtual machine owning the memory.
  * @param type The type of the element of the array to be allocated.
  * @param count The number of elements in the array.
  * @return A pointer to the allocated array.
  */
-#define ALLOCATE(type, count) (type*)reallocate(NULL, 0, sizeof(type) * (count))
+#define ALLOCATE(vm, type, count) \
+    (type*)reallocate(vm, NULL, 0, sizeof(type) * (count))
 
 /**
  * @brief Frees a block of memory for a given type.
  *
+ * @param vm The virtual machine owning the memory.
  * @param type The type of the block to be freed.
  * @param pointer A pointer to the allocated block.
  * @return A NULL pointer.
  */
-#define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
+#define FREE(vm, type, pointer) reallocate(vm, pointer, sizeof(type), 0)
 
 /**
  * @brief Calculates a new, larger capacity for a dynamic array.
@@ -46,26 +49,28 @@
 /**
  * @brief Reallocates a dynamic array to a new size.
  *
+ * @param vm The virtual machine owning the memory.
  * @param type The element type of the array.
  * @param pointer A pointer to the existing array.
  * @param oldCount The current number of elements in the array.
  * @param newCount The desired number of elements.
  * @return A pointer to the reallocated array.
  */
-#define GROW_ARRAY(type, pointer, oldCount, newCount)     \
-    (type*)reallocate(pointer, sizeof(type) * (oldCount), \
+#define GROW_ARRAY(vm, type, pointer, oldCount, newCount)     \
+    (type*)reallocate(vm, pointer, sizeof(type) * (oldCount), \
                       sizeof(type) * (newCount))
 
 /**
  * @brief Frees a block of memory for an array of a given type.
  *
+ * @param vm The virtual machine owning the memory.
  * @param type The type of the element of array to be freed.
  * @param pointer A pointer to the allocated block.
  * @param oldCount The current number of elements in the array.
  * @return A NULL pointer.
  */
-#define FREE_ARRAY(type, pointer, oldCount) \
-    reallocate(pointer, sizeof(type) * (oldCount), 0)
+#define FREE_ARRAY(vm, type, pointer, oldCount) \
+    reallocate(vm, pointer, sizeof(type) * (oldCount), 0)
 
 //-----------------------------------------------------------------------------
 //- Memory Allocation
@@ -78,12 +83,14 @@
  * the size of an existing allocation. It also tracks the total number of
  * bytes allocated and triggers garbage collection when necessary.
  *
+ * @param vm The virtual machine, or NULL for memory that belongs to no VM
+ * and is neither counted nor collected.
  * @param pointer The existing memory block to modify, or NULL to allocate new.
  * @param oldSize The current size of the block.
  * @param newSize The desired new size. If 0, the block is freed.
  * @return void* A pointer to the newly allocated or resized memory block.
  */
-void* reallocate(void* pointer, size_t oldSize, size_t newSize);
+void* reallocate(VM* vm, void* pointer, size_t oldSize, size_t newSize);
 
 //-----------------------------------------------------------------------------
 //- Object Lifecycle
@@ -93,8 +100,10 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize);
  * @brief Frees all heap-allocated objects in the VM.
  *
  * Called during `freeVM` to clean up any remaining objects at shutdown.
+ *
+ * @param vm The virtual machine.
  */
-void freeObjects();
+void freeObjects(VM* vm);
 
 //-----------------------------------------------------------------------------
 //- Garbage Collector: Mark Phase
@@ -102,16 +111,18 @@ void freeObjects();
 
 /**
  * @brief Marks a value for garbage collection if it is an object.
+ * @param vm The virtual machine.
  * @param value The value to mark.
  */
-void markValue(Value value);
+void markValue(VM* vm, Value value);
 
 /**
  * @brief Marks an object and adds it to the gray stack for tracing.
  *
  * If the object is already marked, the function does nothing.
+ * @param vm The virtual machine.
  * @param object The object to mark.
  */
-void markObject(Object* object);
+void markObject(VM* vm, Object* object);
 
 #endif
\ No newline at end of file
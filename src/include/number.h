@@ -0,0 +1,43 @@
+/**
+ * @file number.h
+ * @brief Conversion of numbers to text.
+ *
+ * Numbers are formatted with the Grisu2 algorithm instead of `printf`, which
+ * is both faster and independent of the C locale. Integral values skip the
+ * algorithm entirely.
+ */
+
+#ifndef corelox_number_h
+#define corelox_number_h
+
+#include "common.h"
+
+// Size of a buffer that can hold any formatted number and its NUL.
+#define NUMBER_BUFFER_SIZE 32
+
+// The ways a number can be formatted.
+typedef enum {
+    // Same output as `printf("%g")`: six significant digits, trailing zeros
+    // removed, exponent form outside 1e-4 <= |x| < 1e6.
+    NUMBER_FORMAT_GENERAL,
+    // The shortest digits that read back as the same double, laid out like
+    // JavaScript's `Number.prototype.toString`.
+    NUMBER_FORMAT_SHORTEST,
+} NumberFormat;
+
+/**
+ * @brief Formats a number as text.
+ *
+ * NaN and the infinities are written as "nan" and "inf" with their sign, like
+ * `printf` does, or as "NaN" and "Infinity" in the shortest format, like
+ * JavaScript does.
+ *
+ * @param value The number to format.
+ * @param format The format to use.
+ * @param buffer A buffer of at least `NUMBER_BUFFER_SIZE` bytes receiving the
+ * NUL-terminated text.
+ * @return int32_t The length of the text.
+ */
+int32_t formatNumber(double value, NumberFormat format, char* buffer);
+
+#endif
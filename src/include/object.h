@@ -13,6 +13,7 @@
 
 #include "chunk.h"
 #include "common.h"
+#include "map.h"
 #include "table.h"
 #include "value.h"
 
@@ -25,33 +26,64 @@
 #define IS_BOUND_METHOD(value) isObjectType(value, OBJECT_BOUND_METHOD)
 // Checks if a Value is an ObjectInstance.
 #define IS_INSTANCE(value) isObjectType(value, OBJECT_INSTANCE)
+// Checks if a Value is an ObjectChannel.
+#define IS_CHANNEL(value) isObjectType(value, OBJECT_CHANNEL)
 // Checks if a Value is an ObjectClass.
 #define IS_CLASS(value) isObjectType(value, OBJECT_CLASS)
 // Checks if a Value is an ObjectClosure.
 #define IS_CLOSURE(value) isObjectType(value, OBJECT_CLOSURE)
+// Checks if a Value is an ObjectCoroutine.
+#define IS_COROUTINE(value) isObjectType(value, OBJECT_COROUTINE)
+// Checks if a Value is an ObjectFloat64Array.
+#define IS_FLOAT64_ARRAY(value) isObjectType(value, OBJECT_FLOAT64_ARRAY)
+// Checks if a Value is an ObjectForeign.
+#define IS_FOREIGN(value) isObjectType(value, OBJECT_FOREIGN)
 // Checks if a Value is an ObjectFunction.
 #define IS_FUNCTION(value) isObjectType(value, OBJECT_FUNCTION)
+// Checks if a Value is an ObjectList.
+#define IS_LIST(value) isObjectType(value, OBJECT_LIST)
+// Checks if a Value is an ObjectMap.
+#define IS_MAP(value) isObjectType(value, OBJECT_MAP)
 // Checks if a Value is an ObjectNative.
 #define IS_NATIVE(value) isObjectType(value, OBJECT_NATIVE)
+// Checks if a Value is a string, either an ObjectString or an immediate.
+#define IS_STRING(value) \
+    (IS_SHORT_STRING(value) || isObjectType(value, OBJECT_STRING))
 // Checks if a Value is an ObjectString.
-#define IS_STRING(value) isObjectType(value, OBJECT_STRING)
+#define IS_STRING_OBJECT(value) isObjectType(value, OBJECT_STRING)
+// Checks if a Value is an ObjectWorker.
+#define IS_WORKER(value) isObjectType(value, OBJECT_WORKER)
 
 // Casts an object Value to an ObjectBoundMethod pointer.
 #define AS_BOUND_METHOD(value) ((ObjectBoundMethod*)AS_OBJECT(value))
 // Casts an object Value to an ObjectInstance pointer.
 #define AS_INSTANCE(value) ((ObjectInstance*)AS_OBJECT(value))
+// Casts an object Value to an ObjectChannel pointer.
+#define AS_CHANNEL(value) ((ObjectChannel*)AS_OBJECT(value))
 // Casts an object Value to an ObjectClass pointer.
 #define AS_CLASS(value) ((ObjectClass*)AS_OBJECT(value))
 // Casts an object Value to an ObjectClosure pointer.
 #define AS_CLOSURE(value) ((ObjectClosure*)AS_OBJECT(value))
+// Casts an object Value to an ObjectCoroutine pointer.
+#define AS_COROUTINE(value) ((ObjectCoroutine*)AS_OBJECT(value))
+// Casts an object Value to an ObjectFloat64Array pointer.
+#define AS_FLOAT64_ARRAY(value) ((ObjectFloat64Array*)AS_OBJECT(value))
+// Casts an object Value to an ObjectForeign pointer.
+#define AS_FOREIGN(value) ((ObjectForeign*)AS_OBJECT(value))
 // Casts an object Value to an ObjectFunction pointer.
 #define AS_FUNCTION(value) ((ObjectFunction*)AS_OBJECT(value))
+// Casts an object Value to an ObjectList pointer.
+#define AS_LIST(value) ((ObjectList*)AS_OBJECT(value))
+// Casts an object Value to an ObjectMap pointer.
+#define AS_MAP(value) ((ObjectMap*)AS_OBJECT(value))
 // Casts an object Value to an ObjectNative pointer.
-#define AS_NATIVE(value) (((ObjectNative*)AS_OBJECT(value))->function);
-// Casts an object Value to an ObjectString pointer.
+#define AS_NATIVE(value) ((ObjectNative*)AS_OBJECT(value))
+// Casts an object Value to an ObjectString pointer (not for short strings).
 #define AS_STRING(value) ((ObjectString*)AS_OBJECT(value))
 // Casts an object Value to a C-printable string.
 #define AS_CSTRING(value) (((ObjectString*)AS_OBJECT(value))->chars)
+// Casts an object Value to an ObjectWorker pointer.
+#define AS_WORKER(value) ((ObjectWorker*)AS_OBJECT(value))
 
 // Enum representing all the different types of heap-allocated objects.
 typedef enum {
@@ -60,15 +92,23 @@ typedef enum {
     OBJECT_CLASS,
     OBJECT_CLOSURE,
     OBJECT_UPVALUE,
+    OBJECT_FLOAT64_ARRAY,
     OBJECT_FUNCTION,
+    OBJECT_LIST,
+    OBJECT_MAP,
     OBJECT_NATIVE,
     OBJECT_STRING,
+    OBJECT_CHANNEL,
+    OBJECT_WORKER,
+    OBJECT_COROUTINE,
+    OBJECT_FOREIGN,
 } ObjectType;
 
 // The base struct for all heap-allocated objects.
 struct Object {
     ObjectType type;      ///< The type of the object.
     bool isMarked;        ///< Flag used by the garbage collector.
+    bool isFrozen;        ///< Set for immutable objects shared between VMs.
     struct Object* next;  ///< Pointer to the next object in the allocated list.
 };
 
@@ -80,6 +120,13 @@ struct ObjectString {
     uint32_t hash;   ///< The pre-calculated hash of the string.
 };
 
+// The characters of a string Value, whether immediate or an ObjectString.
+typedef struct {
+    const char* chars;                 ///< The characters, NUL-terminated.
+    int32_t length;                    ///< The number of characters.
+    char buffer[SHORT_STRING_BUFFER];  ///< Storage for a short string.
+} StringView;
+
 // Represents a local variable that has been "closed over" by a closure.
 typedef struct ObjectUpvalue {
     Object object;    ///< Base object header.
@@ -87,24 +134,92 @@ typedef struct ObjectUpvalue {
     Value closed;     ///< Stores the value when the variable is closed.
     struct ObjectUpvalue*
         next;  ///< Points to the next upvalue in the open list.
+    struct ObjectCoroutine*
+        coroutine;  ///< The coroutine whose stack an open upvalue is on.
 } ObjectUpvalue;
 
+// The source of a function whose body is compiled on its first call.
+typedef struct {
+    ObjectString* source;     ///< The source the function was declared in.
+    int32_t start;            ///< The offset of its parameter list.
+    int32_t line;             ///< The line its parameter list starts on.
+    uint8_t type;             ///< The compiler's `FunctionType` for the body.
+    bool inClass;             ///< Whether it was declared inside a class.
+    bool hasSuperclass;       ///< Whether that class has a superclass.
+    ValueArray upvalueNames;  ///< The name of each upvalue, as a string.
+} LazyBody;
+
 // The raw, compiled representation of a function.
 typedef struct {
     Object object;         ///< Base object header.
     int32_t arity;         ///< The number of parameters the function expects.
     int32_t upvalueCount;  ///< The number of upvalues it closes over.
+    int32_t maxSlots;      ///< The most stack slots a call uses.
     Chunk chunk;           ///< The bytecode for the function.
     ObjectString* name;    ///< The name of the function.
+    LazyBody* lazy;        ///< The body to compile on first call, or NULL.
 } ObjectFunction;
 
-// A C function pointer type for native functions.
-typedef Value (*NativeFunction)(const int32_t argCount, const Value* args);
+// A C function pointer type for native functions taking their arguments as
+// an array, however many there are.
+typedef Value (*NativeFunction)(VM* vm, const int32_t argCount,
+                                const Value* args);
+
+// C function pointer types for fast natives, which take a fixed number of
+// arguments directly.
+typedef Value (*NativeFunction0)(VM* vm);
+typedef Value (*NativeFunction1)(VM* vm, Value a);
+typedef Value (*NativeFunction2)(VM* vm, Value a, Value b);
+typedef Value (*NativeFunction3)(VM* vm, Value a, Value b, Value c);
+
+// A C function pointer type for natives defined by a host through the C API
+// (see corelox.h), which read their arguments and set their result through
+// the VM.
+typedef void (*HostFunction)(VM* vm, int32_t argCount);
+
+// The arity of a native that takes any number of arguments.
+#define NATIVE_VARIADIC (-1)
+// The number of leading parameters a native can declare types for.
+#define NATIVE_TYPES_MAX 3
+
+// The type a native can require of a parameter.
+typedef enum {
+    NATIVE_ANY,  ///< Any value; the zero value, so undeclared types are this.
+    NATIVE_NUMBER,
+    NATIVE_STRING,
+    NATIVE_LIST,
+    NATIVE_MAP,
+    NATIVE_FLOAT64_ARRAY,
+    NATIVE_CHANNEL,
+    NATIVE_WORKER,
+    NATIVE_COROUTINE,
+    NATIVE_FOREIGN,
+} NativeType;
+
+// How a native function is called. The VM checks the arity and the declared
+// parameter types before calling it, and raises a runtime error if they do
+// not match, so the C function only sees arguments it accepts.
+//
+// Specs are not copied: they must outlive every VM the native is defined in,
+// which static data does.
+typedef struct {
+    const char* name;                    ///< The global it is defined under.
+    int32_t arity;                       ///< Or `NATIVE_VARIADIC`.
+    NativeType types[NATIVE_TYPES_MAX];  ///< The types of the first arguments.
+    NativeFunction function;  ///< Takes the arguments as an array, or NULL.
+    union {
+        NativeFunction0 call0;
+        NativeFunction1 call1;
+        NativeFunction2 call2;
+        NativeFunction3 call3;
+    } fast;  ///< Takes `arity` arguments, from 0 to 3, if the others are NULL.
+    HostFunction host;  ///< Defined through the C API, or NULL.
+} NativeSpec;
 
 // A wrapper object for a native C function.
 typedef struct {
-    Object object;            ///< Base object header.
-    NativeFunction function;  ///< The C function pointer.
+    Object object;           ///< Base object header.
+    const NativeSpec* spec;  ///< How to call it.
 } ObjectNative;
 
 // A runtime representation of a function, bundling an ObjectFunction with its
@@ -117,10 +232,16 @@ typedef struct {
 } ObjectClosure;
 
 // The runtime representation of a class.
-typedef struct {
-    Object object;       ///< Base object header.
-    ObjectString* name;  ///< The name of the class.
-    Table methods;       ///< A hash table of the class's methods.
+//
+// A subclass starts out sharing the method table of its superclass and only
+// gets a table of its own (copy-on-write) when it defines a method, so lookups
+// always go through `methods` with a single probe.
+typedef struct ObjectClass {
+    Object object;                   ///< Base object header.
+    ObjectString* name;              ///< The name of the class.
+    struct ObjectClass* superclass;  ///< The superclass, or NULL.
+    Table* methods;                  ///< Lookup table, owned or shared.
+    Table ownMethods;                ///< The table owned by this class.
 } ObjectClass;
 
 // An instance of a class.
@@ -130,6 +251,26 @@ typedef struct {
     Table fields;        ///< A hash table of the instance's fields.
 } ObjectInstance;
 
+// A list of values stored in a contiguous, growable buffer.
+typedef struct {
+    Object object;     ///< Base object header.
+    ValueArray items;  ///< The elements of the list.
+} ObjectList;
+
+// A fixed-size array of raw doubles, for bulk numeric work without per-element
+// tag checks.
+typedef struct {
+    Object object;   ///< Base object header.
+    int32_t count;   ///< The number of elements.
+    double* values;  ///< The elements.
+} ObjectFloat64Array;
+
+// A hash map from arbitrary (non-nil) values to values.
+typedef struct {
+    Object object;  ///< Base object header.
+    Map table;      ///< The entries of the map.
+} ObjectMap;
+
 // A pairing of a method closure with the instance it's being called on
 // (`this`).
 typedef struct {
@@ -138,6 +279,83 @@ typedef struct {
     ObjectClosure* method;  ///< The method closure.
 } ObjectBoundMethod;
 
+// The queue behind a channel, shared by every VM holding it (see worker.h).
+typedef struct Channel Channel;
+// A thread running a worker VM (see worker.h).
+typedef struct Worker Worker;
+
+// A VM's handle to a channel between VMs.
+typedef struct {
+    Object object;     ///< Base object header.
+    Channel* channel;  ///< The shared queue, referenced by this handle.
+} ObjectChannel;
+
+// A VM's handle to a worker it spawned.
+typedef struct {
+    Object object;   ///< Base object header.
+    Worker* worker;  ///< The worker, referenced by this handle.
+} ObjectWorker;
+
+// Releases the data of a foreign object once the garbage collector frees it.
+typedef void (*ForeignFinalizer)(void* data, size_t size);
+// Marks the values that the data of a foreign object refers to, with
+// `markValue`, while the garbage collector traces it.
+typedef void (*ForeignTracer)(VM* vm, void* data);
+
+// Data owned by the host, which scripts pass around as a value and natives
+// read in place.
+//
+// The VM never reads, copies or moves the data. With a finalizer the object
+// owns it, and its size counts towards the heap size that triggers a
+// collection; without one the host keeps it alive for as long as scripts may
+// hold the object.
+typedef struct {
+    Object object;              ///< Base object header.
+    void* data;                 ///< The data.
+    size_t size;                ///< The size of the data in bytes.
+    uint32_t tag;               ///< The kind of data, for natives to check.
+    ForeignFinalizer finalize;  ///< Called when it is freed, or NULL.
+    ForeignTracer trace;        ///< Marks the values it holds, or NULL.
+} ObjectForeign;
+
+// A single active function call (see vm.h).
+typedef struct CallFrame CallFrame;
+
+// The stack of values and call frames of one line of execution.
+//
+// While a stack is running, the VM works on copies of `stackTop`,
+// `frameCount` and `openUpvalues`, which are only written back when it
+// switches to another stack; the arrays and their capacities stay current.
+typedef struct {
+    Value* stack;                 ///< The values, bottom first.
+    Value* stackTop;              ///< Just past the top value.
+    int32_t stackCapacity;        ///< The number of value slots allocated.
+    CallFrame* frames;            ///< The call frames, bottom first.
+    int32_t frameCount;           ///< The number of active call frames.
+    int32_t frameCapacity;        ///< The number of call frames allocated.
+    ObjectUpvalue* openUpvalues;  ///< The open upvalues into `stack`.
+} StackSegment;
+
+// Where a coroutine is in its life.
+typedef enum {
+    COROUTINE_SUSPENDED,  ///< Not started yet, or stopped at a `yield`.
+    COROUTINE_RUNNING,    ///< Running, or waiting on one it resumed.
+    COROUTINE_DONE,       ///< Returned, or ended by a runtime error.
+    COROUTINE_WAITING,    ///< Waiting for the event loop to resume it.
+} CoroutineState;
+
+// A function call that can suspend itself with `yield` and be resumed later,
+// on a stack of its own that grows as calls nest.
+typedef struct ObjectCoroutine {
+    Object object;                   ///< Base object header.
+    ObjectClosure* closure;          ///< The function the coroutine runs.
+    CoroutineState state;            ///< Where the coroutine is in its life.
+    struct ObjectCoroutine* caller;  ///< Its resumer, or NULL for the main
+                                     ///< stack, while it is running.
+    bool task;                       ///< Whether the event loop resumes it.
+    StackSegment segment;            ///< Its stack, freed once it is done.
+} ObjectCoroutine;
+
 //-----------------------------------------------------------------------------
 //- Object Constructors
 //-----------------------------------------------------------------------------
@@ -147,54 +365,135 @@ typedef struct {
  *
  * A bound method is a closure that has captured a specific instance (`this`)
  * as its receiver.
+ * @param vm The virtual machine.
  * @param receiver The instance that the method is bound to.
  * @param method The closure representing the method's code.
  * @return ObjectBoundMethod* The new bound method object.
  */
-ObjectBoundMethod* newBoundMethod(Value receiver, ObjectClosure* method);
+ObjectBoundMethod* newBoundMethod(VM* vm, Value receiver,
+                                  ObjectClosure* method);
 
 /**
  * @brief Creates a new ObjectInstance of a class.
+ * @param vm The virtual machine.
  * @param klass The class to instantiate.
  * @return ObjectInstance* The new instance object.
  */
-ObjectInstance* newInstance(ObjectClass* klass);
+ObjectInstance* newInstance(VM* vm, ObjectClass* klass);
 
 /**
  * @brief Creates a new ObjectClass.
+ * @param vm The virtual machine.
  * @param name The name of the class.
  * @return ObjectClass* The new class object.
  */
-ObjectClass* newClass(ObjectString* name);
+ObjectClass* newClass(VM* vm, ObjectString* name);
 
 /**
  * @brief Creates a new ObjectClosure from a function.
+ * @param vm The virtual machine.
  * @param function The function to wrap in a closure.
  * @return ObjectClosure* The new closure object.
  */
-ObjectClosure* newClosure(ObjectFunction* function);
+ObjectClosure* newClosure(VM* vm, ObjectFunction* function);
 
 /**
  * @brief Creates a new ObjectUpvalue.
  *
  * An upvalue represents a local variable that is "closed over" by a closure.
+ * @param vm The virtual machine.
  * @param slot A pointer to the local variable on the VM's stack.
  * @return ObjectUpvalue* The new upvalue object.
  */
-ObjectUpvalue* newUpvalue(Value* slot);
+ObjectUpvalue* newUpvalue(VM* vm, Value* slot);
 
 /**
  * @brief Creates a new ObjectFunction.
+ * @param vm The virtual machine.
  * @return ObjectFunction* The new function object.
  */
-ObjectFunction* newFunction();
+ObjectFunction* newFunction(VM* vm);
+
+/**
+ * @brief Creates a new, empty ObjectList.
+ * @param vm The virtual machine.
+ * @return ObjectList* The new list object.
+ */
+ObjectList* newList(VM* vm);
+
+/**
+ * @brief Creates a new ObjectFloat64Array filled with zeros.
+ * @param vm The virtual machine.
+ * @param count The number of elements.
+ * @return ObjectFloat64Array* The new array object.
+ */
+ObjectFloat64Array* newFloat64Array(VM* vm, int32_t count);
+
+/**
+ * @brief Creates a new, empty ObjectMap.
+ * @param vm The virtual machine.
+ * @return ObjectMap* The new map object.
+ */
+ObjectMap* newMap(VM* vm);
 
 /**
  * @brief Creates a new ObjectNative for wrapping a C function.
- * @param function The C function pointer.
+ * @param vm The virtual machine.
+ * @param spec How to call the function, which must outlive the VM.
  * @return ObjectNative* The new native function object.
  */
-ObjectNative* newNative(NativeFunction function);
+ObjectNative* newNative(VM* vm, const NativeSpec* spec);
+
+/**
+ * @brief Creates a new ObjectChannel.
+ * @param vm The virtual machine.
+ * @param channel The channel, whose reference the object takes over.
+ * @return ObjectChannel* The new channel object.
+ */
+ObjectChannel* newChannel(VM* vm, Channel* channel);
+
+/**
+ * @brief Creates a new ObjectWorker.
+ * @param vm The virtual machine.
+ * @param worker The worker, whose reference the object takes over.
+ * @return ObjectWorker* The new worker object.
+ */
+ObjectWorker* newWorker(VM* vm, Worker* worker);
+
+/**
+ * @brief Creates a new ObjectForeign wrapping host data, without copying it.
+ * @param vm The virtual machine.
+ * @param data The data.
+ * @param size The size of the data in bytes.
+ * @param tag The kind of data, for natives to check.
+ * @param finalize Called with the data when the object is freed, or NULL if
+ * the host keeps ownership.
+ * @param trace Marks the values the data refers to, or NULL if there are
+ * none.
+ * @return ObjectForeign* The new foreign object.
+ */
+ObjectForeign* newForeign(VM* vm, void* data, size_t size, uint32_t tag,
+                          ForeignFinalizer finalize, ForeignTracer trace);
+
+/**
+ * @brief Creates a new ObjectCoroutine that has not started yet.
+ *
+ * The closure is the first value on the coroutine's stack, where it is
+ * called by the first `resume`.
+ * @param vm The virtual machine.
+ * @param closure The function the coroutine runs.
+ * @return ObjectCoroutine* The new coroutine object.
+ */
+ObjectCoroutine* newCoroutine(VM* vm, ObjectClosure* closure);
+
+/**
+ * @brief Frees the arrays of a coroutine's stack and leaves it empty.
+ *
+ * Freeing an empty stack again does nothing.
+ * @param vm The virtual machine.
+ * @param segment The stack.
+ */
+void freeStackSegment(VM* vm, StackSegment* segment);
 
 //-----------------------------------------------------------------------------
 //- String Operations
@@ -206,11 +505,12 @@ ObjectNative* newNative(NativeFunction function);
  * This function takes ownership of the `chars` buffer and will free it if
  * an identical string is already interned.
  *
+ * @param vm The virtual machine.
  * @param chars The character buffer (heap-allocated).
  * @param length The length of the string.
  * @return ObjectString* The interned string object.
  */
-ObjectString* takeString(char* chars, int32_t length);
+ObjectString* takeString(VM* vm, char* chars, int32_t length);
 
 /**
  * @brief Creates a new ObjectString by copying from a character buffer.
@@ -218,24 +518,97 @@ ObjectString* takeString(char* chars, int32_t length);
  * If an identical string is already interned, it is returned without a new
  * allocation.
  *
+ * @param vm The virtual machine.
  * @param chars The character buffer to copy from.
  * @param length The number of characters to copy.
  * @return ObjectString* The interned string object.
  */
-ObjectString* copyString(const char* chars, int32_t length);
+ObjectString* copyString(VM* vm, const char* chars, int32_t length);
+
+/**
+ * @brief Creates an ObjectString holding a copy of a buffer, without hashing
+ * or interning it.
+ *
+ * Meant for large buffers only the VM reads, like the source lazily compiled
+ * functions point into. The string must never become a Lox value, since
+ * strings are compared by identity and only interned ones are unique.
+ *
+ * @param vm The virtual machine.
+ * @param chars The character buffer to copy from.
+ * @param length The number of characters to copy.
+ * @return ObjectString* The new string object.
+ */
+ObjectString* copyUninternedString(VM* vm, const char* chars, int32_t length);
+
+/**
+ * @brief Creates a string Value by taking ownership of a character buffer.
+ *
+ * Strings of up to `SHORT_STRING_MAX` characters become immediate Values and
+ * the buffer is freed; longer ones are interned as with `takeString`.
+ *
+ * @param vm The virtual machine.
+ * @param chars The character buffer (heap-allocated).
+ * @param length The length of the string.
+ * @return Value The string value.
+ */
+Value takeStringValue(VM* vm, char* chars, int32_t length);
+
+/**
+ * @brief Creates a string Value by copying from a character buffer.
+ *
+ * Strings of up to `SHORT_STRING_MAX` characters become immediate Values;
+ * longer ones are interned as with `copyString`.
+ *
+ * @param vm The virtual machine.
+ * @param chars The character buffer to copy from.
+ * @param length The number of characters to copy.
+ * @return Value The string value.
+ */
+Value copyStringValue(VM* vm, const char* chars, int32_t length);
 
 //-----------------------------------------------------------------------------
 //- Object Printing
 //-----------------------------------------------------------------------------
 
 /**
- * @brief Prints a representation of a Clox object to stdout.
- * @param value The object value to print.
+ * @brief Writes a representation of a Clox object to an output buffer.
+ * @param output The output buffer.
+ * @param value The object value to write.
  */
-void printObject(Value value);
+void writeObject(OutputBuffer* output, Value value);
 
 static inline bool isObjectType(Value value, ObjectType type) {
     return IS_OBJECT(value) && AS_OBJECT(value)->type == type;
 }
 
+/**
+ * @brief Gets the characters of a string Value.
+ * @param value The string value.
+ * @param view The view to fill; short strings are unpacked into its buffer.
+ */
+static inline void viewString(Value value, StringView* view) {
+#ifdef NAN_BOXING
+    if (IS_SHORT_STRING(value)) {
+        valueToShortString(value, view->buffer);
+        view->chars = view->buffer;
+        view->length = SHORT_STRING_LENGTH(value);
+        return;
+    }
+#endif
+    view->chars = AS_STRING(value)->chars;
+    view->length = AS_STRING(value)->length;
+}
+
+/**
+ * @brief Gets the length of a string Value.
+ * @param value The string value.
+ * @return int32_t The number of characters.
+ */
+static inline int32_t stringLength(Value value) {
+#ifdef NAN_BOXING
+    if (IS_SHORT_STRING(value)) return SHORT_STRING_LENGTH(value);
+#endif
+    return AS_STRING(value)->length;
+}
+
 #endif
\ No newline at end of file
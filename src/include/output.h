@@ -0,0 +1,76 @@
+/**
+ * @file output.h
+ * @brief Buffered output written straight to a file descriptor.
+ *
+ * An `OutputBuffer` collects formatted bytes in memory and hands them to the
+ * operating system in large `write` calls, bypassing stdio and its locking.
+ * The VM sends everything `print` produces through one of these.
+ */
+
+#ifndef corelox_output_h
+#define corelox_output_h
+
+#include <stdio.h>
+
+#include "common.h"
+
+// The size of the VM's output buffer, in bytes.
+#ifndef OUTPUT_BUFFER_SIZE
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+#endif
+
+// A buffer of bytes waiting to be written to a stream.
+typedef struct {
+    FILE* stream;       ///< The stream whose file descriptor is written to.
+    char* bytes;        ///< The buffered bytes.
+    int32_t count;      ///< The number of buffered bytes.
+    int32_t capacity;   ///< The size of `bytes`.
+    bool lineBuffered;  ///< Whether `endOutputLine` flushes the buffer.
+} OutputBuffer;
+
+/**
+ * @brief Initializes an output buffer.
+ *
+ * The buffer is line-buffered if the stream is a terminal. Defining
+ * `OUTPUT_LINE_BUFFERED` as 0 or 1 at build time overrides this.
+ *
+ * @param output The output buffer to initialize.
+ * @param stream The stream to write to.
+ * @param bytes The memory to buffer bytes in.
+ * @param capacity The size of `bytes`.
+ */
+void initOutput(OutputBuffer* output, FILE* stream, char* bytes,
+                int32_t capacity);
+
+/**
+ * @brief Writes all buffered bytes to the stream.
+ *
+ * Anything already buffered by stdio on the same stream is flushed first, so
+ * output written through both paths stays in order.
+ *
+ * @param output The output buffer to flush.
+ */
+void flushOutput(OutputBuffer* output);
+
+/**
+ * @brief Appends bytes to an output buffer, flushing it when it is full.
+ * @param output The output buffer.
+ * @param bytes The bytes to append.
+ * @param length The number of bytes.
+ */
+void writeOutput(OutputBuffer* output, const char* bytes, int32_t length);
+
+/**
+ * @brief Appends a NUL-terminated string to an output buffer.
+ * @param output The output buffer.
+ * @param string The string to append.
+ */
+void writeOutputString(OutputBuffer* output, const char* string);
+
+/**
+ * @brief Ends a line of output, flushing it if the buffer is line-buffered.
+ * @param output The output buffer.
+ */
+void endOutputLine(OutputBuffer* output);
+
+#endif
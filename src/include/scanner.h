@@ -20,6 +20,9 @@ typedef enum {
     TOKEN_RIGHT_PAREN,
     TOKEN_LEFT_BRACE,
     TOKEN_RIGHT_BRACE,
+    TOKEN_LEFT_BRACKET,
+    TOKEN_RIGHT_BRACKET,
+    TOKEN_COLON,
     TOKEN_COMMA,
     TOKEN_DOT,
     TOKEN_MINUS,
@@ -54,12 +57,14 @@ typedef enum {
     TOKEN_NIL,
     TOKEN_OR,
     TOKEN_PRINT,
+    TOKEN_RESUME,
     TOKEN_RETURN,
     TOKEN_SUPER,
     TOKEN_THIS,
     TOKEN_TRUE,
     TOKEN_VAR,
     TOKEN_WHILE,
+    TOKEN_YIELD,
     TOKEN_ERROR,
     TOKEN_EOF,
 
@@ -81,13 +86,30 @@ typedef struct {
     const char*
         current;   ///< A pointer to the current character being processed.
     int32_t line;  ///< The current line number.
+    const char* end;  ///< A pointer just past the last character.
 } Scanner;
 
 /**
  * @brief Initializes the scanner with the source code to be tokenized.
- * @param source A null-terminated C string containing the Clox source code.
+ *
+ * The source does not need to be null-terminated, so it can be scanned
+ * straight from a file mapped into memory.
+ *
+ * @param scanner The scanner.
+ * @param source The Clox source code.
+ * @param length The length of the source code.
+ */
+void initScanner(Scanner* scanner, const char* source, size_t length);
+
+/**
+ * @brief Initializes the scanner to resume scanning in the middle of a source.
+ * @param scanner The scanner.
+ * @param position A pointer into the Clox source code.
+ * @param end A pointer just past the end of the source code.
+ * @param line The line number of `position`.
  */
-void initScanner(const char* source);
+void initScannerAt(Scanner* scanner, const char* position, const char* end,
+                   int32_t line);
 
 /**
  * @brief Scans and returns the next token from the source code.
@@ -95,8 +117,9 @@ void initScanner(const char* source);
  * This is the main public function of the scanner. It's called repeatedly by
  * the compiler to get the next token in the stream.
  *
+ * @param scanner The scanner.
  * @return Token The next token in the source code.
  */
-Token scanToken();
+Token scanToken(Scanner* scanner);
 
 #endif
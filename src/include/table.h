@@ -3,7 +3,8 @@
  * @brief Public interface for the Clox hash table implementation.
  *
  * Defines the data structures (`Entry`, `Table`) and function prototypes for a
- * hash table that maps `ObjectString*` keys to `Value` values.
+ * hash table that maps `ObjectString*` keys to `Value` values, as well as the
+ * specialized `InternTable` used as the VM's weak string set.
  */
 
 #ifndef corelox_table_h
@@ -12,6 +13,18 @@
 #include "common.h"
 #include "value.h"
 
+// Maximum load factor (live entries and tombstones) before the hash table is
+// rehashed. Can be overridden at build time, e.g. `-DTABLE_MAX_LOAD=0.5`.
+#ifndef TABLE_MAX_LOAD
+#define TABLE_MAX_LOAD 0.75
+#endif
+
+// Load factor (live entries only) below which the hash table is shrunk after a
+// deletion.
+#ifndef TABLE_MIN_LOAD
+#define TABLE_MIN_LOAD 0.2
+#endif
+
 // A single key-value entry in the hash table.
 typedef struct {
     ObjectString* key;
@@ -20,12 +33,40 @@ typedef struct {
 
 // The main hash table structure.
 typedef struct {
-    int32_t count;     ///< The number of entries currently in the table.
-    int32_t capacity;  ///< The total number of possible entries in the
-                       ///< `entries` array.
-    Entry* entries;    ///< A dynamic array of `Entry` structs.
+    int32_t count;       ///< The number of live entries in the table.
+    int32_t tombstones;  ///< The number of tombstones left by deletions.
+    int32_t capacity;    ///< The total number of possible entries in the
+                         ///< `entries` array.
+    Entry* entries;      ///< A dynamic array of `Entry` structs.
 } Table;
 
+// Diagnostic statistics about the shape of a hash table.
+typedef struct {
+    int32_t count;          ///< The number of live entries.
+    int32_t tombstones;     ///< The number of tombstones.
+    int32_t capacity;       ///< The number of slots.
+    double loadFactor;      ///< Occupied slots (live and tombstones) / slots.
+    double tombstoneRatio;  ///< Tombstones / occupied slots.
+    double averageProbe;    ///< Average probe length of a live key lookup.
+    int32_t maxProbe;       ///< Longest probe length of a live key lookup.
+} TableStats;
+
+// A single slot in the string intern table. The hash and length are stored
+// inline so that most mismatches are rejected without touching the string.
+typedef struct {
+    ObjectString* key;  ///< The interned string, or NULL for an empty slot.
+    uint32_t hash;      ///< Cached hash of `key`.
+    int32_t length;     ///< Cached length of `key`.
+} InternEntry;
+
+// The string intern table. It is a set (no value slot) and never contains
+// tombstones, because removals shift the following entries back in place.
+typedef struct {
+    int32_t count;         ///< The number of strings in the table.
+    int32_t capacity;      ///< The capacity mask (`entries` length - 1).
+    InternEntry* entries;  ///< A dynamic array of `InternEntry` structs.
+} InternTable;
+
 //-----------------------------------------------------------------------------
 //- Table Lifecycle
 //-----------------------------------------------------------------------------
@@ -38,9 +79,10 @@ void initTable(Table* table);
 
 /**
  * @brief Frees all memory used by a hash table.
+ * @param vm The virtual machine.
  * @param table A pointer to the Table struct to free.
  */
-void freeTable(Table* table);
+void freeTable(VM* vm, Table* table);
 
 //-----------------------------------------------------------------------------
 //- Public API
@@ -62,48 +104,47 @@ bool tableGet(Table* table, const ObjectString* key, Value* value);
  * If the key already exists, its value is updated. Otherwise, a new entry is
  * created.
  *
+ * @param vm The virtual machine.
  * @param table The table to modify.
  * @param key The key to set.
  * @param value The value to associate with the key.
  * @return bool True if the key was new, false if it was an update.
  */
-bool tableSet(Table* table, ObjectString* key, Value value);
+bool tableSet(VM* vm, Table* table, ObjectString* key, Value value);
 
 /**
  * @brief Deletes a key-value pair from the hash table.
  *
  * Deletion is handled by placing a "tombstone" marker in the entry, which
- * allows the linear probing chain to remain intact.
+ * allows the linear probing chain to remain intact. When the number of live
+ * entries falls below `TABLE_MIN_LOAD`, the table is shrunk, which also
+ * drops all tombstones.
  *
+ * @param vm The virtual machine.
  * @param table The table to modify.
  * @param key The key to delete.
  * @return bool True if the key was found and deleted, false otherwise.
  */
-bool tableDelete(Table* table, const ObjectString* key);
+bool tableDelete(VM* vm, Table* table, const ObjectString* key);
 
 /**
  * @brief Copies all entries from one hash table to another.
  *
- * Used for implementing class inheritance.
+ * Used when a subclass takes its own copy of an inherited method table.
+ * @param vm The virtual machine.
  * @param from The source table.
  * @param to The destination table.
  */
-void tableAddAll(Table* from, Table* to);
+void tableAddAll(VM* vm, Table* from, Table* to);
 
 /**
- * @brief A specialized find function for the string interning table.
- *
- * It looks up a string by its characters, length, and hash, avoiding the
- * need to create an `ObjectString` first.
+ * @brief Collects statistics about a hash table for diagnosis.
  *
- * @param table The string table.
- * @param chars The characters of the string to find.
- * @param length The length of the string.
- * @param hash The hash of the string.
- * @return ObjectString* The found string object, or NULL if not found.
+ * Walks the whole table, so it is meant for debugging, not for hot paths.
+ * @param table The table to inspect.
+ * @param stats A pointer where the statistics will be stored.
  */
-ObjectString* tableFindString(Table* table, const char* chars, int32_t length,
-                              uint32_t hash);
+void tableStats(const Table* table, TableStats* stats);
 
 //-----------------------------------------------------------------------------
 //- Garbage Collection Support
@@ -111,9 +152,67 @@ ObjectString* tableFindString(Table* table, const char* chars, int32_t length,
 
 /**
  * @brief Marks all objects in a table for the garbage collector.
+ * @param vm The virtual machine.
  * @param table The table to mark.
  */
-void markTable(Table* table);
+void markTable(VM* vm, Table* table);
+
+//-----------------------------------------------------------------------------
+//- String Intern Table
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Initializes a string intern table.
+ * @param table A pointer to the InternTable struct to initialize.
+ */
+void initInternTable(InternTable* table);
+
+/**
+ * @brief Frees all memory used by a string intern table.
+ * @param vm The virtual machine.
+ * @param table A pointer to the InternTable struct to free.
+ */
+void freeInternTable(VM* vm, InternTable* table);
+
+/**
+ * @brief Grows the intern table so it can hold `count` strings without
+ * rehashing.
+ *
+ * The compiler calls this with the number of identifiers it is about to
+ * intern, so a large script does not rehash the table repeatedly.
+ *
+ * @param vm The virtual machine.
+ * @param table The string table.
+ * @param count The number of strings the table should be able to hold.
+ */
+void internTableReserve(VM* vm, InternTable* table, int32_t count);
+
+/**
+ * @brief Adds a string to the intern table.
+ *
+ * The caller must have checked with `tableFindString` that no equal string
+ * is already present.
+ *
+ * @param vm The virtual machine.
+ * @param table The string table.
+ * @param string The string to intern.
+ */
+void internTableAdd(VM* vm, InternTable* table, ObjectString* string);
+
+/**
+ * @brief A specialized find function for the string interning table.
+ *
+ * It looks up a string by its characters, length, and hash, avoiding the
+ * need to create an `ObjectString` first.
+ *
+ * @param table The string table.
+ * @param chars The characters of the string to find.
+ * @param length The length of the string.
+ * @param hash The hash of the string.
+ * @return ObjectString* The found string object, or NULL if not found.
+ */
+ObjectString* tableFindString(InternTable* table, const char* chars,
+                              int32_t length, uint32_t hash);
 
 /**
  * @brief Removes entries from the string table whose keys are unmarked (white).
@@ -121,9 +220,10 @@ void markTable(Table* table);
  * This is a special GC step for the string table, which acts as a set of
  * weak references. If a string is not reachable from anywhere else, it
  * should be collected, and its entry in the intern table must be removed.
+ * The table is compacted in place, so no tombstones are left behind.
  *
  * @param table The string table.
  */
-void tableRemoveWhite(Table* table);
+void tableRemoveWhite(InternTable* table);
 
 #endif
\ No newline at end of file
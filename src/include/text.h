@@ -0,0 +1,45 @@
+/**
+ * @file text.h
+ * @brief Byte-string search and scan routines used by the string natives.
+ *
+ * On x86 the routines compare 16 bytes at a time with SSE2; elsewhere, or
+ * when `VECTOR_NO_SIMD` is defined, they fall back to scalar loops. Strings
+ * are treated as plain bytes, without any character encoding.
+ */
+
+#ifndef corelox_text_h
+#define corelox_text_h
+
+#include "common.h"
+
+/**
+ * @brief Finds the first occurrence of a needle in a string.
+ *
+ * @param text The string to search.
+ * @param length The length of `text`.
+ * @param needle The string to look for.
+ * @param needleLength The length of `needle`.
+ * @param start The index in `text` to start searching at.
+ * @return int32_t The index of the occurrence, or -1 if there is none. An
+ * empty needle is found at `start`.
+ */
+int32_t textFind(const char* text, int32_t length, const char* needle,
+                 int32_t needleLength, int32_t start);
+
+/**
+ * @brief Copies a string, converting ASCII lowercase letters to uppercase.
+ * @param dest The buffer receiving the result (may equal `src`).
+ * @param src The source string.
+ * @param length The number of bytes to convert.
+ */
+void textToUpper(char* dest, const char* src, int32_t length);
+
+/**
+ * @brief Copies a string, converting ASCII uppercase letters to lowercase.
+ * @param dest The buffer receiving the result (may equal `src`).
+ * @param src The source string.
+ * @param length The number of bytes to convert.
+ */
+void textToLower(char* dest, const char* src, int32_t length);
+
+#endif
@@ -12,10 +12,13 @@
 #define corelox_value_h
 
 #include "common.h"
+#include "output.h"
 
 // Forward declarations for object types used in Value.
 typedef struct Object Object;
 typedef struct ObjectString ObjectString;
+// Forward declaration of the virtual machine, which owns every allocation.
+typedef struct VM VM;
 
 #ifdef NAN_BOXING
 
@@ -32,6 +35,20 @@ typedef struct ObjectString ObjectString;
 #define TAG_FALSE 2  // 10
 #define TAG_TRUE 3   // 11
 
+// Immediate 32-bit integers set bit 48 of a quiet NaN and keep the integer in
+// the low 32 bits. Bits 48-49 are clear for nil and booleans.
+#define TAG_INT ((uint64_t)1 << 48)
+#define INT_MASK (SIGN_BIT | QNAN | ((uint64_t)3 << 48))
+
+// Strings of up to SHORT_STRING_MAX bytes are immediate too: bits 48-49 are
+// 10, the length is in bits 40-42 and byte i of the string in bits 8i-8i+7.
+// Every string value that short is stored this way, so equality stays a
+// comparison of the bits.
+#define TAG_SHORT_STRING ((uint64_t)2 << 48)
+#define SHORT_STRING_MAX 5
+// Size of a buffer that can hold any unpacked short string and its NUL.
+#define SHORT_STRING_BUFFER 8
+
 // With NaN boxing, a Value is just a 64-bit integer.
 typedef uint64_t Value;
 
@@ -39,17 +56,26 @@ typedef uint64_t Value;
 #define IS_BOOL(value) ((value | 1) == TRUE_VAL)
 // Macro for checking if value is of nil type.
 #define IS_NIL(value) ((value) == NIL_VAL)
-// Macro for checking if value is of number type.
-#define IS_NUMBER(value) (((value) & QNAN) != QNAN)
+// Macro for checking if value is an immediate integer.
+#define IS_INT(value) (((value) & INT_MASK) == (QNAN | TAG_INT))
+// Macro for checking if value is of number type (double or integer).
+#define IS_NUMBER(value) (((value) & QNAN) != QNAN || IS_INT(value))
 // Macro for checking if value is of object type.
 #define IS_OBJECT(value) (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+// Macro for checking if value is an immediate short string.
+#define IS_SHORT_STRING(value) \
+    (((value) & INT_MASK) == (QNAN | TAG_SHORT_STRING))
 
 // Macros for converting a Value to a C boolean type.
 #define AS_BOOL(value) ((value) == TRUE_VAL)
+// Macros for converting an immediate integer Value to a C int32_t type.
+#define AS_INT(value) ((int32_t)(uint32_t)(value))
 // Macros for converting a Value to a C double type.
 #define AS_NUMBER(value) valueToNum(value)
 // Macros for converting a Value to an object type.
 #define AS_OBJECT(value) ((Object*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+// Macros for getting the length of an immediate short string Value.
+#define SHORT_STRING_LENGTH(value) ((int32_t)(((value) >> 40) & 7))
 
 // Macros for converting a C type to a boolean Value.
 #define BOOL_VAL(b) ((b) ? TRUE_VAL : FALSE_VAL)
@@ -59,11 +85,15 @@ typedef uint64_t Value;
 #define NIL_VAL ((Value)(uint64_t)(QNAN | TAG_NIL))
 // Macros for converting a C type to a number Value.
 #define NUMBER_VAL(num) numToValue(num)
+// Macros for converting a C int32_t to an immediate integer Value.
+#define INT_VAL(i) ((Value)(QNAN | TAG_INT | (uint32_t)(i)))
 // Macros for converting a C type to a object Value.
 #define OBJECT_VAL(obj) (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
 
 // Helper to convert a Clox Value back to a C double.
 static inline double valueToNum(Value value) {
+    if (IS_INT(value)) return (double)AS_INT(value);
+
     double num;
     memcpy(&num, &value, sizeof(Value));
     return num;
@@ -76,6 +106,25 @@ static inline Value numToValue(double num) {
     return value;
 }
 
+// Helper to pack up to SHORT_STRING_MAX characters into an immediate Value.
+static inline Value shortStringToValue(const char* chars, int32_t length) {
+    uint64_t bits = 0;
+    for (int32_t i = 0; i < length; i++) {
+        bits |= (uint64_t)(uint8_t)chars[i] << (i * 8);
+    }
+    return QNAN | TAG_SHORT_STRING | ((uint64_t)length << 40) | bits;
+}
+
+// Helper to unpack an immediate short string into a NUL-terminated buffer of
+// SHORT_STRING_BUFFER bytes.
+static inline void valueToShortString(Value value, char* buffer) {
+    int32_t length = SHORT_STRING_LENGTH(value);
+    for (int32_t i = 0; i < length; i++) {
+        buffer[i] = (char)(value >> (i * 8));
+    }
+    buffer[length] = '\0';
+}
+
 #else
 
 //-- Tagged Union Implementation (when NaN boxing is disabled) --//
@@ -111,6 +160,14 @@ typedef struct {
 #define AS_BOOL(value) ((value).as.boolean)
 // Macros for converting a Value to a C double type.
 #define AS_NUMBER(value) ((value).as.number)
+
+// Immediate integers and strings only exist with NaN boxing; every number is
+// a double and every string an object.
+#define IS_INT(value) false
+#define IS_SHORT_STRING(value) false
+#define SHORT_STRING_BUFFER 8
+#define AS_INT(value) ((int32_t)AS_NUMBER(value))
+#define INT_VAL(i) NUMBER_VAL((double)(i))
 // Macros for converting a Value to an object type.
 #define AS_OBJECT(value) ((value).as.object)
 
@@ -144,25 +201,39 @@ void initValueArray(ValueArray* array);
 
 /**
  * @brief Frees all memory used by a ValueArray.
+ * @param vm The virtual machine.
  * @param array The array to free.
  */
-void freeValueArray(ValueArray* array);
+void freeValueArray(VM* vm, ValueArray* array);
 
 /**
  * @brief Appends a value to a ValueArray.
  *
  * Automatically grows the array's capacity if needed.
+ * @param vm The virtual machine.
  * @param array The array to write to.
  * @param value The value to append.
  */
-void writeValueArray(ValueArray* array, Value value);
+void writeValueArray(VM* vm, ValueArray* array, Value value);
 
 //-----------------------------------------------------------------------------
 //- Value Operations
 //-----------------------------------------------------------------------------
 
+/**
+ * @brief Writes a human-readable representation of a Clox value to an output
+ * buffer.
+ * @param output The output buffer.
+ * @param value The value to write.
+ */
+void writeValue(OutputBuffer* output, Value value);
+
 /**
  * @brief Prints a human-readable representation of a Clox value to stdout.
+ *
+ * Unlike `print` statements, which go through the VM's output buffer, this
+ * writes the value out immediately; it is meant for debugging output.
+ *
  * @param value The value to print.
  */
 void printValue(Value value);
@@ -170,7 +241,8 @@ void printValue(Value value);
 /**
  * @brief Checks if two Clox values are equal.
  *
- * - Numbers are compared by their numeric value.
+ * - Numbers are compared by their numeric value, whether they are stored as
+ *   immediate integers or as doubles.
  * - `nil` is equal to `nil`.
  * - Booleans are compared by their truthiness.
  * - Objects (strings, functions, etc.) are compared by reference identity.
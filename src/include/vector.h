@@ -0,0 +1,105 @@
+/**
+ * @file vector.h
+ * @brief Bulk numeric kernels over contiguous arrays of doubles.
+ *
+ * These back the natives of `ObjectFloat64Array`. On x86 the kernels use
+ * SSE2 or AVX2 (with FMA), picked at runtime by `initVectorKernels`, and fall
+ * back to plain scalar loops elsewhere. Defining `VECTOR_NO_SIMD` at build
+ * time forces the scalar kernels.
+ */
+
+#ifndef corelox_vector_h
+#define corelox_vector_h
+
+#include "common.h"
+
+/**
+ * @brief Selects the fastest kernels supported by the running CPU.
+ *
+ * Must be called before any other function in this file. Every VM calls it,
+ * from whatever thread it runs on, and only the first call selects.
+ */
+void initVectorKernels();
+
+/**
+ * @brief Returns the name of the selected kernels ("avx2", "sse2", "scalar").
+ * @return const char* The name of the kernel set.
+ */
+const char* vectorKernelName();
+
+/**
+ * @brief Sums an array of doubles.
+ *
+ * The SIMD kernels add in a different order than the scalar loop, so the
+ * result may differ in the last bits.
+ *
+ * @param values The array to sum.
+ * @param count The number of elements.
+ * @return double The sum, or 0 for an empty array.
+ */
+double vectorSum(const double* values, int32_t count);
+
+/**
+ * @brief Computes the dot product of two arrays of doubles.
+ * @param a The first array.
+ * @param b The second array.
+ * @param count The number of elements in each array.
+ * @return double The dot product, or 0 for empty arrays.
+ */
+double vectorDot(const double* a, const double* b, int32_t count);
+
+/**
+ * @brief Multiplies every element of an array by a factor.
+ * @param dest The array receiving the result (may equal `src`).
+ * @param src The source array.
+ * @param factor The factor to multiply by.
+ * @param count The number of elements.
+ */
+void vectorScale(double* dest, const double* src, double factor,
+                 int32_t count);
+
+/**
+ * @brief Adds two arrays of doubles element-wise.
+ * @param dest The array receiving the result (may equal `a` or `b`).
+ * @param a The first array.
+ * @param b The second array.
+ * @param count The number of elements in each array.
+ */
+void vectorAdd(double* dest, const double* a, const double* b, int32_t count);
+
+/**
+ * @brief Finds the smallest element of a non-empty array.
+ *
+ * NaN elements are skipped, unless the first element is NaN, in which case
+ * the result is NaN.
+ *
+ * @param values The array to search.
+ * @param count The number of elements, at least 1.
+ * @return double The smallest element.
+ */
+double vectorMin(const double* values, int32_t count);
+
+/**
+ * @brief Finds the largest element of a non-empty array.
+ *
+ * NaN elements are handled as in `vectorMin`.
+ *
+ * @param values The array to search.
+ * @param count The number of elements, at least 1.
+ * @return double The largest element.
+ */
+double vectorMax(const double* values, int32_t count);
+
+/**
+ * @brief Sorts an array of doubles in ascending order.
+ *
+ * Uses an LSD radix sort over the IEEE 754 bit patterns, so the order is
+ * total: -0 sorts before 0 and NaNs sort to the ends according to their sign.
+ *
+ * @param values The array to sort in place.
+ * @param scratch A buffer of `2 * count` elements used by the sort.
+ * @param count The number of elements.
+ */
+void vectorSort(double* values, uint64_t* scratch, int32_t count);
+
+#endif
@@ -10,8 +10,10 @@
 #ifndef corelox_vm_h
 #define corelox_vm_h
 
+#include "bytecode.h"
 #include "chunk.h"
 #include "object.h"
+#include "output.h"
 #include "table.h"
 #include "value.h"
 
@@ -19,28 +21,72 @@
 #define FRAMES_MAX 64
 // The maximum number of values that can be on the stack.
 #define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+// The number of values kept free above the deepest point of a frame, for the
+// values instructions and natives push while they run.
+#define STACK_SCRATCH 8
+// The number of values a coroutine's stack starts with; it doubles as needed,
+// up to `STACK_MAX`.
+#define COROUTINE_STACK_INITIAL UINT8_COUNT
+// The number of call frames a coroutine's stack starts with; it doubles as
+// needed, up to `FRAMES_MAX`.
+#define COROUTINE_FRAMES_INITIAL 4
 
 // Represents a single active function call.
-typedef struct {
+struct CallFrame {
     ObjectClosure* closure;  ///< The closure being executed.
     uint8_t*
         ip;  ///< The instruction pointer, pointing to the next instruction.
     Value* slots;  ///< A pointer to the first stack slot used by this function.
-} CallFrame;
+};
 
-// The main Virtual Machine struct, holding all runtime state.
-typedef struct {
-    CallFrame frames[FRAMES_MAX];  ///< The array of active call frames.
+// A call from a native back into Lox, kept on the C stack while it runs so
+// that stack traces can show the native (see `callFromNative`).
+typedef struct NativeCall {
+    const NativeSpec* native;      ///< The native making the call.
+    int32_t frameCount;            ///< Its stack's frame count at the call.
+    ObjectCoroutine* stack;        ///< That stack: a coroutine, or NULL.
+    struct NativeCall* enclosing;  ///< The call it runs in, or NULL.
+} NativeCall;
+
+// A native defined by a host through the C API, owned by the VM it is defined
+// in.
+typedef struct HostNative {
+    NativeSpec spec;          ///< How to call it, with a name of its own.
+    struct HostNative* next;  ///< The native defined before it, or NULL.
+} HostNative;
+
+// The main Virtual Machine struct, holding all runtime state. Nothing is
+// shared between instances, so several VMs can run in one process.
+//
+// The stack registers below belong to the stack that is running: the main
+// stack, or the stack of the running coroutine.
+struct VM {
+    CallFrame* frames;   ///< The array of active call frames.
     int32_t frameCount;  ///< The number of currently active call frames.
 
-    Value stack[STACK_MAX];  ///< The runtime value stack.
+    Value* stack;  ///< The runtime value stack.
     Value*
         stackTop;  ///< A pointer to the element just past the top of the stack.
 
     Table globals;                ///< A hash table for global variables.
-    Table strings;                ///< The string intern table.
+    InternTable strings;          ///< The string intern table.
     ObjectUpvalue* openUpvalues;  ///< A linked list of open upvalues.
 
+    ObjectCoroutine* coroutine;  ///< The running coroutine, or NULL.
+    StackSegment mainStack;      ///< The main stack, of `STACK_MAX` slots.
+    struct EventLoop* loop;      ///< The event loop, created by the first I/O.
+    struct WorkerPool* pool;     ///< The parallel job threads, or NULL.
+    bool waitingForIo;           ///< Set by an I/O native that must wait.
+
+    // A native calling back into Lox runs the call in a nested `run`, which
+    // returns when the frame count on the native's stack is back to where it
+    // was (see `callFromNative`).
+    const NativeSpec* runningNative;  ///< The native called last, or NULL.
+    NativeCall* nativeCall;           ///< The innermost one running, or NULL.
+    int32_t baseFrame;                ///< The frame count it ends at.
+    ObjectCoroutine* baseStack;       ///< Its stack: a coroutine, or NULL.
+    bool nativeFailed;                ///< Set when such a call failed.
+
     Object* objects;  ///< A linked list of all heap-allocated objects.
 
     int32_t grayCount;      ///< The number of objects in the gray stack.
@@ -49,8 +95,35 @@ typedef struct {
     size_t bytesAllocated;  ///< Total bytes of managed memory allocated.
     size_t nextGC;          ///< The memory threshold for the next GC run.
 
-    ObjectString* initString;  ///< A cached reference to the "init" string.
-} VM;
+    ObjectString* initString;   ///< A cached reference to the "init" string.
+    LoadedImage* images;        ///< The bytecode files loaded so far.
+    bool lazyCompilation;       ///< Whether bodies are compiled on first call.
+    struct Parser* parser;      ///< The parser compiling code, or NULL.
+    struct FrozenCode* frozen;  ///< The frozen code attached, or NULL.
+
+    // Without frozen code attached, the code the VM compiled is frozen when
+    // it is first sent to another VM (see `shareFunctions`).
+    struct FrozenCode* sharedCode;  ///< The latest frozen copy, or NULL.
+    ValueArray sharedRoots;  ///< The functions copied, besides nested ones.
+    Map twins;  ///< Each function copied and its twin, in both directions.
+
+    OutputBuffer output;  ///< Buffered `print` output.
+
+    ValueArray handles;       ///< The values held for the C API, by handle.
+    bool* releasedHandles;    ///< Whether each handle is released, by handle.
+    int32_t freeHandle;       ///< The handle released last, or -1.
+    int32_t pushedArguments;  ///< The arguments pushed for the next C call.
+    Value result;             ///< The result of the last C API call.
+    StringView resultView;    ///< The characters of `result`, if a string.
+
+    // A host native reads its arguments and sets its result through these,
+    // while it runs.
+    HostNative* hostNatives;  ///< The natives defined by the host, or NULL.
+    const Value* hostArgs;    ///< The running host native's arguments, or NULL.
+    int32_t hostArgCount;     ///< The number of them.
+    Value hostResult;         ///< The value it returns, nil unless it is set.
+    StringView argumentViews[UINT8_COUNT];  ///< Its string arguments' views.
+};
 
 // The possible results of an interpretation attempt.
 typedef enum {
@@ -59,9 +132,6 @@ typedef enum {
     INTERPRET_RUNTIME_ERROR
 } InterpretResult;
 
-// A global instance of the VM.
-extern VM vm;
-
 //-----------------------------------------------------------------------------
 //- VM Initialization and Teardown
 //-----------------------------------------------------------------------------
@@ -70,13 +140,16 @@ extern VM vm;
  * @brief Initializes the virtual machine.
  *
  * Sets up the stack, global tables, and defines native functions.
+ *
+ * @param vm The virtual machine.
  */
-void initVM();
+void initVM(VM* vm);
 
 /**
  * @brief Frees all resources used by the VM.
+ * @param vm The virtual machine.
  */
-void freeVM();
+void freeVM(VM* vm);
 
 //-----------------------------------------------------------------------------
 //- Public Interpreter Interface
@@ -88,10 +161,105 @@ void freeVM();
  * This function orchestrates the entire process: compiling the source code
  * into bytecode and then executing that bytecode in the VM.
  *
- * @param source The Clox source code to interpret.
+ * @param vm The virtual machine.
+ * @param source The Clox source code to interpret, which does not need to be
+ * NUL-terminated.
+ * @param length The length of the source in bytes.
  * @return InterpretResult The result of the interpretation.
  */
-InterpretResult interpret(const char* source);
+InterpretResult interpret(VM* vm, const char* source, size_t length);
+
+/**
+ * @brief Runs an already compiled top-level function.
+ *
+ * This is how scripts loaded from bytecode files are executed; `interpret`
+ * calls it after compiling.
+ *
+ * @param vm The virtual machine.
+ * @param function The top-level function, as returned by `compile` or
+ * `loadBytecode`.
+ * @return InterpretResult The result of the execution.
+ */
+InterpretResult interpretFunction(VM* vm, ObjectFunction* function);
+
+/**
+ * @brief Calls the function on the stack below its arguments and runs it to
+ * completion.
+ *
+ * Must not be called while the VM is already running code.
+ *
+ * @param vm The virtual machine.
+ * @param argCount The number of arguments on top of the stack.
+ * @return InterpretResult The result of the execution. On success, the
+ * function and its arguments are replaced by the value it returned.
+ */
+InterpretResult interpretCall(VM* vm, int32_t argCount);
+
+/**
+ * @brief Calls a value from a native function and runs it to completion.
+ *
+ * The call runs on the native's stack, above its arguments, in a nested
+ * `run` that returns when the called function does. The function can resume
+ * coroutines and call natives that call back in turn, but can't yield from
+ * the native's stack or wait for I/O.
+ *
+ * The stack may move during the call, so the native must not read its
+ * `args` afterwards; values read from them before stay valid. Values the
+ * native creates must be pushed to survive the call.
+ *
+ * @param vm The virtual machine.
+ * @param callee The function, class or bound method to call.
+ * @param argCount The number of arguments.
+ * @param args The arguments, which must not point into the stack.
+ * @param result A pointer where the value it returned will be stored.
+ * @return bool True on success. False once a runtime error has been reported
+ * and the stack reset: the native must then return at once, without popping
+ * anything, and what it returns is ignored.
+ */
+bool callFromNative(VM* vm, Value callee, int32_t argCount, const Value* args,
+                    Value* result);
+
+//-----------------------------------------------------------------------------
+//- Native Functions
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Defines a native function as a global variable.
+ *
+ * This is how a host adds its own natives, after `initVM`.
+ *
+ * @param vm The virtual machine.
+ * @param spec How to call the function, which must outlive the VM.
+ */
+void defineNative(VM* vm, const NativeSpec* spec);
+
+/**
+ * @brief Reports a runtime error from a native function.
+ *
+ * The error is reported with a stack trace, like those the VM raises, and
+ * the stack is reset. The native must then return at once, without popping
+ * anything; what it returns is ignored.
+ *
+ * @param vm The virtual machine.
+ * @param format A printf-style format string for the error message.
+ * @param ... Arguments for the format string.
+ */
+void nativeError(VM* vm, const char* format, ...);
+
+/**
+ * @brief Finds the name a native function is defined under.
+ * @param spec The native's spec.
+ * @return const char* The name, or NULL if it is not a built-in native.
+ */
+const char* getNativeName(const NativeSpec* spec);
+
+/**
+ * @brief Finds the built-in native function defined under a name.
+ * @param name The characters of the name.
+ * @param length The length of the name.
+ * @return const NativeSpec* The native's spec, or NULL if there is none.
+ */
+const NativeSpec* lookupNative(const char* name, int32_t length);
 
 //-----------------------------------------------------------------------------
 //- Stack Operations
@@ -99,14 +267,16 @@ InterpretResult interpret(const char* source);
 
 /**
  * @brief Pushes a value onto the top of the stack.
+ * @param vm The virtual machine.
  * @param value The value to push.
  */
-void push(Value value);
+void push(VM* vm, Value value);
 
 /**
  * @brief Pops and returns the value from the top of the stack.
+ * @param vm The virtual machine.
  * @return Value The popped value.
  */
-Value pop();
+Value pop(VM* vm);
 
 #endif
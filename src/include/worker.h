@@ -0,0 +1,162 @@
+/**
+ * @file worker.h
+ * @brief Worker VMs on their own threads, and channels between VMs.
+ *
+ * Each worker runs a function in a VM of its own, so scripts use several
+ * cores without any lock around a shared heap. VMs never share mutable
+ * objects: values sent to a worker or through a channel are copied into a
+ * message outside of any heap and rebuilt in the receiving VM, except for
+ * numbers, short strings and frozen code, which are passed as they are.
+ */
+
+#ifndef corelox_worker_h
+#define corelox_worker_h
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+// The number of chunks `parallelMap` and `parallelReduce` split a list into
+// per thread, so that threads finishing early can steal work.
+#ifndef PARALLEL_CHUNKS_PER_THREAD
+#define PARALLEL_CHUNKS_PER_THREAD 8
+#endif
+
+// The threads running a VM's parallel jobs (see worker.c).
+typedef struct WorkerPool WorkerPool;
+
+//-----------------------------------------------------------------------------
+//- Channels
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Creates a channel.
+ * @return Channel* The channel, with one reference for its creator.
+ */
+Channel* createChannel(void);
+
+/**
+ * @brief Drops a reference to a channel, freeing it and the messages it still
+ * holds with the last one.
+ * @param channel The channel.
+ */
+void releaseChannel(Channel* channel);
+
+/**
+ * @brief Sends a copy of a value through a channel.
+ *
+ * Never blocks: the channel holds any number of messages.
+ *
+ * @param vm The virtual machine sending the value.
+ * @param channel The channel.
+ * @param value The value.
+ * @return bool False if the value, or a value it contains, cannot be sent.
+ */
+bool sendValue(VM* vm, Channel* channel, Value value);
+
+/**
+ * @brief Takes the oldest message from a channel, waiting for one if it is
+ * empty.
+ * @param vm The virtual machine receiving the value.
+ * @param channel The channel.
+ * @param value A pointer where the copy of the sent value will be stored.
+ * @return bool False if the message holds code this VM cannot run.
+ */
+bool receiveValue(VM* vm, Channel* channel, Value* value);
+
+//-----------------------------------------------------------------------------
+//- Workers
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Starts a thread calling a function in a new VM.
+ *
+ * The worker VM starts with the frozen code of the spawning VM attached and a
+ * copy of every global of the spawning VM that can be sent. The function and
+ * the arguments are sent like values through a channel: a closure over code
+ * the spawning VM compiled itself is sent as its frozen twin, which requires
+ * stubs left by lazy compilation to compile.
+ *
+ * @param vm The virtual machine spawning the worker.
+ * @param callee The function to call.
+ * @param argCount The number of arguments.
+ * @param args The arguments.
+ * @return Worker* The worker, with one reference for its creator, or NULL
+ * after a runtime error if the callee is not a function, it or an argument
+ * cannot be sent, or the thread cannot start.
+ */
+Worker* spawnWorker(VM* vm, Value callee, int32_t argCount,
+                    const Value* args);
+
+/**
+ * @brief Waits for a worker to finish and copies its result.
+ * @param vm The virtual machine that spawned the worker.
+ * @param worker The worker.
+ * @param result A pointer where the value returned by the function will be
+ * stored.
+ * @return bool False after a runtime error if the function failed with a
+ * runtime error or returned a value that cannot be sent back.
+ */
+bool joinWorker(VM* vm, Worker* worker, Value* result);
+
+/**
+ * @brief Drops the creator's reference to a worker.
+ *
+ * A worker that was never joined keeps running on its own and frees itself
+ * when its function returns.
+ *
+ * @param worker The worker.
+ */
+void releaseWorker(Worker* worker);
+
+//-----------------------------------------------------------------------------
+//- Parallel Map and Reduce
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Stops a VM's worker pool, if it has one, and frees its threads' VMs.
+ * @param vm The virtual machine.
+ */
+void freeWorkerPool(VM* vm);
+
+/**
+ * @brief Applies a function to every element of a list on the VM's worker
+ * pool.
+ *
+ * The function runs in other VMs, so it must be sendable like the function
+ * of `spawnWorker`, and should be pure: it sees a copy of the globals and of
+ * each element. The pool's threads and VMs are started by the first call
+ * and kept for the next ones, but every call still copies the globals into
+ * each of them, so it pays off when the calls of the function outweigh
+ * that.
+ *
+ * @param vm The virtual machine.
+ * @param list The list.
+ * @param fn The function, called with one element at a time.
+ * @return Value A new list of the results in the order of the elements, or
+ * nil after a runtime error if the function, an element or a result cannot
+ * be sent, a call fails with a runtime error, or the pool cannot start.
+ */
+Value parallelMap(VM* vm, const ObjectList* list, Value fn);
+
+/**
+ * @brief Combines the elements of a list with a function on the VM's worker
+ * pool.
+ *
+ * Each thread folds chunks of consecutive elements, and the partial results
+ * are then folded in order starting from `initial`, so the result is the
+ * same as a sequential fold only if the function is associative.
+ *
+ * @param vm The virtual machine.
+ * @param list The list.
+ * @param fn The function, called with the accumulated value and the next
+ * value.
+ * @param initial The value the fold starts from, returned for an empty list.
+ * @return Value The result, or nil after a runtime error if the function, a
+ * value or a result cannot be sent, a call fails with a runtime error, or the
+ * pool cannot start.
+ */
+Value parallelReduce(VM* vm, const ObjectList* list, Value fn,
+                     Value initial);
+
+#endif
@@ -0,0 +1,1254 @@
+/**
+ * @file io.c
+ * @brief The event loop: non-blocking I/O and timers for coroutines.
+ *
+ * Every operation that has to wait is an `IoRequest`, allocated outside of
+ * the GC heap so the kernel can keep pointers to it and its buffer. A request
+ * names the stack waiting for it and moves through the loop's queues: the
+ * queue of its descriptor or the timer heap while it is in flight, then the
+ * ready queue once it has completed. Requests are also linked into one list
+ * of all of them, which roots the waiting coroutines and lets a reset find
+ * everything in flight.
+ *
+ * With epoll, an operation is first tried directly on its non-blocking
+ * descriptor and only waits if the descriptor is not ready, so regular
+ * files, which are always ready, are read and written synchronously. With
+ * io_uring, every operation is submitted to the kernel, and all of them are
+ * submitted with a single system call the next time the loop polls.
+ */
+
+#define _GNU_SOURCE
+
+#include "io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef IO_URING
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "memory.h"
+#include "vm.h"
+
+// What a request waits for.
+typedef enum {
+    REQUEST_RUN,     ///< A task's turn to run.
+    REQUEST_IDLE,    ///< The loop to have nothing else to do.
+    REQUEST_SLEEP,   ///< A timer.
+    REQUEST_READ,    ///< Bytes from a descriptor.
+    REQUEST_WRITE,   ///< All of a buffer written to a descriptor.
+    REQUEST_ACCEPT,  ///< A connection on a listening socket.
+} RequestKind;
+
+// An operation a stack is waiting for.
+typedef struct IoRequest {
+    RequestKind kind;          ///< What the request waits for.
+    ObjectCoroutine* waiter;   ///< The waiting coroutine, or NULL for the
+                               ///< main stack.
+    int fd;                    ///< The descriptor, or -1.
+    char* buffer;              ///< The bytes read or still to write.
+    size_t length;             ///< The size of `buffer`.
+    size_t done;               ///< The bytes of `buffer` written so far.
+    int64_t result;            ///< The result, or a negated `errno`.
+    uint64_t deadline;         ///< When a timer expires, in nanoseconds.
+#ifdef IO_URING
+    struct __kernel_timespec timeout;  ///< The delay of a timer.
+    bool submitted;            ///< Whether the kernel holds the request.
+    bool polling;              ///< Whether it waits for readiness first.
+#endif
+    struct IoRequest* prev;    ///< The previous request in the loop.
+    struct IoRequest* next;    ///< The next request in the loop.
+    struct IoRequest* nextQueued;  ///< The next request in its queue.
+} IoRequest;
+
+// A first-in first-out queue of requests, linked through `nextQueued`.
+typedef struct {
+    IoRequest* head;  ///< The oldest request, or NULL.
+    IoRequest* tail;  ///< The newest request, or NULL.
+    int32_t count;    ///< The number of requests.
+} RequestQueue;
+
+// The requests waiting on one descriptor, with epoll.
+typedef struct {
+    RequestQueue readers;  ///< The reads and accepts, served in order.
+    RequestQueue writers;  ///< The writes, served in order.
+    uint32_t events;       ///< The events epoll watches for.
+} FdState;
+
+#ifdef IO_URING
+// The memory shared with the kernel by an io_uring instance.
+typedef struct {
+    int fd;                      ///< The ring's descriptor.
+    unsigned* sqHead;            ///< The submissions the kernel has taken.
+    unsigned* sqTail;            ///< The submissions written.
+    unsigned sqMask;             ///< The mask of submission indices.
+    unsigned sqEntries;          ///< The number of submission entries.
+    unsigned* sqArray;           ///< The indices of submitted entries.
+    struct io_uring_sqe* sqes;   ///< The submission entries.
+    unsigned* cqHead;            ///< The completions read.
+    unsigned* cqTail;            ///< The completions the kernel has posted.
+    unsigned cqMask;             ///< The mask of completion indices.
+    struct io_uring_cqe* cqes;   ///< The completion entries.
+    void* sqRing;                ///< The mapping of the submission ring.
+    size_t sqRingSize;           ///< The size of `sqRing`.
+    void* cqRing;                ///< The mapping of the completion ring.
+    size_t cqRingSize;           ///< The size of `cqRing`.
+    size_t sqesSize;             ///< The size of `sqes`.
+    unsigned tail;               ///< The submissions written, not yet shown.
+    unsigned toSubmit;           ///< The entries not yet submitted.
+    int32_t inFlight;            ///< The entries without a completion yet.
+} Ring;
+#endif
+
+struct EventLoop {
+    IoRequest* requests;   ///< Every request, linked through `next`.
+    RequestQueue ready;    ///< The requests whose stack can be resumed.
+    RequestQueue idle;     ///< The requests waiting for an idle loop.
+    int32_t pending;       ///< The requests in flight.
+    int32_t roundLeft;     ///< The ready stacks left before polling again.
+
+    int epoll;             ///< The epoll descriptor, or -1.
+    FdState* fds;          ///< The waiting requests, by descriptor.
+    int32_t fdCapacity;    ///< The number of entries in `fds`.
+    IoRequest** timers;    ///< The sleeping requests, as a min-heap.
+    int32_t timerCount;    ///< The number of timers.
+    int32_t timerCapacity; ///< The capacity of the heap.
+
+#ifdef IO_URING
+    bool uring;            ///< Whether the io_uring backend is used.
+    bool closing;          ///< Whether completions are only being drained.
+    Ring ring;             ///< The ring, if `uring` is set.
+#endif
+};
+
+//-----------------------------------------------------------------------------
+//- Requests
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Appends a request to a queue.
+ * @param queue The queue.
+ * @param request The request.
+ */
+static void enqueue(RequestQueue* queue, IoRequest* request) {
+    request->nextQueued = NULL;
+    if (queue->tail != NULL) {
+        queue->tail->nextQueued = request;
+    } else {
+        queue->head = request;
+    }
+    queue->tail = request;
+    queue->count++;
+}
+
+/**
+ * @brief Removes the oldest request from a queue.
+ * @param queue The queue, which must not be empty.
+ * @return IoRequest* The request.
+ */
+static IoRequest* dequeue(RequestQueue* queue) {
+    IoRequest* request = queue->head;
+    queue->head = request->nextQueued;
+    if (queue->head == NULL) queue->tail = NULL;
+    queue->count--;
+    return request;
+}
+
+/**
+ * @brief Returns the current time of a clock that never jumps.
+ * @return uint64_t The time in nanoseconds.
+ */
+static uint64_t monotonicTime(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * @brief Creates a request and links it into the loop.
+ * @param loop The event loop.
+ * @param kind What the request waits for.
+ * @param waiter The waiting coroutine, or NULL for the main stack.
+ * @param fd The descriptor, or -1.
+ * @return IoRequest* The new request.
+ */
+static IoRequest* newRequest(EventLoop* loop, RequestKind kind,
+                             ObjectCoroutine* waiter, int fd) {
+    IoRequest* request = ALLOCATE(NULL, IoRequest, 1);
+    memset(request, 0, sizeof(IoRequest));
+    request->kind = kind;
+    request->waiter = waiter;
+    request->fd = fd;
+
+    request->prev = NULL;
+    request->next = loop->requests;
+    if (loop->requests != NULL) loop->requests->prev = request;
+    loop->requests = request;
+    return request;
+}
+
+/**
+ * @brief Unlinks a request from the loop and frees it with its buffer.
+ * @param loop The event loop.
+ * @param request The request, which must not be in any queue.
+ */
+static void freeRequest(EventLoop* loop, IoRequest* request) {
+    if (request->prev != NULL) {
+        request->prev->next = request->next;
+    } else {
+        loop->requests = request->next;
+    }
+    if (request->next != NULL) request->next->prev = request->prev;
+
+    if (request->buffer != NULL) {
+        FREE_ARRAY(NULL, char, request->buffer, request->length);
+    }
+    FREE(NULL, IoRequest, request);
+}
+
+/**
+ * @brief Moves a request that was in flight to the ready queue.
+ * @param loop The event loop.
+ * @param request The request.
+ * @param result The result, or a negated `errno`.
+ */
+static void completeRequest(EventLoop* loop, IoRequest* request,
+                            int64_t result) {
+    request->result = result;
+    loop->pending--;
+    enqueue(&loop->ready, request);
+}
+
+/**
+ * @brief Converts the result of a completed request to a Value.
+ * @param vm The virtual machine.
+ * @param request The request.
+ * @return Value The bytes read as a string, the bytes written or the
+ * accepted descriptor as a number, or nil at the end of the input, on error
+ * and for requests without a result.
+ */
+static Value requestResult(VM* vm, const IoRequest* request) {
+    if (request->result < 0) return NIL_VAL;
+    switch (request->kind) {
+        case REQUEST_READ:
+            if (request->result == 0) return NIL_VAL;
+            return copyStringValue(vm, request->buffer,
+                                   (int32_t)request->result);
+        case REQUEST_WRITE:
+        case REQUEST_ACCEPT:
+            return INT_VAL((int32_t)request->result);
+        default:
+            return NIL_VAL;
+    }
+}
+
+/**
+ * @brief Tries to finish a read, write or accept without blocking.
+ *
+ * A write goes on until its whole buffer is written.
+ * @param request The request.
+ * @return bool True if the request is finished, with its result set, false
+ * if the descriptor is not ready.
+ */
+static bool attemptRequest(IoRequest* request) {
+    for (;;) {
+        ssize_t count;
+        switch (request->kind) {
+            case REQUEST_READ:
+                count = read(request->fd, request->buffer, request->length);
+                break;
+            case REQUEST_WRITE:
+                count = write(request->fd, request->buffer + request->done,
+                              request->length - request->done);
+                break;
+            default:
+                count = accept4(request->fd, NULL, NULL,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
+                break;
+        }
+
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return false;
+            request->result = -errno;
+            return true;
+        }
+        if (request->kind == REQUEST_WRITE) {
+            request->done += count;
+            if (request->done < request->length) continue;
+            count = (ssize_t)request->length;
+        }
+        request->result = count;
+        return true;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//- The epoll Backend
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Returns the waiting requests of a descriptor, growing the table as
+ * needed.
+ * @param loop The event loop.
+ * @param fd The descriptor.
+ * @return FdState* The descriptor's entry.
+ */
+static FdState* fdState(EventLoop* loop, int fd) {
+    if (fd >= loop->fdCapacity) {
+        int32_t capacity = GROW_CAPACITY(loop->fdCapacity);
+        while (capacity <= fd) capacity *= 2;
+        loop->fds = GROW_ARRAY(NULL, FdState, loop->fds, loop->fdCapacity,
+                               capacity);
+        memset(loop->fds + loop->fdCapacity, 0,
+               sizeof(FdState) * (capacity - loop->fdCapacity));
+        loop->fdCapacity = capacity;
+    }
+    return &loop->fds[fd];
+}
+
+/**
+ * @brief Ends every request in a queue with an error.
+ * @param loop The event loop.
+ * @param queue The queue.
+ * @param error The negated `errno`.
+ */
+static void failQueue(EventLoop* loop, RequestQueue* queue, int64_t error) {
+    while (queue->head != NULL) {
+        completeRequest(loop, dequeue(queue), error);
+    }
+}
+
+/**
+ * @brief Makes epoll watch a descriptor for the events its waiting requests
+ * need, and nothing else.
+ *
+ * Requests that cannot be watched fail.
+ * @param loop The event loop.
+ * @param fd The descriptor.
+ */
+static void watchFd(EventLoop* loop, int fd) {
+    FdState* state = &loop->fds[fd];
+    uint32_t events = (state->readers.head != NULL ? EPOLLIN : 0) |
+                      (state->writers.head != NULL ? EPOLLOUT : 0);
+    if (events == state->events) return;
+
+    struct epoll_event event;
+    event.events = events;
+    event.data.fd = fd;
+    int operation = state->events == 0 ? EPOLL_CTL_ADD
+                    : events == 0      ? EPOLL_CTL_DEL
+                                       : EPOLL_CTL_MOD;
+    if (epoll_ctl(loop->epoll, operation, fd, &event) == 0) {
+        state->events = events;
+        return;
+    }
+
+    int error = errno;
+    failQueue(loop, &state->readers, -error);
+    failQueue(loop, &state->writers, -error);
+    if (state->events != 0) epoll_ctl(loop->epoll, EPOLL_CTL_DEL, fd, NULL);
+    state->events = 0;
+}
+
+/**
+ * @brief Finishes the requests at the front of a descriptor's queue until
+ * one would block.
+ * @param loop The event loop.
+ * @param queue The readers or the writers of the descriptor.
+ */
+static void serviceQueue(EventLoop* loop, RequestQueue* queue) {
+    while (queue->head != NULL && attemptRequest(queue->head)) {
+        IoRequest* request = dequeue(queue);
+        completeRequest(loop, request, request->result);
+    }
+}
+
+/**
+ * @brief Adds a sleeping request to the timer heap.
+ * @param loop The event loop.
+ * @param request The request, with its deadline set.
+ */
+static void pushTimer(EventLoop* loop, IoRequest* request) {
+    if (loop->timerCount == loop->timerCapacity) {
+        int32_t capacity = GROW_CAPACITY(loop->timerCapacity);
+        loop->timers = GROW_ARRAY(NULL, IoRequest*, loop->timers,
+                                  loop->timerCapacity, capacity);
+        loop->timerCapacity = capacity;
+    }
+
+    int32_t index = loop->timerCount++;
+    while (index > 0) {
+        int32_t parent = (index - 1) / 2;
+        if (loop->timers[parent]->deadline <= request->deadline) break;
+        loop->timers[index] = loop->timers[parent];
+        index = parent;
+    }
+    loop->timers[index] = request;
+}
+
+/**
+ * @brief Removes the timer that expires first from the heap.
+ * @param loop The event loop, with at least one timer.
+ * @return IoRequest* The sleeping request.
+ */
+static IoRequest* popTimer(EventLoop* loop) {
+    IoRequest* first = loop->timers[0];
+    IoRequest* last = loop->timers[--loop->timerCount];
+
+    int32_t index = 0;
+    for (;;) {
+        int32_t child = index * 2 + 1;
+        if (child >= loop->timerCount) break;
+        if (child + 1 < loop->timerCount &&
+            loop->timers[child + 1]->deadline < loop->timers[child]->deadline) {
+            child++;
+        }
+        if (last->deadline <= loop->timers[child]->deadline) break;
+        loop->timers[index] = loop->timers[child];
+        index = child;
+    }
+    loop->timers[index] = last;
+    return first;
+}
+
+/**
+ * @brief Waits for descriptors to become ready and for timers to expire, and
+ * completes the requests that can finish.
+ * @param loop The event loop.
+ * @param block Whether to wait for something to happen.
+ */
+static void pollEpoll(EventLoop* loop, bool block) {
+    int timeout = block ? -1 : 0;
+    if (block && loop->timerCount > 0) {
+        uint64_t now = monotonicTime();
+        uint64_t deadline = loop->timers[0]->deadline;
+        // rounded up, so the timer has expired when epoll returns
+        uint64_t milliseconds =
+            deadline <= now ? 0 : (deadline - now + 999999) / 1000000;
+        timeout = milliseconds > INT32_MAX ? INT32_MAX : (int)milliseconds;
+    }
+
+    struct epoll_event events[IO_EVENT_BATCH];
+    int count = epoll_wait(loop->epoll, events, IO_EVENT_BATCH, timeout);
+    for (int i = 0; i < count; i++) {
+        int fd = events[i].data.fd;
+        FdState* state = &loop->fds[fd];
+        uint32_t flags = events[i].events;
+        // errors and hang-ups are reported by the system calls themselves
+        if (flags & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+            serviceQueue(loop, &state->readers);
+        }
+        if (flags & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+            serviceQueue(loop, &state->writers);
+        }
+        watchFd(loop, fd);
+    }
+
+    if (loop->timerCount == 0) return;
+    uint64_t now = monotonicTime();
+    while (loop->timerCount > 0 && loop->timers[0]->deadline <= now) {
+        completeRequest(loop, popTimer(loop), 0);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//- The io_uring Backend
+//-----------------------------------------------------------------------------
+
+#ifdef IO_URING
+
+/**
+ * @brief Creates an io_uring instance and maps its rings.
+ * @param ring The ring to set up.
+ * @return bool True on success, false if the kernel does not allow io_uring
+ * or lacks the operations used here.
+ */
+static bool setupRing(Ring* ring) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int)syscall(__NR_io_uring_setup, IO_RING_ENTRIES, &params);
+    if (fd < 0) return false;
+    // fast poll came with the last of the operations used here (5.7)
+    if (!(params.features & IORING_FEAT_FAST_POLL) ||
+        !(params.features & IORING_FEAT_NODROP)) {
+        close(fd);
+        return false;
+    }
+
+    ring->fd = fd;
+    ring->sqRingSize = params.sq_off.array + params.sq_entries *
+                                                 sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries *
+                                                sizeof(struct io_uring_cqe);
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && ring->cqRingSize > ring->sqRingSize) {
+        ring->sqRingSize = ring->cqRingSize;
+    }
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sqRing == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    ring->cqRing = ring->sqRing;
+    if (!single) {
+        ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cqRing == MAP_FAILED) {
+            munmap(ring->sqRing, ring->sqRingSize);
+            close(fd);
+            return false;
+        }
+    }
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (!single) munmap(ring->cqRing, ring->cqRingSize);
+        munmap(ring->sqRing, ring->sqRingSize);
+        close(fd);
+        return false;
+    }
+
+    char* sq = ring->sqRing;
+    ring->sqHead = (unsigned*)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sqEntries = *(unsigned*)(sq + params.sq_off.ring_entries);
+    ring->sqArray = (unsigned*)(sq + params.sq_off.array);
+    char* cq = ring->cqRing;
+    ring->cqHead = (unsigned*)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    ring->tail = *ring->sqTail;
+    ring->toSubmit = 0;
+    ring->inFlight = 0;
+    return true;
+}
+
+/**
+ * @brief Unmaps a ring and closes it.
+ * @param ring The ring, with nothing in flight.
+ */
+static void closeRing(Ring* ring) {
+    munmap(ring->sqes, ring->sqesSize);
+    if (ring->cqRing != ring->sqRing) munmap(ring->cqRing, ring->cqRingSize);
+    munmap(ring->sqRing, ring->sqRingSize);
+    close(ring->fd);
+}
+
+/**
+ * @brief Submits the entries written so far and optionally waits for
+ * completions.
+ * @param ring The ring.
+ * @param waitFor The number of completions to wait for, which may be zero.
+ */
+static void enterRing(Ring* ring, unsigned waitFor) {
+    atomic_store_explicit((_Atomic unsigned*)ring->sqTail, ring->tail,
+                          memory_order_release);
+    unsigned flags = waitFor > 0 ? IORING_ENTER_GETEVENTS : 0;
+    long submitted = syscall(__NR_io_uring_enter, ring->fd, ring->toSubmit,
+                             waitFor, flags, NULL, 0);
+    if (submitted > 0) ring->toSubmit -= (unsigned)submitted;
+}
+
+/**
+ * @brief Returns a cleared submission entry, submitting the full ring first
+ * if needed.
+ * @param ring The ring.
+ * @return struct io_uring_sqe* The entry, which is submitted with the next
+ * `enterRing`.
+ */
+static struct io_uring_sqe* nextSqe(Ring* ring) {
+    unsigned head = atomic_load_explicit((_Atomic unsigned*)ring->sqHead,
+                                         memory_order_acquire);
+    while (ring->tail - head == ring->sqEntries) {
+        enterRing(ring, 0);
+        head = atomic_load_explicit((_Atomic unsigned*)ring->sqHead,
+                                    memory_order_acquire);
+    }
+
+    unsigned index = ring->tail & ring->sqMask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sqArray[index] = index;
+    ring->tail++;
+    ring->toSubmit++;
+    ring->inFlight++;
+    return sqe;
+}
+
+/**
+ * @brief Hands a request's operation to the kernel.
+ * @param loop The event loop.
+ * @param request The request.
+ */
+static void submitRequest(EventLoop* loop, IoRequest* request) {
+    struct io_uring_sqe* sqe = nextSqe(&loop->ring);
+    sqe->fd = request->fd;
+    sqe->user_data = (uint64_t)(uintptr_t)request;
+    switch (request->kind) {
+        case REQUEST_READ:
+            sqe->opcode = IORING_OP_READ;
+            sqe->addr = (uint64_t)(uintptr_t)request->buffer;
+            sqe->len = (uint32_t)request->length;
+            sqe->off = (uint64_t)-1;  // at the file position, if any
+            break;
+        case REQUEST_WRITE:
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->addr = (uint64_t)(uintptr_t)(request->buffer + request->done);
+            sqe->len = (uint32_t)(request->length - request->done);
+            sqe->off = (uint64_t)-1;
+            break;
+        case REQUEST_ACCEPT:
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+            break;
+        default:
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->fd = -1;
+            sqe->addr = (uint64_t)(uintptr_t)&request->timeout;
+            sqe->len = 1;
+            break;
+    }
+    request->submitted = true;
+}
+
+/**
+ * @brief Makes a request wait for its descriptor to become ready before its
+ * operation is submitted again.
+ *
+ * Older kernels fail operations on non-blocking descriptors with `EAGAIN`
+ * instead of waiting themselves.
+ * @param loop The event loop.
+ * @param request The request.
+ */
+static void pollRequest(EventLoop* loop, IoRequest* request) {
+    struct io_uring_sqe* sqe = nextSqe(&loop->ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = request->fd;
+    sqe->poll_events = request->kind == REQUEST_WRITE ? POLLOUT : POLLIN;
+    sqe->user_data = (uint64_t)(uintptr_t)request;
+    request->submitted = true;
+    request->polling = true;
+}
+
+/**
+ * @brief Asks the kernel to cancel a request's operation.
+ *
+ * The operation still completes, with `ECANCELED` unless it won the race.
+ * @param loop The event loop.
+ * @param request The request, which the kernel holds.
+ */
+static void cancelRequest(EventLoop* loop, IoRequest* request) {
+    struct io_uring_sqe* sqe = nextSqe(&loop->ring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)request;
+    sqe->user_data = 0;  // the completion of a cancellation is ignored
+}
+
+/**
+ * @brief Handles the completion of a request's operation.
+ * @param loop The event loop.
+ * @param request The request.
+ * @param result The result of the operation, or a negated `errno`.
+ */
+static void finishSubmission(EventLoop* loop, IoRequest* request,
+                             int32_t result) {
+    request->submitted = false;
+    if (loop->closing) return;
+
+    if (request->polling) {
+        request->polling = false;
+        if (result < 0) {
+            completeRequest(loop, request, result);
+        } else {
+            submitRequest(loop, request);
+        }
+        return;
+    }
+
+    if (request->kind == REQUEST_SLEEP) {
+        completeRequest(loop, request, 0);  // an expired timer is -ETIME
+    } else if (result == -EINTR) {
+        submitRequest(loop, request);
+    } else if (result == -EAGAIN) {
+        pollRequest(loop, request);
+    } else if (request->kind == REQUEST_WRITE && result >= 0) {
+        request->done += result;
+        if (request->done < request->length) {
+            submitRequest(loop, request);  // a short write goes on
+        } else {
+            completeRequest(loop, request, (int64_t)request->length);
+        }
+    } else {
+        completeRequest(loop, request, result);
+    }
+}
+
+/**
+ * @brief Submits what is queued, waits for completions and handles them.
+ * @param loop The event loop.
+ * @param block Whether to wait for at least one completion.
+ */
+static void pollRing(EventLoop* loop, bool block) {
+    Ring* ring = &loop->ring;
+    if (block || ring->toSubmit > 0) enterRing(ring, block ? 1 : 0);
+
+    unsigned head = *ring->cqHead;
+    unsigned tail = atomic_load_explicit((_Atomic unsigned*)ring->cqTail,
+                                         memory_order_acquire);
+    while (head != tail) {
+        const struct io_uring_cqe* cqe = &ring->cqes[head & ring->cqMask];
+        IoRequest* request = (IoRequest*)(uintptr_t)cqe->user_data;
+        int32_t result = cqe->res;
+        head++;
+        ring->inFlight--;
+        if (request != NULL) finishSubmission(loop, request, result);
+    }
+    atomic_store_explicit((_Atomic unsigned*)ring->cqHead, head,
+                          memory_order_release);
+}
+
+/**
+ * @brief Cancels every operation the kernel holds and waits until all of
+ * them have completed, so no buffer is written after it is freed.
+ * @param loop The event loop.
+ */
+static void drainRing(EventLoop* loop) {
+    loop->closing = true;
+    for (IoRequest* request = loop->requests; request != NULL;
+         request = request->next) {
+        if (request->submitted) cancelRequest(loop, request);
+    }
+    while (loop->ring.inFlight > 0) pollRing(loop, true);
+    loop->closing = false;
+}
+
+#endif
+
+//-----------------------------------------------------------------------------
+//- Event Loop
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Returns a VM's event loop, creating it on first use.
+ * @param vm The virtual machine.
+ * @return EventLoop* The event loop.
+ */
+static EventLoop* getLoop(VM* vm) {
+    if (vm->loop != NULL) return vm->loop;
+
+    EventLoop* loop = ALLOCATE(NULL, EventLoop, 1);
+    memset(loop, 0, sizeof(EventLoop));
+    loop->epoll = -1;
+#ifdef IO_URING
+    loop->uring = setupRing(&loop->ring);
+    if (!loop->uring)
+#endif
+    {
+        loop->epoll = epoll_create1(EPOLL_CLOEXEC);
+        if (loop->epoll < 0) exit(1);
+    }
+
+    // writing to a closed pipe or socket fails with EPIPE instead
+    signal(SIGPIPE, SIG_IGN);
+    vm->loop = loop;
+    return loop;
+}
+
+/**
+ * @brief Starts waiting for a request that is in flight.
+ * @param vm The virtual machine.
+ * @param request The request.
+ * @return Value Nil, which the result replaces when the stack is resumed.
+ */
+static Value startWaiting(VM* vm, IoRequest* request) {
+    EventLoop* loop = vm->loop;
+    loop->pending++;
+#ifdef IO_URING
+    if (loop->uring) {
+        submitRequest(loop, request);
+        vm->waitingForIo = true;
+        return NIL_VAL;
+    }
+#endif
+
+    if (request->kind == REQUEST_SLEEP) {
+        pushTimer(loop, request);
+    } else {
+        FdState* state = fdState(loop, request->fd);
+        enqueue(request->kind == REQUEST_WRITE ? &state->writers
+                                               : &state->readers,
+                request);
+        watchFd(loop, request->fd);
+    }
+    vm->waitingForIo = true;
+    return NIL_VAL;
+}
+
+/**
+ * @brief Finishes a read, write or accept at once if it cannot have to wait
+ * behind others and its descriptor is ready.
+ * @param vm The virtual machine.
+ * @param request The request.
+ * @param value A pointer where the result is stored if it finished.
+ * @return bool True if the request finished and was freed.
+ */
+static bool finishAtOnce(VM* vm, IoRequest* request, Value* value) {
+    EventLoop* loop = vm->loop;
+#ifdef IO_URING
+    if (loop->uring) return false;
+#endif
+
+    FdState* state = fdState(loop, request->fd);
+    const RequestQueue* queue = request->kind == REQUEST_WRITE
+                                    ? &state->writers
+                                    : &state->readers;
+    if (queue->head != NULL || !attemptRequest(request)) return false;
+
+    *value = requestResult(vm, request);
+    freeRequest(loop, request);
+    return true;
+}
+
+/**
+ * @brief Frees every request of a loop after cancelling what is in flight.
+ * @param loop The event loop.
+ * @param endWaiters Whether the coroutines waiting on the requests are done.
+ */
+static void clearRequests(EventLoop* loop, bool endWaiters) {
+#ifdef IO_URING
+    if (loop->uring) drainRing(loop);
+#endif
+    for (int32_t fd = 0; fd < loop->fdCapacity; fd++) {
+        if (loop->fds[fd].events != 0) {
+            epoll_ctl(loop->epoll, EPOLL_CTL_DEL, fd, NULL);
+        }
+        loop->fds[fd] = (FdState){0};
+    }
+
+    while (loop->requests != NULL) {
+        IoRequest* request = loop->requests;
+        // the stack stays allocated: upvalues may still point into it
+        if (endWaiters && request->waiter != NULL) {
+            request->waiter->state = COROUTINE_DONE;
+        }
+        freeRequest(loop, request);
+    }
+    loop->ready = (RequestQueue){NULL, NULL, 0};
+    loop->idle = (RequestQueue){NULL, NULL, 0};
+    loop->pending = 0;
+    loop->roundLeft = 0;
+    loop->timerCount = 0;
+}
+
+/**
+ * @brief Frees a VM's event loop, if it has one.
+ *
+ * Operations still in flight are cancelled first; descriptors opened by the
+ * script are left open.
+ *
+ * @param vm The virtual machine.
+ */
+void freeEventLoop(VM* vm) {
+    EventLoop* loop = vm->loop;
+    if (loop == NULL) return;
+
+    clearRequests(loop, false);
+#ifdef IO_URING
+    if (loop->uring) closeRing(&loop->ring);
+#endif
+    if (loop->epoll >= 0) close(loop->epoll);
+    FREE_ARRAY(NULL, FdState, loop->fds, loop->fdCapacity);
+    FREE_ARRAY(NULL, IoRequest*, loop->timers, loop->timerCapacity);
+    FREE(NULL, EventLoop, loop);
+    vm->loop = NULL;
+}
+
+/**
+ * @brief Forgets every stack waiting on a VM's event loop, after a runtime
+ * error has reset the VM's stacks.
+ *
+ * Operations in flight are cancelled and the coroutines that waited on them
+ * are done.
+ *
+ * @param vm The virtual machine.
+ */
+void resetEventLoop(VM* vm) {
+    if (vm->loop != NULL) clearRequests(vm->loop, true);
+}
+
+/**
+ * @brief Marks the coroutines waiting on a VM's event loop for garbage
+ * collection.
+ * @param vm The virtual machine.
+ */
+void markEventLoop(VM* vm) {
+    if (vm->loop == NULL) return;
+    for (IoRequest* request = vm->loop->requests; request != NULL;
+         request = request->next) {
+        markObject(vm, (Object*)request->waiter);
+    }
+}
+
+/**
+ * @brief Waits for I/O, without blocking unless asked to.
+ * @param vm The virtual machine.
+ * @param loop The event loop.
+ * @param block Whether to wait until something completes.
+ */
+static void pollEvents(VM* vm, EventLoop* loop, bool block) {
+    if (block) flushOutput(&vm->output);  // show what came before the wait
+#ifdef IO_URING
+    if (loop->uring) {
+        pollRing(loop, block);
+        return;
+    }
+#endif
+    pollEpoll(loop, block);
+}
+
+/**
+ * @brief Waits until the event loop can resume a stack and takes it.
+ *
+ * Called after the running stack has started waiting. Print output is
+ * flushed before blocking.
+ *
+ * @param vm The virtual machine.
+ * @param waiter A pointer where the coroutine to resume, or NULL for the main
+ * stack, will be stored.
+ * @param value A pointer where the result of the operation it waited for
+ * will be stored.
+ * @return bool False if nothing is left that could ever complete.
+ */
+bool nextIoEvent(VM* vm, ObjectCoroutine** waiter, Value* value) {
+    EventLoop* loop = vm->loop;
+    if (loop == NULL) return false;
+
+    // I/O is taken once per pass over the ready stacks, so tasks that keep
+    // yielding cannot starve the others
+    if (loop->roundLeft == 0) {
+        if (loop->pending > 0) pollEvents(vm, loop, false);
+        loop->roundLeft = loop->ready.count;
+    }
+
+    while (loop->ready.head == NULL) {
+        if (loop->pending == 0) {
+            if (loop->idle.head == NULL) return false;
+            loop->ready = loop->idle;
+            loop->idle = (RequestQueue){NULL, NULL, 0};
+            break;
+        }
+        pollEvents(vm, loop, true);
+    }
+    if (loop->roundLeft > 0) loop->roundLeft--;
+
+    // the result is converted while the request still roots the waiter
+    IoRequest* request = dequeue(&loop->ready);
+    *waiter = request->waiter;
+    *value = requestResult(vm, request);
+    freeRequest(loop, request);
+    return true;
+}
+
+/**
+ * @brief Lets a task run when the running stack next waits.
+ *
+ * Tasks are run in the order they are queued, each until it waits, yields
+ * or returns.
+ *
+ * @param vm The virtual machine.
+ * @param task The task, which is either new or the running one yielding.
+ */
+void queueTask(VM* vm, ObjectCoroutine* task) {
+    EventLoop* loop = getLoop(vm);
+    enqueue(&loop->ready, newRequest(loop, REQUEST_RUN, task, -1));
+}
+
+/**
+ * @brief Makes the running stack wait until no task is ready and no
+ * operation is in flight.
+ * @param vm The virtual machine.
+ */
+void waitForIdle(VM* vm) {
+    EventLoop* loop = vm->loop;
+    if (loop == NULL) return;  // nothing was ever started
+    enqueue(&loop->idle, newRequest(loop, REQUEST_IDLE, vm->coroutine, -1));
+    vm->waitingForIo = true;
+}
+
+//-----------------------------------------------------------------------------
+//- Operations
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Reads up to a number of bytes from a descriptor.
+ * @param vm The virtual machine.
+ * @param fd The descriptor.
+ * @param count The largest number of bytes to read.
+ * @return Value The bytes read, as a string, or nil at the end of the input
+ * or on error.
+ */
+Value ioRead(VM* vm, int fd, int32_t count) {
+    if (fd < 0 || count <= 0) return NIL_VAL;
+
+    EventLoop* loop = getLoop(vm);
+    IoRequest* request = newRequest(loop, REQUEST_READ, vm->coroutine, fd);
+    request->buffer = ALLOCATE(NULL, char, count);
+    request->length = count;
+
+    Value value;
+    if (finishAtOnce(vm, request, &value)) return value;
+    return startWaiting(vm, request);
+}
+
+/**
+ * @brief Writes all of a string to a descriptor.
+ * @param vm The virtual machine.
+ * @param fd The descriptor.
+ * @param string The string.
+ * @return Value The number of bytes written, or nil on error.
+ */
+Value ioWrite(VM* vm, int fd, Value string) {
+    if (fd < 0 || !IS_STRING(string)) return NIL_VAL;
+    // keep the order of what was printed before
+    if (fd == STDOUT_FILENO || fd == STDERR_FILENO) flushOutput(&vm->output);
+
+    StringView view;
+    viewString(string, &view);
+    if (view.length == 0) return INT_VAL(0);
+
+    // the bytes are copied, so the string may be collected while they wait
+    EventLoop* loop = getLoop(vm);
+    IoRequest* request = newRequest(loop, REQUEST_WRITE, vm->coroutine, fd);
+    request->buffer = ALLOCATE(NULL, char, view.length);
+    memcpy(request->buffer, view.chars, view.length);
+    request->length = view.length;
+
+    Value value;
+    if (finishAtOnce(vm, request, &value)) return value;
+    return startWaiting(vm, request);
+}
+
+/**
+ * @brief Accepts a connection on a listening socket.
+ * @param vm The virtual machine.
+ * @param fd The listening socket.
+ * @return Value The descriptor of the connection, or nil on error.
+ */
+Value ioAccept(VM* vm, int fd) {
+    if (fd < 0) return NIL_VAL;
+
+    EventLoop* loop = getLoop(vm);
+    IoRequest* request = newRequest(loop, REQUEST_ACCEPT, vm->coroutine, fd);
+
+    Value value;
+    if (finishAtOnce(vm, request, &value)) return value;
+    return startWaiting(vm, request);
+}
+
+/**
+ * @brief Waits for a number of milliseconds.
+ * @param vm The virtual machine.
+ * @param milliseconds The time to wait.
+ * @return Value Nil.
+ */
+Value ioSleep(VM* vm, double milliseconds) {
+    // a year at most, and NaN or less than nothing is no time at all
+    if (!(milliseconds > 0)) milliseconds = 0;
+    if (milliseconds > 3.2e10) milliseconds = 3.2e10;
+    uint64_t delay = (uint64_t)(milliseconds * 1e6);
+
+    EventLoop* loop = getLoop(vm);
+    IoRequest* request = newRequest(loop, REQUEST_SLEEP, vm->coroutine, -1);
+    request->deadline = monotonicTime() + delay;
+#ifdef IO_URING
+    request->timeout.tv_sec = (int64_t)(delay / 1000000000u);
+    request->timeout.tv_nsec = (long long)(delay % 1000000000u);
+#endif
+    return startWaiting(vm, request);
+}
+
+/**
+ * @brief Checks that a native argument can be used as a path.
+ * @param value The argument.
+ * @param path A view where the characters of the path are stored.
+ * @return bool True if the argument is a string without NUL characters.
+ */
+static bool pathArgument(Value value, StringView* path) {
+    if (!IS_STRING(value)) return false;
+    viewString(value, path);
+    return path->length > 0 && strlen(path->chars) == (size_t)path->length;
+}
+
+/**
+ * @brief Opens a file for non-blocking use.
+ * @param vm The virtual machine.
+ * @param path The path of the file.
+ * @param mode "r" to read, "w" to truncate and write, "a" to append.
+ * @return Value The descriptor, or nil on error.
+ */
+Value ioOpen(VM* vm __attribute__((unused)), Value path, Value mode) {
+    StringView file;
+    if (!pathArgument(path, &file) || !IS_STRING(mode)) return NIL_VAL;
+    StringView view;
+    viewString(mode, &view);
+    if (view.length != 1) return NIL_VAL;
+
+    int flags = O_NONBLOCK | O_CLOEXEC;
+    switch (view.chars[0]) {
+        case 'r':
+            flags |= O_RDONLY;
+            break;
+        case 'w':
+            flags |= O_WRONLY | O_CREAT | O_TRUNC;
+            break;
+        case 'a':
+            flags |= O_WRONLY | O_CREAT | O_APPEND;
+            break;
+        default:
+            return NIL_VAL;
+    }
+
+    int fd = open(file.chars, flags, 0666);
+    return fd < 0 ? NIL_VAL : INT_VAL(fd);
+}
+
+/**
+ * @brief Creates a pipe whose ends do not block.
+ * @param vm The virtual machine.
+ * @return Value A list of the descriptors of the reading and writing ends,
+ * or nil on error.
+ */
+Value ioPipe(VM* vm) {
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0) return NIL_VAL;
+
+    ObjectList* list = newList(vm);
+    push(vm, OBJECT_VAL(list));  // GC guard while the buffer is allocated
+    writeValueArray(vm, &list->items, INT_VAL(fds[0]));
+    writeValueArray(vm, &list->items, INT_VAL(fds[1]));
+    pop(vm);
+    return OBJECT_VAL(list);
+}
+
+/**
+ * @brief Fills in the address of a Unix socket.
+ * @param path The path, which must fit in the address.
+ * @param address The address.
+ * @return bool True if the path fits.
+ */
+static bool socketAddress(const StringView* path, struct sockaddr_un* address) {
+    memset(address, 0, sizeof(*address));
+    if ((size_t)path->length >= sizeof(address->sun_path)) return false;
+    address->sun_family = AF_UNIX;
+    memcpy(address->sun_path, path->chars, path->length);
+    return true;
+}
+
+/**
+ * @brief Creates a Unix socket listening on a path.
+ * @param vm The virtual machine.
+ * @param path The path, which is replaced if a socket file exists there.
+ * @return Value The descriptor, or nil on error.
+ */
+Value ioListen(VM* vm __attribute__((unused)), Value path) {
+    StringView file;
+    struct sockaddr_un address;
+    if (!pathArgument(path, &file) || !socketAddress(&file, &address)) {
+        return NIL_VAL;
+    }
+
+    // a socket left behind by an earlier run would make bind fail
+    struct stat status;
+    if (lstat(file.chars, &status) == 0 && S_ISSOCK(status.st_mode)) {
+        unlink(file.chars);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return NIL_VAL;
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+        listen(fd, SOMAXCONN) < 0) {
+        close(fd);
+        return NIL_VAL;
+    }
+    return INT_VAL(fd);
+}
+
+/**
+ * @brief Connects a Unix socket to a path.
+ * @param vm The virtual machine.
+ * @param path The path a socket listens on.
+ * @return Value The descriptor, or nil on error.
+ */
+Value ioConnect(VM* vm __attribute__((unused)), Value path) {
+    StringView file;
+    struct sockaddr_un address;
+    if (!pathArgument(path, &file) || !socketAddress(&file, &address)) {
+        return NIL_VAL;
+    }
+
+    // connecting a Unix socket never waits for the other side: it either
+    // joins the listener's backlog at once or fails with EAGAIN
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return NIL_VAL;
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        close(fd);
+        return NIL_VAL;
+    }
+    return INT_VAL(fd);
+}
+
+/**
+ * @brief Closes a descriptor.
+ *
+ * Operations waiting on it fail.
+ *
+ * @param vm The virtual machine.
+ * @param fd The descriptor.
+ * @return Value True if it was closed, false on error.
+ */
+Value ioClose(VM* vm, int fd) {
+    if (fd < 0) return BOOL_VAL(false);
+
+    EventLoop* loop = vm->loop;
+#ifdef IO_URING
+    if (loop != NULL && loop->uring) {
+        for (IoRequest* request = loop->requests; request != NULL;
+             request = request->next) {
+            if (request->fd == fd && request->submitted) {
+                cancelRequest(loop, request);
+            }
+        }
+        loop = NULL;
+    }
+#endif
+    if (loop != NULL && fd < loop->fdCapacity) {
+        FdState* state = &loop->fds[fd];
+        failQueue(loop, &state->readers, -EBADF);
+        failQueue(loop, &state->writers, -EBADF);
+        watchFd(loop, fd);
+    }
+
+    if (fd == STDOUT_FILENO) flushOutput(&vm->output);
+    return BOOL_VAL(close(fd) == 0);
+}
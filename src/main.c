@@ -11,14 +11,21 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "bytecode.h"
 #include "chunk.h"
 #include "common.h"
+#include "compiler.h"
 #include "debug.h"
 #include "vm.h"
 
-static void repl();
-static void runFile(const char* path);
-static char* readFile(const char* path);
+static void repl(VM* vm);
+static void runFile(VM* vm, const char* path);
+static void runFileLazily(VM* vm, const char* path);
+static void compileFile(VM* vm, const char* path, const char* outputPath);
+static void runBytecodeFile(VM* vm, const char* path);
+static void snapshotFile(VM* vm, const char* path, const char* snapshotPath);
+static void bootSnapshot(VM* vm, const char* snapshotPath, const char* path);
+static LoadedImage* openSource(const char* path);
 
 /**
  * @brief The main entry point of the Clox interpreter.
@@ -28,21 +35,38 @@ static char* readFile(const char* path);
  * @return int The exit code. Returns 0 on success.
  */
 int main(int argc, const char* argv[]) {
-    initVM();
+    VM vm;
+    initVM(&vm);
 
     if (argc == 1) {
         // if no arguments are provided, start the REPL
-        repl();
-    } else if (argc == 2) {
+        repl(&vm);
+    } else if (argc == 2 && argv[1][0] != '-') {
         // if one argument (a file path) is provided, execute the file
-        runFile(argv[1]);
+        runFile(&vm, argv[1]);
+    } else if (argc == 3 && strcmp(argv[1], "--lazy") == 0) {
+        runFileLazily(&vm, argv[2]);
+    } else if ((argc == 3 || argc == 4) && strcmp(argv[1], "--compile") == 0) {
+        compileFile(&vm, argv[2], argc == 4 ? argv[3] : NULL);
+    } else if (argc == 3 && strcmp(argv[1], "--run") == 0) {
+        runBytecodeFile(&vm, argv[2]);
+    } else if (argc == 4 && strcmp(argv[1], "--snapshot") == 0) {
+        snapshotFile(&vm, argv[2], argv[3]);
+    } else if ((argc == 3 || argc == 4) && strcmp(argv[1], "--boot") == 0) {
+        bootSnapshot(&vm, argv[2], argc == 4 ? argv[3] : NULL);
     } else {
         // otherwise, show usage information and exit
-        fprintf(stderr, "Usage: clox [path]\n");
+        fprintf(stderr,
+                "Usage: clox [path]\n"
+                "       clox --lazy path\n"
+                "       clox --compile path [output.loxc]\n"
+                "       clox --run path.loxc\n"
+                "       clox --snapshot path output.loxs\n"
+                "       clox --boot snapshot.loxs [path]\n");
         exit(64);  // exit code for incorrect command-line usage
     }
 
-    freeVM();
+    freeVM(&vm);
     return 0;
 }
 
@@ -51,8 +75,10 @@ int main(int argc, const char* argv[]) {
  *
  * Reads lines of code from standard input, interprets them, and prints the
  * result in a continuous loop until the user exits.
+ *
+ * @param vm The virtual machine.
  */
-static void repl() {
+static void repl(VM* vm) {
     char line[1024];
     for (;;) {
         printf("> ");
@@ -62,60 +88,135 @@ static void repl() {
             break;
         }
 
-        interpret(line);
+        interpret(vm, line, strlen(line));
     }
 }
 
 /**
  * @brief Executes a Clox script from a given file.
  *
+ * @param vm The virtual machine.
  * @param path The path to the Clox source file.
  */
-static void runFile(const char* path) {
-    char* source = readFile(path);
-    InterpretResult result = interpret(source);
-    free(source);
+static void runFile(VM* vm, const char* path) {
+    LoadedImage* source = openSource(path);
+    InterpretResult result =
+        interpret(vm, (const char*)source->data, source->size);
+    closeImage(source);
 
     if (result == INTERPRET_COMPILE_ERROR) exit(65);
     if (result == INTERPRET_RUNTIME_ERROR) exit(70);
 }
 
 /**
- * @brief Reads the entire content of a file into a dynamically allocated
- * string.
+ * @brief Executes a Clox script, compiling each function on its first call.
  *
- * The caller is responsible for freeing the returned buffer.
- * Exits the program if the file cannot be opened or read.
+ * Startup then only pays for the code that runs, but compile errors inside a
+ * function body are only reported when the function is first called.
  *
- * @param path The path to the file.
- * @return char* A null-terminated string containing the file's content.
+ * @param vm The virtual machine.
+ * @param path The path to the Clox source file.
  */
-static char* readFile(const char* path) {
-    FILE* file = fopen(path, "rb");
-    if (file == NULL) {
-        fprintf(stderr, "Could not open file \"%s\".\n", path);
-        exit(74);  // exit code for I/O errors
+static void runFileLazily(VM* vm, const char* path) {
+    vm->lazyCompilation = true;
+    runFile(vm, path);
+}
+
+/**
+ * @brief Compiles a Clox script into a bytecode file without running it.
+ *
+ * @param vm The virtual machine.
+ * @param path The path to the Clox source file.
+ * @param outputPath The path of the bytecode file, or NULL to use the source
+ * path with its ".lox" extension replaced by ".loxc".
+ */
+static void compileFile(VM* vm, const char* path, const char* outputPath) {
+    LoadedImage* source = openSource(path);
+    ObjectFunction* function = compile(vm, (const char*)source->data,
+                                       source->size);
+    closeImage(source);
+    if (function == NULL) exit(65);
+
+    char* defaultPath = NULL;
+    if (outputPath == NULL) {
+        size_t length = strlen(path);
+        if (length > 4 && strcmp(path + length - 4, ".lox") == 0) length -= 4;
+        defaultPath = (char*)malloc(length + 6);
+        if (defaultPath == NULL) {
+            fprintf(stderr, "Not enough memory to compile \"%s\".\n", path);
+            exit(74);
+        }
+        memcpy(defaultPath, path, length);
+        memcpy(defaultPath + length, ".loxc", 6);
+        outputPath = defaultPath;
     }
 
-    // seek to the end to determine the file size
-    fseek(file, 0L, SEEK_END);
-    size_t fileSize = ftell(file);
-    rewind(file);
+    // saving allocates nothing on the heap, so the GC cannot free the script
+    bool saved = saveBytecode(function, outputPath);
+    free(defaultPath);
+    if (!saved) exit(74);
+}
 
-    char* buffer = (char*)malloc(fileSize + 1);
-    if (buffer == NULL) {
-        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-        exit(74);
-    }
+/**
+ * @brief Executes a script from a bytecode file written by `--compile`.
+ *
+ * @param vm The virtual machine.
+ * @param path The path to the bytecode file.
+ */
+static void runBytecodeFile(VM* vm, const char* path) {
+    ObjectFunction* function = loadBytecode(vm, path);
+    if (function == NULL) exit(74);
 
-    size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
-    if (bytesRead < fileSize) {
-        fprintf(stderr, "Could not read file \"%s\".\n", path);
-        exit(74);
-    }
+    InterpretResult result = interpretFunction(vm, function);
+    if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+}
 
-    buffer[bytesRead] = '\0';
+/**
+ * @brief Runs a Clox script and snapshots the heap it leaves behind.
+ *
+ * @param vm The virtual machine.
+ * @param path The path to the Clox source file, typically one that only sets
+ * up classes, tables and configuration.
+ * @param snapshotPath The path of the snapshot file to write.
+ */
+static void snapshotFile(VM* vm, const char* path, const char* snapshotPath) {
+    runFile(vm, path);
+    if (!saveSnapshot(vm, snapshotPath)) exit(74);
+}
+
+/**
+ * @brief Restores a snapshot written by `--snapshot`, then runs a script or
+ * starts the REPL on top of it.
+ *
+ * @param vm The virtual machine.
+ * @param snapshotPath The path to the snapshot file.
+ * @param path The path to the Clox source file, or NULL for the REPL.
+ */
+static void bootSnapshot(VM* vm, const char* snapshotPath, const char* path) {
+    if (!loadSnapshot(vm, snapshotPath)) exit(74);
+
+    if (path == NULL) {
+        repl(vm);
+    } else {
+        runFile(vm, path);
+    }
+}
 
-    fclose(file);
-    return buffer;
+/**
+ * @brief Maps a source file into memory.
+ *
+ * The compiler reads the source straight from the mapping, so the file is
+ * never copied. Exits the program if the file cannot be opened or read.
+ *
+ * @param path The path to the file.
+ * @return LoadedImage* The contents of the file, to be released with
+ * `closeImage` once compiled.
+ */
+static LoadedImage* openSource(const char* path) {
+    LoadedImage* source = openImage(path);
+    if (source == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        exit(74);  // exit code for I/O errors
+    }
+    return source;
 }
\ No newline at end of file
@@ -0,0 +1,291 @@
+/**
+ * @file map.c
+ * @brief A hash map keyed by arbitrary Clox values.
+ *
+ * The map uses open addressing with linear probing, like `Table`, and shares
+ * its load policy: tombstones count towards the maximum load, a map that is
+ * mostly tombstones is rehashed at the same size instead of grown, and a map
+ * that deletions left mostly empty is shrunk.
+ */
+
+#include "map.h"
+
+#include <string.h>
+
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+
+// smallest capacity a map is shrunk to
+#define MAP_MIN_CAPACITY 8
+
+//-----------------------------------------------------------------------------
+//- Map Lifecycle
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Initializes a map.
+ * @param map A pointer to the Map struct to initialize.
+ */
+void initMap(Map* map) {
+    map->count = 0;
+    map->tombstones = 0;
+    map->capacity = -1;
+    map->entries = NULL;
+}
+
+/**
+ * @brief Frees all memory used by a map.
+ * @param vm The virtual machine.
+ * @param map A pointer to the Map struct to free.
+ */
+void freeMap(VM* vm, Map* map) {
+    FREE_ARRAY(vm, MapEntry, map->entries, map->capacity + 1);
+    initMap(map);
+}
+
+//-----------------------------------------------------------------------------
+//- Key Hashing and Equality
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Mixes 64 bits down to a well-distributed 32-bit hash.
+ *
+ * Uses the MurmurHash3 finalizer, so that keys differing only in their high
+ * bits (doubles, aligned pointers) still spread over the low bits used for
+ * indexing.
+ * @param bits The bits to hash.
+ * @return uint32_t The computed hash value.
+ */
+static uint32_t hashBits(uint64_t bits) {
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdull;
+    bits ^= bits >> 33;
+    bits *= 0xc4ceb9fe1a85ec53ull;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+/**
+ * @brief Computes the hash of a map key.
+ * @param key The key to hash.
+ * @return uint32_t The computed hash value.
+ */
+static uint32_t hashValue(Value key) {
+    if (IS_NUMBER(key)) {
+        double number = AS_NUMBER(key);
+        uint64_t bits;
+        if (number != number) {
+            bits = 0x7ff8000000000000ull;  // every NaN hashes alike
+        } else {
+            if (number == 0) number = 0;  // -0 hashes like 0
+            memcpy(&bits, &number, sizeof(bits));
+        }
+        return hashBits(bits);
+    }
+
+    // strings are interned, so the content hash matches identity
+    if (IS_STRING_OBJECT(key)) return AS_STRING(key)->hash;
+    if (IS_OBJECT(key)) return hashBits((uint64_t)(uintptr_t)AS_OBJECT(key));
+#ifdef NAN_BOXING
+    // short strings and booleans are equal exactly when their bits are
+    return hashBits(key);
+#else
+    return hashBits(AS_BOOL(key) ? 1 : 2);
+#endif
+}
+
+/**
+ * @brief Checks if two map keys are equal.
+ *
+ * Same as `valuesEqual`, except that NaN is equal to itself, so a NaN key can
+ * be found again.
+ * @param a The first key.
+ * @param b The second key.
+ * @return bool True if the keys are equal, false otherwise.
+ */
+static bool keysEqual(Value a, Value b) {
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        double x = AS_NUMBER(a);
+        double y = AS_NUMBER(b);
+        return x == y || (x != x && y != y);
+    }
+    return valuesEqual(a, b);
+}
+
+//-----------------------------------------------------------------------------
+//- Core Map Operations
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Finds the entry for a given key in the map.
+ *
+ * Returns a pointer to an existing entry, or to the empty entry or tombstone
+ * where the key can be inserted.
+ *
+ * @param entries The array of entries to search.
+ * @param capacity The capacity mask (`capacity - 1`).
+ * @param key The key to find.
+ * @return MapEntry* A pointer to the found entry.
+ */
+static MapEntry* findEntry(MapEntry* entries, int32_t capacity, Value key) {
+    uint32_t index = hashValue(key) & capacity;
+    MapEntry* tombstone = NULL;
+
+    for (;;) {
+        MapEntry* entry = &entries[index];
+        if (IS_NIL(entry->key)) {
+            if (IS_NIL(entry->value)) {
+                return tombstone != NULL ? tombstone : entry;  // empty entry
+            } else {
+                if (tombstone == NULL) tombstone = entry;  // tombstone
+            }
+        } else if (keysEqual(entry->key, key)) {
+            return entry;  // key
+        }
+        index = (index + 1) & capacity;  // linear probing
+    }
+}
+
+/**
+ * @brief Resizes the map to a new capacity, dropping all tombstones.
+ * @param vm The virtual machine.
+ * @param map The map to resize.
+ * @param capacity The new capacity mask (`new_capacity - 1`).
+ */
+static void adjustCapacity(VM* vm, Map* map, int32_t capacity) {
+    MapEntry* entries = ALLOCATE(vm, MapEntry, capacity + 1);
+    for (int32_t i = 0; i <= capacity; i++) {
+        entries[i].key = NIL_VAL;
+        entries[i].value = NIL_VAL;
+    }
+
+    map->count = 0;
+    for (int32_t i = 0; i <= map->capacity; i++) {
+        MapEntry* entry = &map->entries[i];
+        if (IS_NIL(entry->key)) continue;
+        MapEntry* dest = findEntry(entries, capacity, entry->key);
+        dest->key = entry->key;
+        dest->value = entry->value;
+        map->count++;
+    }
+
+    FREE_ARRAY(vm, MapEntry, map->entries, map->capacity + 1);
+    map->entries = entries;
+    map->capacity = capacity;
+    map->tombstones = 0;
+}
+
+/**
+ * @brief Computes the capacity mask a map needs to hold `count` live entries
+ * at no more than half of the maximum load.
+ * @param count The number of live entries.
+ * @return int32_t The capacity mask (`capacity - 1`).
+ */
+static int32_t capacityFor(int32_t count) {
+    int32_t capacity = MAP_MIN_CAPACITY;
+    while (count > capacity * TABLE_MAX_LOAD / 2) {
+        capacity = GROW_CAPACITY(capacity);
+    }
+    return capacity - 1;
+}
+
+//-----------------------------------------------------------------------------
+//- Public API
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Retrieves a value from the map by its key.
+ *
+ * @param map The map to search.
+ * @param key The key to look for.
+ * @param value A pointer where the found value will be stored.
+ * @return bool True if the key was found, false otherwise.
+ */
+bool mapGet(const Map* map, Value key, Value* value) {
+    if (map->count == 0 || IS_NIL(key)) return false;
+
+    const MapEntry* entry = findEntry(map->entries, map->capacity, key);
+    if (IS_NIL(entry->key)) return false;
+
+    *value = entry->value;
+    return true;
+}
+
+/**
+ * @brief Adds or updates a key-value pair in the map.
+ *
+ * @param vm The virtual machine.
+ * @param map The map to modify.
+ * @param key The key to set. Must not be nil.
+ * @param value The value to associate with the key.
+ * @return bool True if the key was new, false if it was an update.
+ */
+bool mapSet(VM* vm, Map* map, Value key, Value value) {
+    if (map->count + map->tombstones + 1 >
+        (map->capacity + 1) * TABLE_MAX_LOAD) {
+        // same policy as tableSet: rehash in place if tombstones dominate
+        int32_t capacity = map->capacity;
+        if (map->count + 1 > (map->capacity + 1) * TABLE_MAX_LOAD / 2) {
+            capacity = GROW_CAPACITY(map->capacity + 1) - 1;
+        }
+        adjustCapacity(vm, map, capacity);
+    }
+
+    MapEntry* entry = findEntry(map->entries, map->capacity, key);
+
+    bool isNewKey = IS_NIL(entry->key);
+    if (isNewKey) {
+        map->count++;
+        if (!IS_NIL(entry->value)) map->tombstones--;
+    }
+
+    entry->key = key;
+    entry->value = value;
+    return isNewKey;
+}
+
+/**
+ * @brief Deletes a key-value pair from the map.
+ *
+ * @param vm The virtual machine.
+ * @param map The map to modify.
+ * @param key The key to delete.
+ * @return bool True if the key was found and deleted, false otherwise.
+ */
+bool mapDelete(VM* vm, Map* map, Value key) {
+    if (map->count == 0 || IS_NIL(key)) return false;
+
+    MapEntry* entry = findEntry(map->entries, map->capacity, key);
+    if (IS_NIL(entry->key)) return false;
+
+    // tombstone = nil key + true value
+    entry->key = NIL_VAL;
+    entry->value = BOOL_VAL(true);
+    map->count--;
+    map->tombstones++;
+
+    if (map->count < (map->capacity + 1) * TABLE_MIN_LOAD) {
+        int32_t capacity = capacityFor(map->count);
+        if (capacity < map->capacity) adjustCapacity(vm, map, capacity);
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//- Garbage Collection Support
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Marks all keys and values in a map for the garbage collector.
+ * @param vm The virtual machine.
+ * @param map The map to mark.
+ */
+void markMap(VM* vm, Map* map) {
+    for (int32_t i = 0; i <= map->capacity; i++) {
+        MapEntry* entry = &map->entries[i];
+        markValue(vm, entry->key);
+        markValue(vm, entry->value);
+    }
+}
@@ -12,7 +12,9 @@
 
 #include <stdlib.h>
 
+#include "io.h"
 #include "vm.h"
+#include "worker.h"
 
 #ifdef DEBUG_LOG_GC
 #include <stdio.h>
@@ -24,7 +26,7 @@
 #define GC_HEAP_GROW_FACTOR 2
 
 // forward declaration
-static void collectGarbage();
+static void collectGarbage(VM* vm);
 
 //-----------------------------------------------------------------------------
 //- Memory Allocation
@@ -37,22 +39,25 @@ static void collectGarbage();
  * the size of an existing allocation. It also tracks the total number of
  * bytes allocated and triggers garbage collection when necessary.
  *
+ * @param vm The virtual machine, or NULL for memory that belongs to no VM
+ * and is neither counted nor collected.
  * @param pointer The existing memory block to modify, or NULL to allocate new.
  * @param oldSize The current size of the block.
  * @param newSize The desired new size. If 0, the block is freed.
  * @return void* A pointer to the newly allocated or resized memory block.
  */
 
-void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
-    vm.bytesAllocated += newSize - oldSize;
+void* reallocate(VM* vm, void* pointer, size_t oldSize, size_t newSize) {
+    // memory outside of any VM heap, such as frozen code, is not collected
+    if (vm != NULL) vm->bytesAllocated += newSize - oldSize;
 
-    if (newSize > oldSize) {
+    if (vm != NULL && newSize > oldSize) {
 #ifdef DEBUG_STRESS_GC
-        collectGarbage();
+        collectGarbage(vm);
 #endif
 
-        if (vm.bytesAllocated > vm.nextGC) {
-            collectGarbage();
+        if (vm->bytesAllocated > vm->nextGC) {
+            collectGarbage(vm);
         }
     }
 
@@ -75,9 +80,10 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
  *
  * This function dispatches to the correct deallocation logic based on the
  * object's type.
+ * @param vm The virtual machine.
  * @param object The object to free.
  */
-static void freeObject(Object* object) {
+static void freeObject(VM* vm, Object* object) {
 #ifdef DEBUG_LOG_GC
     printf("%p free ", (void*)object);
     printValue(OBJECT_VAL(object));
@@ -86,46 +92,92 @@ static void freeObject(Object* object) {
 
     switch (object->type) {
         case OBJECT_BOUND_METHOD: {
-            FREE(OBJECT_BOUND_METHOD, object);
+            FREE(vm, OBJECT_BOUND_METHOD, object);
             break;
         }
         case OBJECT_INSTANCE: {
             ObjectInstance* instance = (ObjectInstance*)object;
-            freeTable(&instance->fields);
-            FREE(ObjectInstance, object);
+            freeTable(vm, &instance->fields);
+            FREE(vm, ObjectInstance, object);
             break;
         }
         case OBJECT_CLASS: {
             ObjectClass* klass = (ObjectClass*)object;
-            freeTable(&klass->methods);
-            FREE(ObjectClass, object);
+            freeTable(vm, &klass->ownMethods);
+            FREE(vm, ObjectClass, object);
             break;
         }
         case OBJECT_CLOSURE: {
             ObjectClosure* closure = (ObjectClosure*)object;
-            FREE_ARRAY(ObjectUpvalue*, closure->upvalues,
+            FREE_ARRAY(vm, ObjectUpvalue*, closure->upvalues,
                        closure->upvalueCount);
-            FREE(ObjectClosure, object);
+            FREE(vm, ObjectClosure, object);
+            break;
+        }
+        case OBJECT_FLOAT64_ARRAY: {
+            ObjectFloat64Array* array = (ObjectFloat64Array*)object;
+            FREE_ARRAY(vm, double, array->values, array->count);
+            FREE(vm, ObjectFloat64Array, object);
             break;
         }
         case OBJECT_FUNCTION: {
             ObjectFunction* function = (ObjectFunction*)object;
-            freeChunk(&function->chunk);
-            FREE(ObjectFunction, object);
+            freeChunk(vm, &function->chunk);
+            if (function->lazy != NULL) {
+                freeValueArray(vm, &function->lazy->upvalueNames);
+                FREE(vm, LazyBody, function->lazy);
+            }
+            FREE(vm, ObjectFunction, object);
+            break;
+        }
+        case OBJECT_LIST: {
+            ObjectList* list = (ObjectList*)object;
+            freeValueArray(vm, &list->items);
+            FREE(vm, ObjectList, object);
+            break;
+        }
+        case OBJECT_MAP: {
+            ObjectMap* map = (ObjectMap*)object;
+            freeMap(vm, &map->table);
+            FREE(vm, ObjectMap, object);
             break;
         }
         case OBJECT_NATIVE: {
-            FREE(ObjectNative, object);
+            FREE(vm, ObjectNative, object);
             break;
         }
         case OBJECT_STRING: {
             ObjectString* string = (ObjectString*)object;
-            FREE_ARRAY(char, string->chars, string->length + 1);
-            FREE(ObjectString, object);
+            FREE_ARRAY(vm, char, string->chars, string->length + 1);
+            FREE(vm, ObjectString, object);
             break;
         }
         case OBJECT_UPVALUE: {
-            FREE(ObjectUpvalue, object);
+            FREE(vm, ObjectUpvalue, object);
+            break;
+        }
+        case OBJECT_CHANNEL: {
+            releaseChannel(((ObjectChannel*)object)->channel);
+            FREE(vm, ObjectChannel, object);
+            break;
+        }
+        case OBJECT_WORKER: {
+            releaseWorker(((ObjectWorker*)object)->worker);
+            FREE(vm, ObjectWorker, object);
+            break;
+        }
+        case OBJECT_COROUTINE: {
+            freeStackSegment(vm, &((ObjectCoroutine*)object)->segment);
+            FREE(vm, ObjectCoroutine, object);
+            break;
+        }
+        case OBJECT_FOREIGN: {
+            ObjectForeign* foreign = (ObjectForeign*)object;
+            if (foreign->finalize != NULL) {
+                vm->bytesAllocated -= foreign->size;
+                foreign->finalize(foreign->data, foreign->size);
+            }
+            FREE(vm, ObjectForeign, object);
             break;
         }
     }
@@ -135,15 +187,17 @@ static void freeObject(Object* object) {
  * @brief Frees all heap-allocated objects in the VM.
  *
  * Called during `freeVM` to clean up any remaining objects at shutdown.
+ *
+ * @param vm The virtual machine.
  */
-void freeObjects() {
-    Object* object = vm.objects;
+void freeObjects(VM* vm) {
+    Object* object = vm->objects;
     while (object != NULL) {
         Object* next = object->next;
-        freeObject(object);
+        freeObject(vm, object);
         object = next;
     }
-    free(vm.grayStack);
+    free(vm->grayStack);
 }
 
 //-----------------------------------------------------------------------------
@@ -152,20 +206,22 @@ void freeObjects() {
 
 /**
  * @brief Marks a value for garbage collection if it is an object.
+ * @param vm The virtual machine.
  * @param value The value to mark.
  */
-void markValue(Value value) {
+void markValue(VM* vm, Value value) {
     if (!IS_OBJECT(value)) return;
-    markObject(AS_OBJECT(value));
+    markObject(vm, AS_OBJECT(value));
 }
 
 /**
  * @brief Marks an object and adds it to the gray stack for tracing.
  *
  * If the object is already marked, the function does nothing.
+ * @param vm The virtual machine.
  * @param object The object to mark.
  */
-void markObject(Object* object) {
+void markObject(VM* vm, Object* object) {
     if (object == NULL) return;
     if (object->isMarked) return;
 
@@ -181,21 +237,42 @@ void markObject(Object* object) {
     // white = node not reached -> just added to the stack
     // gray = node reached, but its children not reached -> on the stack
     // black = node and its children reached -> isMarked = true and of the stack
-    if (vm.grayCapacity < vm.grayCount + 1) {
-        vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
-        vm.grayStack =
-            (Object**)realloc(vm.grayStack, sizeof(Object*) * vm.grayCapacity);
-        if (vm.grayStack == NULL) exit(1);
+    if (vm->grayCapacity < vm->grayCount + 1) {
+        vm->grayCapacity = GROW_CAPACITY(vm->grayCapacity);
+        vm->grayStack =
+            (Object**)realloc(vm->grayStack,
+                              sizeof(Object*) * vm->grayCapacity);
+        if (vm->grayStack == NULL) exit(1);
     }
-    vm.grayStack[vm.grayCount++] = object;
+    vm->grayStack[vm->grayCount++] = object;
 }
 
 /**
  * @brief Helper to mark all values in a ValueArray.
  */
-static void markArray(const ValueArray* array) {
+static void markArray(VM* vm, const ValueArray* array) {
     for (int32_t i = 0; i < array->count; i++) {
-        markValue(array->values[i]);
+        markValue(vm, array->values[i]);
+    }
+}
+
+/**
+ * @brief Marks the values, closures and open upvalues of a stack that is not
+ * running.
+ * @param vm The virtual machine.
+ * @param segment The stack.
+ */
+static void markStackSegment(VM* vm, const StackSegment* segment) {
+    for (const Value* slot = segment->stack; slot < segment->stackTop;
+         slot++) {
+        markValue(vm, *slot);
+    }
+    for (int32_t i = 0; i < segment->frameCount; i++) {
+        markObject(vm, (Object*)segment->frames[i].closure);
+    }
+    for (ObjectUpvalue* upvalue = segment->openUpvalues; upvalue != NULL;
+         upvalue = upvalue->next) {
+        markObject(vm, (Object*)upvalue);
     }
 }
 
@@ -205,40 +282,61 @@ static void markArray(const ValueArray* array) {
  * Roots are objects that are directly accessible by the VM without going
  * through another object.
  */
-static void markRoots() {
+static void markRoots(VM* vm) {
     // mark values sitting on the stack
-    for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
-        markValue(*slot);
+    for (Value* slot = vm->stack; slot < vm->stackTop; slot++) {
+        markValue(vm, *slot);
     }
 
     // mark closures pointed by CallFrames
-    for (int32_t i = 0; i < vm.frameCount; i++) {
-        markObject((Object*)vm.frames[i].closure);
+    for (int32_t i = 0; i < vm->frameCount; i++) {
+        markObject(vm, (Object*)vm->frames[i].closure);
     }
 
     // mark upvalues
-    for (ObjectUpvalue* upvalue = vm.openUpvalues; upvalue != NULL;
+    for (ObjectUpvalue* upvalue = vm->openUpvalues; upvalue != NULL;
          upvalue = upvalue->next) {
-        markObject((Object*)upvalue);
+        markObject(vm, (Object*)upvalue);
+    }
+
+    // while a coroutine runs, the main stack waits below it, and the
+    // coroutines between them are reached through `caller`
+    if (vm->coroutine != NULL) {
+        markObject(vm, (Object*)vm->coroutine);
+        markStackSegment(vm, &vm->mainStack);
     }
 
+    // mark the stacks waiting on the event loop
+    markEventLoop(vm);
+
+    // mark the values held for the C API
+    for (int32_t i = 0; i < vm->handles.count; i++) {
+        markValue(vm, vm->handles.values[i]);
+    }
+    markValue(vm, vm->result);
+    markValue(vm, vm->hostResult);
+
+    // the functions whose twins are sent to other VMs may come back
+    markArray(vm, &vm->sharedRoots);
+
     // mark global variables
-    markTable(&vm.globals);
+    markTable(vm, &vm->globals);
 
     // mark memory allocated by compiler
-    markCompilerRoots();
+    markCompilerRoots(vm);
 
     // string for class initilizer
-    markObject((Object*)vm.initString);
+    markObject(vm, (Object*)vm->initString);
 }
 
 /**
  * @brief Traces through an object's fields and marks all reachable objects.
  *
  * This process is called "blackening" an object in the tri-color abstraction.
+ * @param vm The virtual machine.
  * @param object The object to trace.
  */
-static void blackenObject(Object* object) {
+static void blackenObject(VM* vm, Object* object) {
 #ifdef DEBUG_LOG_GC
     printf("%p blacken ", (void*)object);
     printValue(OBJECT_VAL(object));
@@ -248,43 +346,78 @@ static void blackenObject(Object* object) {
     switch (object->type) {
         case OBJECT_BOUND_METHOD: {
             ObjectBoundMethod* bound = (ObjectBoundMethod*)object;
-            markValue(bound->receiver);
-            markObject((Object*)bound->method);
+            markValue(vm, bound->receiver);
+            markObject(vm, (Object*)bound->method);
             break;
         }
         case OBJECT_INSTANCE: {
             ObjectInstance* instance = (ObjectInstance*)object;
-            markObject((Object*)instance->klass);
-            markTable(&instance->fields);
+            markObject(vm, (Object*)instance->klass);
+            markTable(vm, &instance->fields);
             break;
         }
         case OBJECT_CLASS: {
             ObjectClass* klass = (ObjectClass*)object;
-            markObject((Object*)klass->name);
-            markTable(&klass->methods);
+            markObject(vm, (Object*)klass->name);
+            // a shared method table is marked through the superclass
+            markObject(vm, (Object*)klass->superclass);
+            markTable(vm, &klass->ownMethods);
             break;
         }
         case OBJECT_CLOSURE: {
             ObjectClosure* closure = (ObjectClosure*)object;
-            markObject((Object*)closure->function);
+            markObject(vm, (Object*)closure->function);
             for (int32_t i = 0; i < closure->upvalueCount; i++) {
-                markObject((Object*)closure->upvalues[i]);
+                markObject(vm, (Object*)closure->upvalues[i]);
             }
             break;
         }
         case OBJECT_UPVALUE: {
-            markValue(((ObjectUpvalue*)object)->closed);
+            // an open upvalue keeps the stack it points into alive
+            ObjectUpvalue* upvalue = (ObjectUpvalue*)object;
+            markValue(vm, upvalue->closed);
+            markObject(vm, (Object*)upvalue->coroutine);
+            break;
+        }
+        case OBJECT_COROUTINE: {
+            // the running coroutine's stack is marked as the VM's stack
+            ObjectCoroutine* coroutine = (ObjectCoroutine*)object;
+            markObject(vm, (Object*)coroutine->closure);
+            markObject(vm, (Object*)coroutine->caller);
+            if (coroutine != vm->coroutine) {
+                markStackSegment(vm, &coroutine->segment);
+            }
             break;
         }
         case OBJECT_FUNCTION: {
             ObjectFunction* function = (ObjectFunction*)object;
-            markObject((Object*)function->name);
-            markArray(&function->chunk.constants);
+            markObject(vm, (Object*)function->name);
+            markArray(vm, &function->chunk.constants);
+            if (function->lazy != NULL) {
+                markObject(vm, (Object*)function->lazy->source);
+                markArray(vm, &function->lazy->upvalueNames);
+            }
+            break;
+        }
+        case OBJECT_LIST: {
+            markArray(vm, &((ObjectList*)object)->items);
+            break;
+        }
+        case OBJECT_MAP: {
+            markMap(vm, &((ObjectMap*)object)->table);
+            break;
+        }
+        case OBJECT_FOREIGN: {
+            ObjectForeign* foreign = (ObjectForeign*)object;
+            if (foreign->trace != NULL) foreign->trace(vm, foreign->data);
             break;
         }
         // no outgoing references
+        case OBJECT_FLOAT64_ARRAY:
         case OBJECT_NATIVE:
         case OBJECT_STRING:
+        case OBJECT_CHANNEL:
+        case OBJECT_WORKER:
             break;
     }
 }
@@ -295,10 +428,10 @@ static void blackenObject(Object* object) {
  * It repeatedly takes an object from the gray stack, blackens it (marks all
  * objects it refers to), and continues until the gray stack is empty.
  */
-static void traceReferences() {
-    while (vm.grayCount > 0) {
-        Object* object = vm.grayStack[--vm.grayCount];
-        blackenObject(object);
+static void traceReferences(VM* vm) {
+    while (vm->grayCount > 0) {
+        Object* object = vm->grayStack[--vm->grayCount];
+        blackenObject(vm, object);
     }
 }
 
@@ -312,9 +445,9 @@ static void traceReferences() {
  * Iterates through the linked list of all allocated objects. Any object that
  * was not marked during the mark phase is unreachable and is freed.
  */
-static void sweep() {
+static void sweep(VM* vm) {
     Object* previous = NULL;
-    Object* object = vm.objects;
+    Object* object = vm->objects;
 
     // delete all unmarked objects
     while (object != NULL) {
@@ -328,9 +461,9 @@ static void sweep() {
             if (previous != NULL) {
                 previous->next = object;
             } else {
-                vm.objects = object;
+                vm->objects = object;
             }
-            freeObject(unreached);
+            freeObject(vm, unreached);
         }
     }
 }
@@ -342,25 +475,26 @@ static void sweep() {
 /**
  * @brief Runs a full garbage collection cycle.
  */
-static void collectGarbage() {
+static void collectGarbage(VM* vm) {
 #ifdef DEBUG_LOG_GC
     printf("-- GC begin\n");
-    size_t before = vm.bytesAllocated;
+    size_t before = vm->bytesAllocated;
 #endif
 
-    markRoots();
-    traceReferences();
+    markRoots(vm);
+    traceReferences(vm);
     // string table must be handled specially to remove weak references to
     // dead strings, preventing dangling pointers
-    tableRemoveWhite(&vm.strings);
+    tableRemoveWhite(&vm->strings);
 
-    sweep();
+    sweep(vm);
 
-    vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+    vm->nextGC = vm->bytesAllocated * GC_HEAP_GROW_FACTOR;
 
 #ifdef DEBUG_LOG_GC
+    printTableStats("globals", &vm->globals);
     printf("-- GC end\n");
     printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
-           before - vm.bytesAllocated, before, vm.bytesAllocated, vm.nextGC);
+           before - vm->bytesAllocated, before, vm->bytesAllocated, vm->nextGC);
 #endif
 }
\ No newline at end of file
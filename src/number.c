@@ -0,0 +1,561 @@
+/**
+ * @file number.c
+ * @brief Conversion of numbers to text.
+ *
+ * Digits are generated with Florian Loitsch's Grisu2 ("Printing
+ * Floating-Point Numbers Quickly and Accurately with Integers", PLDI 2010),
+ * which only needs 64-bit integer arithmetic and a table of cached powers of
+ * ten. Its output always reads back as the same double and is the shortest
+ * such output in all but a tiny fraction of cases.
+ *
+ * The `%g` format rounds those digits to six significant digits. That is only
+ * ambiguous when the digits sit right on a rounding midpoint, and those rare
+ * cases, as well as subnormal numbers, are handed to `snprintf`.
+ */
+
+#include "number.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// significant digits of the %g format
+#define GENERAL_PRECISION 6
+
+// the range of binary exponents the scaled numbers are brought into
+#define GRISU_ALPHA -60
+#define GRISU_GAMMA -32
+
+// smallest normal double, below which %g output is left to snprintf
+#define MIN_NORMAL 2.2250738585072014e-308
+
+// A floating-point number with a 64-bit significand: f * 2^e.
+typedef struct {
+    uint64_t f;
+    int32_t e;
+} DiyFp;
+
+// A cached power of ten: f * 2^e is 10^k, rounded to 64 bits.
+typedef struct {
+    uint64_t f;
+    int32_t e;
+    int32_t k;
+} CachedPower;
+
+// 10^k for k = -300, -292, ..., 324, enough for the whole double range
+#define CACHED_POWERS_MIN_EXPONENT -300
+#define CACHED_POWERS_STEP 8
+
+static const CachedPower cachedPowers[] = {
+    {0xAB70FE17C79AC6CAull, -1060, -300},
+    {0xFF77B1FCBEBCDC4Full, -1034, -292},
+    {0xBE5691EF416BD60Cull, -1007, -284},
+    {0x8DD01FAD907FFC3Cull, -980, -276},
+    {0xD3515C2831559A83ull, -954, -268},
+    {0x9D71AC8FADA6C9B5ull, -927, -260},
+    {0xEA9C227723EE8BCBull, -901, -252},
+    {0xAECC49914078536Dull, -874, -244},
+    {0x823C12795DB6CE57ull, -847, -236},
+    {0xC21094364DFB5637ull, -821, -228},
+    {0x9096EA6F3848984Full, -794, -220},
+    {0xD77485CB25823AC7ull, -768, -212},
+    {0xA086CFCD97BF97F4ull, -741, -204},
+    {0xEF340A98172AACE5ull, -715, -196},
+    {0xB23867FB2A35B28Eull, -688, -188},
+    {0x84C8D4DFD2C63F3Bull, -661, -180},
+    {0xC5DD44271AD3CDBAull, -635, -172},
+    {0x936B9FCEBB25C996ull, -608, -164},
+    {0xDBAC6C247D62A584ull, -582, -156},
+    {0xA3AB66580D5FDAF6ull, -555, -148},
+    {0xF3E2F893DEC3F126ull, -529, -140},
+    {0xB5B5ADA8AAFF80B8ull, -502, -132},
+    {0x87625F056C7C4A8Bull, -475, -124},
+    {0xC9BCFF6034C13053ull, -449, -116},
+    {0x964E858C91BA2655ull, -422, -108},
+    {0xDFF9772470297EBDull, -396, -100},
+    {0xA6DFBD9FB8E5B88Full, -369, -92},
+    {0xF8A95FCF88747D94ull, -343, -84},
+    {0xB94470938FA89BCFull, -316, -76},
+    {0x8A08F0F8BF0F156Bull, -289, -68},
+    {0xCDB02555653131B6ull, -263, -60},
+    {0x993FE2C6D07B7FACull, -236, -52},
+    {0xE45C10C42A2B3B06ull, -210, -44},
+    {0xAA242499697392D3ull, -183, -36},
+    {0xFD87B5F28300CA0Eull, -157, -28},
+    {0xBCE5086492111AEBull, -130, -20},
+    {0x8CBCCC096F5088CCull, -103, -12},
+    {0xD1B71758E219652Cull, -77, -4},
+    {0x9C40000000000000ull, -50, 4},
+    {0xE8D4A51000000000ull, -24, 12},
+    {0xAD78EBC5AC620000ull, 3, 20},
+    {0x813F3978F8940984ull, 30, 28},
+    {0xC097CE7BC90715B3ull, 56, 36},
+    {0x8F7E32CE7BEA5C70ull, 83, 44},
+    {0xD5D238A4ABE98068ull, 109, 52},
+    {0x9F4F2726179A2245ull, 136, 60},
+    {0xED63A231D4C4FB27ull, 162, 68},
+    {0xB0DE65388CC8ADA8ull, 189, 76},
+    {0x83C7088E1AAB65DBull, 216, 84},
+    {0xC45D1DF942711D9Aull, 242, 92},
+    {0x924D692CA61BE758ull, 269, 100},
+    {0xDA01EE641A708DEAull, 295, 108},
+    {0xA26DA3999AEF774Aull, 322, 116},
+    {0xF209787BB47D6B85ull, 348, 124},
+    {0xB454E4A179DD1877ull, 375, 132},
+    {0x865B86925B9BC5C2ull, 402, 140},
+    {0xC83553C5C8965D3Dull, 428, 148},
+    {0x952AB45CFA97A0B3ull, 455, 156},
+    {0xDE469FBD99A05FE3ull, 481, 164},
+    {0xA59BC234DB398C25ull, 508, 172},
+    {0xF6C69A72A3989F5Cull, 534, 180},
+    {0xB7DCBF5354E9BECEull, 561, 188},
+    {0x88FCF317F22241E2ull, 588, 196},
+    {0xCC20CE9BD35C78A5ull, 614, 204},
+    {0x98165AF37B2153DFull, 641, 212},
+    {0xE2A0B5DC971F303Aull, 667, 220},
+    {0xA8D9D1535CE3B396ull, 694, 228},
+    {0xFB9B7CD9A4A7443Cull, 720, 236},
+    {0xBB764C4CA7A44410ull, 747, 244},
+    {0x8BAB8EEFB6409C1Aull, 774, 252},
+    {0xD01FEF10A657842Cull, 800, 260},
+    {0x9B10A4E5E9913129ull, 827, 268},
+    {0xE7109BFBA19C0C9Dull, 853, 276},
+    {0xAC2820D9623BF429ull, 880, 284},
+    {0x80444B5E7AA7CF85ull, 907, 292},
+    {0xBF21E44003ACDD2Dull, 933, 300},
+    {0x8E679C2F5E44FF8Full, 960, 308},
+    {0xD433179D9C8CB841ull, 986, 316},
+    {0x9E19DB92B4E31BA9ull, 1013, 324},
+};
+
+//-----------------------------------------------------------------------------
+//- DiyFp Arithmetic
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Subtracts two DiyFps with the same exponent, where `x >= y`.
+ * @param x The minuend.
+ * @param y The subtrahend.
+ * @return DiyFp The difference.
+ */
+static DiyFp diyFpSub(DiyFp x, DiyFp y) {
+    DiyFp result = {x.f - y.f, x.e};
+    return result;
+}
+
+/**
+ * @brief Multiplies two DiyFps, rounding the 128-bit product to 64 bits.
+ * @param x The first factor.
+ * @param y The second factor.
+ * @return DiyFp The product.
+ */
+static DiyFp diyFpMul(DiyFp x, DiyFp y) {
+    const uint64_t xLo = x.f & 0xffffffffu;
+    const uint64_t xHi = x.f >> 32;
+    const uint64_t yLo = y.f & 0xffffffffu;
+    const uint64_t yHi = y.f >> 32;
+
+    const uint64_t p0 = xLo * yLo;
+    const uint64_t p1 = xLo * yHi;
+    const uint64_t p2 = xHi * yLo;
+    const uint64_t p3 = xHi * yHi;
+
+    uint64_t middle = (p0 >> 32) + (p1 & 0xffffffffu) + (p2 & 0xffffffffu);
+    middle += (uint64_t)1 << 31;  // round the lower half
+
+    DiyFp result = {p3 + (p1 >> 32) + (p2 >> 32) + (middle >> 32),
+                    x.e + y.e + 64};
+    return result;
+}
+
+/**
+ * @brief Shifts a non-zero DiyFp left until its highest bit is set.
+ * @param x The number to normalize.
+ * @return DiyFp The normalized number.
+ */
+static DiyFp diyFpNormalize(DiyFp x) {
+    while ((x.f >> 63) == 0) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+//-----------------------------------------------------------------------------
+//- Grisu2
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Computes a positive double and the boundaries of its rounding
+ * interval, normalized to a common exponent.
+ * @param value The number, finite and greater than zero.
+ * @param minus A pointer where the lower boundary will be stored.
+ * @param plus A pointer where the upper boundary will be stored.
+ * @return DiyFp The normalized number.
+ */
+static DiyFp computeBoundaries(double value, DiyFp* minus, DiyFp* plus) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint64_t fraction = bits & (((uint64_t)1 << 52) - 1);
+    const int32_t exponent = (int32_t)(bits >> 52);
+
+    DiyFp v;
+    if (exponent == 0) {
+        v.f = fraction;  // subnormal
+        v.e = 1 - 1075;
+    } else {
+        v.f = fraction | ((uint64_t)1 << 52);
+        v.e = exponent - 1075;
+    }
+
+    // the gap below a power of two is half the gap above it
+    const bool lowerCloser = fraction == 0 && exponent > 1;
+    DiyFp upper = {2 * v.f + 1, v.e - 1};
+    DiyFp lower;
+    if (lowerCloser) {
+        lower.f = 4 * v.f - 1;
+        lower.e = v.e - 2;
+    } else {
+        lower.f = 2 * v.f - 1;
+        lower.e = v.e - 1;
+    }
+
+    *plus = diyFpNormalize(upper);
+    lower.f <<= lower.e - plus->e;
+    lower.e = plus->e;
+    *minus = lower;
+    return diyFpNormalize(v);
+}
+
+/**
+ * @brief Finds the cached power of ten that brings a binary exponent into
+ * [GRISU_ALPHA, GRISU_GAMMA].
+ * @param e The binary exponent of the number to scale.
+ * @return const CachedPower* The cached power.
+ */
+static const CachedPower* cachedPowerFor(int32_t e) {
+    // k = ceil((GRISU_ALPHA - e - 1) * log10(2)), using 78913 / 2^18
+    const int32_t f = GRISU_ALPHA - e - 1;
+    const int32_t k = (f * 78913) / (1 << 18) + (f > 0);
+    const int32_t index =
+        (-CACHED_POWERS_MIN_EXPONENT + k + (CACHED_POWERS_STEP - 1)) /
+        CACHED_POWERS_STEP;
+    return &cachedPowers[index];
+}
+
+/**
+ * @brief Moves the last generated digit towards the number while it stays
+ * inside the rounding interval.
+ * @param digits The generated digits.
+ * @param length The number of digits.
+ * @param distance The distance from the upper boundary to the number.
+ * @param delta The width of the rounding interval.
+ * @param rest The distance from the upper boundary to the digits.
+ * @param tenK The value of one unit in the last digit.
+ */
+static void roundWeed(char* digits, int32_t length, uint64_t distance,
+                      uint64_t delta, uint64_t rest, uint64_t tenK) {
+    while (rest < distance && delta - rest >= tenK &&
+           (rest + tenK < distance ||
+            distance - rest > rest + tenK - distance)) {
+        digits[length - 1]--;
+        rest += tenK;
+    }
+}
+
+/**
+ * @brief Generates the digits of the scaled upper boundary until they are
+ * inside the rounding interval.
+ * @param digits The buffer receiving the digits.
+ * @param decimalExponent A pointer to the decimal exponent, adjusted for
+ * the digits generated.
+ * @param minus The scaled lower boundary.
+ * @param w The scaled number.
+ * @param plus The scaled upper boundary.
+ * @return int32_t The number of digits.
+ */
+static int32_t generateDigits(char* digits, int32_t* decimalExponent,
+                              DiyFp minus, DiyFp w, DiyFp plus) {
+    uint64_t delta = diyFpSub(plus, minus).f;
+    uint64_t distance = diyFpSub(plus, w).f;
+
+    // split the upper boundary into integral and fractional parts
+    const int32_t shift = -plus.e;
+    const uint64_t one = (uint64_t)1 << shift;
+    uint32_t integral = (uint32_t)(plus.f >> shift);
+    uint64_t fractional = plus.f & (one - 1);
+
+    uint32_t pow10 = 1;
+    int32_t n = 1;
+    while (n < 10 && pow10 * 10 <= integral) {
+        pow10 *= 10;
+        n++;
+    }
+
+    int32_t length = 0;
+    while (n > 0) {
+        digits[length++] = (char)('0' + integral / pow10);
+        integral %= pow10;
+        n--;
+
+        const uint64_t rest = ((uint64_t)integral << shift) + fractional;
+        if (rest <= delta) {
+            *decimalExponent += n;
+            roundWeed(digits, length, distance, delta, rest,
+                      (uint64_t)pow10 << shift);
+            return length;
+        }
+        pow10 /= 10;
+    }
+
+    int32_t m = 0;
+    for (;;) {
+        fractional *= 10;
+        digits[length++] = (char)('0' + (fractional >> shift));
+        fractional &= one - 1;
+        m++;
+        delta *= 10;
+        distance *= 10;
+        if (fractional <= delta) break;
+    }
+
+    *decimalExponent -= m;
+    roundWeed(digits, length, distance, delta, fractional, one);
+    return length;
+}
+
+/**
+ * @brief Computes the shortest digits of a positive double.
+ * @param value The number, finite and greater than zero.
+ * @param digits A buffer of at least 17 bytes receiving the digits.
+ * @param decimalExponent A pointer where the exponent will be stored, such
+ * that the number is `digits * 10^decimalExponent`.
+ * @return int32_t The number of digits.
+ */
+static int32_t grisu2(double value, char* digits, int32_t* decimalExponent) {
+    DiyFp minus;
+    DiyFp plus;
+    const DiyFp v = computeBoundaries(value, &minus, &plus);
+
+    const CachedPower* cached = cachedPowerFor(plus.e);
+    const DiyFp power = {cached->f, cached->e};
+    const DiyFp w = diyFpMul(v, power);
+    DiyFp scaledMinus = diyFpMul(minus, power);
+    DiyFp scaledPlus = diyFpMul(plus, power);
+
+    // shrink the interval by one unit to cover the rounding in diyFpMul
+    scaledMinus.f++;
+    scaledPlus.f--;
+
+    *decimalExponent = -cached->k;
+    return generateDigits(digits, decimalExponent, scaledMinus, w, scaledPlus);
+}
+
+//-----------------------------------------------------------------------------
+//- Layout
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Writes a non-negative integer.
+ * @param buffer The buffer receiving the digits.
+ * @param value The integer.
+ * @return int32_t The number of characters written.
+ */
+static int32_t writeInteger(char* buffer, uint64_t value) {
+    char reversed[20];
+    int32_t length = 0;
+    do {
+        reversed[length++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    for (int32_t i = 0; i < length; i++) {
+        buffer[i] = reversed[length - 1 - i];
+    }
+    return length;
+}
+
+/**
+ * @brief Writes digits in fixed notation.
+ * @param buffer The buffer receiving the text.
+ * @param digits The significant digits, without trailing zeros.
+ * @param length The number of digits.
+ * @param exponent The decimal exponent of the first digit.
+ * @return int32_t The number of characters written.
+ */
+static int32_t writeFixed(char* buffer, const char* digits, int32_t length,
+                          int32_t exponent) {
+    char* out = buffer;
+    if (exponent < 0) {
+        *out++ = '0';
+        *out++ = '.';
+        for (int32_t i = -1; i > exponent; i--) *out++ = '0';
+        memcpy(out, digits, length);
+        out += length;
+    } else if (exponent + 1 >= length) {
+        memcpy(out, digits, length);
+        out += length;
+        for (int32_t i = length; i <= exponent; i++) *out++ = '0';
+    } else {
+        memcpy(out, digits, exponent + 1);
+        out += exponent + 1;
+        *out++ = '.';
+        memcpy(out, digits + exponent + 1, length - exponent - 1);
+        out += length - exponent - 1;
+    }
+    return (int32_t)(out - buffer);
+}
+
+/**
+ * @brief Writes digits in exponent notation, like "1.5e+20".
+ * @param buffer The buffer receiving the text.
+ * @param digits The significant digits, without trailing zeros.
+ * @param length The number of digits.
+ * @param exponent The decimal exponent of the first digit.
+ * @param minExponentDigits The minimum number of exponent digits.
+ * @return int32_t The number of characters written.
+ */
+static int32_t writeExponent(char* buffer, const char* digits, int32_t length,
+                             int32_t exponent, int32_t minExponentDigits) {
+    char* out = buffer;
+    *out++ = digits[0];
+    if (length > 1) {
+        *out++ = '.';
+        memcpy(out, digits + 1, length - 1);
+        out += length - 1;
+    }
+
+    *out++ = 'e';
+    *out++ = exponent < 0 ? '-' : '+';
+    if (exponent < 0) exponent = -exponent;
+    if (exponent < 10 && minExponentDigits > 1) *out++ = '0';
+    out += writeInteger(out, (uint64_t)exponent);
+    return (int32_t)(out - buffer);
+}
+
+/**
+ * @brief Rounds the digits of a positive double to the %g precision.
+ * @param digits The digits, updated in place.
+ * @param length A pointer to the number of digits, updated in place.
+ * @param exponent A pointer to the exponent of the first digit, incremented
+ * when rounding carries into a new digit.
+ * @return bool False if the digits are too close to a rounding midpoint to
+ * decide, true otherwise.
+ */
+static bool roundGeneral(char* digits, int32_t* length, int32_t* exponent) {
+    if (*length <= GENERAL_PRECISION) return true;
+
+    // compare the dropped digits with one half, leaving a margin for the
+    // error of the Grisu2 digits, which is below 1e-9 of the last kept digit
+    uint64_t tail = 0;
+    uint64_t scale = 1;
+    for (int32_t i = GENERAL_PRECISION; i < *length; i++) {
+        tail = tail * 10 + (uint64_t)(digits[i] - '0');
+        scale *= 10;
+    }
+    const uint64_t twice = 2 * tail;
+    const uint64_t difference = twice > scale ? twice - scale : scale - twice;
+    if (difference <= scale / 1000000000) return false;
+
+    *length = GENERAL_PRECISION;
+    if (twice > scale) {
+        int32_t i = GENERAL_PRECISION - 1;
+        while (i >= 0 && digits[i] == '9') digits[i--] = '0';
+        if (i < 0) {
+            digits[0] = '1';
+            (*exponent)++;
+        } else {
+            digits[i]++;
+        }
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//- Public API
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Formats a number as text.
+ *
+ * NaN and the infinities are written as "nan" and "inf" with their sign, like
+ * `printf` does, or as "NaN" and "Infinity" in the shortest format, like
+ * JavaScript does.
+ *
+ * @param value The number to format.
+ * @param format The format to use.
+ * @param buffer A buffer of at least `NUMBER_BUFFER_SIZE` bytes receiving the
+ * NUL-terminated text.
+ * @return int32_t The length of the text.
+ */
+int32_t formatNumber(double value, NumberFormat format, char* buffer) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    // JavaScript gives NaN no sign
+    if (value != value && format == NUMBER_FORMAT_SHORTEST) {
+        memcpy(buffer, "NaN", 4);
+        return 3;
+    }
+
+    char* out = buffer;
+    if (bits >> 63) {
+        *out++ = '-';
+        value = -value;
+    }
+
+    if (value != value) {
+        memcpy(out, "nan", 4);
+        return (int32_t)(out - buffer) + 3;
+    }
+    if (value > 1.7976931348623157e308) {
+        const char* name =
+            format == NUMBER_FORMAT_SHORTEST ? "Infinity" : "inf";
+        size_t length = strlen(name);
+        memcpy(out, name, length + 1);
+        return (int32_t)(out - buffer + length);
+    }
+
+    // integral values print their digits directly
+    const double integerLimit =
+        format == NUMBER_FORMAT_GENERAL ? 1e6 : 9007199254740992.0;
+    if (value < integerLimit && value == (double)(uint64_t)value) {
+        out += writeInteger(out, (uint64_t)value);
+        *out = '\0';
+        return (int32_t)(out - buffer);
+    }
+
+    if (format == NUMBER_FORMAT_GENERAL && value < MIN_NORMAL) {
+        return (int32_t)(out - buffer) +
+               snprintf(out, NUMBER_BUFFER_SIZE - 1, "%g", value);
+    }
+
+    char digits[18];
+    int32_t decimalExponent;
+    int32_t length = grisu2(value, digits, &decimalExponent);
+    int32_t exponent = length + decimalExponent - 1;
+
+    if (format == NUMBER_FORMAT_GENERAL) {
+        if (!roundGeneral(digits, &length, &exponent)) {
+            return (int32_t)(out - buffer) +
+                   snprintf(out, NUMBER_BUFFER_SIZE - 1, "%g", value);
+        }
+    }
+    while (length > 1 && digits[length - 1] == '0') length--;
+
+    if (format == NUMBER_FORMAT_GENERAL) {
+        if (exponent >= -4 && exponent < GENERAL_PRECISION) {
+            out += writeFixed(out, digits, length, exponent);
+        } else {
+            out += writeExponent(out, digits, length, exponent, 2);
+        }
+    } else {
+        if (exponent >= -6 && exponent < 21) {
+            out += writeFixed(out, digits, length, exponent);
+        } else {
+            out += writeExponent(out, digits, length, exponent, 1);
+        }
+    }
+
+    *out = '\0';
+    return (int32_t)(out - buffer);
+}
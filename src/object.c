@@ -13,14 +13,15 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "frozen.h"
 #include "memory.h"
 #include "table.h"
 #include "value.h"
 #include "vm.h"
 
 // A macro to simplify allocating an object of a specific type
-#define ALLOCATE_OBJECT(type, objectType) \
-    (type*)allocateObject(sizeof(type), objectType)
+#define ALLOCATE_OBJECT(vm, type, objectType) \
+    (type*)allocateObject(vm, sizeof(type), objectType)
 
 //-----------------------------------------------------------------------------
 //- Object Allocation
@@ -32,16 +33,18 @@
  * Allocates a memory block of the given size, initializes the object's header
  * (type and GC mark bit), and links it into the VM's list of all objects.
  *
+ * @param vm The virtual machine.
  * @param size The size of the object to allocate in bytes.
  * @param type The ObjectType of the object being created.
  * @return Object* A pointer to the newly allocated object.
  */
-static Object* allocateObject(size_t size, ObjectType type) {
-    Object* object = (Object*)reallocate(NULL, 0, size);
+static Object* allocateObject(VM* vm, size_t size, ObjectType type) {
+    Object* object = (Object*)reallocate(vm, NULL, 0, size);
     object->type = type;
     object->isMarked = false;
-    object->next = vm.objects;  // add to linked list for garbage collection
-    vm.objects = object;
+    object->isFrozen = false;
+    object->next = vm->objects;  // add to linked list for garbage collection
+    vm->objects = object;
 
 #ifdef DEBUG_LOG_GC
     printf("%p allocate %zu for %d\n", (void*)object, size, type);
@@ -52,24 +55,25 @@ static Object* allocateObject(size_t size, ObjectType type) {
 
 /**
  * @brief Allocates a new ObjectString and interns it in the VM's string table.
+ * @param vm The virtual machine.
  * @param chars The character buffer for the string. This function takes
  * ownership.
  * @param length The length of the string.
  * @param hash The precomputed hash of the string.
  * @return ObjectString* A pointer to the allocated string object.
  */
-static ObjectString* allocateString(char* chars, int32_t length,
+static ObjectString* allocateString(VM* vm, char* chars, int32_t length,
                                     uint32_t hash) {
-    ObjectString* string = ALLOCATE_OBJECT(ObjectString, OBJECT_STRING);
+    ObjectString* string = ALLOCATE_OBJECT(vm, ObjectString, OBJECT_STRING);
     string->length = length;
     string->chars = chars;
     string->hash = hash;
 
     // push/pop to guard against GC during table resizing
-    push(OBJECT_VAL(string));
+    push(vm, OBJECT_VAL(string));
     // interning
-    tableSet(&vm.strings, string, NIL_VAL);
-    pop();
+    internTableAdd(vm, &vm->strings, string);
+    pop(vm);
 
     return string;
 }
@@ -93,27 +97,50 @@ static uint32_t hashString(const char* key, int32_t length) {
     return hash;
 }
 
+/**
+ * @brief Looks up the interned string with the given contents.
+ *
+ * The strings of attached frozen code take precedence, so the VM never
+ * creates a twin of a frozen string.
+ *
+ * @param vm The virtual machine.
+ * @param chars The characters of the string.
+ * @param length The length of the string.
+ * @param hash The hash of the string.
+ * @return ObjectString* The interned string, or NULL if there is none.
+ */
+static ObjectString* findInterned(VM* vm, const char* chars, int32_t length,
+                                  uint32_t hash) {
+    if (vm->frozen != NULL) {
+        ObjectString* frozen =
+            tableFindString(&vm->frozen->strings, chars, length, hash);
+        if (frozen != NULL) return frozen;
+    }
+    return tableFindString(&vm->strings, chars, length, hash);
+}
+
 /**
  * @brief Creates a new ObjectString from an existing character buffer.
  *
  * This function takes ownership of the `chars` buffer and will free it if
  * an identical string is already interned.
  *
+ * @param vm The virtual machine.
  * @param chars The character buffer (heap-allocated).
  * @param length The length of the string.
  * @return ObjectString* The interned string object.
  */
-ObjectString* takeString(char* chars, int32_t length) {
+ObjectString* takeString(VM* vm, char* chars, int32_t length) {
     uint32_t hash = hashString(chars, length);
 
     // check if we already have an identical string in the vm
-    ObjectString* interned = tableFindString(&vm.strings, chars, length, hash);
+    ObjectString* interned = findInterned(vm, chars, length, hash);
     if (interned != NULL) {
-        FREE_ARRAY(char, chars, length + 1);
+        FREE_ARRAY(vm, char, chars, length + 1);
         return interned;
     }
 
-    return allocateString(chars, length, hash);
+    return allocateString(vm, chars, length, hash);
 }
 
 /**
@@ -122,22 +149,88 @@ ObjectString* takeString(char* chars, int32_t length) {
  * If an identical string is already interned, it is returned without a new
  * allocation.
  *
+ * @param vm The virtual machine.
  * @param chars The character buffer to copy from.
  * @param length The number of characters to copy.
  * @return ObjectString* The interned string object.
  */
-ObjectString* copyString(const char* chars, int32_t length) {
+ObjectString* copyString(VM* vm, const char* chars, int32_t length) {
     uint32_t hash = hashString(chars, length);
 
     // check if we already have an identical string in the vm
-    ObjectString* interned = tableFindString(&vm.strings, chars, length, hash);
+    ObjectString* interned = findInterned(vm, chars, length, hash);
     if (interned != NULL) return interned;
 
-    char* heapChars = ALLOCATE(char, length + 1);
+    char* heapChars = ALLOCATE(vm, char, length + 1);
     memcpy(heapChars, chars, length);
     heapChars[length] = '\0';
 
-    return allocateString(heapChars, length, hash);
+    return allocateString(vm, heapChars, length, hash);
+}
+
+/**
+ * @brief Creates an ObjectString holding a copy of a buffer, without hashing
+ * or interning it.
+ *
+ * Meant for large buffers only the VM reads, like the source lazily compiled
+ * functions point into. The string must never become a Lox value, since
+ * strings are compared by identity and only interned ones are unique.
+ *
+ * @param vm The virtual machine.
+ * @param chars The character buffer to copy from.
+ * @param length The number of characters to copy.
+ * @return ObjectString* The new string object.
+ */
+ObjectString* copyUninternedString(VM* vm, const char* chars, int32_t length) {
+    char* heapChars = ALLOCATE(vm, char, length + 1);
+    memcpy(heapChars, chars, length);
+    heapChars[length] = '\0';
+
+    ObjectString* string = ALLOCATE_OBJECT(vm, ObjectString, OBJECT_STRING);
+    string->length = length;
+    string->chars = heapChars;
+    string->hash = 0;
+    return string;
+}
+
+/**
+ * @brief Creates a string Value by taking ownership of a character buffer.
+ *
+ * Strings of up to `SHORT_STRING_MAX` characters become immediate Values and
+ * the buffer is freed; longer ones are interned as with `takeString`.
+ *
+ * @param vm The virtual machine.
+ * @param chars The character buffer (heap-allocated).
+ * @param length The length of the string.
+ * @return Value The string value.
+ */
+Value takeStringValue(VM* vm, char* chars, int32_t length) {
+#ifdef NAN_BOXING
+    if (length <= SHORT_STRING_MAX) {
+        Value value = shortStringToValue(chars, length);
+        FREE_ARRAY(vm, char, chars, length + 1);
+        return value;
+    }
+#endif
+    return OBJECT_VAL(takeString(vm, chars, length));
+}
+
+/**
+ * @brief Creates a string Value by copying from a character buffer.
+ *
+ * Strings of up to `SHORT_STRING_MAX` characters become immediate Values;
+ * longer ones are interned as with `copyString`.
+ *
+ * @param vm The virtual machine.
+ * @param chars The character buffer to copy from.
+ * @param length The number of characters to copy.
+ * @return Value The string value.
+ */
+Value copyStringValue(VM* vm, const char* chars, int32_t length) {
+#ifdef NAN_BOXING
+    if (length <= SHORT_STRING_MAX) return shortStringToValue(chars, length);
+#endif
+    return OBJECT_VAL(copyString(vm, chars, length));
 }
 
 //-----------------------------------------------------------------------------
@@ -146,40 +239,191 @@ ObjectString* copyString(const char* chars, int32_t length) {
 
 /**
  * @brief Creates a new ObjectFunction.
+ * @param vm The virtual machine.
  * @return ObjectFunction* The new function object.
  */
-ObjectFunction* newFunction() {
-    ObjectFunction* function = ALLOCATE_OBJECT(ObjectFunction, OBJECT_FUNCTION);
+ObjectFunction* newFunction(VM* vm) {
+    ObjectFunction* function = ALLOCATE_OBJECT(vm, ObjectFunction,
+                                               OBJECT_FUNCTION);
     function->arity = 0;
     function->upvalueCount = 0;
+    function->maxSlots = 0;
     function->name = NULL;
+    function->lazy = NULL;
     initChunk(&function->chunk);
     return function;
 }
 
+/**
+ * @brief Creates a new, empty ObjectList.
+ * @param vm The virtual machine.
+ * @return ObjectList* The new list object.
+ */
+ObjectList* newList(VM* vm) {
+    ObjectList* list = ALLOCATE_OBJECT(vm, ObjectList, OBJECT_LIST);
+    initValueArray(&list->items);
+    return list;
+}
+
+/**
+ * @brief Creates a new ObjectFloat64Array filled with zeros.
+ * @param vm The virtual machine.
+ * @param count The number of elements.
+ * @return ObjectFloat64Array* The new array object.
+ */
+ObjectFloat64Array* newFloat64Array(VM* vm, int32_t count) {
+    // the buffer is allocated first, so a GC it triggers cannot see an
+    // array without its elements
+    double* values = ALLOCATE(vm, double, count);
+    if (count > 0) memset(values, 0, sizeof(double) * count);
+
+    ObjectFloat64Array* array =
+        ALLOCATE_OBJECT(vm, ObjectFloat64Array, OBJECT_FLOAT64_ARRAY);
+    array->count = count;
+    array->values = values;
+    return array;
+}
+
+/**
+ * @brief Creates a new, empty ObjectMap.
+ * @param vm The virtual machine.
+ * @return ObjectMap* The new map object.
+ */
+ObjectMap* newMap(VM* vm) {
+    ObjectMap* map = ALLOCATE_OBJECT(vm, ObjectMap, OBJECT_MAP);
+    initMap(&map->table);
+    return map;
+}
+
 /**
  * @brief Creates a new ObjectNative for wrapping a C function.
- * @param function The C function pointer.
+ * @param vm The virtual machine.
+ * @param spec How to call the function, which must outlive the VM.
  * @return ObjectNative* The new native function object.
  */
-ObjectNative* newNative(NativeFunction function) {
-    ObjectNative* native = ALLOCATE_OBJECT(ObjectNative, OBJECT_NATIVE);
-    native->function = function;
+ObjectNative* newNative(VM* vm, const NativeSpec* spec) {
+    ObjectNative* native = ALLOCATE_OBJECT(vm, ObjectNative, OBJECT_NATIVE);
+    native->spec = spec;
     return native;
 }
 
+/**
+ * @brief Creates a new ObjectChannel.
+ * @param vm The virtual machine.
+ * @param channel The channel, whose reference the object takes over.
+ * @return ObjectChannel* The new channel object.
+ */
+ObjectChannel* newChannel(VM* vm, Channel* channel) {
+    ObjectChannel* object = ALLOCATE_OBJECT(vm, ObjectChannel, OBJECT_CHANNEL);
+    object->channel = channel;
+    return object;
+}
+
+/**
+ * @brief Creates a new ObjectWorker.
+ * @param vm The virtual machine.
+ * @param worker The worker, whose reference the object takes over.
+ * @return ObjectWorker* The new worker object.
+ */
+ObjectWorker* newWorker(VM* vm, Worker* worker) {
+    ObjectWorker* object = ALLOCATE_OBJECT(vm, ObjectWorker, OBJECT_WORKER);
+    object->worker = worker;
+    return object;
+}
+
+/**
+ * @brief Creates a new ObjectForeign wrapping host data, without copying it.
+ * @param vm The virtual machine.
+ * @param data The data.
+ * @param size The size of the data in bytes.
+ * @param tag The kind of data, for natives to check.
+ * @param finalize Called with the data when the object is freed, or NULL if
+ * the host keeps ownership.
+ * @param trace Marks the values the data refers to, or NULL if there are
+ * none.
+ * @return ObjectForeign* The new foreign object.
+ */
+ObjectForeign* newForeign(VM* vm, void* data, size_t size, uint32_t tag,
+                          ForeignFinalizer finalize, ForeignTracer trace) {
+    ObjectForeign* foreign = ALLOCATE_OBJECT(vm, ObjectForeign, OBJECT_FOREIGN);
+    foreign->data = data;
+    foreign->size = size;
+    foreign->tag = tag;
+    foreign->finalize = finalize;
+    foreign->trace = trace;
+
+    // data the object owns is heap memory as far as the collector is concerned
+    if (finalize != NULL) vm->bytesAllocated += size;
+    return foreign;
+}
+
+/**
+ * @brief Creates a new ObjectCoroutine that has not started yet.
+ *
+ * The closure is the first value on the coroutine's stack, where it is
+ * called by the first `resume`.
+ * @param vm The virtual machine.
+ * @param closure The function the coroutine runs.
+ * @return ObjectCoroutine* The new coroutine object.
+ */
+ObjectCoroutine* newCoroutine(VM* vm, ObjectClosure* closure) {
+    // the stack is allocated first, so a collection it triggers cannot see a
+    // coroutine without one
+    Value* stack = ALLOCATE(vm, Value, COROUTINE_STACK_INITIAL);
+    CallFrame* frames = ALLOCATE(vm, CallFrame, COROUTINE_FRAMES_INITIAL);
+
+    ObjectCoroutine* coroutine = ALLOCATE_OBJECT(vm, ObjectCoroutine,
+                                                 OBJECT_COROUTINE);
+    coroutine->closure = closure;
+    coroutine->state = COROUTINE_SUSPENDED;
+    coroutine->caller = NULL;
+    coroutine->task = false;
+
+    StackSegment* segment = &coroutine->segment;
+    segment->stack = stack;
+    segment->stackCapacity = COROUTINE_STACK_INITIAL;
+    segment->frames = frames;
+    segment->frameCapacity = COROUTINE_FRAMES_INITIAL;
+    segment->frameCount = 0;
+    segment->openUpvalues = NULL;
+    stack[0] = OBJECT_VAL(closure);
+    segment->stackTop = stack + 1;
+    return coroutine;
+}
+
+/**
+ * @brief Frees the arrays of a coroutine's stack and leaves it empty.
+ *
+ * Freeing an empty stack again does nothing.
+ * @param vm The virtual machine.
+ * @param segment The stack.
+ */
+void freeStackSegment(VM* vm, StackSegment* segment) {
+    FREE_ARRAY(vm, Value, segment->stack, segment->stackCapacity);
+    FREE_ARRAY(vm, CallFrame, segment->frames, segment->frameCapacity);
+    segment->stack = NULL;
+    segment->stackTop = NULL;
+    segment->stackCapacity = 0;
+    segment->frames = NULL;
+    segment->frameCount = 0;
+    segment->frameCapacity = 0;
+    segment->openUpvalues = NULL;
+}
+
 /**
  * @brief Creates a new ObjectClosure from a function.
+ * @param vm The virtual machine.
  * @param function The function to wrap in a closure.
  * @return ObjectClosure* The new closure object.
  */
-ObjectClosure* newClosure(ObjectFunction* function) {
-    ObjectUpvalue** upvalues = ALLOCATE(ObjectUpvalue*, function->upvalueCount);
+ObjectClosure* newClosure(VM* vm, ObjectFunction* function) {
+    ObjectUpvalue** upvalues = ALLOCATE(vm, ObjectUpvalue*,
+                                        function->upvalueCount);
     for (int32_t i = 0; i < function->upvalueCount; i++) {
         upvalues[i] = NULL;
     }
 
-    ObjectClosure* closure = ALLOCATE_OBJECT(ObjectClosure, OBJECT_CLOSURE);
+    ObjectClosure* closure = ALLOCATE_OBJECT(vm, ObjectClosure, OBJECT_CLOSURE);
     closure->function = function;
     closure->upvalues = upvalues;
     closure->upvalueCount = function->upvalueCount;
@@ -190,36 +434,43 @@ ObjectClosure* newClosure(ObjectFunction* function) {
  * @brief Creates a new ObjectUpvalue.
  *
  * An upvalue represents a local variable that is "closed over" by a closure.
+ * @param vm The virtual machine.
  * @param slot A pointer to the local variable on the VM's stack.
  * @return ObjectUpvalue* The new upvalue object.
  */
-ObjectUpvalue* newUpvalue(Value* slot) {
-    ObjectUpvalue* upvalue = ALLOCATE_OBJECT(ObjectUpvalue, OBJECT_UPVALUE);
+ObjectUpvalue* newUpvalue(VM* vm, Value* slot) {
+    ObjectUpvalue* upvalue = ALLOCATE_OBJECT(vm, ObjectUpvalue, OBJECT_UPVALUE);
     upvalue->closed = NIL_VAL;
     upvalue->location = slot;
     upvalue->next = NULL;
+    upvalue->coroutine = NULL;
     return upvalue;
 }
 
 /**
  * @brief Creates a new ObjectClass.
+ * @param vm The virtual machine.
  * @param name The name of the class.
  * @return ObjectClass* The new class object.
  */
-ObjectClass* newClass(ObjectString* name) {
-    ObjectClass* klass = ALLOCATE_OBJECT(ObjectClass, OBJECT_CLASS);
-    initTable(&klass->methods);
+ObjectClass* newClass(VM* vm, ObjectString* name) {
+    ObjectClass* klass = ALLOCATE_OBJECT(vm, ObjectClass, OBJECT_CLASS);
+    initTable(&klass->ownMethods);
+    klass->methods = &klass->ownMethods;
+    klass->superclass = NULL;
     klass->name = name;
     return klass;
 }
 
 /**
  * @brief Creates a new ObjectInstance of a class.
+ * @param vm The virtual machine.
  * @param klass The class to instantiate.
  * @return ObjectInstance* The new instance object.
  */
-ObjectInstance* newInstance(ObjectClass* klass) {
-    ObjectInstance* instance = ALLOCATE_OBJECT(ObjectInstance, OBJECT_INSTANCE);
+ObjectInstance* newInstance(VM* vm, ObjectClass* klass) {
+    ObjectInstance* instance = ALLOCATE_OBJECT(vm, ObjectInstance,
+                                               OBJECT_INSTANCE);
     instance->klass = klass;
     initTable(&instance->fields);
     return instance;
@@ -230,13 +481,15 @@ ObjectInstance* newInstance(ObjectClass* klass) {
  *
  * A bound method is a closure that has captured a specific instance (`this`)
  * as its receiver.
+ * @param vm The virtual machine.
  * @param receiver The instance that the method is bound to.
  * @param method The closure representing the method's code.
  * @return ObjectBoundMethod* The new bound method object.
  */
-ObjectBoundMethod* newBoundMethod(Value receiver, ObjectClosure* method) {
+ObjectBoundMethod* newBoundMethod(VM* vm, Value receiver,
+                                  ObjectClosure* method) {
     ObjectBoundMethod* bound =
-        ALLOCATE_OBJECT(ObjectBoundMethod, OBJECT_BOUND_METHOD);
+        ALLOCATE_OBJECT(vm, ObjectBoundMethod, OBJECT_BOUND_METHOD);
     bound->receiver = receiver;
     bound->method = method;
     return bound;
@@ -247,53 +500,131 @@ ObjectBoundMethod* newBoundMethod(Value receiver, ObjectClosure* method) {
 //-----------------------------------------------------------------------------
 
 /**
- * @brief Helper function to print a function object.
+ * @brief Helper function to write a function object.
  */
-static void printFunction(const ObjectFunction* function) {
+static void writeFunction(OutputBuffer* output,
+                          const ObjectFunction* function) {
     if (function->name == NULL) {
-        printf("<script>");
+        writeOutput(output, "<script>", 8);
         return;
     }
-    printf("<fn %s>", function->name->chars);
+    writeOutput(output, "<fn ", 4);
+    writeOutput(output, function->name->chars, function->name->length);
+    writeOutput(output, ">", 1);
+}
+
+/**
+ * @brief Helper function to write a list and its elements.
+ */
+static void writeList(OutputBuffer* output, const ObjectList* list) {
+    writeOutput(output, "[", 1);
+    for (int32_t i = 0; i < list->items.count; i++) {
+        if (i > 0) writeOutput(output, ", ", 2);
+        writeValue(output, list->items.values[i]);
+    }
+    writeOutput(output, "]", 1);
+}
+
+/**
+ * @brief Helper function to write a Float64Array and its elements.
+ */
+static void writeFloat64Array(OutputBuffer* output,
+                              const ObjectFloat64Array* array) {
+    writeOutput(output, "Float64Array[", 13);
+    for (int32_t i = 0; i < array->count; i++) {
+        if (i > 0) writeOutput(output, ", ", 2);
+        writeValue(output, NUMBER_VAL(array->values[i]));
+    }
+    writeOutput(output, "]", 1);
 }
 
 /**
- * @brief Prints a representation of a Clox object to stdout.
- * @param value The object value to print.
+ * @brief Helper function to write a map and its entries.
  */
-void printObject(Value value) {
+static void writeMap(OutputBuffer* output, const ObjectMap* map) {
+    writeOutput(output, "{", 1);
+    bool first = true;
+    for (int32_t i = 0; i <= map->table.capacity; i++) {
+        const MapEntry* entry = &map->table.entries[i];
+        if (IS_NIL(entry->key)) continue;
+        if (!first) writeOutput(output, ", ", 2);
+        first = false;
+        writeValue(output, entry->key);
+        writeOutput(output, ": ", 2);
+        writeValue(output, entry->value);
+    }
+    writeOutput(output, "}", 1);
+}
+
+/**
+ * @brief Writes a representation of a Clox object to an output buffer.
+ * @param output The output buffer.
+ * @param value The object value to write.
+ */
+void writeObject(OutputBuffer* output, Value value) {
     switch (OBJECT_TYPE(value)) {
         case OBJECT_BOUND_METHOD: {
-            printFunction(AS_BOUND_METHOD(value)->method->function);
+            writeFunction(output, AS_BOUND_METHOD(value)->method->function);
             break;
         }
         case OBJECT_INSTANCE: {
-            printf("%s instance", AS_INSTANCE(value)->klass->name->chars);
+            const ObjectString* name = AS_INSTANCE(value)->klass->name;
+            writeOutput(output, name->chars, name->length);
+            writeOutput(output, " instance", 9);
             break;
         }
         case OBJECT_CLASS: {
-            printf("%s", AS_CLASS(value)->name->chars);
+            const ObjectString* name = AS_CLASS(value)->name;
+            writeOutput(output, name->chars, name->length);
             break;
         }
         case OBJECT_CLOSURE: {
-            printFunction(AS_CLOSURE(value)->function);
+            writeFunction(output, AS_CLOSURE(value)->function);
+            break;
+        }
+        case OBJECT_FLOAT64_ARRAY: {
+            writeFloat64Array(output, AS_FLOAT64_ARRAY(value));
             break;
         }
         case OBJECT_FUNCTION: {
-            printFunction(AS_FUNCTION(value));
+            writeFunction(output, AS_FUNCTION(value));
+            break;
+        }
+        case OBJECT_LIST: {
+            writeList(output, AS_LIST(value));
+            break;
+        }
+        case OBJECT_MAP: {
+            writeMap(output, AS_MAP(value));
             break;
         }
         case OBJECT_NATIVE: {
-            printf("<native fn>");
+            writeOutput(output, "<native fn>", 11);
             break;
         }
         case OBJECT_STRING: {
-            printf("%s", AS_CSTRING(value));
+            writeOutput(output, AS_CSTRING(value), AS_STRING(value)->length);
+            break;
+        }
+        case OBJECT_CHANNEL: {
+            writeOutput(output, "<channel>", 9);
+            break;
+        }
+        case OBJECT_WORKER: {
+            writeOutput(output, "<worker>", 8);
+            break;
+        }
+        case OBJECT_COROUTINE: {
+            writeOutput(output, "<coroutine>", 11);
+            break;
+        }
+        case OBJECT_FOREIGN: {
+            writeOutput(output, "<foreign>", 9);
             break;
         }
         case OBJECT_UPVALUE: {  // will never actually execute -> users don't
                                 // have "access" to upvalues
-            printf("upvalue");
+            writeOutput(output, "upvalue", 7);
             break;
         }
     }
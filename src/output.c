@@ -0,0 +1,165 @@
+/**
+ * @file output.c
+ * @brief Buffered output written straight to a file descriptor.
+ *
+ * Bytes are copied into the buffer until it is full and then written with a
+ * single `write`. A chunk too large to fit is not copied at all: it is
+ * written together with whatever is buffered in one `writev` call.
+ */
+
+#include "output.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+//-----------------------------------------------------------------------------
+//- System Calls
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Writes bytes to a file descriptor, retrying short writes.
+ *
+ * Bytes that cannot be written because of an error are dropped, as stdio
+ * would do.
+ *
+ * @param fd The file descriptor.
+ * @param bytes The bytes to write.
+ * @param length The number of bytes.
+ */
+static void writeAll(int fd, const char* bytes, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        bytes += written;
+        length -= (size_t)written;
+    }
+}
+
+/**
+ * @brief Writes two runs of bytes to a file descriptor, in order.
+ * @param fd The file descriptor.
+ * @param first The first run of bytes.
+ * @param firstLength The length of the first run.
+ * @param second The second run of bytes.
+ * @param secondLength The length of the second run.
+ */
+static void writePair(int fd, const char* first, size_t firstLength,
+                      const char* second, size_t secondLength) {
+#ifndef _WIN32
+    struct iovec parts[2] = {{(void*)first, firstLength},
+                             {(void*)second, secondLength}};
+    ssize_t written;
+    do {
+        written = writev(fd, parts, 2);
+    } while (written < 0 && errno == EINTR);
+    if (written < 0) return;
+
+    // finish a short write with plain writes
+    if ((size_t)written < firstLength) {
+        writeAll(fd, first + written, firstLength - (size_t)written);
+        writeAll(fd, second, secondLength);
+    } else {
+        size_t done = (size_t)written - firstLength;
+        writeAll(fd, second + done, secondLength - done);
+    }
+#else
+    writeAll(fd, first, firstLength);
+    writeAll(fd, second, secondLength);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+//- Output Buffer
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Initializes an output buffer.
+ *
+ * The buffer is line-buffered if the stream is a terminal. Defining
+ * `OUTPUT_LINE_BUFFERED` as 0 or 1 at build time overrides this.
+ *
+ * @param output The output buffer to initialize.
+ * @param stream The stream to write to.
+ * @param bytes The memory to buffer bytes in.
+ * @param capacity The size of `bytes`.
+ */
+void initOutput(OutputBuffer* output, FILE* stream, char* bytes,
+                int32_t capacity) {
+    output->stream = stream;
+    output->bytes = bytes;
+    output->count = 0;
+    output->capacity = capacity;
+#ifdef OUTPUT_LINE_BUFFERED
+    output->lineBuffered = OUTPUT_LINE_BUFFERED;
+#else
+    output->lineBuffered = isatty(fileno(stream));
+#endif
+}
+
+/**
+ * @brief Writes all buffered bytes to the stream.
+ *
+ * Anything already buffered by stdio on the same stream is flushed first, so
+ * output written through both paths stays in order.
+ *
+ * @param output The output buffer to flush.
+ */
+void flushOutput(OutputBuffer* output) {
+    if (output->count == 0) return;
+    fflush(output->stream);
+    writeAll(fileno(output->stream), output->bytes, output->count);
+    output->count = 0;
+}
+
+/**
+ * @brief Appends bytes to an output buffer, flushing it when it is full.
+ * @param output The output buffer.
+ * @param bytes The bytes to append.
+ * @param length The number of bytes.
+ */
+void writeOutput(OutputBuffer* output, const char* bytes, int32_t length) {
+    if (length <= output->capacity - output->count) {
+        memcpy(output->bytes + output->count, bytes, length);
+        output->count += length;
+        return;
+    }
+
+    if (length >= output->capacity) {
+        // too large to buffer: send it along with the buffered bytes
+        fflush(output->stream);
+        writePair(fileno(output->stream), output->bytes, output->count, bytes,
+                  length);
+        output->count = 0;
+        return;
+    }
+
+    flushOutput(output);
+    memcpy(output->bytes, bytes, length);
+    output->count = length;
+}
+
+/**
+ * @brief Appends a NUL-terminated string to an output buffer.
+ * @param output The output buffer.
+ * @param string The string to append.
+ */
+void writeOutputString(OutputBuffer* output, const char* string) {
+    writeOutput(output, string, (int32_t)strlen(string));
+}
+
+/**
+ * @brief Ends a line of output, flushing it if the buffer is line-buffered.
+ * @param output The output buffer.
+ */
+void endOutputLine(OutputBuffer* output) {
+    writeOutput(output, "\n", 1);
+    if (output->lineBuffered) flushOutput(output);
+}
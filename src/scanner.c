@@ -14,17 +14,33 @@
 
 #include "common.h"
 
-// global scanner
-Scanner scanner;
-
 /**
  * @brief Initializes the scanner with the source code to be tokenized.
- * @param source A null-terminated C string containing the Clox source code.
+ *
+ * The source does not need to be null-terminated, so it can be scanned
+ * straight from a file mapped into memory.
+ *
+ * @param scanner The scanner.
+ * @param source The Clox source code.
+ * @param length The length of the source code.
+ */
+void initScanner(Scanner* scanner, const char* source, size_t length) {
+    initScannerAt(scanner, source, source + length, 1);
+}
+
+/**
+ * @brief Initializes the scanner to resume scanning in the middle of a source.
+ * @param scanner The scanner.
+ * @param position A pointer into the Clox source code.
+ * @param end A pointer just past the end of the source code.
+ * @param line The line number of `position`.
  */
-void initScanner(const char* source) {
-    scanner.start = source;
-    scanner.current = source;
-    scanner.line = 1;
+void initScannerAt(Scanner* scanner, const char* position, const char* end,
+                   int32_t line) {
+    scanner->start = position;
+    scanner->current = position;
+    scanner->line = line;
+    scanner->end = end;
 }
 
 //-----------------------------------------------------------------------------
@@ -49,9 +65,12 @@ static bool isDigit(char c) { return c >= '0' && c <= '9'; }
 
 /**
  * @brief Checks if the scanner has reached the end of the source code.
+ * @param scanner The scanner.
  * @return bool True if at the end of the file, false otherwise.
  */
-static bool isAtEnd() { return *scanner.current == '\0'; }
+static bool isAtEnd(Scanner* scanner) {
+    return scanner->current == scanner->end;
+}
 
 //-----------------------------------------------------------------------------
 //- Scanner Primitives
@@ -59,40 +78,47 @@ static bool isAtEnd() { return *scanner.current == '\0'; }
 
 /**
  * @brief Consumes and returns the current character, advancing the scanner.
+ * @param scanner The scanner.
  * @return char The character that was just consumed.
  */
-static char advance() {
-    scanner.current++;
-    return scanner.current[-1];
+static char advance(Scanner* scanner) {
+    scanner->current++;
+    return scanner->current[-1];
 }
 
 /**
  * @brief Returns the character at the current scanner position without
  * consuming it.
- * @return char The current character.
+ * @param scanner The scanner.
+ * @return char The current character, or '\0' if at the end.
  */
-static char peek() { return *scanner.current; }
+static char peek(Scanner* scanner) {
+    if (isAtEnd(scanner)) return '\0';
+    return *scanner->current;
+}
 
 /**
  * @brief Returns the character just after the current scanner position without
  * consuming it.
+ * @param scanner The scanner.
  * @return char The next character, or '\0' if at the end.
  */
-static char peekNext() {
-    if (isAtEnd()) return '\0';
-    return scanner.current[1];
+static char peekNext(Scanner* scanner) {
+    if (scanner->end - scanner->current < 2) return '\0';
+    return scanner->current[1];
 }
 
 /**
  * @brief Conditionally consumes the current character if it matches the
  * expected one.
+ * @param scanner The scanner.
  * @param expected The character to match against.
  * @return bool True if the character was matched and consumed, false otherwise.
  */
-static bool match(char expected) {
-    if (isAtEnd()) return false;
-    if (*scanner.current != expected) return false;
-    scanner.current++;
+static bool match(Scanner* scanner, char expected) {
+    if (isAtEnd(scanner)) return false;
+    if (*scanner->current != expected) return false;
+    scanner->current++;
     return true;
 }
 
@@ -103,31 +129,33 @@ static bool match(char expected) {
 /**
  * @brief Creates a token of the given type.
  *
- * The token's lexeme is defined by the range from `scanner.start` to
- * `scanner.current`.
+ * The token's lexeme is defined by the range from `scanner->start` to
+ * `scanner->current`.
+ * @param scanner The scanner.
  * @param type The type of the token to create.
  * @return Token The newly created token.
  */
-static Token makeToken(TokenType type) {
+static Token makeToken(Scanner* scanner, TokenType type) {
     Token token;
     token.type = type;
-    token.start = scanner.start;
-    token.length = (int32_t)(scanner.current - scanner.start);
-    token.line = scanner.line;
+    token.start = scanner->start;
+    token.length = (int32_t)(scanner->current - scanner->start);
+    token.line = scanner->line;
     return token;
 }
 
 /**
  * @brief Creates an error token with a specific message.
+ * @param scanner The scanner.
  * @param message The error message to embed in the token.
  * @return Token The newly created error token.
  */
-static Token errorToken(const char* message) {
+static Token errorToken(Scanner* scanner, const char* message) {
     Token token;
     token.type = TOKEN_ERROR;
     token.start = message;  // reuse for message passing
     token.length = (int)strlen(message);
-    token.line = scanner.line;
+    token.line = scanner->line;
     return token;
 }
 
@@ -141,22 +169,24 @@ static Token errorToken(const char* message) {
  * This includes spaces, tabs, carriage returns, newlines, and line comments
  * starting with '//'.
  */
-static void skipWhitespace() {
+static void skipWhitespace(Scanner* scanner) {
     for (;;) {
-        char c = peek();
+        char c = peek(scanner);
         switch (c) {
             case ' ':
             case '\r':
             case '\t':
-                advance();
+                advance(scanner);
                 break;
             case '\n':
-                scanner.line++;
-                advance();
+                scanner->line++;
+                advance(scanner);
                 break;
             case '/':
-                if (peekNext() == '/') {  // skip comments too
-                    while (peek() != '\n' && !isAtEnd()) advance();
+                if (peekNext(scanner) == '/') {  // skip comments too
+                    while (peek(scanner) != '\n' && !isAtEnd(scanner)) {
+                        advance(scanner);
+                    }
                 } else {
                     return;
                 }
@@ -172,40 +202,42 @@ static void skipWhitespace() {
  *
  * Consumes characters until a closing double quote is found or the end of
  * the file is reached.
+ * @param scanner The scanner.
  * @return Token A `TOKEN_STRING` or `TOKEN_ERROR` if the string is
  * unterminated.
  */
-static Token string() {
-    while (peek() != '"' && !isAtEnd()) {
-        if (peek() == '\n') scanner.line++;
-        advance();
+static Token string(Scanner* scanner) {
+    while (peek(scanner) != '"' && !isAtEnd(scanner)) {
+        if (peek(scanner) == '\n') scanner->line++;
+        advance(scanner);
     }
 
-    if (isAtEnd()) return errorToken("Unterminated string.");
+    if (isAtEnd(scanner)) return errorToken(scanner, "Unterminated string.");
 
     // the closing quote
-    advance();
-    return makeToken(TOKEN_STRING);
+    advance(scanner);
+    return makeToken(scanner, TOKEN_STRING);
 }
 
 /**
  * @brief Scans a number literal.
  *
  * Handles both integer and floating-point numbers.
+ * @param scanner The scanner.
  * @return Token A `TOKEN_NUMBER`.
  */
-static Token number() {
-    while (isDigit(peek())) advance();
+static Token number(Scanner* scanner) {
+    while (isDigit(peek(scanner))) advance(scanner);
 
     // look for a fractional part
-    if (peek() == '.' && isDigit(peekNext())) {
+    if (peek(scanner) == '.' && isDigit(peekNext(scanner))) {
         // consume the '.'
-        advance();
+        advance(scanner);
         // consume the fractional part
-        while (isDigit(peek())) advance();
+        while (isDigit(peek(scanner))) advance(scanner);
     }
 
-    return makeToken(TOKEN_NUMBER);
+    return makeToken(scanner, TOKEN_NUMBER);
 }
 
 /**
@@ -213,16 +245,18 @@ static Token number() {
  *
  * Compares a substring of the current lexeme against a potential keyword.
  *
+ * @param scanner The scanner.
  * @param start The starting offset within the lexeme to check.
  * @param length The length of the keyword to check.
  * @param rest The expected characters of the keyword.
  * @param type The token type to return if it's a match.
  * @return TokenType The keyword's token type or `TOKEN_IDENTIFIER`.
  */
-static TokenType checkKeyword(int32_t start, int32_t length, const char* rest,
+static TokenType checkKeyword(Scanner* scanner, int32_t start, int32_t length,
+                              const char* rest,
                               TokenType type) {
-    if (scanner.current - scanner.start == start + length &&
-        memcmp(scanner.start + start, rest, length) == 0) {
+    if (scanner->current - scanner->start == start + length &&
+        memcmp(scanner->start + start, rest, length) == 0) {
         return type;
     }
     return TOKEN_IDENTIFIER;
@@ -234,56 +268,71 @@ static TokenType checkKeyword(int32_t start, int32_t length, const char* rest,
  * This uses a simple trie-like structure implemented with nested switches to
  * efficiently check for keywords.
  *
+ * @param scanner The scanner.
  * @return TokenType The appropriate `TokenType` for the identifier.
  */
-static TokenType identifierType() {
-    switch (scanner.start[0]) {
+static TokenType identifierType(Scanner* scanner) {
+    switch (scanner->start[0]) {
         case 'a':
-            return checkKeyword(1, 2, "nd", TOKEN_AND);
+            return checkKeyword(scanner, 1, 2, "nd", TOKEN_AND);
         case 'c':
-            return checkKeyword(1, 4, "lass", TOKEN_CLASS);
+            return checkKeyword(scanner, 1, 4, "lass", TOKEN_CLASS);
         case 'e':
-            return checkKeyword(1, 3, "lse", TOKEN_ELSE);
+            return checkKeyword(scanner, 1, 3, "lse", TOKEN_ELSE);
         case 'f':
             // check if it is not just 'f'
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
+            if (scanner->current - scanner->start > 1) {
+                switch (scanner->start[1]) {
                     case 'a':
-                        return checkKeyword(2, 3, "lse", TOKEN_FALSE);
+                        return checkKeyword(scanner, 2, 3, "lse", TOKEN_FALSE);
                     case 'o':
-                        return checkKeyword(2, 1, "r", TOKEN_FOR);
+                        return checkKeyword(scanner, 2, 1, "r", TOKEN_FOR);
                     case 'u':
-                        return checkKeyword(2, 1, "n", TOKEN_FUN);
+                        return checkKeyword(scanner, 2, 1, "n", TOKEN_FUN);
                 }
             }
             break;
         case 'i':
-            return checkKeyword(1, 1, "f", TOKEN_IF);
+            return checkKeyword(scanner, 1, 1, "f", TOKEN_IF);
         case 'n':
-            return checkKeyword(1, 2, "il", TOKEN_NIL);
+            return checkKeyword(scanner, 1, 2, "il", TOKEN_NIL);
         case 'o':
-            return checkKeyword(1, 1, "r", TOKEN_OR);
+            return checkKeyword(scanner, 1, 1, "r", TOKEN_OR);
         case 'p':
-            return checkKeyword(1, 4, "rint", TOKEN_PRINT);
+            return checkKeyword(scanner, 1, 4, "rint", TOKEN_PRINT);
         case 'r':
-            return checkKeyword(1, 5, "eturn", TOKEN_RETURN);
+            // check if it is not just 'r' or 're'
+            if (scanner->current - scanner->start > 2 &&
+                scanner->start[1] == 'e') {
+                switch (scanner->start[2]) {
+                    case 's':
+                        return checkKeyword(scanner, 3, 3, "ume",
+                                            TOKEN_RESUME);
+                    case 't':
+                        return checkKeyword(scanner, 3, 3, "urn",
+                                            TOKEN_RETURN);
+                }
+            }
+            break;
         case 's':
-            return checkKeyword(1, 4, "uper", TOKEN_SUPER);
+            return checkKeyword(scanner, 1, 4, "uper", TOKEN_SUPER);
         case 't':
             // check if it is not just 't'
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
+            if (scanner->current - scanner->start > 1) {
+                switch (scanner->start[1]) {
                     case 'h':
-                        return checkKeyword(2, 2, "is", TOKEN_THIS);
+                        return checkKeyword(scanner, 2, 2, "is", TOKEN_THIS);
                     case 'r':
-                        return checkKeyword(2, 2, "ue", TOKEN_TRUE);
+                        return checkKeyword(scanner, 2, 2, "ue", TOKEN_TRUE);
                 }
             }
             break;
         case 'v':
-            return checkKeyword(1, 2, "ar", TOKEN_VAR);
+            return checkKeyword(scanner, 1, 2, "ar", TOKEN_VAR);
         case 'w':
-            return checkKeyword(1, 4, "hile", TOKEN_WHILE);
+            return checkKeyword(scanner, 1, 4, "hile", TOKEN_WHILE);
+        case 'y':
+            return checkKeyword(scanner, 1, 4, "ield", TOKEN_YIELD);
     }
     return TOKEN_IDENTIFIER;
 }
@@ -292,11 +341,12 @@ static TokenType identifierType() {
  * @brief Scans an identifier or keyword.
  *
  * Consumes alphanumeric characters and underscores.
+ * @param scanner The scanner.
  * @return Token A token of type `TOKEN_IDENTIFIER` or a keyword token type.
  */
-static Token identifier() {
-    while (isAlpha(peek()) || isDigit(peek())) advance();
-    return makeToken(identifierType());
+static Token identifier(Scanner* scanner) {
+    while (isAlpha(peek(scanner)) || isDigit(peek(scanner))) advance(scanner);
+    return makeToken(scanner, identifierType(scanner));
 }
 
 //-----------------------------------------------------------------------------
@@ -309,53 +359,65 @@ static Token identifier() {
  * This is the main public function of the scanner. It's called repeatedly by
  * the compiler to get the next token in the stream.
  *
+ * @param scanner The scanner.
  * @return Token The next token in the source code.
  */
-Token scanToken() {
-    skipWhitespace();
+Token scanToken(Scanner* scanner) {
+    skipWhitespace(scanner);
 
-    scanner.start = scanner.current;
-    if (isAtEnd()) return makeToken(TOKEN_EOF);
+    scanner->start = scanner->current;
+    if (isAtEnd(scanner)) return makeToken(scanner, TOKEN_EOF);
 
-    char c = advance();
+    char c = advance(scanner);
 
-    if (isAlpha(c)) return identifier();
-    if (isDigit(c)) return number();
+    if (isAlpha(c)) return identifier(scanner);
+    if (isDigit(c)) return number(scanner);
 
     switch (c) {
         case '(':
-            return makeToken(TOKEN_LEFT_PAREN);
+            return makeToken(scanner, TOKEN_LEFT_PAREN);
         case ')':
-            return makeToken(TOKEN_RIGHT_PAREN);
+            return makeToken(scanner, TOKEN_RIGHT_PAREN);
         case '{':
-            return makeToken(TOKEN_LEFT_BRACE);
+            return makeToken(scanner, TOKEN_LEFT_BRACE);
         case '}':
-            return makeToken(TOKEN_RIGHT_BRACE);
+            return makeToken(scanner, TOKEN_RIGHT_BRACE);
+        case '[':
+            return makeToken(scanner, TOKEN_LEFT_BRACKET);
+        case ']':
+            return makeToken(scanner, TOKEN_RIGHT_BRACKET);
         case ';':
-            return makeToken(TOKEN_SEMICOLON);
+            return makeToken(scanner, TOKEN_SEMICOLON);
+        case ':':
+            return makeToken(scanner, TOKEN_COLON);
         case ',':
-            return makeToken(TOKEN_COMMA);
+            return makeToken(scanner, TOKEN_COMMA);
         case '.':
-            return makeToken(TOKEN_DOT);
+            return makeToken(scanner, TOKEN_DOT);
         case '-':
-            return makeToken(TOKEN_MINUS);
+            return makeToken(scanner, TOKEN_MINUS);
         case '+':
-            return makeToken(TOKEN_PLUS);
+            return makeToken(scanner, TOKEN_PLUS);
         case '/':
-            return makeToken(TOKEN_SLASH);
+            return makeToken(scanner, TOKEN_SLASH);
         case '*':
-            return makeToken(TOKEN_STAR);
+            return makeToken(scanner, TOKEN_STAR);
         case '!':
-            return makeToken(match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
+            return makeToken(
+                scanner, match(scanner, '=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
         case '=':
-            return makeToken(match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
+            return makeToken(
+                scanner, match(scanner, '=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
         case '<':
-            return makeToken(match('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
+            return makeToken(
+                scanner, match(scanner, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
         case '>':
-            return makeToken(match('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
+            return makeToken(
+                scanner,
+                match(scanner, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
         case '"':
-            return string();
+            return string(scanner);
     }
 
-    return errorToken("Unexpected character.");
+    return errorToken(scanner, "Unexpected character.");
 }
\ No newline at end of file
@@ -5,7 +5,13 @@
  * This hash table maps string keys (ObjectString*) to Clox values (Value).
  * It is used for storing global variables, class methods, and instance fields.
  * It uses open addressing with linear probing for collision resolution and
- * automatically resizes when its load factor exceeds a threshold.
+ * automatically resizes when its load factor exceeds a threshold. Tombstones
+ * count towards that load factor; when most of the load is tombstones, the
+ * table is rehashed at the same size instead of grown, and it is shrunk when
+ * deletions leave it mostly empty.
+ *
+ * The file also implements the string intern table, a specialized set of
+ * strings without value slots that is compacted in place during GC.
  */
 
 #include "table.h"
@@ -17,8 +23,8 @@
 #include "object.h"
 #include "value.h"
 
-// maximum load factor before the hash table is resized
-#define TABLE_MAX_LOAD 0.75
+// smallest capacity a table is shrunk to
+#define TABLE_MIN_CAPACITY 8
 
 //-----------------------------------------------------------------------------
 //- Table Lifecycle
@@ -30,16 +36,18 @@
  */
 void initTable(Table* table) {
     table->count = 0;
+    table->tombstones = 0;
     table->capacity = -1;
     table->entries = NULL;
 }
 
 /**
  * @brief Frees all memory used by a hash table.
+ * @param vm The virtual machine.
  * @param table A pointer to the Table struct to free.
  */
-void freeTable(Table* table) {
-    FREE_ARRAY(Entry, table->entries, table->capacity + 1);
+void freeTable(VM* vm, Table* table) {
+    FREE_ARRAY(vm, Entry, table->entries, table->capacity + 1);
     initTable(table);
 }
 
@@ -90,18 +98,19 @@ static Entry* findEntry(Entry* entries, int32_t capacity,
  * This involves allocating a new entry array and rehashing all existing
  * entries from the old array into the new one.
  *
+ * @param vm The virtual machine.
  * @param table The table to resize.
  * @param capacity The new capacity mask (`new_capacity - 1`).
  */
-static void adjustCapacity(Table* table, int32_t capacity) {
-    Entry* entries = ALLOCATE(Entry, capacity + 1);
+static void adjustCapacity(VM* vm, Table* table, int32_t capacity) {
+    Entry* entries = ALLOCATE(vm, Entry, capacity + 1);
     for (int32_t i = 0; i <= capacity; i++) {
         entries[i].key = NULL;
         entries[i].value = NIL_VAL;
     }
 
     table->count = 0;
-    // recaluculate new entries
+    // recaluculate new entries, tombstones are dropped along the way
     for (int32_t i = 0; i <= table->capacity; i++) {
         Entry* entry = &table->entries[i];
         if (entry->key == NULL) continue;
@@ -111,9 +120,27 @@ static void adjustCapacity(Table* table, int32_t capacity) {
         table->count++;
     }
 
-    FREE_ARRAY(Entry, table->entries, table->capacity + 1);
+    FREE_ARRAY(vm, Entry, table->entries, table->capacity + 1);
     table->entries = entries;
     table->capacity = capacity;
+    table->tombstones = 0;
+}
+
+/**
+ * @brief Computes the capacity mask a table needs to hold `count` live
+ * entries at no more than half of the maximum load.
+ *
+ * Leaving headroom after shrinking keeps a table that churns at a steady size
+ * from resizing again right away.
+ * @param count The number of live entries.
+ * @return int32_t The capacity mask (`capacity - 1`).
+ */
+static int32_t capacityFor(int32_t count) {
+    int32_t capacity = TABLE_MIN_CAPACITY;
+    while (count > capacity * TABLE_MAX_LOAD / 2) {
+        capacity = GROW_CAPACITY(capacity);
+    }
+    return capacity - 1;
 }
 
 //-----------------------------------------------------------------------------
@@ -144,23 +171,32 @@ bool tableGet(Table* table, const ObjectString* key, Value* value) {
  * If the key already exists, its value is updated. Otherwise, a new entry is
  * created.
  *
+ * @param vm The virtual machine.
  * @param table The table to modify.
  * @param key The key to set.
  * @param value The value to associate with the key.
  * @return bool True if the key was new, false if it was an update.
  */
-bool tableSet(Table* table, ObjectString* key, Value value) {
-    if (table->count + 1 > (table->capacity + 1) * TABLE_MAX_LOAD) {
-        int32_t capacity = GROW_CAPACITY(table->capacity + 1) - 1;
-        adjustCapacity(table, capacity);
+bool tableSet(VM* vm, Table* table, ObjectString* key, Value value) {
+    if (table->count + table->tombstones + 1 >
+        (table->capacity + 1) * TABLE_MAX_LOAD) {
+        // if tombstones make up most of the load, rehashing at the current
+        // size is enough; otherwise grow
+        int32_t capacity = table->capacity;
+        if (table->count + 1 > (table->capacity + 1) * TABLE_MAX_LOAD / 2) {
+            capacity = GROW_CAPACITY(table->capacity + 1) - 1;
+        }
+        adjustCapacity(vm, table, capacity);
     }
 
     Entry* entry = findEntry(table->entries, table->capacity, key);
 
     bool isNewKey = entry->key == NULL;
-    // make sure we increase the count only when the entry was empty, not filled
-    // and not a tombstone
-    if (isNewKey && IS_NIL(entry->value)) table->count++;
+    if (isNewKey) {
+        table->count++;
+        // reusing a tombstone doesn't change the load of the table
+        if (!IS_NIL(entry->value)) table->tombstones--;
+    }
 
     entry->key = key;
     entry->value = value;
@@ -173,11 +209,12 @@ bool tableSet(Table* table, ObjectString* key, Value value) {
  * Deletion is handled by placing a "tombstone" marker in the entry, which
  * allows the linear probing chain to remain intact.
  *
+ * @param vm The virtual machine.
  * @param table The table to modify.
  * @param key The key to delete.
  * @return bool True if the key was found and deleted, false otherwise.
  */
-bool tableDelete(Table* table, const ObjectString* key) {
+bool tableDelete(VM* vm, Table* table, const ObjectString* key) {
     if (table->count == 0) return false;
 
     Entry* entry = findEntry(table->entries, table->capacity, key);
@@ -186,6 +223,14 @@ bool tableDelete(Table* table, const ObjectString* key) {
     // tombstone = null key + true value
     entry->key = NULL;
     entry->value = BOOL_VAL(true);
+    table->count--;
+    table->tombstones++;
+
+    // shrink tables that deletions left mostly empty
+    if (table->count < (table->capacity + 1) * TABLE_MIN_LOAD) {
+        int32_t capacity = capacityFor(table->count);
+        if (capacity < table->capacity) adjustCapacity(vm, table, capacity);
+    }
 
     return true;
 }
@@ -193,19 +238,187 @@ bool tableDelete(Table* table, const ObjectString* key) {
 /**
  * @brief Copies all entries from one hash table to another.
  *
- * Used for implementing class inheritance.
+ * Used when a subclass takes its own copy of an inherited method table.
+ * @param vm The virtual machine.
  * @param from The source table.
  * @param to The destination table.
  */
-void tableAddAll(Table* from, Table* to) {
+void tableAddAll(VM* vm, Table* from, Table* to) {
+    // an empty destination can take a verbatim copy of the entry array, since
+    // both tables hash the keys to the same slots
+    if (to->count == 0 && from->count > 0) {
+        Entry* entries = ALLOCATE(vm, Entry, from->capacity + 1);
+        memcpy(entries, from->entries, sizeof(Entry) * (from->capacity + 1));
+        FREE_ARRAY(vm, Entry, to->entries, to->capacity + 1);
+        to->entries = entries;
+        to->capacity = from->capacity;
+        to->count = from->count;
+        to->tombstones = from->tombstones;
+        return;
+    }
+
     for (int32_t i = 0; i <= from->capacity; i++) {
         Entry* entry = &from->entries[i];
         if (entry->key != NULL) {
-            tableSet(to, entry->key, entry->value);
+            tableSet(vm, to, entry->key, entry->value);
         }
     }
 }
 
+/**
+ * @brief Collects statistics about a hash table for diagnosis.
+ *
+ * Walks the whole table, so it is meant for debugging, not for hot paths.
+ * @param table The table to inspect.
+ * @param stats A pointer where the statistics will be stored.
+ */
+void tableStats(const Table* table, TableStats* stats) {
+    int32_t slots = table->capacity + 1;
+    stats->count = table->count;
+    stats->tombstones = table->tombstones;
+    stats->capacity = slots;
+    stats->loadFactor = 0;
+    stats->tombstoneRatio = 0;
+    stats->averageProbe = 0;
+    stats->maxProbe = 0;
+    if (slots == 0) return;
+
+    int32_t occupied = table->count + table->tombstones;
+    stats->loadFactor = (double)occupied / slots;
+    if (occupied > 0) {
+        stats->tombstoneRatio = (double)table->tombstones / occupied;
+    }
+
+    // probe length = distance from the key's home slot + 1
+    int64_t totalProbe = 0;
+    for (int32_t i = 0; i < slots; i++) {
+        const Entry* entry = &table->entries[i];
+        if (entry->key == NULL) continue;
+        int32_t home = (int32_t)(entry->key->hash & table->capacity);
+        int32_t probe = ((i - home) & table->capacity) + 1;
+        totalProbe += probe;
+        if (probe > stats->maxProbe) stats->maxProbe = probe;
+    }
+    if (table->count > 0) {
+        stats->averageProbe = (double)totalProbe / table->count;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//- Garbage Collection Support
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Marks all objects in a table for the garbage collector.
+ * @param vm The virtual machine.
+ * @param table The table to mark.
+ */
+void markTable(VM* vm, Table* table) {
+    for (int32_t i = 0; i <= table->capacity; i++) {
+        Entry* entry = &table->entries[i];
+        markObject(vm, (Object*)entry->key);
+        markValue(vm, entry->value);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//- String Intern Table
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Initializes a string intern table.
+ * @param table A pointer to the InternTable struct to initialize.
+ */
+void initInternTable(InternTable* table) {
+    table->count = 0;
+    table->capacity = -1;
+    table->entries = NULL;
+}
+
+/**
+ * @brief Frees all memory used by a string intern table.
+ * @param vm The virtual machine.
+ * @param table A pointer to the InternTable struct to free.
+ */
+void freeInternTable(VM* vm, InternTable* table) {
+    FREE_ARRAY(vm, InternEntry, table->entries, table->capacity + 1);
+    initInternTable(table);
+}
+
+/**
+ * @brief Resizes the intern table to a new capacity and reinserts all strings.
+ * @param vm The virtual machine.
+ * @param table The table to resize.
+ * @param capacity The new capacity mask (`new_capacity - 1`).
+ */
+static void adjustInternCapacity(VM* vm, InternTable* table, int32_t capacity) {
+    InternEntry* entries = ALLOCATE(vm, InternEntry, capacity + 1);
+    for (int32_t i = 0; i <= capacity; i++) {
+        entries[i].key = NULL;
+    }
+
+    // the table has no tombstones, so only the first empty slot is needed
+    for (int32_t i = 0; i <= table->capacity; i++) {
+        const InternEntry* entry = &table->entries[i];
+        if (entry->key == NULL) continue;
+        uint32_t index = entry->hash & capacity;
+        while (entries[index].key != NULL) index = (index + 1) & capacity;
+        entries[index] = *entry;
+    }
+
+    FREE_ARRAY(vm, InternEntry, table->entries, table->capacity + 1);
+    table->entries = entries;
+    table->capacity = capacity;
+}
+
+/**
+ * @brief Grows the intern table so it can hold `count` strings without
+ * rehashing.
+ *
+ * The compiler calls this with the number of identifiers it is about to
+ * intern, so a large script does not rehash the table repeatedly.
+ *
+ * @param vm The virtual machine.
+ * @param table The string table.
+ * @param count The number of strings the table should be able to hold.
+ */
+void internTableReserve(VM* vm, InternTable* table, int32_t count) {
+    int32_t capacity = table->capacity + 1;
+    if (count <= capacity * TABLE_MAX_LOAD) return;
+
+    while (count > capacity * TABLE_MAX_LOAD) {
+        capacity = GROW_CAPACITY(capacity);
+    }
+    adjustInternCapacity(vm, table, capacity - 1);
+}
+
+/**
+ * @brief Adds a string to the intern table.
+ *
+ * The caller must have checked with `tableFindString` that no equal string
+ * is already present.
+ *
+ * @param vm The virtual machine.
+ * @param table The string table.
+ * @param string The string to intern.
+ */
+void internTableAdd(VM* vm, InternTable* table, ObjectString* string) {
+    if (table->count + 1 > (table->capacity + 1) * TABLE_MAX_LOAD) {
+        adjustInternCapacity(vm, table, GROW_CAPACITY(table->capacity + 1) - 1);
+    }
+
+    uint32_t index = string->hash & table->capacity;
+    while (table->entries[index].key != NULL) {
+        index = (index + 1) & table->capacity;
+    }
+
+    InternEntry* entry = &table->entries[index];
+    entry->key = string;
+    entry->hash = string->hash;
+    entry->length = string->length;
+    table->count++;
+}
+
 /**
  * @brief A specialized find function for the string interning table.
  *
@@ -218,41 +431,54 @@ void tableAddAll(Table* from, Table* to) {
  * @param hash The hash of the string.
  * @return ObjectString* The found string object, or NULL if not found.
  */
-ObjectString* tableFindString(Table* table, const char* chars, int32_t length,
-                              uint32_t hash) {
+ObjectString* tableFindString(InternTable* table, const char* chars,
+                              int32_t length, uint32_t hash) {
     if (table->count == 0) return NULL;
 
     // look in findEntry for explanation
     uint32_t index = hash & table->capacity;
     for (;;) {
-        Entry* entry = &table->entries[index];
+        const InternEntry* entry = &table->entries[index];
 
-        if (entry->key == NULL) {
-            // stop looking if we find empty non-tombstone entry
-            if (IS_NIL(entry->value)) return NULL;
-        } else if (entry->key->length == length && entry->key->hash == hash &&
-                   memcmp(entry->key->chars, chars, length) == 0) {
-            // found it
+        // there are no tombstones, so the first empty slot ends the probe
+        if (entry->key == NULL) return NULL;
+
+        // hash and length live in the slot, so the string itself is only
+        // dereferenced for a likely match
+        if (entry->hash == hash && entry->length == length &&
+            memcmp(entry->key->chars, chars, length) == 0) {
             return entry->key;
         }
         index = (index + 1) & table->capacity;
     }
 }
 
-//-----------------------------------------------------------------------------
-//- Garbage Collection Support
-//-----------------------------------------------------------------------------
-
 /**
- * @brief Marks all objects in a table for the garbage collector.
- * @param table The table to mark.
+ * @brief Removes the entry at `index` and shifts later entries of the same
+ * probe sequence back, so the table stays free of tombstones.
+ * @param table The string table.
+ * @param index The index of the entry to remove.
  */
-void markTable(Table* table) {
-    for (int32_t i = 0; i <= table->capacity; i++) {
-        Entry* entry = &table->entries[i];
-        markObject((Object*)entry->key);
-        markValue(entry->value);
+static void internTableRemoveAt(InternTable* table, uint32_t index) {
+    uint32_t hole = index;
+    uint32_t next = index;
+    for (;;) {
+        next = (next + 1) & table->capacity;
+        const InternEntry* entry = &table->entries[next];
+        if (entry->key == NULL) break;
+
+        // an entry may only move back if its home slot is not between the
+        // hole and its current position (cyclically)
+        uint32_t home = entry->hash & table->capacity;
+        bool stays = hole <= next ? (hole < home && home <= next)
+                                  : (hole < home || home <= next);
+        if (stays) continue;
+
+        table->entries[hole] = *entry;
+        hole = next;
     }
+    table->entries[hole].key = NULL;
+    table->count--;
 }
 
 /**
@@ -261,14 +487,17 @@ void markTable(Table* table) {
  * This is a special GC step for the string table, which acts as a set of
  * weak references. If a string is not reachable from anywhere else, it
  * should be collected, and its entry in the intern table must be removed.
+ * The table is compacted in place, so no tombstones are left behind.
  *
  * @param table The string table.
  */
-void tableRemoveWhite(Table* table) {
+void tableRemoveWhite(InternTable* table) {
     for (int32_t i = 0; i <= table->capacity; i++) {
-        const Entry* entry = &table->entries[i];
-        if (entry->key != NULL && !entry->key->object.isMarked) {
-            tableDelete(table, entry->key);
+        // re-check the same slot after a removal, because the shift may have
+        // moved another white string into it
+        while (table->entries[i].key != NULL &&
+               !table->entries[i].key->object.isMarked) {
+            internTableRemoveAt(table, (uint32_t)i);
         }
     }
 }
@@ -0,0 +1,132 @@
+/**
+ * @file text.c
+ * @brief Byte-string search and scan routines used by the string natives.
+ *
+ * The search compares the first and the last byte of the needle against 16
+ * candidate positions at once and only runs `memcmp` on positions where both
+ * match, which skips most of the text for typical needles. SSE2 is part of
+ * the x86-64 baseline, so unlike the AVX2 kernels in vector.c these routines
+ * need no runtime CPU check.
+ */
+
+#include "text.h"
+
+#include <string.h>
+
+#if !defined(VECTOR_NO_SIMD) && defined(__SSE2__)
+#define TEXT_SSE2
+#include <emmintrin.h>
+#endif
+
+//-----------------------------------------------------------------------------
+//- Search
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Finds the first occurrence of a needle in a string.
+ *
+ * @param text The string to search.
+ * @param length The length of `text`.
+ * @param needle The string to look for.
+ * @param needleLength The length of `needle`.
+ * @param start The index in `text` to start searching at.
+ * @return int32_t The index of the occurrence, or -1 if there is none. An
+ * empty needle is found at `start`.
+ */
+int32_t textFind(const char* text, int32_t length, const char* needle,
+                 int32_t needleLength, int32_t start) {
+    if (needleLength == 0) return start <= length ? start : -1;
+    if (needleLength > length - start) return -1;
+
+    const char first = needle[0];
+    const char last = needle[needleLength - 1];
+    int32_t i = start;
+
+#ifdef TEXT_SSE2
+    const __m128i firstBytes = _mm_set1_epi8(first);
+    const __m128i lastBytes = _mm_set1_epi8(last);
+
+    // each lane i checks whether a match could start at text[i]
+    for (; i + needleLength - 1 + 16 <= length; i += 16) {
+        __m128i blockFirst = _mm_loadu_si128((const __m128i*)(text + i));
+        __m128i blockLast =
+            _mm_loadu_si128((const __m128i*)(text + i + needleLength - 1));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(blockFirst, firstBytes),
+                          _mm_cmpeq_epi8(blockLast, lastBytes)));
+
+        while (mask != 0) {
+            int32_t offset = __builtin_ctz(mask);
+            if (memcmp(text + i + offset, needle, needleLength) == 0) {
+                return i + offset;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for (; i + needleLength <= length; i++) {
+        if (text[i] == first && text[i + needleLength - 1] == last &&
+            memcmp(text + i, needle, needleLength) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+//- Case Conversion
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Flips the case bit (0x20) of every byte in [`from`, `to`].
+ * @param dest The buffer receiving the result (may equal `src`).
+ * @param src The source string.
+ * @param length The number of bytes to convert.
+ * @param from The first byte to convert.
+ * @param to The last byte to convert.
+ */
+static void convertCase(char* dest, const char* src, int32_t length, char from,
+                        char to) {
+    int32_t i = 0;
+
+#ifdef TEXT_SSE2
+    // the letters are below 0x80, so a signed compare keeps other bytes out
+    const __m128i below = _mm_set1_epi8((char)(from - 1));
+    const __m128i above = _mm_set1_epi8((char)(to + 1));
+    const __m128i caseBit = _mm_set1_epi8(0x20);
+
+    for (; i + 16 <= length; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i inRange = _mm_and_si128(_mm_cmpgt_epi8(block, below),
+                                        _mm_cmplt_epi8(block, above));
+        block = _mm_xor_si128(block, _mm_and_si128(inRange, caseBit));
+        _mm_storeu_si128((__m128i*)(dest + i), block);
+    }
+#endif
+
+    for (; i < length; i++) {
+        char c = src[i];
+        dest[i] = (c >= from && c <= to) ? (char)(c ^ 0x20) : c;
+    }
+}
+
+/**
+ * @brief Copies a string, converting ASCII lowercase letters to uppercase.
+ * @param dest The buffer receiving the result (may equal `src`).
+ * @param src The source string.
+ * @param length The number of bytes to convert.
+ */
+void textToUpper(char* dest, const char* src, int32_t length) {
+    convertCase(dest, src, length, 'a', 'z');
+}
+
+/**
+ * @brief Copies a string, converting ASCII uppercase letters to lowercase.
+ * @param dest The buffer receiving the result (may equal `src`).
+ * @param src The source string.
+ * @param length The number of bytes to convert.
+ */
+void textToLower(char* dest, const char* src, int32_t length) {
+    convertCase(dest, src, length, 'A', 'Z');
+}
@@ -15,8 +15,15 @@
 #include <string.h>
 
 #include "memory.h"
+#include "number.h"
 #include "object.h"
 
+#ifdef PRINT_SHORTEST_NUMBERS
+#define PRINT_NUMBER_FORMAT NUMBER_FORMAT_SHORTEST
+#else
+#define PRINT_NUMBER_FORMAT NUMBER_FORMAT_GENERAL
+#endif
+
 //-----------------------------------------------------------------------------
 //- Value Array Implementation
 //-----------------------------------------------------------------------------
@@ -33,10 +40,11 @@ void initValueArray(ValueArray* array) {
 
 /**
  * @brief Frees all memory used by a ValueArray.
+ * @param vm The virtual machine.
  * @param array The array to free.
  */
-void freeValueArray(ValueArray* array) {
-    FREE_ARRAY(Value, array->values, array->capacity);
+void freeValueArray(VM* vm, ValueArray* array) {
+    FREE_ARRAY(vm, Value, array->values, array->capacity);
     initValueArray(array);
 }
 
@@ -44,15 +52,16 @@ void freeValueArray(ValueArray* array) {
  * @brief Appends a value to a ValueArray.
  *
  * Automatically grows the array's capacity if needed.
+ * @param vm The virtual machine.
  * @param array The array to write to.
  * @param value The value to append.
  */
-void writeValueArray(ValueArray* array, Value value) {
+void writeValueArray(VM* vm, ValueArray* array, Value value) {
     if (array->capacity < array->count + 1) {
         int32_t oldCapacity = array->capacity;
         array->capacity = GROW_CAPACITY(oldCapacity);
         array->values =
-            GROW_ARRAY(Value, array->values, oldCapacity, array->capacity);
+            GROW_ARRAY(vm, Value, array->values, oldCapacity, array->capacity);
     }
 
     array->values[array->count] = value;
@@ -64,42 +73,76 @@ void writeValueArray(ValueArray* array, Value value) {
 //-----------------------------------------------------------------------------
 
 /**
- * @brief Prints a human-readable representation of a Clox value to stdout.
- * @param value The value to print.
+ * @brief Writes a number to an output buffer.
+ * @param output The output buffer.
+ * @param number The number to write.
  */
-void printValue(Value value) {
+static void writeNumber(OutputBuffer* output, double number) {
+    char buffer[NUMBER_BUFFER_SIZE];
+    int32_t length = formatNumber(number, PRINT_NUMBER_FORMAT, buffer);
+    writeOutput(output, buffer, length);
+}
+
+/**
+ * @brief Writes a human-readable representation of a Clox value to an output
+ * buffer.
+ * @param output The output buffer.
+ * @param value The value to write.
+ */
+void writeValue(OutputBuffer* output, Value value) {
 #ifdef NAN_BOXING
     if (IS_BOOL(value)) {
-        printf(AS_BOOL(value) ? "true" : "false");
+        writeOutputString(output, AS_BOOL(value) ? "true" : "false");
     } else if (IS_NIL(value)) {
-        printf("nil");
+        writeOutput(output, "nil", 3);
     } else if (IS_NUMBER(value)) {
-        printf("%g", AS_NUMBER(value));
+        writeNumber(output, AS_NUMBER(value));
     } else if (IS_OBJECT(value)) {
-        printObject(value);
+        writeObject(output, value);
+    } else if (IS_SHORT_STRING(value)) {
+        char chars[SHORT_STRING_BUFFER];
+        valueToShortString(value, chars);
+        writeOutput(output, chars, SHORT_STRING_LENGTH(value));
     }
 #else
     switch (value.type) {
         case VAL_BOOL:
-            printf(AS_BOOL(value) ? "true" : "false");
+            writeOutputString(output, AS_BOOL(value) ? "true" : "false");
             break;
         case VAL_NIL:
-            printf("nil");
+            writeOutput(output, "nil", 3);
             break;
         case VAL_NUMBER:
-            printf("%g", AS_NUMBER(value));
+            writeNumber(output, AS_NUMBER(value));
             break;
         case VAL_OBJECT:
-            printObject(value);
+            writeObject(output, value);
             break;
     }
 #endif
 }
 
+/**
+ * @brief Prints a human-readable representation of a Clox value to stdout.
+ *
+ * Unlike `print` statements, which go through the VM's output buffer, this
+ * writes the value out immediately; it is meant for debugging output.
+ *
+ * @param value The value to print.
+ */
+void printValue(Value value) {
+    char bytes[256];
+    OutputBuffer output;
+    initOutput(&output, stdout, bytes, sizeof(bytes));
+    writeValue(&output, value);
+    flushOutput(&output);
+}
+
 /**
  * @brief Checks if two Clox values are equal.
  *
- * - Numbers are compared by their numeric value.
+ * - Numbers are compared by their numeric value, whether they are stored as
+ *   immediate integers or as doubles.
  * - `nil` is equal to `nil`.
  * - Booleans are compared by their truthiness.
  * - Objects (strings, functions, etc.) are compared by reference identity.
@@ -111,7 +154,9 @@ void printValue(Value value) {
 bool valuesEqual(Value a, Value b) {
 #ifdef NAN_BOXING
     // for IEEE 754, this ensures NaN != NaN
-    if (IS_NUMBER(a) && IS_NUMBER(a)) {
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        // 1 and 1.0 have different encodings but are the same number
+        if (IS_INT(a) && IS_INT(b)) return a == b;
         return AS_NUMBER(a) == AS_NUMBER(b);
     }
     return a == b;
@@ -0,0 +1,539 @@
+/**
+ * @file vector.c
+ * @brief Bulk numeric kernels over contiguous arrays of doubles.
+ *
+ * Every operation has a scalar kernel and, on x86 with GCC or Clang, SSE2 and
+ * AVX2 kernels. The AVX2 kernels are compiled with a `target` attribute, so
+ * the rest of the interpreter does not need to be built with `-mavx2`; the
+ * CPU is checked once at startup and the kernels are called through function
+ * pointers.
+ */
+
+#include "vector.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#if !defined(VECTOR_NO_SIMD) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define VECTOR_X86
+#include <immintrin.h>
+#endif
+
+// arrays shorter than this are sorted by insertion sort
+#define SORT_INSERTION_LIMIT 64
+
+//-- Selected kernels --//
+
+static const char* kernelName = "scalar";
+static double (*sumKernel)(const double*, int32_t);
+static double (*dotKernel)(const double*, const double*, int32_t);
+static void (*scaleKernel)(double*, const double*, double, int32_t);
+static void (*addKernel)(double*, const double*, const double*, int32_t);
+static double (*minKernel)(const double*, int32_t);
+static double (*maxKernel)(const double*, int32_t);
+
+//-----------------------------------------------------------------------------
+//- Scalar Kernels
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Scalar kernel for `vectorSum`.
+ */
+static double sumScalar(const double* values, int32_t count) {
+    double sum = 0;
+    for (int32_t i = 0; i < count; i++) sum += values[i];
+    return sum;
+}
+
+/**
+ * @brief Scalar kernel for `vectorDot`.
+ */
+static double dotScalar(const double* a, const double* b, int32_t count) {
+    double sum = 0;
+    for (int32_t i = 0; i < count; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+/**
+ * @brief Scalar kernel for `vectorScale`.
+ */
+static void scaleScalar(double* dest, const double* src, double factor,
+                        int32_t count) {
+    for (int32_t i = 0; i < count; i++) dest[i] = src[i] * factor;
+}
+
+/**
+ * @brief Scalar kernel for `vectorAdd`.
+ */
+static void addScalar(double* dest, const double* a, const double* b,
+                      int32_t count) {
+    for (int32_t i = 0; i < count; i++) dest[i] = a[i] + b[i];
+}
+
+// The comparisons below match the semantics of the x86 MINPD/MAXPD
+// instructions (the second operand wins when either is NaN), so all kernels
+// agree on arrays containing NaN.
+
+/**
+ * @brief Scalar kernel for `vectorMin`.
+ */
+static double minScalar(const double* values, int32_t count) {
+    double min = values[0];
+    for (int32_t i = 1; i < count; i++) {
+        min = values[i] < min ? values[i] : min;
+    }
+    return min;
+}
+
+/**
+ * @brief Scalar kernel for `vectorMax`.
+ */
+static double maxScalar(const double* values, int32_t count) {
+    double max = values[0];
+    for (int32_t i = 1; i < count; i++) {
+        max = values[i] > max ? values[i] : max;
+    }
+    return max;
+}
+
+#ifdef VECTOR_X86
+
+//-----------------------------------------------------------------------------
+//- SSE2 Kernels
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief SSE2 kernel for `vectorSum`.
+ */
+__attribute__((target("sse2"))) static double sumSse2(const double* values,
+                                                      int32_t count) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    int32_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(values + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(values + i + 2));
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    double sum = lanes[0] + lanes[1];
+    for (; i < count; i++) sum += values[i];
+    return sum;
+}
+
+/**
+ * @brief SSE2 kernel for `vectorDot`.
+ */
+__attribute__((target("sse2"))) static double dotSse2(const double* a,
+                                                      const double* b,
+                                                      int32_t count) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    int32_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        acc0 = _mm_add_pd(
+            acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        acc1 = _mm_add_pd(
+            acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    double sum = lanes[0] + lanes[1];
+    for (; i < count; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+/**
+ * @brief SSE2 kernel for `vectorScale`.
+ */
+__attribute__((target("sse2"))) static void scaleSse2(double* dest,
+                                                      const double* src,
+                                                      double factor,
+                                                      int32_t count) {
+    __m128d scale = _mm_set1_pd(factor);
+    int32_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        _mm_storeu_pd(dest + i, _mm_mul_pd(_mm_loadu_pd(src + i), scale));
+    }
+    for (; i < count; i++) dest[i] = src[i] * factor;
+}
+
+/**
+ * @brief SSE2 kernel for `vectorAdd`.
+ */
+__attribute__((target("sse2"))) static void addSse2(double* dest,
+                                                    const double* a,
+                                                    const double* b,
+                                                    int32_t count) {
+    int32_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        _mm_storeu_pd(dest + i,
+                      _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    }
+    for (; i < count; i++) dest[i] = a[i] + b[i];
+}
+
+/**
+ * @brief SSE2 kernel for `vectorMin`.
+ */
+__attribute__((target("sse2"))) static double minSse2(const double* values,
+                                                      int32_t count) {
+    __m128d acc = _mm_set1_pd(values[0]);
+    int32_t i = 1;
+    for (; i + 2 <= count; i += 2) {
+        acc = _mm_min_pd(_mm_loadu_pd(values + i), acc);
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    double min = lanes[0];
+    min = lanes[1] < min ? lanes[1] : min;
+    for (; i < count; i++) min = values[i] < min ? values[i] : min;
+    return min;
+}
+
+/**
+ * @brief SSE2 kernel for `vectorMax`.
+ */
+__attribute__((target("sse2"))) static double maxSse2(const double* values,
+                                                      int32_t count) {
+    __m128d acc = _mm_set1_pd(values[0]);
+    int32_t i = 1;
+    for (; i + 2 <= count; i += 2) {
+        acc = _mm_max_pd(_mm_loadu_pd(values + i), acc);
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    double max = lanes[0];
+    max = lanes[1] > max ? lanes[1] : max;
+    for (; i < count; i++) max = values[i] > max ? values[i] : max;
+    return max;
+}
+
+//-----------------------------------------------------------------------------
+//- AVX2 Kernels
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief AVX2 kernel for `vectorSum`.
+ */
+__attribute__((target("avx2,fma"))) static double sumAvx2(
+    const double* values, int32_t count) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    int32_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(values + i));
+        acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(values + i + 4));
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < count; i++) sum += values[i];
+    return sum;
+}
+
+/**
+ * @brief AVX2 kernel for `vectorDot`, using fused multiply-add.
+ */
+__attribute__((target("avx2,fma"))) static double dotAvx2(const double* a,
+                                                          const double* b,
+                                                          int32_t count) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    int32_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i),
+                               acc0);
+        acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 4),
+                               _mm256_loadu_pd(b + i + 4), acc1);
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < count; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+/**
+ * @brief AVX2 kernel for `vectorScale`.
+ */
+__attribute__((target("avx2,fma"))) static void scaleAvx2(double* dest,
+                                                          const double* src,
+                                                          double factor,
+                                                          int32_t count) {
+    __m256d scale = _mm256_set1_pd(factor);
+    int32_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm256_storeu_pd(dest + i,
+                         _mm256_mul_pd(_mm256_loadu_pd(src + i), scale));
+    }
+    for (; i < count; i++) dest[i] = src[i] * factor;
+}
+
+/**
+ * @brief AVX2 kernel for `vectorAdd`.
+ */
+__attribute__((target("avx2,fma"))) static void addAvx2(double* dest,
+                                                        const double* a,
+                                                        const double* b,
+                                                        int32_t count) {
+    int32_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm256_storeu_pd(dest + i, _mm256_add_pd(_mm256_loadu_pd(a + i),
+                                                 _mm256_loadu_pd(b + i)));
+    }
+    for (; i < count; i++) dest[i] = a[i] + b[i];
+}
+
+/**
+ * @brief AVX2 kernel for `vectorMin`.
+ */
+__attribute__((target("avx2,fma"))) static double minAvx2(
+    const double* values, int32_t count) {
+    __m256d acc = _mm256_set1_pd(values[0]);
+    int32_t i = 1;
+    for (; i + 4 <= count; i += 4) {
+        acc = _mm256_min_pd(_mm256_loadu_pd(values + i), acc);
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    double min = lanes[0];
+    for (int32_t lane = 1; lane < 4; lane++) {
+        min = lanes[lane] < min ? lanes[lane] : min;
+    }
+    for (; i < count; i++) min = values[i] < min ? values[i] : min;
+    return min;
+}
+
+/**
+ * @brief AVX2 kernel for `vectorMax`.
+ */
+__attribute__((target("avx2,fma"))) static double maxAvx2(
+    const double* values, int32_t count) {
+    __m256d acc = _mm256_set1_pd(values[0]);
+    int32_t i = 1;
+    for (; i + 4 <= count; i += 4) {
+        acc = _mm256_max_pd(_mm256_loadu_pd(values + i), acc);
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    double max = lanes[0];
+    for (int32_t lane = 1; lane < 4; lane++) {
+        max = lanes[lane] > max ? lanes[lane] : max;
+    }
+    for (; i < count; i++) max = values[i] > max ? values[i] : max;
+    return max;
+}
+
+#endif
+
+//-----------------------------------------------------------------------------
+//- Kernel Selection
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Selects the fastest kernels supported by the running CPU.
+ */
+static void selectVectorKernels(void) {
+    kernelName = "scalar";
+    sumKernel = sumScalar;
+    dotKernel = dotScalar;
+    scaleKernel = scaleScalar;
+    addKernel = addScalar;
+    minKernel = minScalar;
+    maxKernel = maxScalar;
+
+#ifdef VECTOR_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        kernelName = "avx2";
+        sumKernel = sumAvx2;
+        dotKernel = dotAvx2;
+        scaleKernel = scaleAvx2;
+        addKernel = addAvx2;
+        minKernel = minAvx2;
+        maxKernel = maxAvx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        kernelName = "sse2";
+        sumKernel = sumSse2;
+        dotKernel = dotSse2;
+        scaleKernel = scaleSse2;
+        addKernel = addSse2;
+        minKernel = minSse2;
+        maxKernel = maxSse2;
+    }
+#endif
+}
+
+/**
+ * @brief Selects the fastest kernels supported by the running CPU.
+ *
+ * Must be called before any other function in this file. Every VM calls it,
+ * from whatever thread it runs on, and only the first call selects.
+ */
+void initVectorKernels() {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, selectVectorKernels);
+}
+
+/**
+ * @brief Returns the name of the selected kernels ("avx2", "sse2", "scalar").
+ * @return const char* The name of the kernel set.
+ */
+const char* vectorKernelName() { return kernelName; }
+
+//-----------------------------------------------------------------------------
+//- Public API
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Sums an array of doubles.
+ * @param values The array to sum.
+ * @param count The number of elements.
+ * @return double The sum, or 0 for an empty array.
+ */
+double vectorSum(const double* values, int32_t count) {
+    return sumKernel(values, count);
+}
+
+/**
+ * @brief Computes the dot product of two arrays of doubles.
+ * @param a The first array.
+ * @param b The second array.
+ * @param count The number of elements in each array.
+ * @return double The dot product, or 0 for empty arrays.
+ */
+double vectorDot(const double* a, const double* b, int32_t count) {
+    return dotKernel(a, b, count);
+}
+
+/**
+ * @brief Multiplies every element of an array by a factor.
+ * @param dest The array receiving the result (may equal `src`).
+ * @param src The source array.
+ * @param factor The factor to multiply by.
+ * @param count The number of elements.
+ */
+void vectorScale(double* dest, const double* src, double factor,
+                 int32_t count) {
+    scaleKernel(dest, src, factor, count);
+}
+
+/**
+ * @brief Adds two arrays of doubles element-wise.
+ * @param dest The array receiving the result (may equal `a` or `b`).
+ * @param a The first array.
+ * @param b The second array.
+ * @param count The number of elements in each array.
+ */
+void vectorAdd(double* dest, const double* a, const double* b, int32_t count) {
+    addKernel(dest, a, b, count);
+}
+
+/**
+ * @brief Finds the smallest element of a non-empty array.
+ * @param values The array to search.
+ * @param count The number of elements, at least 1.
+ * @return double The smallest element.
+ */
+double vectorMin(const double* values, int32_t count) {
+    return minKernel(values, count);
+}
+
+/**
+ * @brief Finds the largest element of a non-empty array.
+ * @param values The array to search.
+ * @param count The number of elements, at least 1.
+ * @return double The largest element.
+ */
+double vectorMax(const double* values, int32_t count) {
+    return maxKernel(values, count);
+}
+
+//-----------------------------------------------------------------------------
+//- Sorting
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Maps the bits of a double to an unsigned key with the same order.
+ *
+ * Negative numbers have all bits flipped (so larger magnitudes sort first),
+ * positive numbers only get the sign bit set.
+ */
+static uint64_t sortKey(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits >> 63) ? ~bits : bits | 0x8000000000000000ull;
+}
+
+/**
+ * @brief Inverse of `sortKey`.
+ */
+static double keyValue(uint64_t key) {
+    uint64_t bits = (key >> 63) ? key & ~0x8000000000000000ull : ~key;
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/**
+ * @brief Sorts an array of doubles in ascending order.
+ * @param values The array to sort in place.
+ * @param scratch A buffer of `2 * count` elements used by the sort.
+ * @param count The number of elements.
+ */
+void vectorSort(double* values, uint64_t* scratch, int32_t count) {
+    uint64_t* keys = scratch;
+    uint64_t* buffer = scratch + count;
+    for (int32_t i = 0; i < count; i++) keys[i] = sortKey(values[i]);
+
+    if (count < SORT_INSERTION_LIMIT) {
+        for (int32_t i = 1; i < count; i++) {
+            uint64_t key = keys[i];
+            int32_t j = i - 1;
+            for (; j >= 0 && keys[j] > key; j--) keys[j + 1] = keys[j];
+            keys[j + 1] = key;
+        }
+    } else {
+        // one pass over the keys builds the histograms of all eight digits
+        int32_t counts[8][256];
+        memset(counts, 0, sizeof(counts));
+        for (int32_t i = 0; i < count; i++) {
+            for (int32_t digit = 0; digit < 8; digit++) {
+                counts[digit][(keys[i] >> (digit * 8)) & 0xff]++;
+            }
+        }
+
+        for (int32_t digit = 0; digit < 8; digit++) {
+            int32_t shift = digit * 8;
+
+            // a digit shared by every key does not change the order
+            if (counts[digit][(keys[0] >> shift) & 0xff] == count) continue;
+
+            int32_t offsets[256];
+            int32_t offset = 0;
+            for (int32_t bucket = 0; bucket < 256; bucket++) {
+                offsets[bucket] = offset;
+                offset += counts[digit][bucket];
+            }
+            for (int32_t i = 0; i < count; i++) {
+                buffer[offsets[(keys[i] >> shift) & 0xff]++] = keys[i];
+            }
+
+            uint64_t* swap = keys;
+            keys = buffer;
+            buffer = swap;
+        }
+    }
+
+    for (int32_t i = 0; i < count; i++) values[i] = keyValue(keys[i]);
+}
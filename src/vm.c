@@ -10,25 +10,149 @@
 
 #include "vm.h"
 
+#include <ctype.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
+#include "frozen.h"
+#include "io.h"
 #include "memory.h"
 #include "object.h"
-
-// single global VM instance
-VM vm;
+#include "text.h"
+#include "vector.h"
+#include "worker.h"
 
 // forward declarations
-static void defineNative(const char* name, NativeFunction function);
-static Value clockNative(const int32_t argCount __attribute__((unused)),
-                         const Value* args __attribute__((unused)));
-static void resetStack();
+static Value clockNative(VM* vm __attribute__((unused)));
+static Value lenNative(VM* vm __attribute__((unused)), Value value);
+static Value pushNative(VM* vm, Value list, Value value);
+static Value popNative(VM* vm __attribute__((unused)), Value list);
+static Value keysNative(VM* vm, Value map);
+static Value hasNative(VM* vm __attribute__((unused)), Value map, Value key);
+static Value removeNative(VM* vm, Value map, Value key);
+static Value forEachNative(VM* vm, Value list, Value function);
+static Value mapNative(VM* vm, Value list, Value function);
+static Value filterNative(VM* vm, Value list, Value function);
+static Value reduceNative(VM* vm, Value list, Value function, Value initial);
+static Value float64ArrayNative(VM* vm, Value source);
+static Value sumNative(VM* vm __attribute__((unused)), Value array);
+static Value dotNative(VM* vm, Value a, Value b);
+static Value scaleNative(VM* vm, Value array, Value factor);
+static Value addNative(VM* vm, Value a, Value b);
+static Value minNative(VM* vm __attribute__((unused)), Value array);
+static Value maxNative(VM* vm __attribute__((unused)), Value array);
+static Value sortNative(VM* vm, const int32_t argCount, const Value* args);
+static Value findNative(VM* vm, const int32_t argCount, const Value* args);
+static Value splitNative(VM* vm, Value subject, Value delimiter);
+static Value replaceNative(VM* vm, Value subject, Value pattern,
+                           Value replacement);
+static Value substrNative(VM* vm, const int32_t argCount, const Value* args);
+static Value joinNative(VM* vm, Value list, Value delimiter);
+static Value toUpperNative(VM* vm, Value subject);
+static Value toLowerNative(VM* vm, Value subject);
+static Value trimNative(VM* vm, Value subject);
+static Value channelNative(VM* vm);
+static Value sendNative(VM* vm, Value channel, Value value);
+static Value receiveNative(VM* vm, Value channel);
+static Value spawnNative(VM* vm, const int32_t argCount, const Value* args);
+static Value waitNative(VM* vm, Value worker);
+static Value parallelMapNative(VM* vm, Value list, Value function);
+static Value parallelReduceNative(VM* vm, Value list, Value function,
+                                  Value initial);
+static Value coroutineNative(VM* vm, Value function);
+static Value doneNative(VM* vm __attribute__((unused)), Value coroutine);
+static Value asyncNative(VM* vm, Value function);
+static Value runLoopNative(VM* vm);
+static Value sleepNative(VM* vm, Value milliseconds);
+static Value pipeNative(VM* vm);
+static Value openNative(VM* vm, Value path, Value mode);
+static Value readNative(VM* vm, Value descriptor, Value limit);
+static Value writeNative(VM* vm, Value descriptor, Value string);
+static Value closeNative(VM* vm, Value descriptor);
+static Value listenNative(VM* vm, Value path);
+static Value acceptNative(VM* vm, Value descriptor);
+static Value connectNative(VM* vm, Value path);
+static void resetStack(VM* vm);
+static void reserveCoroutineFrame(VM* vm, int32_t needed);
+static void leaveCoroutine(VM* vm, CoroutineState state);
+static bool waitForIo(VM* vm);
+static bool isFalsey(Value value);
+
+// A native taking any number of arguments as an array, and one taking a fixed
+// number of them directly, with the types required of the first few.
+#define NATIVE(name, function, ...) \
+    {name, NATIVE_VARIADIC, {__VA_ARGS__}, function, {NULL}, NULL}
+#define FAST_NATIVE(name, arity, function, ...) \
+    {name, arity, {__VA_ARGS__}, NULL, {.call##arity = function}, NULL}
+
+// The native functions by the global name each is defined under, which is how
+// heap snapshots refer to them.
+static const NativeSpec natives[] = {
+    FAST_NATIVE("clock", 0, clockNative, NATIVE_ANY),
+    FAST_NATIVE("len", 1, lenNative, NATIVE_ANY),
+    FAST_NATIVE("push", 2, pushNative, NATIVE_LIST),
+    FAST_NATIVE("pop", 1, popNative, NATIVE_LIST),
+    FAST_NATIVE("keys", 1, keysNative, NATIVE_MAP),
+    FAST_NATIVE("has", 2, hasNative, NATIVE_MAP),
+    FAST_NATIVE("remove", 2, removeNative, NATIVE_MAP),
+    FAST_NATIVE("forEach", 2, forEachNative, NATIVE_LIST),
+    FAST_NATIVE("map", 2, mapNative, NATIVE_LIST),
+    FAST_NATIVE("filter", 2, filterNative, NATIVE_LIST),
+    FAST_NATIVE("reduce", 3, reduceNative, NATIVE_LIST),
+
+    FAST_NATIVE("Float64Array", 1, float64ArrayNative, NATIVE_ANY),
+    FAST_NATIVE("sum", 1, sumNative, NATIVE_FLOAT64_ARRAY),
+    FAST_NATIVE("dot", 2, dotNative, NATIVE_FLOAT64_ARRAY,
+                NATIVE_FLOAT64_ARRAY),
+    FAST_NATIVE("scale", 2, scaleNative, NATIVE_FLOAT64_ARRAY, NATIVE_NUMBER),
+    FAST_NATIVE("add", 2, addNative, NATIVE_FLOAT64_ARRAY,
+                NATIVE_FLOAT64_ARRAY),
+    FAST_NATIVE("min", 1, minNative, NATIVE_FLOAT64_ARRAY),
+    FAST_NATIVE("max", 1, maxNative, NATIVE_FLOAT64_ARRAY),
+    NATIVE("sort", sortNative, NATIVE_ANY),
+
+    NATIVE("find", findNative, NATIVE_STRING, NATIVE_STRING),
+    FAST_NATIVE("split", 2, splitNative, NATIVE_STRING, NATIVE_STRING),
+    FAST_NATIVE("replace", 3, replaceNative, NATIVE_STRING, NATIVE_STRING,
+                NATIVE_STRING),
+    NATIVE("substr", substrNative, NATIVE_STRING),
+    FAST_NATIVE("join", 2, joinNative, NATIVE_LIST, NATIVE_STRING),
+    FAST_NATIVE("toUpper", 1, toUpperNative, NATIVE_STRING),
+    FAST_NATIVE("toLower", 1, toLowerNative, NATIVE_STRING),
+    FAST_NATIVE("trim", 1, trimNative, NATIVE_STRING),
+
+    FAST_NATIVE("channel", 0, channelNative, NATIVE_ANY),
+    FAST_NATIVE("send", 2, sendNative, NATIVE_CHANNEL),
+    FAST_NATIVE("receive", 1, receiveNative, NATIVE_CHANNEL),
+    NATIVE("spawn", spawnNative, NATIVE_ANY),
+    FAST_NATIVE("wait", 1, waitNative, NATIVE_WORKER),
+    FAST_NATIVE("parallelMap", 2, parallelMapNative, NATIVE_LIST),
+    FAST_NATIVE("parallelReduce", 3, parallelReduceNative, NATIVE_LIST),
+
+    FAST_NATIVE("coroutine", 1, coroutineNative, NATIVE_ANY),
+    FAST_NATIVE("done", 1, doneNative, NATIVE_COROUTINE),
+
+    FAST_NATIVE("async", 1, asyncNative, NATIVE_ANY),
+    FAST_NATIVE("runLoop", 0, runLoopNative, NATIVE_ANY),
+    FAST_NATIVE("sleep", 1, sleepNative, NATIVE_NUMBER),
+    FAST_NATIVE("pipe", 0, pipeNative, NATIVE_ANY),
+    FAST_NATIVE("open", 2, openNative, NATIVE_ANY),
+    FAST_NATIVE("read", 2, readNative, NATIVE_ANY),
+    FAST_NATIVE("write", 2, writeNative, NATIVE_ANY),
+    FAST_NATIVE("close", 1, closeNative, NATIVE_ANY),
+    FAST_NATIVE("listen", 1, listenNative, NATIVE_ANY),
+    FAST_NATIVE("accept", 1, acceptNative, NATIVE_ANY),
+    FAST_NATIVE("connect", 1, connectNative, NATIVE_ANY),
+};
+
+#undef NATIVE
+#undef FAST_NATIVE
 
 //-----------------------------------------------------------------------------
 //- VM Initialization and Teardown
@@ -38,46 +162,120 @@ static void resetStack();
  * @brief Initializes the virtual machine.
  *
  * Sets up the stack, global tables, and defines native functions.
+ *
+ * @param vm The virtual machine.
  */
-void initVM() {
-    resetStack();
-    vm.objects = NULL;
-    vm.bytesAllocated = 0;
-    vm.nextGC = 1024 * 1024;
-
-    vm.grayCount = 0;
-    vm.grayCapacity = 0;
-    vm.grayStack = NULL;
+void initVM(VM* vm) {
+    // the stack, the frames and the output buffer live outside the GC heap
+    vm->stack = (Value*)malloc(sizeof(Value) * STACK_MAX);
+    vm->frames = (CallFrame*)malloc(sizeof(CallFrame) * FRAMES_MAX);
+    char* outputBytes = (char*)malloc(OUTPUT_BUFFER_SIZE);
+    if (vm->stack == NULL || vm->frames == NULL || outputBytes == NULL) {
+        exit(1);
+    }
+    vm->mainStack.stack = vm->stack;
+    vm->mainStack.stackCapacity = STACK_MAX;
+    vm->mainStack.frames = vm->frames;
+    vm->mainStack.frameCapacity = FRAMES_MAX;
+
+    vm->coroutine = NULL;
+    vm->loop = NULL;
+    vm->pool = NULL;
+    vm->runningNative = NULL;
+    vm->nativeCall = NULL;
+    vm->baseFrame = 0;
+    vm->baseStack = NULL;
+    vm->nativeFailed = false;
+    resetStack(vm);
+    vm->objects = NULL;
+    vm->bytesAllocated = 0;
+    vm->nextGC = 1024 * 1024;
+
+    vm->grayCount = 0;
+    vm->grayCapacity = 0;
+    vm->grayStack = NULL;
+
+    initValueArray(&vm->handles);
+    vm->releasedHandles = NULL;
+    vm->freeHandle = -1;
+    vm->pushedArguments = 0;
+    vm->hostNatives = NULL;
+    vm->hostArgs = NULL;
+    vm->hostArgCount = 0;
+    vm->hostResult = NIL_VAL;
+    vm->result = NIL_VAL;
+
+    initOutput(&vm->output, stdout, outputBytes, OUTPUT_BUFFER_SIZE);
+#ifdef DEBUG_TRACE_EXECUTION
+    vm->output.lineBuffered = true;  // keep print output between trace lines
+#endif
 
-    initTable(&vm.strings);
-    initTable(&vm.globals);
+    initInternTable(&vm->strings);
+    initTable(&vm->globals);
 
     // pre-intern the "init" string for faster method lookups on class
     // initializers
-    vm.initString = NULL;  // set to NULL for GC safety during copyString
-    vm.initString = copyString("init", 4);
+    vm->images = NULL;
+    vm->lazyCompilation = false;
+    vm->parser = NULL;
+    vm->frozen = NULL;
+    vm->sharedCode = NULL;
+    initValueArray(&vm->sharedRoots);
+    initMap(&vm->twins);
+    vm->initString = NULL;  // set to NULL for GC safety during copyString
+    vm->initString = copyString(vm, "init", 4);
 
     // define native functions
-    defineNative("clock", clockNative);
+    initVectorKernels();
+    for (size_t i = 0; i < sizeof(natives) / sizeof(natives[0]); i++) {
+        defineNative(vm, &natives[i]);
+    }
 }
 
 /**
  * @brief Frees all resources used by the VM.
+ * @param vm The virtual machine.
  */
-void freeVM() {
-    freeTable(&vm.globals);
-    freeTable(&vm.strings);
-    vm.initString = NULL;
-    freeObjects();
+void freeVM(VM* vm) {
+    flushOutput(&vm->output);
+    freeWorkerPool(vm);
+    freeEventLoop(vm);
+    freeTable(vm, &vm->globals);
+    freeInternTable(vm, &vm->strings);
+    FREE_ARRAY(vm, bool, vm->releasedHandles, vm->handles.capacity);
+    freeValueArray(vm, &vm->handles);
+    vm->initString = NULL;
+    freeObjects(vm);
+    freeLoadedImages(vm);
+    while (vm->hostNatives != NULL) {
+        HostNative* native = vm->hostNatives;
+        vm->hostNatives = native->next;
+        free((char*)native->spec.name);
+        free(native);
+    }
+    if (vm->frozen != NULL) releaseFrozenCode(vm->frozen);
+    freeSharedCode(vm);
+
+    free(vm->output.bytes);
+    free(vm->mainStack.frames);
+    free(vm->mainStack.stack);
 }
 
 /**
  * @brief Resets the VM's stack to an empty state.
+ *
+ * Every coroutine between the running one and the main stack is ended, as
+ * is every stack waiting on the event loop, and the main stack is emptied.
+ *
+ * @param vm The virtual machine.
  */
-static void resetStack() {
-    vm.stackTop = vm.stack;
-    vm.frameCount = 0;
-    vm.openUpvalues = NULL;
+static void resetStack(VM* vm) {
+    while (vm->coroutine != NULL) leaveCoroutine(vm, COROUTINE_DONE);
+    resetEventLoop(vm);
+    vm->waitingForIo = false;
+    vm->stackTop = vm->stack;
+    vm->frameCount = 0;
+    vm->openUpvalues = NULL;
 }
 
 //-----------------------------------------------------------------------------
@@ -87,29 +285,1090 @@ static void resetStack() {
 /**
  * @brief Native function to return the elapsed CPU time.
  *
- * @param argCount The number of arguments (unused).
- * @param args A pointer to the arguments on the stack (unused).
+ * @param vm The virtual machine (unused).
  * @return Value The elapsed time as a number in miliseconds.
  */
-static Value clockNative(const int32_t argCount __attribute__((unused)),
-                         const Value* args __attribute__((unused))) {
+static Value clockNative(VM* vm __attribute__((unused))) {
     return NUMBER_VAL((double)clock());
 }
 
 /**
- * @brief Defines a native function and makes it available as a global variable.
+ * @brief Native function to return the length of a list, map, Float64Array,
+ * string or foreign object.
+ *
+ * @param vm The virtual machine (unused).
+ * @param value The list, map, array, string or foreign object.
+ * @return Value The number of elements, the size in bytes of a foreign
+ * object's data, or nil for any other argument.
+ */
+static Value lenNative(VM* vm __attribute__((unused)), Value value) {
+    if (IS_LIST(value)) return INT_VAL(AS_LIST(value)->items.count);
+    if (IS_MAP(value)) return INT_VAL(AS_MAP(value)->table.count);
+    if (IS_FLOAT64_ARRAY(value)) return INT_VAL(AS_FLOAT64_ARRAY(value)->count);
+    if (IS_STRING(value)) return INT_VAL(stringLength(value));
+    if (IS_FOREIGN(value)) {
+        size_t size = AS_FOREIGN(value)->size;
+        return size <= INT32_MAX ? INT_VAL((int32_t)size)
+                                 : NUMBER_VAL((double)size);
+    }
+    return NIL_VAL;
+}
+
+/**
+ * @brief Native function to append a value to the end of a list.
+ *
+ * The buffer grows geometrically, so appending is amortized O(1).
+ *
+ * @param vm The virtual machine.
+ * @param list The list.
+ * @param value The value to append.
+ * @return Value The new length of the list.
+ */
+static Value pushNative(VM* vm, Value list, Value value) {
+    // both arguments are still on the stack, so growing the buffer is GC safe
+    ValueArray* items = &AS_LIST(list)->items;
+    writeValueArray(vm, items, value);
+    return INT_VAL(items->count);
+}
+
+/**
+ * @brief Native function to remove and return the last value of a list.
+ *
+ * @param vm The virtual machine (unused).
+ * @param list The list.
+ * @return Value The removed value, or nil if the list is empty.
+ */
+static Value popNative(VM* vm __attribute__((unused)), Value list) {
+    ValueArray* items = &AS_LIST(list)->items;
+    if (items->count == 0) return NIL_VAL;
+    return items->values[--items->count];
+}
+
+/**
+ * @brief Native function to return the keys of a map as a new list.
+ *
+ * The list is a snapshot, so the map can be modified while iterating it.
+ *
+ * @param vm The virtual machine.
+ * @param map The map.
+ * @return Value The list of keys.
+ */
+static Value keysNative(VM* vm, Value map) {
+    const Map* table = &AS_MAP(map)->table;
+    ObjectList* list = newList(vm);
+    push(vm, OBJECT_VAL(list));  // GC guard while the buffer is allocated
+    if (table->count > 0) {
+        list->items.values = ALLOCATE(vm, Value, table->count);
+        list->items.capacity = table->count;
+        for (int32_t i = 0; i <= table->capacity; i++) {
+            if (IS_NIL(table->entries[i].key)) continue;
+            list->items.values[list->items.count++] = table->entries[i].key;
+        }
+    }
+    pop(vm);
+    return OBJECT_VAL(list);
+}
+
+/**
+ * @brief Native function to check if a map contains a key.
+ *
+ * @param vm The virtual machine (unused).
+ * @param map The map.
+ * @param key The key.
+ * @return Value True if the key is present, false otherwise.
+ */
+static Value hasNative(VM* vm __attribute__((unused)), Value map, Value key) {
+    Value value;
+    return BOOL_VAL(mapGet(&AS_MAP(map)->table, key, &value));
+}
+
+/**
+ * @brief Native function to remove a key from a map.
+ *
+ * @param vm The virtual machine.
+ * @param map The map.
+ * @param key The key.
+ * @return Value True if the key was present, false otherwise.
+ */
+static Value removeNative(VM* vm, Value map, Value key) {
+    return BOOL_VAL(mapDelete(vm, &AS_MAP(map)->table, key));
+}
+
+// The higher-order natives call back into Lox with callFromNative. They read
+// the list's length on each step, as the function may change it.
+
+/**
+ * @brief Native function to call a function with every element of a list.
+ *
+ * @param vm The virtual machine.
+ * @param list The list.
+ * @param function The function.
+ * @return Value Nil.
+ */
+static Value forEachNative(VM* vm, Value list, Value function) {
+    const ValueArray* items = &AS_LIST(list)->items;
+    for (int32_t i = 0; i < items->count; i++) {
+        Value item = items->values[i];
+        Value result;
+        if (!callFromNative(vm, function, 1, &item, &result)) return NIL_VAL;
+    }
+    return NIL_VAL;
+}
+
+/**
+ * @brief Native function to apply a function to every element of a list.
+ *
+ * @param vm The virtual machine.
+ * @param list The list.
+ * @param function The function.
+ * @return Value A new list of the results.
+ */
+static Value mapNative(VM* vm, Value list, Value function) {
+    const ValueArray* items = &AS_LIST(list)->items;
+    ObjectList* results = newList(vm);
+    push(vm, OBJECT_VAL(results));
+    for (int32_t i = 0; i < items->count; i++) {
+        Value item = items->values[i];
+        Value result;
+        if (!callFromNative(vm, function, 1, &item, &result)) return NIL_VAL;
+        push(vm, result);  // GC guard while the list grows
+        writeValueArray(vm, &results->items, result);
+        pop(vm);
+    }
+    pop(vm);
+    return OBJECT_VAL(results);
+}
+
+/**
+ * @brief Native function to keep the elements of a list a function accepts.
+ *
+ * @param vm The virtual machine.
+ * @param list The list.
+ * @param function The function.
+ * @return Value A new list of the elements for which the function returned
+ * a truthy value.
+ */
+static Value filterNative(VM* vm, Value list, Value function) {
+    const ValueArray* items = &AS_LIST(list)->items;
+    ObjectList* results = newList(vm);
+    push(vm, OBJECT_VAL(results));
+    for (int32_t i = 0; i < items->count; i++) {
+        // the element stays on the stack even if the function drops it
+        Value item = items->values[i];
+        push(vm, item);
+        Value result;
+        if (!callFromNative(vm, function, 1, &item, &result)) return NIL_VAL;
+        if (!isFalsey(result)) writeValueArray(vm, &results->items, item);
+        pop(vm);
+    }
+    pop(vm);
+    return OBJECT_VAL(results);
+}
+
+/**
+ * @brief Native function to combine the elements of a list, from the first
+ * to the last, like `reduce(list, fn, initial)`.
+ *
+ * @param vm The virtual machine.
+ * @param list The list.
+ * @param function The function, which takes the value so far and an element.
+ * @param initial The initial value.
+ * @return Value The last value returned, or `initial` for an empty list.
+ */
+static Value reduceNative(VM* vm, Value list, Value function, Value initial) {
+    const ValueArray* items = &AS_LIST(list)->items;
+    Value pair[2] = {initial, NIL_VAL};
+    for (int32_t i = 0; i < items->count; i++) {
+        pair[1] = items->values[i];
+        push(vm, pair[0]);  // GC guard between the calls
+        bool called = callFromNative(vm, function, 2, pair, &pair[0]);
+        if (!called) return NIL_VAL;
+        pop(vm);
+    }
+    return pair[0];
+}
+
+/**
+ * @brief Native function to create a Float64Array.
+ *
+ * `Float64Array(n)` creates an array of `n` zeros, `Float64Array(list)`
+ * copies a list of numbers.
+ *
+ * @param vm The virtual machine.
+ * @param source The length or the list to copy.
+ * @return Value The new array.
+ */
+static Value float64ArrayNative(VM* vm, Value source) {
+    if (IS_NUMBER(source)) {
+        double count = AS_NUMBER(source);
+        if (!(count >= 0 && count <= INT32_MAX) || (int32_t)count != count) {
+            nativeError(vm, "Array length must be a non-negative integer.");
+            return NIL_VAL;
+        }
+        return OBJECT_VAL(newFloat64Array(vm, (int32_t)count));
+    }
+
+    if (IS_LIST(source)) {
+        const ValueArray* items = &AS_LIST(source)->items;
+        for (int32_t i = 0; i < items->count; i++) {
+            if (!IS_NUMBER(items->values[i])) {
+                nativeError(vm, "Array elements must be numbers.");
+                return NIL_VAL;
+            }
+        }
+
+        ObjectFloat64Array* array = newFloat64Array(vm, items->count);
+        for (int32_t i = 0; i < items->count; i++) {
+            array->values[i] = AS_NUMBER(items->values[i]);
+        }
+        return OBJECT_VAL(array);
+    }
+
+    nativeError(vm, "Argument 1 of Float64Array() must be a number or a list.");
+    return NIL_VAL;
+}
+
+/**
+ * @brief Native function to sum the elements of a Float64Array.
+ *
+ * @param vm The virtual machine (unused).
+ * @param array The array.
+ * @return Value The sum.
+ */
+static Value sumNative(VM* vm __attribute__((unused)), Value array) {
+    const ObjectFloat64Array* values = AS_FLOAT64_ARRAY(array);
+    return NUMBER_VAL(vectorSum(values->values, values->count));
+}
+
+/**
+ * @brief Native function to compute the dot product of two Float64Arrays.
+ *
+ * @param vm The virtual machine.
+ * @param a The first array.
+ * @param b The second array, of the same length.
+ * @return Value The dot product.
+ */
+static Value dotNative(VM* vm, Value a, Value b) {
+    const ObjectFloat64Array* left = AS_FLOAT64_ARRAY(a);
+    const ObjectFloat64Array* right = AS_FLOAT64_ARRAY(b);
+    if (left->count != right->count) {
+        nativeError(vm, "Arrays must have the same length.");
+        return NIL_VAL;
+    }
+    return NUMBER_VAL(vectorDot(left->values, right->values, left->count));
+}
+
+/**
+ * @brief Native function to multiply a Float64Array by a number.
+ *
+ * @param vm The virtual machine.
+ * @param array The array.
+ * @param factor The factor.
+ * @return Value A new array with the scaled elements.
+ */
+static Value scaleNative(VM* vm, Value array, Value factor) {
+    // the source array is still on the stack while the result is allocated
+    const ObjectFloat64Array* source = AS_FLOAT64_ARRAY(array);
+    ObjectFloat64Array* result = newFloat64Array(vm, source->count);
+    vectorScale(result->values, source->values, AS_NUMBER(factor),
+                source->count);
+    return OBJECT_VAL(result);
+}
+
+/**
+ * @brief Native function to add two Float64Arrays element-wise.
+ *
+ * @param vm The virtual machine.
+ * @param a The first array.
+ * @param b The second array, of the same length.
+ * @return Value A new array with the sums.
+ */
+static Value addNative(VM* vm, Value a, Value b) {
+    const ObjectFloat64Array* left = AS_FLOAT64_ARRAY(a);
+    const ObjectFloat64Array* right = AS_FLOAT64_ARRAY(b);
+    if (left->count != right->count) {
+        nativeError(vm, "Arrays must have the same length.");
+        return NIL_VAL;
+    }
+
+    ObjectFloat64Array* result = newFloat64Array(vm, left->count);
+    vectorAdd(result->values, left->values, right->values, left->count);
+    return OBJECT_VAL(result);
+}
+
+/**
+ * @brief Native function to return the smallest element of a Float64Array.
+ *
+ * @param vm The virtual machine (unused).
+ * @param array The array.
+ * @return Value The smallest element, or nil for an empty array.
+ */
+static Value minNative(VM* vm __attribute__((unused)), Value array) {
+    const ObjectFloat64Array* values = AS_FLOAT64_ARRAY(array);
+    if (values->count == 0) return NIL_VAL;
+    return NUMBER_VAL(vectorMin(values->values, values->count));
+}
+
+/**
+ * @brief Native function to return the largest element of a Float64Array.
+ *
+ * @param vm The virtual machine (unused).
+ * @param array The array.
+ * @return Value The largest element, or nil for an empty array.
+ */
+static Value maxNative(VM* vm __attribute__((unused)), Value array) {
+    const ObjectFloat64Array* values = AS_FLOAT64_ARRAY(array);
+    if (values->count == 0) return NIL_VAL;
+    return NUMBER_VAL(vectorMax(values->values, values->count));
+}
+
+/**
+ * @brief Merges runs of values sorted by a comparison function, one pass of
+ * a bottom-up merge sort.
+ *
+ * Both arrays must be reachable by the GC, as the function may collect.
+ * @param vm The virtual machine.
+ * @param before The function, which tells whether its first argument sorts
+ * before its second.
+ * @param from The runs.
+ * @param to The array to merge them into.
+ * @param count The number of values.
+ * @param width The length of the runs.
+ * @return bool True on success, false if a call failed.
+ */
+static bool mergeRuns(VM* vm, Value before, const Value* from, Value* to,
+                      int32_t count, int32_t width) {
+    for (int32_t low = 0; low < count; low += 2 * width) {
+        int32_t middle = low + width < count ? low + width : count;
+        int32_t high = middle + width < count ? middle + width : count;
+        int32_t left = low;
+        int32_t right = middle;
+        int32_t next = low;
+        while (left < middle && right < high) {
+            // the right value goes first only if it sorts strictly before
+            // the left one, so that equal values keep their order
+            Value pair[2] = {from[right], from[left]};
+            Value result;
+            if (!callFromNative(vm, before, 2, pair, &result)) return false;
+            to[next++] = isFalsey(result) ? from[left++] : from[right++];
+        }
+        while (left < middle) to[next++] = from[left++];
+        while (right < high) to[next++] = from[right++];
+    }
+    return true;
+}
+
+/**
+ * @brief Sorts a list in place with a comparison function, stably.
+ *
+ * The values are sorted in a copy, so that the function sees the list
+ * unchanged and can't corrupt the sort by changing it; the sorted copy then
+ * replaces the list's values.
+ * @param vm The virtual machine.
+ * @param list The list, which must be reachable by the GC.
+ * @param before The function, which tells whether its first argument sorts
+ * before its second.
+ * @return bool True on success, false if a call failed.
+ */
+static bool sortList(VM* vm, ObjectList* list, Value before) {
+    int32_t count = list->items.count;
+    ObjectList* buffers[2];
+    for (int32_t i = 0; i < 2; i++) {
+        buffers[i] = newList(vm);
+        push(vm, OBJECT_VAL(buffers[i]));
+        for (int32_t j = 0; j < count; j++) {
+            writeValueArray(vm, &buffers[i]->items, list->items.values[j]);
+        }
+    }
+
+    int32_t sorted = 0;
+    for (int32_t width = 1; width < count; width *= 2) {
+        if (!mergeRuns(vm, before, buffers[sorted]->items.values,
+                       buffers[1 - sorted]->items.values, count, width)) {
+            return false;
+        }
+        sorted = 1 - sorted;
+    }
+
+    // the old values go to the buffer, which is collected with them
+    ValueArray items = list->items;
+    list->items = buffers[sorted]->items;
+    buffers[sorted]->items = items;
+    pop(vm);
+    pop(vm);
+    return true;
+}
+
+/**
+ * @brief Native function to sort a Float64Array in place, in ascending order,
+ * or a list with a comparison function.
+ *
+ * `sort(list, before)` calls `before(a, b)` to tell whether `a` sorts before
+ * `b`; the sort is stable.
+ *
+ * @param vm The virtual machine.
+ * @param argCount The number of arguments.
+ * @param args The array, or the list and the function.
+ * @return Value The sorted array or list.
+ */
+static Value sortNative(VM* vm, const int32_t argCount, const Value* args) {
+    if (argCount == 2 && IS_LIST(args[0])) {
+        Value list = args[0];
+        return sortList(vm, AS_LIST(list), args[1]) ? list : NIL_VAL;
+    }
+    if (argCount != 1 || !IS_FLOAT64_ARRAY(args[0])) {
+        nativeError(vm, "Can only sort a Float64Array, or a list with a "
+                        "function.");
+        return NIL_VAL;
+    }
+
+    ObjectFloat64Array* array = AS_FLOAT64_ARRAY(args[0]);
+    uint64_t* scratch = ALLOCATE(vm, uint64_t, array->count * 2);
+    vectorSort(array->values, scratch, array->count);
+    FREE_ARRAY(vm, uint64_t, scratch, array->count * 2);
+    return args[0];
+}
+
+// The string natives build each result in a single buffer and intern it once
+// with takeStringValue/copyStringValue, instead of concatenating intermediate
+// strings.
+
+/**
+ * @brief Converts a native argument to an integer.
+ * @param value The argument.
+ * @param result A pointer where the integer will be stored.
+ * @return bool True if the argument is an integer number, false otherwise.
+ */
+static bool integerArgument(Value value, int32_t* result) {
+    if (IS_INT(value)) {
+        *result = AS_INT(value);
+        return true;
+    }
+    if (!IS_NUMBER(value)) return false;
+
+    double number = AS_NUMBER(value);
+    if (!(number >= INT32_MIN && number <= INT32_MAX)) return false;
+    *result = (int32_t)number;
+    return *result == number;
+}
+
+/**
+ * @brief Native function to find a substring, like `find(s, needle, start)`.
+ *
+ * @param vm The virtual machine.
+ * @param argCount The number of arguments.
+ * @param args The string, the needle, and an optional start index.
+ * @return Value The index of the first occurrence at or after `start`, -1 if
+ * there is none, or nil if `start` is not an integer.
+ */
+static Value findNative(VM* vm, const int32_t argCount, const Value* args) {
+    if (argCount < 2 || argCount > 3) {
+        nativeError(vm, "Expected 2 or 3 arguments, but got %d.", argCount);
+        return NIL_VAL;
+    }
+
+    StringView string;
+    viewString(args[0], &string);
+    StringView needle;
+    viewString(args[1], &needle);
+    int32_t start = 0;
+    if (argCount == 3) {
+        if (!integerArgument(args[2], &start)) return NIL_VAL;
+        if (start < 0) start = 0;
+        if (start > string.length) return INT_VAL(-1);
+    }
+
+    return INT_VAL(textFind(string.chars, string.length, needle.chars,
+                            needle.length, start));
+}
+
+/**
+ * @brief Appends a copy of a piece of a string to a list.
+ * @param vm The virtual machine.
+ * @param list The list, which must be reachable by the GC.
+ * @param chars The characters of the piece.
+ * @param length The length of the piece.
+ */
+static void appendPiece(VM* vm, ObjectList* list, const char* chars,
+                        int32_t length) {
+    Value piece = copyStringValue(vm, chars, length);
+    push(vm, piece);  // GC guard while the list grows
+    writeValueArray(vm, &list->items, piece);
+    pop(vm);
+}
+
+/**
+ * @brief Native function to split a string around a separator.
+ *
+ * An empty separator splits the string into single characters.
+ *
+ * @param vm The virtual machine.
+ * @param subject The string.
+ * @param delimiter The separator.
+ * @return Value A list of the pieces.
+ */
+static Value splitNative(VM* vm, Value subject, Value delimiter) {
+    StringView string;
+    viewString(subject, &string);
+    StringView separator;
+    viewString(delimiter, &separator);
+    ObjectList* list = newList(vm);
+    push(vm, OBJECT_VAL(list));
+
+    if (separator.length == 0) {
+        for (int32_t i = 0; i < string.length; i++) {
+            appendPiece(vm, list, string.chars + i, 1);
+        }
+    } else {
+        int32_t start = 0;
+        for (;;) {
+            int32_t found = textFind(string.chars, string.length,
+                                     separator.chars, separator.length,
+                                     start);
+            int32_t end = found < 0 ? string.length : found;
+            appendPiece(vm, list, string.chars + start, end - start);
+            if (found < 0) break;
+            start = found + separator.length;
+        }
+    }
+
+    pop(vm);
+    return OBJECT_VAL(list);
+}
+
+/**
+ * @brief Native function to replace every occurrence of a substring.
+ *
+ * @param vm The virtual machine.
+ * @param subject The string.
+ * @param pattern The substring to replace.
+ * @param replacement Its replacement.
+ * @return Value The new string.
+ */
+static Value replaceNative(VM* vm, Value subject, Value pattern,
+                           Value replacement) {
+    StringView string;
+    viewString(subject, &string);
+    StringView from;
+    viewString(pattern, &from);
+    StringView to;
+    viewString(replacement, &to);
+    if (from.length == 0) return subject;
+
+    // count first, so the result is allocated once at its final size
+    int32_t count = 0;
+    int32_t found = textFind(string.chars, string.length, from.chars,
+                             from.length, 0);
+    while (found >= 0) {
+        count++;
+        found = textFind(string.chars, string.length, from.chars,
+                         from.length, found + from.length);
+    }
+    if (count == 0) return subject;
+
+    int32_t length = string.length + count * (to.length - from.length);
+    char* chars = ALLOCATE(vm, char, length + 1);
+    char* dest = chars;
+    int32_t start = 0;
+    for (int32_t i = 0; i < count; i++) {
+        found = textFind(string.chars, string.length, from.chars,
+                         from.length, start);
+        memcpy(dest, string.chars + start, found - start);
+        dest += found - start;
+        memcpy(dest, to.chars, to.length);
+        dest += to.length;
+        start = found + from.length;
+    }
+    memcpy(dest, string.chars + start, string.length - start);
+    chars[length] = '\0';
+
+    return takeStringValue(vm, chars, length);
+}
+
+/**
+ * @brief Native function to extract a substring, like `substr(s, start, n)`.
+ *
+ * The start and length are clamped to the bounds of the string; without a
+ * length the substring runs to the end.
+ *
+ * @param vm The virtual machine.
+ * @param argCount The number of arguments.
+ * @param args The string, the start index, and an optional length.
+ * @return Value The substring, or nil if an index is not an integer.
+ */
+static Value substrNative(VM* vm, const int32_t argCount, const Value* args) {
+    if (argCount < 2 || argCount > 3) {
+        nativeError(vm, "Expected 2 or 3 arguments, but got %d.", argCount);
+        return NIL_VAL;
+    }
+    int32_t start;
+    if (!integerArgument(args[1], &start)) return NIL_VAL;
+
+    StringView string;
+    viewString(args[0], &string);
+    if (start < 0) start = 0;
+    if (start > string.length) start = string.length;
+
+    int32_t length = string.length - start;
+    if (argCount == 3) {
+        int32_t requested;
+        if (!integerArgument(args[2], &requested)) return NIL_VAL;
+        if (requested < 0) requested = 0;
+        if (requested < length) length = requested;
+    }
+
+    if (length == string.length) return args[0];
+    return copyStringValue(vm, string.chars + start, length);
+}
+
+/**
+ * @brief Native function to join a list of strings with a separator.
+ *
+ * @param vm The virtual machine.
+ * @param list The list of strings.
+ * @param delimiter The separator.
+ * @return Value The joined string.
+ */
+static Value joinNative(VM* vm, Value list, Value delimiter) {
+    const ValueArray* items = &AS_LIST(list)->items;
+    StringView separator;
+    viewString(delimiter, &separator);
+    int32_t length = 0;
+    for (int32_t i = 0; i < items->count; i++) {
+        if (!IS_STRING(items->values[i])) {
+            nativeError(vm, "Can only join strings.");
+            return NIL_VAL;
+        }
+        if (i > 0) length += separator.length;
+        length += stringLength(items->values[i]);
+    }
+
+    char* chars = ALLOCATE(vm, char, length + 1);
+    char* dest = chars;
+    for (int32_t i = 0; i < items->count; i++) {
+        if (i > 0) {
+            memcpy(dest, separator.chars, separator.length);
+            dest += separator.length;
+        }
+        StringView item;
+        viewString(items->values[i], &item);
+        memcpy(dest, item.chars, item.length);
+        dest += item.length;
+    }
+    chars[length] = '\0';
+
+    return takeStringValue(vm, chars, length);
+}
+
+/**
+ * @brief Native function to convert a string to uppercase (ASCII only).
+ *
+ * @param vm The virtual machine.
+ * @param subject The string.
+ * @return Value The converted string.
+ */
+static Value toUpperNative(VM* vm, Value subject) {
+    StringView string;
+    viewString(subject, &string);
+    char* chars = ALLOCATE(vm, char, string.length + 1);
+    textToUpper(chars, string.chars, string.length);
+    chars[string.length] = '\0';
+    return takeStringValue(vm, chars, string.length);
+}
+
+/**
+ * @brief Native function to convert a string to lowercase (ASCII only).
+ *
+ * @param vm The virtual machine.
+ * @param subject The string.
+ * @return Value The converted string.
+ */
+static Value toLowerNative(VM* vm, Value subject) {
+    StringView string;
+    viewString(subject, &string);
+    char* chars = ALLOCATE(vm, char, string.length + 1);
+    textToLower(chars, string.chars, string.length);
+    chars[string.length] = '\0';
+    return takeStringValue(vm, chars, string.length);
+}
+
+/**
+ * @brief Native function to strip leading and trailing whitespace.
+ *
+ * @param vm The virtual machine.
+ * @param subject The string.
+ * @return Value The trimmed string.
+ */
+static Value trimNative(VM* vm, Value subject) {
+    StringView string;
+    viewString(subject, &string);
+    int32_t start = 0;
+    int32_t end = string.length;
+    while (start < end && isspace((unsigned char)string.chars[start])) {
+        start++;
+    }
+    while (end > start && isspace((unsigned char)string.chars[end - 1])) {
+        end--;
+    }
+
+    if (end - start == string.length) return subject;
+    return copyStringValue(vm, string.chars + start, end - start);
+}
+
+/**
+ * @brief Native function to create a channel for sending values between VMs.
  *
- * @param name The name of the native function in Clox.
- * @param function A C function pointer that implements the native behavior.
+ * @param vm The virtual machine.
+ * @return Value The new channel.
  */
-static void defineNative(const char* name, NativeFunction function) {
+static Value channelNative(VM* vm) {
+    return OBJECT_VAL(newChannel(vm, createChannel()));
+}
+
+/**
+ * @brief Native function to send a copy of a value through a channel.
+ *
+ * @param vm The virtual machine.
+ * @param channel The channel.
+ * @param value The value.
+ * @return Value True if the value was sent, false if it cannot be, such as
+ * an instance or a class.
+ */
+static Value sendNative(VM* vm, Value channel, Value value) {
+    return BOOL_VAL(sendValue(vm, AS_CHANNEL(channel)->channel, value));
+}
+
+/**
+ * @brief Native function to take the oldest value sent through a channel,
+ * waiting until there is one.
+ *
+ * It is a runtime error if the value holds a function this VM has no code
+ * for, such as one defined by the sender after this worker was spawned.
+ *
+ * @param vm The virtual machine.
+ * @param channel The channel.
+ * @return Value The value.
+ */
+static Value receiveNative(VM* vm, Value channel) {
+    flushOutput(&vm->output);  // show what came before the wait
+    Value value;
+    if (!receiveValue(vm, AS_CHANNEL(channel)->channel, &value)) {
+        nativeError(vm, "Can't receive a function this VM has no code for.");
+        return NIL_VAL;
+    }
+    return value;
+}
+
+/**
+ * @brief Native function to call a function in a worker VM on a new thread.
+ *
+ * `spawn(fn, args...)` copies the function, the arguments and the globals
+ * into the worker, so the worker only shares channels with the caller. It is
+ * a runtime error if the function or an argument cannot be sent.
+ *
+ * @param vm The virtual machine.
+ * @param argCount The number of arguments.
+ * @param args The function and its arguments.
+ * @return Value The worker.
+ */
+static Value spawnNative(VM* vm, const int32_t argCount, const Value* args) {
+    if (argCount < 1) {
+        nativeError(vm, "Expected at least 1 argument, but got 0.");
+        return NIL_VAL;
+    }
+
+    // the worker's output follows what the script printed so far
+    flushOutput(&vm->output);
+    Worker* worker = spawnWorker(vm, args[0], argCount - 1, args + 1);
+    if (worker == NULL) return NIL_VAL;  // the error is reported
+    return OBJECT_VAL(newWorker(vm, worker));
+}
+
+/**
+ * @brief Native function to wait for a worker to finish.
+ *
+ * It is a runtime error if the worker's function failed or returned a value
+ * that cannot be sent back.
+ *
+ * @param vm The virtual machine.
+ * @param worker The worker.
+ * @return Value A copy of the value the worker's function returned.
+ */
+static Value waitNative(VM* vm, Value worker) {
+    flushOutput(&vm->output);  // show what came before the wait
+    Value result;
+    joinWorker(vm, AS_WORKER(worker)->worker, &result);
+    return result;  // nil if the error is reported
+}
+
+/**
+ * @brief Native function to apply a function to every element of a list on
+ * all cores.
+ *
+ * `parallelMap(list, fn)` runs `fn` in worker VMs, so `fn` should not rely on
+ * changing globals or its arguments.
+ *
+ * @param vm The virtual machine.
+ * @param list The list.
+ * @param function The function.
+ * @return Value A new list of the results, or nil after a runtime error if
+ * the work could not be sent or a call failed.
+ */
+static Value parallelMapNative(VM* vm, Value list, Value function) {
+    flushOutput(&vm->output);  // the workers' output follows the script's
+    return parallelMap(vm, AS_LIST(list), function);
+}
+
+/**
+ * @brief Native function to combine the elements of a list with an
+ * associative function on all cores.
+ *
+ * `parallelReduce(list, fn, initial)` folds chunks of the list in worker VMs
+ * and then folds their results, starting from `initial`.
+ *
+ * @param vm The virtual machine.
+ * @param list The list.
+ * @param function The function.
+ * @param initial The initial value.
+ * @return Value The result, or nil after a runtime error if the work could
+ * not be sent or a call failed.
+ */
+static Value parallelReduceNative(VM* vm, Value list, Value function,
+                                  Value initial) {
+    flushOutput(&vm->output);  // the workers' output follows the script's
+    return parallelReduce(vm, AS_LIST(list), function, initial);
+}
+
+/**
+ * @brief Native function to create a coroutine running a function.
+ *
+ * The function starts on the first `resume(co, value)`, which passes it
+ * `value` if it takes a parameter.
+ *
+ * @param vm The virtual machine.
+ * @param function The function, which takes at most one parameter.
+ * @return Value The new coroutine.
+ */
+static Value coroutineNative(VM* vm, Value function) {
+    if (!IS_CLOSURE(function) || AS_CLOSURE(function)->function->arity > 1) {
+        nativeError(vm, "A coroutine runs a function of at most 1 parameter.");
+        return NIL_VAL;
+    }
+    return OBJECT_VAL(newCoroutine(vm, AS_CLOSURE(function)));
+}
+
+/**
+ * @brief Native function to check whether a coroutine has finished.
+ *
+ * @param vm The virtual machine (unused).
+ * @param coroutine The coroutine.
+ * @return Value True if its function returned or a runtime error ended it.
+ */
+static Value doneNative(VM* vm __attribute__((unused)), Value coroutine) {
+    return BOOL_VAL(AS_COROUTINE(coroutine)->state == COROUTINE_DONE);
+}
+
+// The I/O natives return their result at once when they can. Otherwise they
+// leave the calling stack waiting: `callValue` then switches to whatever the
+// event loop can resume, and the result is pushed when the stack's turn
+// comes back (see io.h).
+
+/**
+ * @brief Native function to run a function as a task on the event loop.
+ *
+ * The task starts the next time the running stack waits, and from then on
+ * takes turns with the other stacks whenever it waits for I/O or yields.
+ * Tasks only run while some stack waits: the main stack calls `runLoop()` to
+ * wait for all of them.
+ *
+ * @param vm The virtual machine.
+ * @param function The function, which takes no parameters.
+ * @return Value The task, a coroutine that cannot be resumed by hand.
+ */
+static Value asyncNative(VM* vm, Value function) {
+    if (!IS_CLOSURE(function) || AS_CLOSURE(function)->function->arity != 0) {
+        nativeError(vm, "A task runs a function of no parameters.");
+        return NIL_VAL;
+    }
+
+    ObjectCoroutine* task = newCoroutine(vm, AS_CLOSURE(function));
+    task->task = true;
+    task->state = COROUTINE_WAITING;
+    queueTask(vm, task);
+    return OBJECT_VAL(task);
+}
+
+/**
+ * @brief Native function to wait until every task has finished or is
+ * waiting on I/O that can never complete.
+ *
+ * More exactly, the caller waits until no task is ready to run and no
+ * operation is in flight.
+ *
+ * @param vm The virtual machine.
+ * @return Value Nil.
+ */
+static Value runLoopNative(VM* vm) {
+    waitForIdle(vm);
+    return NIL_VAL;
+}
+
+/**
+ * @brief Native function to wait for a number of milliseconds.
+ *
+ * @param vm The virtual machine.
+ * @param milliseconds The number of milliseconds.
+ * @return Value Nil.
+ */
+static Value sleepNative(VM* vm, Value milliseconds) {
+    return ioSleep(vm, AS_NUMBER(milliseconds));
+}
+
+/**
+ * @brief Native function to create a pipe.
+ *
+ * @param vm The virtual machine.
+ * @return Value A list of the descriptors of the reading and writing ends,
+ * or nil on error.
+ */
+static Value pipeNative(VM* vm) { return ioPipe(vm); }
+
+/**
+ * @brief Native function to open a file, like `open(path, "r")`.
+ *
+ * @param vm The virtual machine.
+ * @param path The path.
+ * @param mode "r" to read, "w" to truncate and write, "a" to append.
+ * @return Value The descriptor, or nil on error.
+ */
+static Value openNative(VM* vm, Value path, Value mode) {
+    return ioOpen(vm, path, mode);
+}
+
+/**
+ * @brief Native function to read up to a number of bytes from a descriptor,
+ * waiting until some are available.
+ *
+ * @param vm The virtual machine.
+ * @param descriptor The descriptor.
+ * @param limit The largest number of bytes to read.
+ * @return Value The bytes read, as a string, or nil at the end of the input
+ * or on error.
+ */
+static Value readNative(VM* vm, Value descriptor, Value limit) {
+    int32_t fd;
+    int32_t count;
+    if (!integerArgument(descriptor, &fd) || !integerArgument(limit, &count)) {
+        return NIL_VAL;
+    }
+    return ioRead(vm, fd, count);
+}
+
+/**
+ * @brief Native function to write a string to a descriptor, waiting until
+ * all of it is written.
+ *
+ * @param vm The virtual machine.
+ * @param descriptor The descriptor.
+ * @param string The string.
+ * @return Value The number of bytes written, or nil on error.
+ */
+static Value writeNative(VM* vm, Value descriptor, Value string) {
+    int32_t fd;
+    if (!integerArgument(descriptor, &fd)) return NIL_VAL;
+    return ioWrite(vm, fd, string);
+}
+
+/**
+ * @brief Native function to close a descriptor.
+ *
+ * @param vm The virtual machine.
+ * @param descriptor The descriptor.
+ * @return Value True if it was closed, false on error.
+ */
+static Value closeNative(VM* vm, Value descriptor) {
+    int32_t fd;
+    if (!integerArgument(descriptor, &fd)) return BOOL_VAL(false);
+    return ioClose(vm, fd);
+}
+
+/**
+ * @brief Native function to listen for connections on a Unix socket.
+ *
+ * @param vm The virtual machine.
+ * @param path The path of the socket.
+ * @return Value The descriptor of the listening socket, or nil on error.
+ */
+static Value listenNative(VM* vm, Value path) { return ioListen(vm, path); }
+
+/**
+ * @brief Native function to accept a connection, waiting until one arrives.
+ *
+ * @param vm The virtual machine.
+ * @param descriptor The descriptor of the listening socket.
+ * @return Value The descriptor of the connection, or nil on error.
+ */
+static Value acceptNative(VM* vm, Value descriptor) {
+    int32_t fd;
+    if (!integerArgument(descriptor, &fd)) return NIL_VAL;
+    return ioAccept(vm, fd);
+}
+
+/**
+ * @brief Native function to connect to a Unix socket.
+ *
+ * @param vm The virtual machine.
+ * @param path The path of the socket.
+ * @return Value The descriptor of the connection, or nil on error.
+ */
+static Value connectNative(VM* vm, Value path) { return ioConnect(vm, path); }
+
+/**
+ * @brief Defines a native function as a global variable.
+ *
+ * This is how the VM adds its own natives, after `initVM`; a host built on
+ * libcorelox adds its natives through `loxDefineNative`.
+ *
+ * @param vm The virtual machine.
+ * @param spec How to call the function, which must outlive the VM.
+ */
+void defineNative(VM* vm, const NativeSpec* spec) {
     // pushing and poping to ensure garbage collector knows we're not done with
     // the function
-    push(OBJECT_VAL(copyString(name, (int32_t)strlen(name))));
-    push(OBJECT_VAL(newNative(function)));
-    tableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
-    pop();
-    pop();
+    push(vm,
+         OBJECT_VAL(copyString(vm, spec->name, (int32_t)strlen(spec->name))));
+    push(vm, OBJECT_VAL(newNative(vm, spec)));
+    tableSet(vm, &vm->globals, AS_STRING(vm->stackTop[-2]), vm->stackTop[-1]);
+    pop(vm);
+    pop(vm);
+}
+
+/**
+ * @brief Finds the name a native function is defined under.
+ * @param spec The native's spec.
+ * @return const char* The name, or NULL if it is not a built-in native.
+ */
+const char* getNativeName(const NativeSpec* spec) {
+    for (size_t i = 0; i < sizeof(natives) / sizeof(natives[0]); i++) {
+        if (&natives[i] == spec) return natives[i].name;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Finds the built-in native function defined under a name.
+ * @param name The characters of the name.
+ * @param length The length of the name.
+ * @return const NativeSpec* The native's spec, or NULL if there is none.
+ */
+const NativeSpec* lookupNative(const char* name, int32_t length) {
+    for (size_t i = 0; i < sizeof(natives) / sizeof(natives[0]); i++) {
+        if (strlen(natives[i].name) == (size_t)length &&
+            memcmp(natives[i].name, name, length) == 0) {
+            return &natives[i];
+        }
+    }
+    return NULL;
 }
 
 //-----------------------------------------------------------------------------
@@ -118,93 +1377,372 @@ static void defineNative(const char* name, NativeFunction function) {
 
 /**
  * @brief Pushes a value onto the top of the stack.
+ * @param vm The virtual machine.
  * @param value The value to push.
  */
-void push(Value value) {
-    *vm.stackTop = value;
-    vm.stackTop++;
+void push(VM* vm, Value value) {
+    *vm->stackTop = value;
+    vm->stackTop++;
 }
 
 /**
  * @brief Pops and returns the value from the top of the stack.
+ * @param vm The virtual machine.
  * @return Value The popped value.
  */
-Value pop() {
-    vm.stackTop--;
-    return *vm.stackTop;
+Value pop(VM* vm) {
+    vm->stackTop--;
+    return *vm->stackTop;
+}
+
+/**
+ * @brief Returns a value from the stack without popping it.
+ * @param vm The virtual machine.
+ * @param distance The distance from the top of the stack (0 is the top).
+ * @return Value The value at the specified distance.
+ */
+static Value peek(VM* vm,
+                  int32_t distance) { return vm->stackTop[-1 - distance]; }
+
+//-----------------------------------------------------------------------------
+//- Runtime Semantics
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Prints the natives that called back into Lox from a stack at a given
+ * frame count.
+ * @param stack The stack: a coroutine, or NULL for the main stack.
+ * @param frameCount The frame count.
+ * @param nativeCall The innermost call from a native not printed yet, which
+ * is moved past those printed.
+ */
+static void printNativeCalls(const ObjectCoroutine* stack, int32_t frameCount,
+                             const NativeCall** nativeCall) {
+    while (*nativeCall != NULL && (*nativeCall)->stack == stack &&
+           (*nativeCall)->frameCount == frameCount) {
+        fprintf(stderr, "[native] in %s()\n", (*nativeCall)->native->name);
+        *nativeCall = (*nativeCall)->enclosing;
+    }
+}
+
+/**
+ * @brief Prints the call frames of a stack, from the most recent downwards.
+ *
+ * A native that called back into Lox from the stack is shown between the
+ * frame of the call and the frame it was called from.
+ *
+ * @param frames The call frames.
+ * @param frameCount The number of call frames.
+ * @param stack The stack: a coroutine, or NULL for the main stack.
+ * @param nativeCall The innermost call from a native not printed yet, which
+ * is moved past those printed.
+ */
+static void printStackTrace(const CallFrame* frames, int32_t frameCount,
+                            const ObjectCoroutine* stack,
+                            const NativeCall** nativeCall) {
+    for (int32_t i = frameCount - 1; i >= 0; i--) {
+        printNativeCalls(stack, i + 1, nativeCall);
+        const CallFrame* frame = &frames[i];
+        ObjectFunction* function = frame->closure->function;
+
+        // -1 because the ip is sitting on the next instruction to be executed
+        size_t instruction = frame->ip - function->chunk.code - 1;
+        fprintf(stderr, "[line %d] in ", function->chunk.lines[instruction]);
+        if (function->name == NULL) {
+            fprintf(stderr, "script\n");
+        } else {
+            fprintf(stderr, "%s()\n", function->name->chars);
+        }
+    }
+    printNativeCalls(stack, 0, nativeCall);
+}
+
+/**
+ * @brief Reports a runtime error and prints a stack trace.
+ * @param vm The virtual machine.
+ * @param format A printf-style format string for the error message.
+ * @param ... Arguments for the format string.
+ */
+static void runtimeError(
+    VM* vm, const char* format,
+    ...) {  // variadic function -> varying number of arguments
+    flushOutput(&vm->output);  // keep the error after the output before it
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputs("\n", stderr);
+
+    // print a stack trace from the most recent call frame downwards, through
+    // the natives that called back into Lox and the coroutines that resumed
+    // the running one, down to a task or the main stack
+    const NativeCall* nativeCall = vm->nativeCall;
+    printStackTrace(vm->frames, vm->frameCount, vm->coroutine, &nativeCall);
+    for (const ObjectCoroutine* coroutine = vm->coroutine;
+         coroutine != NULL && !coroutine->task;
+         coroutine = coroutine->caller) {
+        const StackSegment* segment = coroutine->caller != NULL
+                                          ? &coroutine->caller->segment
+                                          : &vm->mainStack;
+        printStackTrace(segment->frames, segment->frameCount,
+                        coroutine->caller, &nativeCall);
+    }
+
+    resetStack(vm);
+}
+
+/**
+ * @brief Reports a runtime error from a native function.
+ *
+ * The error is reported with a stack trace, like those the VM raises, and
+ * the stack is reset. The native must then return at once, without popping
+ * anything; what it returns is ignored.
+ *
+ * @param vm The virtual machine.
+ * @param format A printf-style format string for the error message.
+ * @param ... Arguments for the format string.
+ */
+void nativeError(VM* vm, const char* format, ...) {
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    runtimeError(vm, "%s", message);
+    vm->nativeFailed = true;  // the call returns false once the native does
+}
+
+/**
+ * @brief Determines if a value is "falsey" in Clox.
+ *
+ * In Clox, only `nil` and `false` are falsey. Everything else is truthy.
+ * @param value The value to check.
+ * @return bool True if the value is falsey, false otherwise.
+ */
+static bool isFalsey(Value value) {
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+/**
+ * @brief Converts the result of integer arithmetic to a Value.
+ *
+ * The operands are 32-bit, so the exact result always fits in 64 bits; it is
+ * promoted to a double when it does not fit an immediate integer.
+ * @param result The exact result.
+ * @return Value The result as an integer or double Value.
+ */
+static inline Value integerResult(int64_t result) {
+    if (result >= INT32_MIN && result <= INT32_MAX) {
+        return INT_VAL((int32_t)result);
+    }
+    return NUMBER_VAL((double)result);
+}
+
+/**
+ * @brief Concatenates two strings on top of the stack.
+ */
+static void concatenate(VM* vm) {
+    StringView b;
+    StringView a;
+    viewString(peek(vm, 0), &b);
+    viewString(peek(vm, 1), &a);
+
+    Value result;
+    int32_t length = a.length + b.length;
+    if (length < (int32_t)sizeof(a.buffer)) {
+        // short results never touch the heap
+        char chars[sizeof(a.buffer)];
+        memcpy(chars, a.chars, a.length);
+        memcpy(chars + a.length, b.chars, b.length);
+        result = copyStringValue(vm, chars, length);
+    } else {
+        char* chars = ALLOCATE(vm, char, length + 1);
+        memcpy(chars, a.chars, a.length);
+        memcpy(chars + a.length, b.chars, b.length);
+        chars[length] = '\0';
+        result = takeStringValue(vm, chars, length);
+    }
+
+    pop(vm);
+    pop(vm);
+    push(vm, result);
+}
+
+/**
+ * @brief Creates a list from the `count` values on top of the stack.
+ *
+ * The values are replaced by the new list.
+ * @param vm The virtual machine.
+ * @param count The number of elements.
+ */
+static void buildList(VM* vm, int32_t count) {
+    ObjectList* list = newList(vm);
+    push(vm, OBJECT_VAL(list));  // GC guard while the buffer is allocated
+
+    if (count > 0) {
+        list->items.values = ALLOCATE(vm, Value, count);
+        list->items.capacity = count;
+        memcpy(list->items.values, vm->stackTop - 1 - count,
+               sizeof(Value) * count);
+        list->items.count = count;
+    }
+
+    vm->stackTop -= count + 1;
+    push(vm, OBJECT_VAL(list));
 }
 
 /**
- * @brief Returns a value from the stack without popping it.
- * @param distance The distance from the top of the stack (0 is the top).
- * @return Value The value at the specified distance.
+ * @brief Creates a map from the `count` key-value pairs on top of the stack.
+ *
+ * The pairs are replaced by the new map.
+ * @param vm The virtual machine.
+ * @param count The number of key-value pairs.
+ * @return bool True on success, false if a key is nil.
  */
-static Value peek(int32_t distance) { return vm.stackTop[-1 - distance]; }
+static bool buildMap(VM* vm, int32_t count) {
+    ObjectMap* map = newMap(vm);
+    push(vm, OBJECT_VAL(map));  // GC guard while the entries are allocated
+
+    Value* pairs = vm->stackTop - 1 - count * 2;
+    for (int32_t i = 0; i < count; i++) {
+        if (IS_NIL(pairs[i * 2])) {
+            runtimeError(vm, "Map key cannot be nil.");
+            return false;
+        }
+        mapSet(vm, &map->table, pairs[i * 2], pairs[i * 2 + 1]);
+    }
 
-//-----------------------------------------------------------------------------
-//- Runtime Semantics
-//-----------------------------------------------------------------------------
+    vm->stackTop = pairs;
+    push(vm, OBJECT_VAL(map));
+    return true;
+}
 
 /**
- * @brief Reports a runtime error and prints a stack trace.
- * @param format A printf-style format string for the error message.
- * @param ... Arguments for the format string.
+ * @brief Validates an index into a list or Float64Array.
+ *
+ * Reports a runtime error if the index is not an integer within the bounds
+ * of the sequence.
+ *
+ * @param vm The virtual machine.
+ * @param index The index value.
+ * @param count The number of elements in the sequence.
+ * @param slot A pointer where the element position will be stored.
+ * @return bool True if the index is valid, false otherwise.
  */
-static void runtimeError(
-    const char* format,
-    ...) {  // variadic function -> varying number of arguments
-    va_list args;
-    va_start(args, format);
-    vfprintf(stderr, format, args);
-    va_end(args);
-    fputs("\n", stderr);
+static bool sequenceIndex(VM* vm, Value index, int32_t count, int32_t* slot) {
+    if (IS_INT(index)) {
+        *slot = AS_INT(index);
+        if (*slot < 0 || *slot >= count) {
+            runtimeError(vm, "Index out of range.");
+            return false;
+        }
+        return true;
+    }
 
-    // print a stack trace from the most recent call frame downwards
-    for (int32_t i = vm.frameCount - 1; i >= 0; i--) {
-        CallFrame* frame = &vm.frames[i];
-        ObjectFunction* function = frame->closure->function;
+    if (!IS_NUMBER(index)) {
+        runtimeError(vm, "Index must be a number.");
+        return false;
+    }
 
-        // -1 because the ip is sitting on the next instruction to be executed
-        size_t instruction = frame->ip - function->chunk.code - 1;
-        fprintf(stderr, "[line %d] in ", function->chunk.lines[instruction]);
-        if (function->name == NULL) {
-            fprintf(stderr, "script\n");
-        } else {
-            fprintf(stderr, "%s()\n", function->name->chars);
-        }
+    // the negated comparison also rejects NaN
+    double number = AS_NUMBER(index);
+    if (!(number >= 0 && number < count)) {
+        runtimeError(vm, "Index out of range.");
+        return false;
     }
 
-    resetStack();
+    *slot = (int32_t)number;
+    if (*slot != number) {
+        runtimeError(vm, "Index must be an integer.");
+        return false;
+    }
+    return true;
 }
 
 /**
- * @brief Determines if a value is "falsey" in Clox.
+ * @brief Reads the element of a list, map or Float64Array for the
+ * `receiver[index]` operator.
  *
- * In Clox, only `nil` and `false` are falsey. Everything else is truthy.
- * @param value The value to check.
- * @return bool True if the value is falsey, false otherwise.
+ * A key missing from a map reads as nil.
+ *
+ * @param vm The virtual machine.
+ * @param receiver The list, map or Float64Array being indexed.
+ * @param index The list index or map key.
+ * @param value A pointer where the element will be stored.
+ * @return bool True on success, false on a runtime error.
  */
-static bool isFalsey(Value value) {
-    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+static bool getIndex(VM* vm, Value receiver, Value index, Value* value) {
+    if (IS_LIST(receiver)) {
+        const ObjectList* list = AS_LIST(receiver);
+        int32_t slot;
+        if (!sequenceIndex(vm, index, list->items.count, &slot)) return false;
+        *value = list->items.values[slot];
+        return true;
+    }
+
+    if (IS_MAP(receiver)) {
+        if (!mapGet(&AS_MAP(receiver)->table, index, value)) *value = NIL_VAL;
+        return true;
+    }
+
+    if (IS_FLOAT64_ARRAY(receiver)) {
+        const ObjectFloat64Array* array = AS_FLOAT64_ARRAY(receiver);
+        int32_t slot;
+        if (!sequenceIndex(vm, index, array->count, &slot)) return false;
+        *value = NUMBER_VAL(array->values[slot]);
+        return true;
+    }
+
+    runtimeError(vm, "Only lists, maps and Float64Arrays can be indexed.");
+    return false;
 }
 
 /**
- * @brief Concatenates two strings on top of the stack.
+ * @brief Writes the element of a list, map or Float64Array for the
+ * `receiver[index] = value` operator.
+ *
+ * @param vm The virtual machine.
+ * @param receiver The list, map or Float64Array being indexed.
+ * @param index The list index or map key.
+ * @param value The value to store.
+ * @return bool True on success, false on a runtime error.
  */
-static void concatenate() {
-    const ObjectString* b = AS_STRING(peek(0));
-    const ObjectString* a = AS_STRING(peek(1));
+static bool setIndex(VM* vm, Value receiver, Value index, Value value) {
+    if (IS_LIST(receiver)) {
+        ObjectList* list = AS_LIST(receiver);
+        int32_t slot;
+        if (!sequenceIndex(vm, index, list->items.count, &slot)) return false;
+        list->items.values[slot] = value;
+        return true;
+    }
 
-    int32_t length = a->length + b->length;
-    char* chars = ALLOCATE(char, length + 1);
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
+    if (IS_MAP(receiver)) {
+        if (IS_NIL(index)) {
+            runtimeError(vm, "Map key cannot be nil.");
+            return false;
+        }
+        // receiver, key and value are still on the stack, so growing the
+        // map is GC safe
+        mapSet(vm, &AS_MAP(receiver)->table, index, value);
+        return true;
+    }
+
+    if (IS_FLOAT64_ARRAY(receiver)) {
+        ObjectFloat64Array* array = AS_FLOAT64_ARRAY(receiver);
+        int32_t slot;
+        if (!sequenceIndex(vm, index, array->count, &slot)) return false;
+        if (!IS_NUMBER(value)) {
+            runtimeError(vm, "Float64Array elements must be numbers.");
+            return false;
+        }
+        array->values[slot] = AS_NUMBER(value);
+        return true;
+    }
 
-    ObjectString* result = takeString(chars, length);
-    pop();
-    pop();
-    push(OBJECT_VAL(result));
+    runtimeError(vm, "Only lists, maps and Float64Arrays can be indexed.");
+    return false;
 }
 
 //-----------------------------------------------------------------------------
@@ -213,27 +1751,168 @@ static void concatenate() {
 
 /**
  * @brief Prepares a new CallFrame to execute a function's code.
+ * @param vm The virtual machine.
  * @param closure The closure being called.
  * @param argCount The number of arguments passed to the function.
  * @return bool True on success, false on error (e.g., stack overflow).
  */
-static bool call(ObjectClosure* closure, int32_t argCount) {
+static bool call(VM* vm, ObjectClosure* closure, int32_t argCount) {
     if (argCount != closure->function->arity) {
-        runtimeError("Expected %d arguments, but got %d.",
+        runtimeError(vm, "Expected %d arguments, but got %d.",
                      closure->function->arity, argCount);
         return false;
     }
 
-    if (vm.frameCount == FRAMES_MAX) {
-        runtimeError("Stack overflow.");
+    if (vm->frameCount == FRAMES_MAX) {
+        runtimeError(vm, "Stack overflow.");
+        return false;
+    }
+
+    // a function compiled lazily is compiled on its first call
+    if (closure->function->lazy != NULL &&
+        !compileLazyFunction(vm, closure->function)) {
+        runtimeError(vm, "Could not compile function '%s'.",
+                     closure->function->name->chars);
+        return false;
+    }
+
+    // the function's stack window starts where the arguments were pushed and
+    // holds as many values as its code ever has on the stack at once
+    Value* slots = vm->stackTop - argCount - 1;
+    int32_t needed = (int32_t)(slots - vm->stack) +
+                     closure->function->maxSlots + STACK_SCRATCH;
+    if (needed > STACK_MAX) {
+        runtimeError(vm, "Stack overflow.");
         return false;
     }
 
-    CallFrame* frame = &vm.frames[vm.frameCount++];
+    // a coroutine's stack grows on demand, the main stack is allocated whole
+    if (vm->coroutine != NULL) reserveCoroutineFrame(vm, needed);
+
+    CallFrame* frame = &vm->frames[vm->frameCount++];
     frame->closure = closure;
     frame->ip = closure->function->chunk.code;
-    // the function's stack window starts where the arguments were pushed
-    frame->slots = vm.stackTop - argCount - 1;
+    frame->slots = vm->stackTop - argCount - 1;
+    return true;
+}
+
+// How a native's parameter types are named in errors, by NativeType.
+static const char* const nativeTypeNames[] = {
+    [NATIVE_ANY] = "any value",
+    [NATIVE_NUMBER] = "a number",
+    [NATIVE_STRING] = "a string",
+    [NATIVE_LIST] = "a list",
+    [NATIVE_MAP] = "a map",
+    [NATIVE_FLOAT64_ARRAY] = "a Float64Array",
+    [NATIVE_CHANNEL] = "a channel",
+    [NATIVE_WORKER] = "a worker",
+    [NATIVE_COROUTINE] = "a coroutine",
+    [NATIVE_FOREIGN] = "a foreign object",
+};
+
+/**
+ * @brief Checks whether a value has the type a native requires.
+ * @param value The argument.
+ * @param type The type.
+ * @return bool True if it does.
+ */
+static inline bool isNativeType(Value value, NativeType type) {
+    switch (type) {
+        case NATIVE_ANY:
+            return true;
+        case NATIVE_NUMBER:
+            return IS_NUMBER(value);
+        case NATIVE_STRING:
+            return IS_STRING(value);
+        case NATIVE_LIST:
+            return IS_LIST(value);
+        case NATIVE_MAP:
+            return IS_MAP(value);
+        case NATIVE_FLOAT64_ARRAY:
+            return IS_FLOAT64_ARRAY(value);
+        case NATIVE_CHANNEL:
+            return IS_CHANNEL(value);
+        case NATIVE_WORKER:
+            return IS_WORKER(value);
+        case NATIVE_COROUTINE:
+            return IS_COROUTINE(value);
+        case NATIVE_FOREIGN:
+            return IS_FOREIGN(value);
+    }
+    return false;
+}
+
+/**
+ * @brief Calls a native function with the arguments on top of the stack.
+ *
+ * The arity and the declared parameter types are checked first. A fast
+ * native takes its arguments as C parameters, so it is called without
+ * building an array or going through `callValue`; a host native reads them
+ * through the VM.
+ *
+ * @param vm The virtual machine.
+ * @param native The native's spec.
+ * @param argCount The number of arguments.
+ * @return bool True on success, false on error.
+ */
+static inline bool callNative(VM* vm, const NativeSpec* native,
+                              int32_t argCount) {
+    if (native->arity != NATIVE_VARIADIC && argCount != native->arity) {
+        runtimeError(vm, "Expected %d arguments, but got %d.", native->arity,
+                     argCount);
+        return false;
+    }
+
+    Value* args = vm->stackTop - argCount;
+    int32_t typed = argCount < NATIVE_TYPES_MAX ? argCount : NATIVE_TYPES_MAX;
+    for (int32_t i = 0; i < typed; i++) {
+        if (!isNativeType(args[i], native->types[i])) {
+            runtimeError(vm, "Argument %d of %s() must be %s.", i + 1,
+                         native->name, nativeTypeNames[native->types[i]]);
+            return false;
+        }
+    }
+
+    Value result;
+    vm->runningNative = native;  // for the calls it makes back into Lox
+    if (native->host != NULL) {
+        // a host native cannot call back into Lox, so `args` stays put
+        vm->hostArgs = args;
+        vm->hostArgCount = argCount;
+        vm->hostResult = NIL_VAL;
+        native->host(vm, argCount);
+        vm->hostArgs = NULL;
+        result = vm->hostResult;
+    } else if (native->function != NULL) {
+        result = native->function(vm, argCount, args);
+    } else {
+        switch (argCount) {
+            case 0:
+                result = native->fast.call0(vm);
+                break;
+            case 1:
+                result = native->fast.call1(vm, args[0]);
+                break;
+            case 2:
+                result = native->fast.call2(vm, args[0], args[1]);
+                break;
+            default:
+                result = native->fast.call3(vm, args[0], args[1], args[2]);
+                break;
+        }
+    }
+
+    // the native reported an error, or a call it made back into Lox failed,
+    // and the error has reset the stack already
+    if (vm->nativeFailed) {
+        vm->nativeFailed = false;
+        return false;
+    }
+    // the stack may have moved during the call, so `args` is not used here
+    vm->stackTop -= argCount + 1;
+    // an I/O native may leave the stack waiting for its result
+    if (vm->waitingForIo) return waitForIo(vm);
+    push(vm, result);
     return true;
 }
 
@@ -242,106 +1921,109 @@ static bool call(ObjectClosure* closure, int32_t argCount) {
  *
  * Handles calls to functions, classes (constructors), bound methods, and
  * native functions.
+ * @param vm The virtual machine.
  * @param callee The value to call.
  * @param argCount The number of arguments.
  * @return bool True on success, false on error.
  */
-static bool callValue(Value callee, int32_t argCount) {
+static bool callValue(VM* vm, Value callee, int32_t argCount) {
     if (IS_OBJECT(callee)) {
         switch (OBJECT_TYPE(callee)) {
             case OBJECT_BOUND_METHOD: {
                 ObjectBoundMethod* bound = AS_BOUND_METHOD(callee);
                 // the receiver (`this`) is placed in slot 0 for the method call
-                vm.stackTop[-argCount - 1] = bound->receiver;
-                return call(bound->method, argCount);
+                vm->stackTop[-argCount - 1] = bound->receiver;
+                return call(vm, bound->method, argCount);
             }
             case OBJECT_CLASS: {
                 ObjectClass* klass = AS_CLASS(callee);
-                vm.stackTop[-argCount - 1] = OBJECT_VAL(newInstance(klass));
+                vm->stackTop[-argCount - 1] = OBJECT_VAL(newInstance(vm,
+                                                                     klass));
                 Value initializer;
-                if (tableGet(&klass->methods, vm.initString, &initializer)) {
-                    return call(AS_CLOSURE(initializer), argCount);
+                if (tableGet(klass->methods, vm->initString, &initializer)) {
+                    return call(vm, AS_CLOSURE(initializer), argCount);
                 } else if (argCount != 0) {
-                    runtimeError("expected 0 arguments, but got %d.", argCount);
+                    runtimeError(vm, "expected 0 arguments, but got %d.",
+                                 argCount);
+                    return false;
                 }
                 return true;
             }
             case OBJECT_CLOSURE:
-                return call(AS_CLOSURE(callee), argCount);
-            case OBJECT_NATIVE: {
-                NativeFunction native = AS_NATIVE(callee);
-                Value result = native(argCount, vm.stackTop - argCount);
-                vm.stackTop -= argCount + 1;
-                push(result);
-                return true;
-            }
+                return call(vm, AS_CLOSURE(callee), argCount);
+            case OBJECT_NATIVE:
+                return callNative(vm, AS_NATIVE(callee)->spec, argCount);
             default:
                 break;  // non-callable object type
         }
     }
-    runtimeError("Only functions and classes are callable.");
+    runtimeError(vm, "Only functions and classes are callable.");
     return false;
 }
 
 /**
  * @brief Binds a method to an instance, creating a bound method object.
+ * @param vm The virtual machine.
  * @param klass The class containing the method.
  * @param name The name of the method.
  * @return bool True on success, false if the method is not found.
  */
-static bool bindMethod(ObjectClass* klass, ObjectString* name) {
+static bool bindMethod(VM* vm, ObjectClass* klass, ObjectString* name) {
     Value method;
-    if (!tableGet(&klass->methods, name, &method)) {
-        runtimeError("Undefined property '%s'.", name->chars);
+    if (!tableGet(klass->methods, name, &method)) {
+        runtimeError(vm, "Undefined property '%s'.", name->chars);
         return false;
     }
 
-    ObjectBoundMethod* bound = newBoundMethod(peek(0), AS_CLOSURE(method));
-    pop();
-    push(OBJECT_VAL(bound));
+    ObjectBoundMethod* bound = newBoundMethod(vm, peek(vm, 0),
+                                              AS_CLOSURE(method));
+    pop(vm);
+    push(vm, OBJECT_VAL(bound));
     return true;
 }
 
 /**
  * @brief Invokes a method from a specific class (used for `super` calls).
+ * @param vm The virtual machine.
  * @param klass The class to find the method in.
  * @param name The method name.
  * @param argCount The number of arguments.
  * @return bool True on success, false on error.
  */
-static bool invokeFromClass(ObjectClass* klass, ObjectString* name,
+static bool invokeFromClass(VM* vm, ObjectClass* klass, ObjectString* name,
                             int32_t argCount) {
     Value method;
-    if (!tableGet(&klass->methods, name, &method)) {
-        runtimeError("Undefined property '%s'.", name->chars);
+    if (!tableGet(klass->methods, name, &method)) {
+        runtimeError(vm, "Undefined property '%s'.", name->chars);
         return false;
     }
-    return call(AS_CLOSURE(method), argCount);
+    return call(vm, AS_CLOSURE(method), argCount);
 }
 
 /**
  * @brief Invokes a method on an instance.
  *
  * Looks for the method on the instance's class and calls it.
+ * @param vm The virtual machine.
  * @param name The name of the method to invoke.
  * @param argCount The number of arguments.
  * @return bool True on success, false on error.
  */
-static bool invoke(ObjectString* name, int32_t argCount) {
-    Value receiver = peek(argCount);
+static bool invoke(VM* vm, ObjectString* name, int32_t argCount) {
+    Value receiver = peek(vm, argCount);
     if (!IS_INSTANCE(receiver)) {
-        runtimeError("Only instances have methods.");
+        runtimeError(vm, "Only instances have methods.");
         return false;
     }
     ObjectInstance* instance = AS_INSTANCE(receiver);
 
     Value value;
     if (tableGet(&instance->fields, name, &value)) {
-        vm.stackTop[-argCount - 1] = value;
-        return callValue(value, argCount);
+        vm->stackTop[-argCount - 1] = value;
+        return callValue(vm, value, argCount);
     }
 
-    return invokeFromClass(instance->klass, name, argCount);
+    return invokeFromClass(vm, instance->klass, name, argCount);
 }
 
 //-----------------------------------------------------------------------------
@@ -352,13 +2034,15 @@ static bool invoke(ObjectString* name, int32_t argCount) {
  * @brief Captures a local variable as an upvalue.
  *
  * If an upvalue for this local already exists, it is reused. Otherwise, a
- * new one is created and added to the VM's list of open upvalues.
+ * new one is created and added to the VM's list of open upvalues, which only
+ * holds upvalues into the running stack.
+ * @param vm The virtual machine.
  * @param local A pointer to the local variable on the stack.
  * @return ObjectUpvalue* The created or reused upvalue.
  */
-static ObjectUpvalue* captureUpvalue(Value* local) {
+static ObjectUpvalue* captureUpvalue(VM* vm, Value* local) {
     ObjectUpvalue* prevUpvalue = NULL;
-    ObjectUpvalue* upvalue = vm.openUpvalues;
+    ObjectUpvalue* upvalue = vm->openUpvalues;
 
     // search through all upvalues whose local slot is above the one we're
     // looking for
@@ -372,11 +2056,12 @@ static ObjectUpvalue* captureUpvalue(Value* local) {
         return upvalue;
     }
 
-    ObjectUpvalue* createdUpvalue = newUpvalue(local);
+    ObjectUpvalue* createdUpvalue = newUpvalue(vm, local);
     createdUpvalue->next = upvalue;
+    createdUpvalue->coroutine = vm->coroutine;
 
     if (prevUpvalue == NULL) {
-        vm.openUpvalues = createdUpvalue;
+        vm->openUpvalues = createdUpvalue;
     } else {
         prevUpvalue->next = createdUpvalue;
     }
@@ -390,29 +2075,253 @@ static ObjectUpvalue* captureUpvalue(Value* local) {
  * When a local variable goes out of scope, any upvalue pointing to it must
  * be "closed" by copying the variable's value from the stack into the
  * upvalue object itself.
+ * @param vm The virtual machine.
  * @param last A pointer to the stack slot at the boundary of the scope being
  * exited.
  */
-static void closeUpvalues(const Value* last) {
-    while (vm.openUpvalues != NULL && vm.openUpvalues->location >= last) {
-        ObjectUpvalue* upvalue = vm.openUpvalues;
+static void closeUpvalues(VM* vm, const Value* last) {
+    while (vm->openUpvalues != NULL && vm->openUpvalues->location >= last) {
+        ObjectUpvalue* upvalue = vm->openUpvalues;
         upvalue->closed = *upvalue->location;
         upvalue->location = &upvalue->closed;
-        vm.openUpvalues = upvalue->next;
+        upvalue->coroutine = NULL;
+        vm->openUpvalues = upvalue->next;
     }
 }
 
 /**
  * @brief Defines a method on a class.
  *
- * The class and method are expected to be on top of the stack.
+ * The class and method are expected to be on top of the stack. A class that
+ * still shares its superclass's method table copies it first, so the
+ * superclass is never modified.
+ * @param vm The virtual machine.
  * @param name The name of the method.
+ * @return bool True on success, false if loaded bytecode put something else
+ * than a class and a closure on the stack.
+ */
+static bool defineMethod(VM* vm, ObjectString* name) {
+    Value method = peek(vm, 0);
+    if (!IS_CLASS(peek(vm, 1)) || !IS_CLOSURE(method)) {
+        runtimeError(vm, "Can only define functions as methods of classes.");
+        return false;
+    }
+
+    ObjectClass* klass = AS_CLASS(peek(vm, 1));
+    if (klass->methods != &klass->ownMethods) {
+        tableAddAll(vm, klass->methods, &klass->ownMethods);
+        klass->methods = &klass->ownMethods;
+    }
+    tableSet(vm, klass->methods, name, method);
+    pop(vm);  // pop the method closure
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//- Coroutines
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Makes the VM run on another stack.
+ *
+ * The registers of the running stack are saved into its segment and those of
+ * the other stack are loaded.
+ * @param vm The virtual machine.
+ * @param coroutine The coroutine to run, or NULL for the main stack.
+ */
+static void switchStack(VM* vm, ObjectCoroutine* coroutine) {
+    StackSegment* from = vm->coroutine != NULL ? &vm->coroutine->segment
+                                               : &vm->mainStack;
+    from->stackTop = vm->stackTop;
+    from->frameCount = vm->frameCount;
+    from->openUpvalues = vm->openUpvalues;
+
+    const StackSegment* to = coroutine != NULL ? &coroutine->segment
+                                               : &vm->mainStack;
+    vm->stack = to->stack;
+    vm->stackTop = to->stackTop;
+    vm->frames = to->frames;
+    vm->frameCount = to->frameCount;
+    vm->openUpvalues = to->openUpvalues;
+    vm->coroutine = coroutine;
+}
+
+/**
+ * @brief Makes sure the running coroutine's stack has room for one more call
+ * frame.
+ *
+ * When the values are moved to a larger array, the frames and the open
+ * upvalues pointing into them move along.
+ * @param vm The virtual machine.
+ * @param needed The number of values the stack must hold with the new frame,
+ * at most `STACK_MAX`.
+ */
+static void reserveCoroutineFrame(VM* vm, int32_t needed) {
+    StackSegment* segment = &vm->coroutine->segment;
+    if (vm->frameCount == segment->frameCapacity) {
+        int32_t capacity = segment->frameCapacity * 2;
+        segment->frames = GROW_ARRAY(vm, CallFrame, segment->frames,
+                                     segment->frameCapacity, capacity);
+        segment->frameCapacity = capacity;
+        vm->frames = segment->frames;
+    }
+
+    if (needed <= segment->stackCapacity) return;
+
+    int32_t capacity = segment->stackCapacity;
+    while (capacity < needed) capacity *= 2;
+    Value* stack = ALLOCATE(vm, Value, capacity);
+    Value* old = vm->stack;
+    memcpy(stack, old, sizeof(Value) * (vm->stackTop - old));
+
+    for (int32_t i = 0; i < vm->frameCount; i++) {
+        vm->frames[i].slots = stack + (vm->frames[i].slots - old);
+    }
+    for (ObjectUpvalue* upvalue = vm->openUpvalues; upvalue != NULL;
+         upvalue = upvalue->next) {
+        upvalue->location = stack + (upvalue->location - old);
+    }
+    vm->stackTop = stack + (vm->stackTop - old);
+    vm->stack = stack;
+
+    FREE_ARRAY(vm, Value, old, segment->stackCapacity);
+    segment->stack = stack;
+    segment->stackCapacity = capacity;
+}
+
+/**
+ * @brief Switches from a coroutine back to its resumer.
+ *
+ * A coroutine that is done no longer needs its stack, which is freed at once
+ * rather than with the coroutine; upvalues a runtime error left open into it
+ * are closed first.
+ * @param vm The virtual machine.
+ * @param state `COROUTINE_SUSPENDED` if the coroutine yielded,
+ * `COROUTINE_DONE` if it returned or failed.
+ */
+static void leaveCoroutine(VM* vm, CoroutineState state) {
+    ObjectCoroutine* coroutine = vm->coroutine;
+    coroutine->state = state;
+    if (state == COROUTINE_DONE) closeUpvalues(vm, vm->stack);
+    switchStack(vm, coroutine->caller);
+    coroutine->caller = NULL;
+    if (state == COROUTINE_DONE) freeStackSegment(vm, &coroutine->segment);
+}
+
+/**
+ * @brief Resumes a coroutine with the coroutine and a value on top of the
+ * stack.
+ *
+ * The value becomes the argument of the coroutine's function on the first
+ * resume, if it takes one, and the result of the `yield` it is stopped at
+ * afterwards.
+ * @param vm The virtual machine.
+ * @return bool True if the coroutine is running, false on error.
+ */
+static bool resume(VM* vm) {
+    if (!IS_COROUTINE(peek(vm, 1))) {
+        runtimeError(vm, "Can only resume coroutines.");
+        return false;
+    }
+    ObjectCoroutine* coroutine = AS_COROUTINE(peek(vm, 1));
+    if (coroutine->state == COROUTINE_RUNNING) {
+        runtimeError(vm, "Can't resume a running coroutine.");
+        return false;
+    }
+    if (coroutine->state == COROUTINE_DONE) {
+        runtimeError(vm, "Can't resume a finished coroutine.");
+        return false;
+    }
+    if (coroutine->state == COROUTINE_WAITING) {
+        runtimeError(vm, "Can't resume a coroutine waiting for I/O.");
+        return false;
+    }
+
+    // the value is pushed onto the coroutine's stack before anything can
+    // allocate, and the coroutine is then reachable as the running one
+    Value value = pop(vm);
+    pop(vm);
+    coroutine->caller = vm->coroutine;
+    coroutine->state = COROUTINE_RUNNING;
+    bool started = coroutine->segment.frameCount > 0;
+    switchStack(vm, coroutine);
+    if (started) {
+        push(vm, value);
+        return true;
+    }
+
+    ObjectClosure* closure = coroutine->closure;
+    if (closure->function->arity == 1) push(vm, value);
+    return call(vm, closure, closure->function->arity);
+}
+
+/**
+ * @brief Switches to the next stack the event loop can resume, waiting for
+ * I/O to complete if none can yet.
+ *
+ * A task that has not started is called; any other stack gets the result of
+ * the native it waited in.
+ * @param vm The virtual machine.
+ * @return bool True if a stack is running, false on error.
+ */
+static bool resumeNextWaiter(VM* vm) {
+    ObjectCoroutine* waiter;
+    Value value;
+    if (!nextIoEvent(vm, &waiter, &value)) {
+        runtimeError(vm, "Every stack is waiting, and nothing can wake one.");
+        return false;
+    }
+
+    switchStack(vm, waiter);
+    if (waiter == NULL) {
+        push(vm, value);
+        return true;
+    }
+    waiter->state = COROUTINE_RUNNING;
+    if (waiter->segment.frameCount == 0) return call(vm, waiter->closure, 0);
+    push(vm, value);
+    return true;
+}
+
+/**
+ * @brief Makes the running stack wait for the event loop and switches to
+ * another one.
+ *
+ * Called once an I/O native has set `waitingForIo`, with the native and its
+ * arguments popped.
+ * @param vm The virtual machine.
+ * @return bool True if a stack is running, false on error.
+ */
+static bool waitForIo(VM* vm) {
+    vm->waitingForIo = false;
+    // without a frame to return to, the result would have nowhere to go
+    if (vm->frameCount == 0) {
+        runtimeError(vm, "Can't wait for I/O outside of a function.");
+        return false;
+    }
+    // the native's C frame can't be left waiting while another stack runs
+    if (vm->nativeCall != NULL) {
+        runtimeError(vm, "Can't wait for I/O in a call from a native.");
+        return false;
+    }
+    if (vm->coroutine != NULL) vm->coroutine->state = COROUTINE_WAITING;
+    return resumeNextWaiter(vm);
+}
+
+/**
+ * @brief Ends the running task, whose function has returned, and switches to
+ * the next stack the event loop can resume.
+ *
+ * The task's stack is freed only once the VM has left it.
+ * @param vm The virtual machine.
+ * @return bool True if a stack is running, false on error.
  */
-static void defineMethod(ObjectString* name) {
-    Value method = peek(0);
-    ObjectClass* klass = AS_CLASS(peek(1));
-    tableSet(&klass->methods, name, method);
-    pop();  // pop the method closure
+static bool finishTask(VM* vm) {
+    ObjectCoroutine* task = vm->coroutine;
+    task->state = COROUTINE_DONE;
+    bool resumed = resumeNextWaiter(vm);
+    freeStackSegment(vm, &task->segment);
+    return resumed;
 }
 
 //-----------------------------------------------------------------------------
@@ -424,10 +2333,11 @@ static void defineMethod(ObjectString* name) {
  *
  * This function is the heart of the interpreter. It fetches, decodes, and
  * executes bytecode instructions one by one until the program terminates.
+ * @param vm The virtual machine.
  * @return InterpretResult The result of the execution.
  */
-static InterpretResult run() {
-    CallFrame* frame = &vm.frames[vm.frameCount - 1];
+static InterpretResult run(VM* vm) {
+    CallFrame* frame = &vm->frames[vm->frameCount - 1];
 
     // Macros for reading from the bytecode stream.
 #define READ_BYTE() (*frame->ip++)
@@ -440,19 +2350,19 @@ static InterpretResult run() {
     // Macro for binary numeric operations.
 #define BINARY_OP(valueType, op)                          \
     do {                                                  \
-        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-            runtimeError("Operands must be numbers.");    \
+        if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) { \
+            runtimeError(vm, "Operands must be numbers.");    \
             return INTERPRET_RUNTIME_ERROR;               \
         }                                                 \
-        double b = AS_NUMBER(pop());                      \
-        double a = AS_NUMBER(pop());                      \
-        push(valueType(a op b));                          \
+        double b = AS_NUMBER(pop(vm));                      \
+        double a = AS_NUMBER(pop(vm));                      \
+        push(vm, valueType(a op b));                          \
     } while (false)
 
     for (;;) {
 #ifdef DEBUG_TRACE_EXECUTION
         printf("            ");
-        for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
+        for (Value* slot = vm->stack; slot < vm->stackTop; slot++) {
             printf("[ ");
             printValue(*slot);
             printf(" ]");
@@ -466,70 +2376,84 @@ static InterpretResult run() {
         switch (instruction = READ_BYTE()) {
             case OP_CONSTANT: {
                 Value constant = READ_CONSTANT();
-                push(constant);
+                push(vm, constant);
                 break;
             }
             case OP_NIL: {
-                push(NIL_VAL);
+                push(vm, NIL_VAL);
                 break;
             }
             case OP_TRUE: {
-                push(BOOL_VAL(true));
+                push(vm, BOOL_VAL(true));
                 break;
             }
             case OP_FALSE: {
-                push(BOOL_VAL(false));
+                push(vm, BOOL_VAL(false));
                 break;
             }
             case OP_POP: {
-                pop();
+                pop(vm);
                 break;
             }
             case OP_GET_LOCAL: {
                 uint8_t slot = READ_BYTE();
-                push(frame->slots[slot]);
+                push(vm, frame->slots[slot]);
                 break;
             }
             case OP_GET_UPVALUE: {
                 uint8_t slot = READ_BYTE();
-                push(*frame->closure->upvalues[slot]->location);
+                push(vm, *frame->closure->upvalues[slot]->location);
                 break;
             }
             case OP_GET_PROPERTY: {
-                if (!IS_INSTANCE(peek(0))) {
-                    runtimeError("Only instances have properties.");
+                if (!IS_INSTANCE(peek(vm, 0))) {
+                    runtimeError(vm, "Only instances have properties.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                ObjectInstance* instance = AS_INSTANCE(peek(0));
+                ObjectInstance* instance = AS_INSTANCE(peek(vm, 0));
                 ObjectString* name = READ_STRING();
 
                 Value value;
                 if (tableGet(&instance->fields, name, &value)) {
-                    pop();  // instance
-                    push(value);
+                    pop(vm);  // instance
+                    push(vm, value);
                     break;
                 }
 
-                if (!bindMethod(instance->klass, name)) {
+                if (!bindMethod(vm, instance->klass, name)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case OP_GET_INDEX: {
+                Value value;
+                if (!getIndex(vm, peek(vm, 1), peek(vm, 0), &value)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
+                pop(vm);  // index
+                pop(vm);  // receiver
+                push(vm, value);
                 break;
             }
             case OP_GET_GLOBAL: {
                 ObjectString* name = READ_STRING();
                 Value value;
-                if (!tableGet(&vm.globals, name, &value)) {
-                    runtimeError("Undefined variable '%s'.", name->chars);
+                if (!tableGet(&vm->globals, name, &value)) {
+                    runtimeError(vm, "Undefined variable '%s'.", name->chars);
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                push(value);
+                push(vm, value);
                 break;
             }
             case OP_GET_SUPER: {
                 ObjectString* name = READ_STRING();
-                ObjectClass* superclass = AS_CLASS(pop());
-                if (!bindMethod(superclass, name)) {
+                if (!IS_CLASS(peek(vm, 0))) {
+                    runtimeError(vm, "Superclass must be a class.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                ObjectClass* superclass = AS_CLASS(pop(vm));
+                if (!bindMethod(vm, superclass, name)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 break;
@@ -538,78 +2462,122 @@ static InterpretResult run() {
                 // get the name of the variable from the constant table
                 ObjectString* name = READ_STRING();
                 // store it in the hash table with the name as the key
-                tableSet(&vm.globals, name, peek(0));
+                tableSet(vm, &vm->globals, name, peek(vm, 0));
                 // remove the value from the stack
-                pop();
+                pop(vm);
                 break;
             }
             case OP_SET_LOCAL: {
                 uint8_t slot = READ_BYTE();
-                frame->slots[slot] = peek(0);
+                frame->slots[slot] = peek(vm, 0);
                 break;
             }
             case OP_SET_UPVALUE: {
                 uint8_t slot = READ_BYTE();
-                *frame->closure->upvalues[slot]->location = peek(0);
+                *frame->closure->upvalues[slot]->location = peek(vm, 0);
                 break;
             }
             case OP_SET_PROPERTY: {
-                if (!IS_INSTANCE(peek(1))) {
-                    runtimeError("Only instances have fields.");
+                if (!IS_INSTANCE(peek(vm, 1))) {
+                    runtimeError(vm, "Only instances have fields.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                ObjectInstance* instance = AS_INSTANCE(peek(1));
-                tableSet(&instance->fields, READ_STRING(), peek(0));
+                ObjectInstance* instance = AS_INSTANCE(peek(vm, 1));
+                tableSet(vm, &instance->fields, READ_STRING(), peek(vm, 0));
+
+                Value value = pop(vm);  // remove value
+                pop(vm);                // remove instance
+                push(vm, value);        // add value back
+                break;
+            }
+            case OP_SET_INDEX: {
+                if (!setIndex(vm, peek(vm, 2), peek(vm, 1), peek(vm, 0))) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
 
-                Value value = pop();  // remove value
-                pop();                // remove instance
-                push(value);          // add value back
+                Value value = pop(vm);  // remove value
+                pop(vm);                // remove index
+                pop(vm);                // remove receiver
+                push(vm, value);        // add value back
                 break;
             }
             case OP_SET_GLOBAL: {
                 ObjectString* name = READ_STRING();
-                if (tableSet(&vm.globals, name, peek(0))) {
-                    tableDelete(&vm.globals, name);
-                    runtimeError("Undefined variable '%s'.", name->chars);
+                if (tableSet(vm, &vm->globals, name, peek(vm, 0))) {
+                    tableDelete(vm, &vm->globals, name);
+                    runtimeError(vm, "Undefined variable '%s'.", name->chars);
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 break;
             }
             case OP_EQUAL: {
-                Value b = pop();
-                Value a = pop();
-                push(BOOL_VAL(valuesEqual(a, b)));
+                Value b = pop(vm);
+                Value a = pop(vm);
+                push(vm, BOOL_VAL(valuesEqual(a, b)));
                 break;
             }
             case OP_GREATER: {
+                if (IS_INT(peek(vm, 0)) && IS_INT(peek(vm, 1))) {
+                    int32_t b = AS_INT(pop(vm));
+                    int32_t a = AS_INT(pop(vm));
+                    push(vm, BOOL_VAL(a > b));
+                    break;
+                }
                 BINARY_OP(BOOL_VAL, >);
                 break;
             }
             case OP_LESS: {
+                if (IS_INT(peek(vm, 0)) && IS_INT(peek(vm, 1))) {
+                    int32_t b = AS_INT(pop(vm));
+                    int32_t a = AS_INT(pop(vm));
+                    push(vm, BOOL_VAL(a < b));
+                    break;
+                }
                 BINARY_OP(BOOL_VAL, <);
                 break;
             }
             case OP_ADD: {
-                if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-                    concatenate();
-                } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-                    // double b = AS_NUMBER(pop());
-                    // double a = AS_NUMBER(pop());
-                    // push(NUMBER_VAL(a + b));
+                if (IS_INT(peek(vm, 0)) && IS_INT(peek(vm, 1))) {
+                    int64_t b = AS_INT(pop(vm));
+                    int64_t a = AS_INT(pop(vm));
+                    push(vm, integerResult(a + b));
+                } else if (IS_STRING(peek(vm, 0)) && IS_STRING(peek(vm, 1))) {
+                    concatenate(vm);
+                } else if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 1))) {
+                    // double b = AS_NUMBER(pop(vm));
+                    // double a = AS_NUMBER(pop(vm));
+                    // push(vm, NUMBER_VAL(a + b));
                     BINARY_OP(NUMBER_VAL, +);
                 } else {
                     runtimeError(
-                        "Operands must be two numbers or two strings.");
+                        vm, "Operands must be two numbers or two strings.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 break;
             }
             case OP_SUBTRACT: {
+                if (IS_INT(peek(vm, 0)) && IS_INT(peek(vm, 1))) {
+                    int64_t b = AS_INT(pop(vm));
+                    int64_t a = AS_INT(pop(vm));
+                    push(vm, integerResult(a - b));
+                    break;
+                }
                 BINARY_OP(NUMBER_VAL, -);
                 break;
             }
             case OP_MULTIPLY: {
+                if (IS_INT(peek(vm, 0)) && IS_INT(peek(vm, 1))) {
+                    int64_t b = AS_INT(pop(vm));
+                    int64_t a = AS_INT(pop(vm));
+                    // 0 * -n is -0, which only a double can hold
+                    if (a * b == 0 && (a < 0 || b < 0)) {
+                        push(vm, NUMBER_VAL(-0.0));
+                    } else {
+                        push(vm, integerResult(a * b));
+                    }
+                    break;
+                }
                 BINARY_OP(NUMBER_VAL, *);
                 break;
             }
@@ -618,20 +2586,26 @@ static InterpretResult run() {
                 break;
             }
             case OP_NOT: {
-                push(BOOL_VAL(isFalsey(pop())));
+                push(vm, BOOL_VAL(isFalsey(pop(vm))));
                 break;
             }
             case OP_NEGATE: {
-                if (!IS_NUMBER(peek(0))) {
-                    runtimeError("Operand must be a number.");
+                if (!IS_NUMBER(peek(vm, 0))) {
+                    runtimeError(vm, "Operand must be a number.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                push(NUMBER_VAL(-AS_NUMBER(pop())));
+                // -0 and -INT32_MIN are not integers
+                if (IS_INT(peek(vm, 0)) && AS_INT(peek(vm, 0)) != 0 &&
+                    AS_INT(peek(vm, 0)) != INT32_MIN) {
+                    push(vm, INT_VAL(-AS_INT(pop(vm))));
+                    break;
+                }
+                push(vm, NUMBER_VAL(-AS_NUMBER(pop(vm))));
                 break;
             }
             case OP_PRINT: {
-                printValue(pop());
-                printf("\n");
+                writeValue(&vm->output, pop(vm));
+                endOutputLine(&vm->output);
                 break;
             }
             case OP_JUMP: {
@@ -641,7 +2615,7 @@ static InterpretResult run() {
             }
             case OP_JUMP_IF_FALSE: {
                 uint16_t offset = READ_SHORT();
-                if (isFalsey(peek(0))) frame->ip += offset;
+                if (isFalsey(peek(vm, 0))) frame->ip += offset;
                 break;
             }
             case OP_LOOP: {
@@ -652,42 +2626,51 @@ static InterpretResult run() {
             case OP_CALL: {
                 int32_t argCount = READ_BYTE();
 
-                // function identifier is 'argCount' slots away
-                if (!callValue(peek(argCount), argCount)) {
+                // function identifier is 'argCount' slots away; natives
+                // are the most common callee after closures, and skip the
+                // dispatch in callValue
+                Value callee = peek(vm, argCount);
+                if (!(IS_NATIVE(callee)
+                          ? callNative(vm, AS_NATIVE(callee)->spec, argCount)
+                          : callValue(vm, callee, argCount))) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                frame = &vm.frames[vm.frameCount - 1];
+                frame = &vm->frames[vm->frameCount - 1];
                 break;
             }
             case OP_INVOKE: {
                 ObjectString* method = READ_STRING();
                 int32_t argCount = READ_BYTE();
-                if (!invoke(method, argCount)) {
+                if (!invoke(vm, method, argCount)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                frame = &vm.frames[vm.frameCount - 1];
+                frame = &vm->frames[vm->frameCount - 1];
                 break;
             }
             case OP_SUPER_INVOKE: {
                 ObjectString* method = READ_STRING();
                 int32_t argCount = READ_BYTE();
-                ObjectClass* superclass = AS_CLASS(pop());
-                if (!invokeFromClass(superclass, method, argCount)) {
+                if (!IS_CLASS(peek(vm, 0))) {
+                    runtimeError(vm, "Superclass must be a class.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                ObjectClass* superclass = AS_CLASS(pop(vm));
+                if (!invokeFromClass(vm, superclass, method, argCount)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                frame = &vm.frames[vm.frameCount - 1];
+                frame = &vm->frames[vm->frameCount - 1];
                 break;
             }
             case OP_CLOSURE: {
                 ObjectFunction* function = AS_FUNCTION(READ_CONSTANT());
-                ObjectClosure* closure = newClosure(function);
-                push(OBJECT_VAL(closure));
+                ObjectClosure* closure = newClosure(vm, function);
+                push(vm, OBJECT_VAL(closure));
                 for (int32_t i = 0; i < closure->upvalueCount; i++) {
                     uint8_t isLocal = READ_BYTE();
                     uint8_t index = READ_BYTE();
                     if (isLocal) {
                         closure->upvalues[i] =
-                            captureUpvalue(frame->slots + index);
+                            captureUpvalue(vm, frame->slots + index);
                     } else {
                         closure->upvalues[i] = frame->closure->upvalues[index];
                     }
@@ -695,45 +2678,103 @@ static InterpretResult run() {
                 break;
             }
             case OP_CLOSE_UPVALUE: {
-                closeUpvalues(vm.stackTop - 1);
-                pop();
+                closeUpvalues(vm, vm->stackTop - 1);
+                pop(vm);
                 break;
             }
             case OP_RETURN: {
-                Value result = pop();
-
-                closeUpvalues(frame->slots);
-
-                vm.frameCount--;
-                if (vm.frameCount == 0) {  // check if the whole script is done
-                    pop();                 // pop the implicit script function
+                Value result = pop(vm);
+
+                closeUpvalues(vm, frame->slots);
+
+                vm->frameCount--;
+                vm->stackTop = frame->slots;
+                // a coroutine's function returns to whoever resumed it, and a
+                // task's result is dropped as the event loop moves on
+                if (vm->frameCount == 0 && vm->coroutine != NULL) {
+                    if (vm->coroutine->task) {
+                        if (!finishTask(vm)) return INTERPRET_RUNTIME_ERROR;
+                        frame = &vm->frames[vm->frameCount - 1];
+                        break;
+                    }
+                    leaveCoroutine(vm, COROUTINE_DONE);
+                }
+                push(vm, result);
+                // the outermost call, or one from a native, has returned
+                if (vm->frameCount == vm->baseFrame &&
+                    vm->coroutine == vm->baseStack) {
                     return INTERPRET_OK;
                 }
 
-                vm.stackTop = frame->slots;
-                push(result);
-
-                frame = &vm.frames[vm.frameCount - 1];
+                frame = &vm->frames[vm->frameCount - 1];
+                break;
+            }
+            case OP_YIELD: {
+                if (vm->coroutine == NULL) {
+                    runtimeError(vm, "Can't yield outside of a coroutine.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                // leaving the stack a native runs on would strand its C frame
+                if (vm->coroutine == vm->baseStack) {
+                    runtimeError(vm,
+                                 "Can't yield across a call from a native.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                Value value = pop(vm);
+                if (vm->coroutine->task) {
+                    // a task yields its turn to the other stacks, and nothing
+                    // receives the value
+                    queueTask(vm, vm->coroutine);
+                    if (!waitForIo(vm)) return INTERPRET_RUNTIME_ERROR;
+                } else {
+                    leaveCoroutine(vm, COROUTINE_SUSPENDED);
+                    push(vm, value);  // the result of the `resume`
+                }
+                frame = &vm->frames[vm->frameCount - 1];
+                break;
+            }
+            case OP_RESUME: {
+                if (!resume(vm)) return INTERPRET_RUNTIME_ERROR;
+                frame = &vm->frames[vm->frameCount - 1];
                 break;
             }
             case OP_CLASS: {
-                push(OBJECT_VAL(newClass(READ_STRING())));
+                push(vm, OBJECT_VAL(newClass(vm, READ_STRING())));
                 break;
             }
             case OP_INHERIT: {
-                Value superclass = peek(1);
+                Value superclass = peek(vm, 1);
                 if (!IS_CLASS(superclass)) {
-                    runtimeError("Superclass must be a class.");
+                    runtimeError(vm, "Superclass must be a class.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if (!IS_CLASS(peek(vm, 0))) {
+                    runtimeError(vm, "Only classes can inherit.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                ObjectClass* subclass = AS_CLASS(peek(0));
-                tableAddAll(&AS_CLASS(superclass)->methods, &subclass->methods);
-                pop();
+                // share the superclass's methods until the subclass defines
+                // one of its own (see defineMethod)
+                ObjectClass* subclass = AS_CLASS(peek(vm, 0));
+                subclass->superclass = AS_CLASS(superclass);
+                subclass->methods = AS_CLASS(superclass)->methods;
+                pop(vm);
                 break;
             }
             case OP_METHOD: {
-                defineMethod(READ_STRING());
+                if (!defineMethod(vm, READ_STRING())) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case OP_BUILD_LIST: {
+                buildList(vm, READ_BYTE());
+                break;
+            }
+            case OP_BUILD_MAP: {
+                if (!buildMap(vm, READ_BYTE())) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
                 break;
             }
         }
@@ -755,20 +2796,120 @@ static InterpretResult run() {
  * This function orchestrates the entire process: compiling the source code
  * into bytecode and then executing that bytecode in the VM.
  *
- * @param source The Clox source code to interpret.
+ * @param vm The virtual machine.
+ * @param source The Clox source code to interpret, which does not need to be
+ * NUL-terminated.
+ * @param length The length of the source in bytes.
  * @return InterpretResult The result of the interpretation.
  */
-InterpretResult interpret(const char* source) {
-    ObjectFunction* function = compile(source);
+InterpretResult interpret(VM* vm, const char* source, size_t length) {
+    ObjectFunction* function = compile(vm, source, length);
     if (function == NULL) return INTERPRET_COMPILE_ERROR;
 
+    return interpretFunction(vm, function);
+}
+
+/**
+ * @brief Runs an already compiled top-level function.
+ *
+ * This is how scripts loaded from bytecode files are executed; `interpret`
+ * calls it after compiling.
+ *
+ * @param vm The virtual machine.
+ * @param function The top-level function, as returned by `compile` or
+ * `loadBytecode`.
+ * @return InterpretResult The result of the execution.
+ */
+InterpretResult interpretFunction(VM* vm, ObjectFunction* function) {
     // the compiler returns a function, which needs to be wrapped in a closure
     // before it can be called
-    push(OBJECT_VAL(function));
-    ObjectClosure* closure = newClosure(function);
-    pop();
-    push(OBJECT_VAL(closure));
-    callValue(OBJECT_VAL(closure), 0);
+    push(vm, OBJECT_VAL(function));
+    ObjectClosure* closure = newClosure(vm, function);
+    pop(vm);
+    push(vm, OBJECT_VAL(closure));
+
+    InterpretResult result = interpretCall(vm, 0);
+    if (result == INTERPRET_OK) pop(vm);  // the script returns nil
+    return result;
+}
+
+/**
+ * @brief Calls the function on the stack below its arguments and runs it to
+ * completion.
+ *
+ * Must not be called while the VM is already running code.
+ *
+ * @param vm The virtual machine.
+ * @param argCount The number of arguments on top of the stack.
+ * @return InterpretResult The result of the execution. On success, the
+ * function and its arguments are replaced by the value it returned.
+ */
+InterpretResult interpretCall(VM* vm, int32_t argCount) {
+    InterpretResult result = INTERPRET_RUNTIME_ERROR;
+    if (callValue(vm, peek(vm, argCount), argCount)) {
+        // natives and classes without an initializer return at once
+        result = vm->frameCount > 0 ? run(vm) : INTERPRET_OK;
+    }
+    flushOutput(&vm->output);
+    return result;
+}
 
-    return run();
+/**
+ * @brief Calls a value from a native function and runs it to completion.
+ *
+ * The call runs on the native's stack, above its arguments, in a nested
+ * `run` that returns when the called function does. The function can resume
+ * coroutines and call natives that call back in turn, but can't yield from
+ * the native's stack or wait for I/O.
+ *
+ * The stack may move during the call, so the native must not read its
+ * `args` afterwards; values read from them before stay valid. Values the
+ * native creates must be pushed to survive the call.
+ *
+ * @param vm The virtual machine.
+ * @param callee The function, class or bound method to call.
+ * @param argCount The number of arguments.
+ * @param args The arguments, which must not point into the stack.
+ * @param result A pointer where the value it returned will be stored.
+ * @return bool True on success. False once a runtime error has been reported
+ * and the stack reset: the native must then return at once, without popping
+ * anything, and what it returns is ignored.
+ */
+bool callFromNative(VM* vm, Value callee, int32_t argCount, const Value* args,
+                    Value* result) {
+    // the callee and its arguments get a window of their own, as in `call`
+    int32_t needed =
+        (int32_t)(vm->stackTop - vm->stack) + argCount + 1 + STACK_SCRATCH;
+    if (needed > STACK_MAX) {
+        runtimeError(vm, "Stack overflow.");
+        vm->nativeFailed = true;
+        return false;
+    }
+    if (vm->coroutine != NULL) reserveCoroutineFrame(vm, needed);
+    push(vm, callee);
+    for (int32_t i = 0; i < argCount; i++) push(vm, args[i]);
+
+    // the boundary of the enclosing call is restored however this one ends
+    NativeCall nativeCall = {vm->runningNative, vm->frameCount, vm->coroutine,
+                             vm->nativeCall};
+    int32_t baseFrame = vm->baseFrame;
+    ObjectCoroutine* baseStack = vm->baseStack;
+    vm->baseFrame = vm->frameCount;
+    vm->baseStack = vm->coroutine;
+    vm->nativeCall = &nativeCall;
+
+    // natives and classes without an initializer return at once
+    bool called = callValue(vm, callee, argCount) &&
+                  (vm->frameCount == vm->baseFrame || run(vm) == INTERPRET_OK);
+
+    vm->nativeCall = nativeCall.enclosing;
+    vm->baseFrame = baseFrame;
+    vm->baseStack = baseStack;
+    vm->runningNative = nativeCall.native;
+    if (!called) {
+        vm->nativeFailed = true;
+        return false;
+    }
+    *result = pop(vm);
+    return true;
 }
@@ -0,0 +1,1632 @@
+/**
+ * @file worker.c
+ * @brief Worker VMs on their own threads, and channels between VMs.
+ *
+ * Values travel between VMs as messages: a flat encoding of the value graph,
+ * allocated outside of any heap, in which every object is numbered on first
+ * sight so that shared and cyclic structures come out the same shape. Frozen
+ * strings and functions are encoded as pointers, and a message keeps the
+ * frozen image of its sender alive until it is freed. A sender without frozen
+ * code attached sends the twins of its functions in its shared copy, and an
+ * encoding that reaches functions not copied yet is made again once they are
+ * frozen.
+ *
+ * A channel is an intrusive multi-producer queue of messages: senders append
+ * with a single atomic exchange and never lock or wait. Receivers take turns
+ * through a mutex and sleep on a semaphore counting the messages sent.
+ */
+
+#include "worker.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "frozen.h"
+#include "memory.h"
+#include "vm.h"
+
+// The tags of the encoded values.
+typedef enum {
+    MESSAGE_IMMEDIATE,      ///< A value that is not an object, as its bits.
+    MESSAGE_REFERENCE,      ///< An object encoded earlier, by number.
+    MESSAGE_STRING,         ///< A string, by its characters.
+    MESSAGE_FROZEN_STRING,  ///< A frozen string, by pointer.
+    MESSAGE_LIST,           ///< A list and its elements.
+    MESSAGE_MAP,            ///< A map and its entries.
+    MESSAGE_FLOAT64_ARRAY,  ///< A Float64Array and its elements.
+    MESSAGE_CLOSURE,        ///< A frozen function and its upvalues' values.
+    MESSAGE_NATIVE,         ///< A native function, by spec pointer.
+    MESSAGE_CHANNEL,        ///< A channel, by index in `channels`.
+} MessageTag;
+
+// An encoded value on its way from one VM to another.
+typedef struct Message {
+    _Atomic(struct Message*) next;  ///< The next message in the channel.
+    uint8_t* bytes;                 ///< The encoded value.
+    size_t count;                   ///< The number of bytes used.
+    size_t capacity;                ///< The number of bytes allocated.
+    Channel** channels;    ///< The channels it holds a reference to.
+    int32_t channelCount;  ///< The number of channels.
+    FrozenCode* code;  ///< The frozen image of the sender, or NULL.
+} Message;
+
+struct Channel {
+    atomic_int references;          ///< The handles and messages holding it.
+    _Atomic(Message*) head;         ///< The newest message, or the stub.
+    Message* tail;                  ///< The oldest message, or the stub.
+    Message stub;                   ///< Keeps the queue from ever emptying.
+    sem_t available;                ///< Counts the messages sent.
+    pthread_mutex_t receiving;      ///< Held while a message is taken.
+};
+
+struct Worker {
+    atomic_int references;  ///< The creator's handle and the thread.
+    pthread_t thread;       ///< The thread running the worker VM.
+    bool joined;            ///< Whether the creator has joined the thread.
+    Message* call;          ///< The function, its arguments and the globals.
+    Message* result;  ///< The value returned, or NULL if there is none.
+    bool failed;      ///< Whether the call raised a runtime error.
+};
+
+// Encodes values into a message.
+typedef struct {
+    VM* vm;              ///< The virtual machine the values live in.
+    Message* message;    ///< The message being written.
+    Map numbers;         ///< The number of every object encoded so far.
+    ValueArray objects;  ///< The objects encoded so far, by number.
+    ValueArray missing;  ///< The functions with no frozen twin yet.
+} MessageWriter;
+
+// Rebuilds the values of a message in a VM.
+typedef struct {
+    VM* vm;                  ///< The virtual machine receiving the values.
+    const Message* message;  ///< The message being read.
+    const uint8_t* current;  ///< The next byte to read.
+    ObjectList* objects;     ///< The objects rebuilt so far, by number.
+} MessageReader;
+
+//-----------------------------------------------------------------------------
+//- Messages
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Creates an empty message.
+ * @param vm The virtual machine whose frozen image, attached or shared, the
+ * message may refer to.
+ * @return Message* The message.
+ */
+static Message* newMessage(VM* vm) {
+    Message* message = ALLOCATE(NULL, Message, 1);
+    atomic_init(&message->next, NULL);
+    message->bytes = NULL;
+    message->count = 0;
+    message->capacity = 0;
+    message->channels = NULL;
+    message->channelCount = 0;
+    message->code = vm->frozen != NULL ? vm->frozen : vm->sharedCode;
+    if (message->code != NULL) atomic_fetch_add(&message->code->references, 1);
+    return message;
+}
+
+/**
+ * @brief Frees a message and drops the references it holds.
+ * @param message The message, or NULL.
+ */
+static void freeMessage(Message* message) {
+    if (message == NULL) return;
+    for (int32_t i = 0; i < message->channelCount; i++) {
+        releaseChannel(message->channels[i]);
+    }
+    FREE_ARRAY(NULL, Channel*, message->channels, message->channelCount);
+    FREE_ARRAY(NULL, uint8_t, message->bytes, message->capacity);
+    if (message->code != NULL) releaseFrozenCode(message->code);
+    FREE(NULL, Message, message);
+}
+
+/**
+ * @brief Appends bytes to a message.
+ * @param writer The message writer.
+ * @param bytes The bytes.
+ * @param count The number of bytes.
+ */
+static void writeBytes(MessageWriter* writer, const void* bytes,
+                       size_t count) {
+    Message* message = writer->message;
+    if (message->count + count > message->capacity) {
+        size_t oldCapacity = message->capacity;
+        while (message->count + count > message->capacity) {
+            message->capacity = GROW_CAPACITY(message->capacity);
+        }
+        message->bytes = GROW_ARRAY(NULL, uint8_t, message->bytes, oldCapacity,
+                                    message->capacity);
+    }
+    memcpy(message->bytes + message->count, bytes, count);
+    message->count += count;
+}
+
+/**
+ * @brief Appends a tag to a message.
+ * @param writer The message writer.
+ * @param tag The tag.
+ */
+static void writeTag(MessageWriter* writer, MessageTag tag) {
+    uint8_t byte = (uint8_t)tag;
+    writeBytes(writer, &byte, 1);
+}
+
+/**
+ * @brief Appends a count to a message.
+ * @param writer The message writer.
+ * @param count The count.
+ */
+static void writeCount(MessageWriter* writer, int32_t count) {
+    writeBytes(writer, &count, sizeof(count));
+}
+
+/**
+ * @brief Numbers an object the first time it is encoded.
+ * @param writer The message writer.
+ * @param object The object.
+ */
+static void numberObject(MessageWriter* writer, Value object) {
+    mapSet(writer->vm, &writer->numbers, object,
+           INT_VAL(writer->objects.count));
+    writeValueArray(writer->vm, &writer->objects, object);
+}
+
+/**
+ * @brief Returns the frozen function another VM runs for a function.
+ *
+ * A VM without frozen code attached sends the twins of its functions; one
+ * that has none yet is noted, to be frozen before the values are encoded
+ * again.
+ *
+ * @param writer The message writer.
+ * @param function The function.
+ * @return ObjectFunction* The frozen function, or NULL if there is none.
+ */
+static ObjectFunction* frozenFunction(MessageWriter* writer,
+                                      ObjectFunction* function) {
+    if (function->object.isFrozen) return function;
+    if (writer->vm->frozen != NULL) return NULL;
+
+    ObjectFunction* twin = findTwin(writer->vm, function);
+    if (twin != NULL) return twin;
+    for (int32_t i = 0; i < writer->missing.count; i++) {
+        if (AS_FUNCTION(writer->missing.values[i]) == function) return NULL;
+    }
+    writeValueArray(writer->vm, &writer->missing, OBJECT_VAL(function));
+    return NULL;
+}
+
+static bool encodeValue(MessageWriter* writer, Value value);
+
+/**
+ * @brief Encodes an object that was not encoded before.
+ * @param writer The message writer.
+ * @param value The object.
+ * @return bool False if the object, or an object it refers to, cannot be
+ * sent.
+ */
+static bool encodeObject(MessageWriter* writer, Value value) {
+    Object* object = AS_OBJECT(value);
+    switch (object->type) {
+        case OBJECT_STRING: {
+            numberObject(writer, value);
+            ObjectString* string = (ObjectString*)object;
+            if (object->isFrozen) {
+                writeTag(writer, MESSAGE_FROZEN_STRING);
+                writeBytes(writer, &string, sizeof(string));
+                return true;
+            }
+            writeTag(writer, MESSAGE_STRING);
+            writeCount(writer, string->length);
+            writeBytes(writer, string->chars, string->length);
+            return true;
+        }
+        case OBJECT_LIST: {
+            numberObject(writer, value);
+            const ValueArray* items = &((ObjectList*)object)->items;
+            writeTag(writer, MESSAGE_LIST);
+            writeCount(writer, items->count);
+            for (int32_t i = 0; i < items->count; i++) {
+                if (!encodeValue(writer, items->values[i])) return false;
+            }
+            return true;
+        }
+        case OBJECT_MAP: {
+            numberObject(writer, value);
+            const Map* table = &((ObjectMap*)object)->table;
+            writeTag(writer, MESSAGE_MAP);
+            writeCount(writer, table->count);
+            for (int32_t i = 0; i <= table->capacity; i++) {
+                if (IS_NIL(table->entries[i].key)) continue;
+                if (!encodeValue(writer, table->entries[i].key) ||
+                    !encodeValue(writer, table->entries[i].value)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case OBJECT_FLOAT64_ARRAY: {
+            numberObject(writer, value);
+            const ObjectFloat64Array* array = (ObjectFloat64Array*)object;
+            writeTag(writer, MESSAGE_FLOAT64_ARRAY);
+            writeCount(writer, array->count);
+            writeBytes(writer, array->values, sizeof(double) * array->count);
+            return true;
+        }
+        case OBJECT_CLOSURE: {
+            // only frozen code exists in the other VM as well
+            const ObjectClosure* closure = (ObjectClosure*)object;
+            ObjectFunction* function =
+                frozenFunction(writer, closure->function);
+            if (function == NULL) return false;
+            numberObject(writer, value);
+            writeTag(writer, MESSAGE_CLOSURE);
+            writeBytes(writer, &function, sizeof(function));
+            for (int32_t i = 0; i < closure->upvalueCount; i++) {
+                if (!encodeValue(writer, *closure->upvalues[i]->location)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case OBJECT_NATIVE: {
+            // a host's native belongs to the VM it was defined in
+            if (((ObjectNative*)object)->spec->host != NULL) return false;
+            numberObject(writer, value);
+            writeTag(writer, MESSAGE_NATIVE);
+            writeBytes(writer, &((ObjectNative*)object)->spec,
+                       sizeof(const NativeSpec*));
+            return true;
+        }
+        case OBJECT_CHANNEL: {
+            numberObject(writer, value);
+            Message* message = writer->message;
+            Channel* channel = ((ObjectChannel*)object)->channel;
+            atomic_fetch_add(&channel->references, 1);
+            message->channels =
+                GROW_ARRAY(NULL, Channel*, message->channels,
+                           message->channelCount, message->channelCount + 1);
+            message->channels[message->channelCount] = channel;
+            writeTag(writer, MESSAGE_CHANNEL);
+            writeCount(writer, message->channelCount++);
+            return true;
+        }
+        default:
+            // classes, instances, workers, coroutines and foreign data
+            // belong to a single VM
+            return false;
+    }
+}
+
+/**
+ * @brief Encodes a value.
+ * @param writer The message writer.
+ * @param value The value.
+ * @return bool False if the value, or an object it refers to, cannot be sent.
+ */
+static bool encodeValue(MessageWriter* writer, Value value) {
+    if (!IS_OBJECT(value)) {
+        writeTag(writer, MESSAGE_IMMEDIATE);
+        writeBytes(writer, &value, sizeof(value));
+        return true;
+    }
+
+    Value number;
+    if (mapGet(&writer->numbers, value, &number)) {
+        writeTag(writer, MESSAGE_REFERENCE);
+        writeCount(writer, AS_INT(number));
+        return true;
+    }
+    return encodeObject(writer, value);
+}
+
+/**
+ * @brief Prepares a writer for a new message.
+ * @param writer The message writer.
+ * @param vm The virtual machine the values live in.
+ */
+static void initMessageWriter(MessageWriter* writer, VM* vm) {
+    writer->vm = vm;
+    writer->message = newMessage(vm);
+    initMap(&writer->numbers);
+    initValueArray(&writer->objects);
+    initValueArray(&writer->missing);
+}
+
+/**
+ * @brief Frees the state of a writer, but not its message.
+ * @param writer The message writer.
+ */
+static void freeMessageWriter(MessageWriter* writer) {
+    freeMap(writer->vm, &writer->numbers);
+    freeValueArray(writer->vm, &writer->objects);
+    freeValueArray(writer->vm, &writer->missing);
+}
+
+/**
+ * @brief Freezes the functions an encoding could not send, if there are any.
+ *
+ * Even a successful encoding may have skipped globals holding them, so the
+ * writer and its message are then freed, for the values to be encoded again.
+ *
+ * @param writer The message writer.
+ * @return bool True if the values should be encoded again.
+ */
+static bool shouldEncodeAgain(MessageWriter* writer) {
+    if (writer->missing.count == 0 ||
+        !shareFunctions(writer->vm, &writer->missing)) {
+        return false;
+    }
+    freeMessageWriter(writer);
+    freeMessage(writer->message);
+    return true;
+}
+
+/**
+ * @brief Encodes a single value into a new message.
+ * @param vm The virtual machine the value lives in.
+ * @param value The value.
+ * @return Message* The message, or NULL if the value cannot be sent.
+ */
+static Message* encodeMessage(VM* vm, Value value) {
+    MessageWriter writer;
+    bool encoded;
+    do {
+        initMessageWriter(&writer, vm);
+        encoded = encodeValue(&writer, value);
+    } while (shouldEncodeAgain(&writer));
+    freeMessageWriter(&writer);
+
+    if (encoded) return writer.message;
+    freeMessage(writer.message);
+    return NULL;
+}
+
+/**
+ * @brief Reads bytes from a message.
+ * @param reader The message reader.
+ * @param bytes Where to copy the bytes.
+ * @param count The number of bytes.
+ */
+static void readBytes(MessageReader* reader, void* bytes, size_t count) {
+    memcpy(bytes, reader->current, count);
+    reader->current += count;
+}
+
+/**
+ * @brief Reads a count from a message.
+ * @param reader The message reader.
+ * @return int32_t The count.
+ */
+static int32_t readCount(MessageReader* reader) {
+    int32_t count;
+    readBytes(reader, &count, sizeof(count));
+    return count;
+}
+
+/**
+ * @brief Numbers a rebuilt object, which also keeps it from being collected.
+ * @param reader The message reader.
+ * @param object The object.
+ */
+static void appendObject(MessageReader* reader, Object* object) {
+    push(reader->vm, OBJECT_VAL(object));
+    writeValueArray(reader->vm, &reader->objects->items, OBJECT_VAL(object));
+    pop(reader->vm);
+}
+
+/**
+ * @brief Rebuilds a value.
+ * @param reader The message reader.
+ * @param value A pointer where the value will be stored.
+ * @return bool False if the value holds a closure over frozen code the VM
+ * does not have attached or did not share.
+ */
+static bool decodeValue(MessageReader* reader, Value* value) {
+    VM* vm = reader->vm;
+    uint8_t tag = *reader->current++;
+    switch ((MessageTag)tag) {
+        case MESSAGE_IMMEDIATE:
+            readBytes(reader, value, sizeof(*value));
+            return true;
+        case MESSAGE_REFERENCE:
+            *value = reader->objects->items.values[readCount(reader)];
+            return true;
+        case MESSAGE_STRING: {
+            int32_t length = readCount(reader);
+            // an attached frozen twin is found without copying
+            ObjectString* string =
+                copyString(vm, (const char*)reader->current, length);
+            reader->current += length;
+            appendObject(reader, (Object*)string);
+            *value = OBJECT_VAL(string);
+            return true;
+        }
+        case MESSAGE_FROZEN_STRING: {
+            ObjectString* frozen;
+            readBytes(reader, &frozen, sizeof(frozen));
+            ObjectString* string =
+                copyString(vm, frozen->chars, frozen->length);
+            appendObject(reader, (Object*)string);
+            *value = OBJECT_VAL(string);
+            return true;
+        }
+        case MESSAGE_LIST: {
+            ObjectList* list = newList(vm);
+            appendObject(reader, (Object*)list);
+            *value = OBJECT_VAL(list);
+            int32_t count = readCount(reader);
+            for (int32_t i = 0; i < count; i++) {
+                Value item;
+                if (!decodeValue(reader, &item)) return false;
+                writeValueArray(vm, &list->items, item);
+            }
+            return true;
+        }
+        case MESSAGE_MAP: {
+            ObjectMap* map = newMap(vm);
+            appendObject(reader, (Object*)map);
+            *value = OBJECT_VAL(map);
+            int32_t count = readCount(reader);
+            for (int32_t i = 0; i < count; i++) {
+                Value key;
+                Value item;
+                if (!decodeValue(reader, &key) || !decodeValue(reader, &item)) {
+                    return false;
+                }
+                mapSet(vm, &map->table, key, item);
+            }
+            return true;
+        }
+        case MESSAGE_FLOAT64_ARRAY: {
+            int32_t count = readCount(reader);
+            ObjectFloat64Array* array = newFloat64Array(vm, count);
+            readBytes(reader, array->values, sizeof(double) * count);
+            appendObject(reader, (Object*)array);
+            *value = OBJECT_VAL(array);
+            return true;
+        }
+        case MESSAGE_CLOSURE: {
+            ObjectFunction* function;
+            readBytes(reader, &function, sizeof(function));
+            // a VM without frozen code attached gets back the function the
+            // twin was made from
+            if (vm->frozen == NULL) {
+                function = findTwin(vm, function);
+            } else if (vm->frozen != reader->message->code) {
+                function = NULL;
+            }
+            if (function == NULL) return false;
+            ObjectClosure* closure = newClosure(vm, function);
+            appendObject(reader, (Object*)closure);
+            *value = OBJECT_VAL(closure);
+
+            // captured variables are copied, so they become closed upvalues
+            for (int32_t i = 0; i < closure->upvalueCount; i++) {
+                Value captured;
+                if (!decodeValue(reader, &captured)) return false;
+                ObjectUpvalue* upvalue = newUpvalue(vm, NULL);
+                upvalue->closed = captured;
+                upvalue->location = &upvalue->closed;
+                closure->upvalues[i] = upvalue;
+            }
+            return true;
+        }
+        case MESSAGE_NATIVE: {
+            const NativeSpec* spec;
+            readBytes(reader, &spec, sizeof(spec));
+            ObjectNative* native = newNative(vm, spec);
+            appendObject(reader, (Object*)native);
+            *value = OBJECT_VAL(native);
+            return true;
+        }
+        case MESSAGE_CHANNEL: {
+            Channel* channel = reader->message->channels[readCount(reader)];
+            atomic_fetch_add(&channel->references, 1);
+            ObjectChannel* object = newChannel(vm, channel);
+            appendObject(reader, (Object*)object);
+            *value = OBJECT_VAL(object);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Prepares a reader for a message.
+ *
+ * The table of rebuilt objects is pushed on the stack and must be popped
+ * with `endMessageReader`.
+ *
+ * @param reader The message reader.
+ * @param vm The virtual machine receiving the values.
+ * @param message The message.
+ */
+static void initMessageReader(MessageReader* reader, VM* vm,
+                              const Message* message) {
+    reader->vm = vm;
+    reader->message = message;
+    reader->current = message->bytes;
+    reader->objects = newList(vm);
+    push(vm, OBJECT_VAL(reader->objects));
+}
+
+/**
+ * @brief Pops the table of rebuilt objects of a reader.
+ * @param reader The message reader.
+ */
+static void endMessageReader(MessageReader* reader) {
+    pop(reader->vm);
+}
+
+/**
+ * @brief Rebuilds the value of a message.
+ * @param vm The virtual machine receiving the value.
+ * @param message The message.
+ * @param value A pointer where the value will be stored.
+ * @return bool False if the value holds code the VM cannot run.
+ */
+static bool decodeMessage(VM* vm, const Message* message, Value* value) {
+    MessageReader reader;
+    initMessageReader(&reader, vm, message);
+    bool decoded = decodeValue(&reader, value);
+    endMessageReader(&reader);
+    if (!decoded) *value = NIL_VAL;
+    return decoded;
+}
+
+//-----------------------------------------------------------------------------
+//- Channels
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Creates a channel.
+ * @return Channel* The channel, with one reference for its creator.
+ */
+Channel* createChannel(void) {
+    Channel* channel = ALLOCATE(NULL, Channel, 1);
+    atomic_init(&channel->references, 1);
+    atomic_init(&channel->stub.next, NULL);
+    atomic_init(&channel->head, &channel->stub);
+    channel->tail = &channel->stub;
+    sem_init(&channel->available, 0, 0);
+    pthread_mutex_init(&channel->receiving, NULL);
+    return channel;
+}
+
+/**
+ * @brief Drops a reference to a channel, freeing it and the messages it still
+ * holds with the last one.
+ * @param channel The channel.
+ */
+void releaseChannel(Channel* channel) {
+    if (atomic_fetch_sub(&channel->references, 1) != 1) return;
+
+    // nobody can send anymore, so every message is linked
+    Message* message = channel->tail;
+    while (message != NULL) {
+        Message* next = atomic_load(&message->next);
+        if (message != &channel->stub) freeMessage(message);
+        message = next;
+    }
+    sem_destroy(&channel->available);
+    pthread_mutex_destroy(&channel->receiving);
+    FREE(NULL, Channel, channel);
+}
+
+/**
+ * @brief Appends a message to a channel, without locking.
+ * @param channel The channel.
+ * @param message The message.
+ */
+static void enqueue(Channel* channel, Message* message) {
+    atomic_store_explicit(&message->next, NULL, memory_order_relaxed);
+    Message* previous = atomic_exchange_explicit(&channel->head, message,
+                                                 memory_order_acq_rel);
+    // until this store, receivers cannot reach the message
+    atomic_store_explicit(&previous->next, message, memory_order_release);
+}
+
+/**
+ * @brief Takes the oldest message of a channel.
+ *
+ * Must be called with `receiving` held, after the semaphore has counted a
+ * message. A sender that was interrupted between its exchange and its link
+ * is waited for.
+ *
+ * @param channel The channel.
+ * @return Message* The message.
+ */
+static Message* dequeue(Channel* channel) {
+    for (;;) {
+        Message* tail = channel->tail;
+        Message* next =
+            atomic_load_explicit(&tail->next, memory_order_acquire);
+        if (tail == &channel->stub) {
+            if (next == NULL) {
+                sched_yield();
+                continue;
+            }
+            channel->tail = next;
+            tail = next;
+            next = atomic_load_explicit(&tail->next, memory_order_acquire);
+        }
+        if (next != NULL) {
+            channel->tail = next;
+            return tail;
+        }
+
+        // the tail is the last message: put the stub behind it before taking
+        // it, unless a sender is already appending
+        if (tail == atomic_load_explicit(&channel->head,
+                                         memory_order_acquire)) {
+            enqueue(channel, &channel->stub);
+        }
+        sched_yield();
+    }
+}
+
+/**
+ * @brief Sends a copy of a value through a channel.
+ *
+ * Never blocks: the channel holds any number of messages.
+ *
+ * @param vm The virtual machine sending the value.
+ * @param channel The channel.
+ * @param value The value.
+ * @return bool False if the value, or a value it contains, cannot be sent.
+ */
+bool sendValue(VM* vm, Channel* channel, Value value) {
+    Message* message = encodeMessage(vm, value);
+    if (message == NULL) return false;
+
+    enqueue(channel, message);
+    sem_post(&channel->available);
+    return true;
+}
+
+/**
+ * @brief Takes the oldest message from a channel, waiting for one if it is
+ * empty.
+ * @param vm The virtual machine receiving the value.
+ * @param channel The channel.
+ * @param value A pointer where the copy of the sent value will be stored.
+ * @return bool False if the message holds code this VM cannot run.
+ */
+bool receiveValue(VM* vm, Channel* channel, Value* value) {
+    while (sem_wait(&channel->available) != 0 && errno == EINTR) {
+    }
+    pthread_mutex_lock(&channel->receiving);
+    Message* message = dequeue(channel);
+    pthread_mutex_unlock(&channel->receiving);
+
+    bool decoded = decodeMessage(vm, message, value);
+    freeMessage(message);
+    return decoded;
+}
+
+//-----------------------------------------------------------------------------
+//- Calls
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Encodes every global that can be sent, skipping the others.
+ * @param writer The message writer.
+ * @param globals The globals of the calling VM.
+ */
+static void encodeGlobals(MessageWriter* writer, const Table* globals) {
+    Message* message = writer->message;
+    size_t countOffset = message->count;
+    int32_t count = 0;
+    writeCount(writer, 0);
+
+    for (int32_t i = 0; i <= globals->capacity; i++) {
+        const Entry* entry = &globals->entries[i];
+        if (entry->key == NULL) continue;
+
+        size_t byteCount = message->count;
+        int32_t objectCount = writer->objects.count;
+        int32_t channelCount = message->channelCount;
+        if (encodeValue(writer, OBJECT_VAL(entry->key)) &&
+            encodeValue(writer, entry->value)) {
+            count++;
+            continue;
+        }
+
+        // forget the part of the global that was encoded
+        message->count = byteCount;
+        while (writer->objects.count > objectCount) {
+            Value object = writer->objects.values[--writer->objects.count];
+            mapDelete(writer->vm, &writer->numbers, object);
+        }
+        while (message->channelCount > channelCount) {
+            releaseChannel(message->channels[--message->channelCount]);
+        }
+    }
+    memcpy(message->bytes + countOffset, &count, sizeof(count));
+}
+
+/**
+ * @brief Encodes a call for another VM to make: the callee, its arguments
+ * and the globals of the calling VM.
+ * @param vm The virtual machine making the call.
+ * @param callee The function to call.
+ * @param argCount The number of arguments.
+ * @param args The arguments.
+ * @return Message* The message, or NULL if the callee is not a function or
+ * it or an argument cannot be sent.
+ */
+static Message* encodeCall(VM* vm, Value callee, int32_t argCount,
+                           const Value* args) {
+    if (!IS_CLOSURE(callee) && !IS_NATIVE(callee)) return NULL;
+
+    MessageWriter writer;
+    bool encoded;
+    do {
+        initMessageWriter(&writer, vm);
+        encoded = encodeValue(&writer, callee);
+        writeCount(&writer, argCount);
+        for (int32_t i = 0; encoded && i < argCount; i++) {
+            encoded = encodeValue(&writer, args[i]);
+        }
+        if (encoded) encodeGlobals(&writer, &vm->globals);
+    } while (shouldEncodeAgain(&writer));
+    freeMessageWriter(&writer);
+
+    if (encoded) return writer.message;
+    freeMessage(writer.message);
+    return NULL;
+}
+
+/**
+ * @brief Rebuilds a call in a worker VM.
+ *
+ * Attaches the frozen image of the message, defines the globals, and pushes
+ * the callee and its arguments, ready for `interpretCall`.
+ *
+ * @param vm The virtual machine, which must not have run any code yet or
+ * have the image of the message attached.
+ * @param call The message written by `encodeCall`.
+ * @param argCount A pointer where the number of arguments will be stored.
+ * @return bool False if the call cannot be rebuilt.
+ */
+static bool decodeCall(VM* vm, const Message* call, int32_t* argCount) {
+    if (call->code != NULL) attachFrozenCode(vm, call->code);
+
+    MessageReader reader;
+    initMessageReader(&reader, vm, call);
+    Value callee = NIL_VAL;
+    bool decoded = decodeValue(&reader, &callee);
+    push(vm, callee);
+    *argCount = decoded ? readCount(&reader) : 0;
+    for (int32_t i = 0; decoded && i < *argCount; i++) {
+        Value arg = NIL_VAL;
+        decoded = decodeValue(&reader, &arg);
+        push(vm, arg);
+    }
+    int32_t globalCount = decoded ? readCount(&reader) : 0;
+    for (int32_t i = 0; decoded && i < globalCount; i++) {
+        Value name;
+        Value global;
+        decoded = decodeValue(&reader, &name) &&
+                  decodeValue(&reader, &global);
+        if (decoded) tableSet(vm, &vm->globals, AS_STRING(name), global);
+    }
+
+    // everything rebuilt is reachable from the stack or the globals now, so
+    // the emptied table can stay below the callee
+    reader.objects->items.count = 0;
+    return decoded;
+}
+
+//-----------------------------------------------------------------------------
+//- Workers
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Drops a reference to a worker, freeing it with the last one.
+ * @param worker The worker.
+ */
+static void dropWorker(Worker* worker) {
+    if (atomic_fetch_sub(&worker->references, 1) != 1) return;
+    freeMessage(worker->call);
+    freeMessage(worker->result);
+    FREE(NULL, Worker, worker);
+}
+
+/**
+ * @brief Runs a worker VM: the body of the worker's thread.
+ * @param argument The worker.
+ * @return void* NULL.
+ */
+static void* runWorker(void* argument) {
+    Worker* worker = (Worker*)argument;
+
+    VM vm;
+    initVM(&vm);
+    int32_t argCount;
+    bool decoded = decodeCall(&vm, worker->call, &argCount);
+    freeMessage(worker->call);
+    worker->call = NULL;
+
+    if (decoded && interpretCall(&vm, argCount) == INTERPRET_OK) {
+        worker->result = encodeMessage(&vm, vm.stackTop[-1]);
+    } else {
+        worker->failed = true;
+    }
+    freeVM(&vm);
+    dropWorker(worker);
+    return NULL;
+}
+
+/**
+ * @brief Starts a thread calling a function in a new VM.
+ *
+ * The worker VM starts with the frozen code of the spawning VM attached and a
+ * copy of every global of the spawning VM that can be sent. The function and
+ * the arguments are sent like values through a channel: a closure over code
+ * the spawning VM compiled itself is sent as its frozen twin, which requires
+ * stubs left by lazy compilation to compile.
+ *
+ * @param vm The virtual machine spawning the worker.
+ * @param callee The function to call.
+ * @param argCount The number of arguments.
+ * @param args The arguments.
+ * @return Worker* The worker, with one reference for its creator, or NULL
+ * after a runtime error if the callee is not a function, it or an argument
+ * cannot be sent, or the thread cannot start.
+ */
+Worker* spawnWorker(VM* vm, Value callee, int32_t argCount,
+                    const Value* args) {
+    if (!IS_CLOSURE(callee) && !IS_NATIVE(callee)) {
+        nativeError(vm, "Can only spawn functions.");
+        return NULL;
+    }
+    Message* call = encodeCall(vm, callee, argCount, args);
+    if (call == NULL) {
+        nativeError(vm, "Can't send the function or an argument to a worker.");
+        return NULL;
+    }
+
+    Worker* worker = ALLOCATE(NULL, Worker, 1);
+    atomic_init(&worker->references, 2);
+    worker->joined = false;
+    worker->call = call;
+    worker->result = NULL;
+    worker->failed = false;
+    if (pthread_create(&worker->thread, NULL, runWorker, worker) != 0) {
+        freeMessage(worker->call);
+        FREE(NULL, Worker, worker);
+        nativeError(vm, "Can't start a thread for the worker.");
+        return NULL;
+    }
+    return worker;
+}
+
+/**
+ * @brief Waits for a worker to finish and copies its result.
+ * @param vm The virtual machine that spawned the worker.
+ * @param worker The worker.
+ * @param result A pointer where the value returned by the function will be
+ * stored.
+ * @return bool False after a runtime error if the function failed with a
+ * runtime error or returned a value that cannot be sent back.
+ */
+bool joinWorker(VM* vm, Worker* worker, Value* result) {
+    if (!worker->joined) {
+        pthread_join(worker->thread, NULL);
+        worker->joined = true;
+    }
+
+    *result = NIL_VAL;
+    if (worker->failed) {
+        nativeError(vm, "The function of the worker failed.");
+        return false;
+    }
+    if (worker->result == NULL ||
+        !decodeMessage(vm, worker->result, result)) {
+        nativeError(vm, "Can't send the result of the worker back.");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Drops the creator's reference to a worker.
+ *
+ * A worker that was never joined keeps running on its own and frees itself
+ * when its function returns.
+ *
+ * @param worker The worker.
+ */
+void releaseWorker(Worker* worker) {
+    if (!worker->joined) pthread_detach(worker->thread);
+    dropWorker(worker);
+}
+
+//-----------------------------------------------------------------------------
+//- Parallel Map and Reduce
+//-----------------------------------------------------------------------------
+
+// The chunks a pool thread still has to process, packed as the first chunk
+// in the low half and the end in the high half so both move in one CAS. The
+// owner takes chunks from the front, idle threads steal from the back.
+typedef struct {
+    _Atomic uint64_t range;  ///< The first chunk left and the end.
+    char padding[56];        ///< Keeps each range on its own cache line.
+} ChunkRange;
+
+// Why a parallel job failed.
+typedef enum {
+    JOB_OK,           ///< It has not failed.
+    JOB_CALL_FAILED,  ///< A call raised a runtime error in a worker.
+    JOB_NOT_SENT,     ///< A value could not be sent between its VMs.
+} JobFailure;
+
+// A map or reduce spread over the worker pool of the calling VM.
+typedef struct {
+    const char* name;       ///< The native running the job, for errors.
+    Message* call;          ///< The function and the globals.
+    Message** chunks;       ///< Each chunk of elements, as a list.
+    Message** results;      ///< The mapped list or partial result by chunk.
+    int32_t chunkCount;     ///< The number of chunks.
+    ChunkRange* ranges;     ///< The chunks left to each thread.
+    int32_t threadCount;    ///< The number of pool threads taking part.
+    Message* initial;       ///< The initial value of a reduce, or NULL.
+    Message* reduced;       ///< The result of a reduce.
+    atomic_int running;     ///< The threads that have not finished.
+    atomic_int failure;     ///< Why the job failed first, or `JOB_OK`.
+    bool done;              ///< Set by the last thread, under the pool lock.
+} ParallelJob;
+
+// The state of one thread of the pool.
+typedef struct {
+    WorkerPool* pool;  ///< The pool.
+    int32_t index;     ///< The thread's own range in each job.
+    pthread_t thread;  ///< The thread.
+} PoolThread;
+
+// The threads running the parallel jobs of a VM, each with a VM of its own
+// that is kept from one job to the next.
+struct WorkerPool {
+    pthread_mutex_t lock;     ///< Guards the fields below and `done`.
+    pthread_cond_t posted;    ///< Signalled when a job is posted or on stop.
+    pthread_cond_t finished;  ///< Signalled when a job is done.
+    ParallelJob* job;         ///< The job running, or NULL.
+    uint32_t generation;      ///< The number of jobs posted so far.
+    bool stopping;            ///< Set when the threads must exit.
+    PoolThread* threads;      ///< The threads.
+    int32_t threadCount;      ///< The number of threads that started.
+    int32_t threadCapacity;   ///< The number of threads allocated.
+};
+
+/**
+ * @brief Records why a job failed, unless it failed before.
+ * @param job The job.
+ * @param failure The reason.
+ */
+static void failJob(ParallelJob* job, JobFailure failure) {
+    int expected = JOB_OK;
+    atomic_compare_exchange_strong(&job->failure, &expected, (int)failure);
+}
+
+/**
+ * @brief Checks whether a job has failed.
+ * @param job The job.
+ * @return bool True if it has.
+ */
+static bool hasFailed(ParallelJob* job) {
+    return atomic_load(&job->failure) != JOB_OK;
+}
+
+/**
+ * @brief Takes a chunk from the front of a thread's own range or, once it is
+ * empty, steals one from the back of another thread's range.
+ * @param job The job.
+ * @param self The index of the thread.
+ * @return int32_t The chunk, or -1 when none are left.
+ */
+static int32_t takeChunk(ParallelJob* job, int32_t self) {
+    for (int32_t i = 0; i < job->threadCount; i++) {
+        int32_t victim = (self + i) % job->threadCount;
+        _Atomic uint64_t* range = &job->ranges[victim].range;
+        uint64_t old = atomic_load(range);
+        for (;;) {
+            uint32_t first = (uint32_t)old;
+            uint32_t end = (uint32_t)(old >> 32);
+            if (first >= end) break;
+
+            uint32_t chunk = victim == self ? first : end - 1;
+            uint64_t taken = victim == self
+                                 ? ((uint64_t)end << 32) | (first + 1)
+                                 : ((uint64_t)(end - 1) << 32) | first;
+            if (atomic_compare_exchange_weak(range, &old, taken)) {
+                return (int32_t)chunk;
+            }
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Calls the function below its arguments and leaves the result on the
+ * stack.
+ * @param vm The virtual machine.
+ * @param job The job, which fails on a runtime error.
+ * @param argCount The number of arguments.
+ * @return bool False on a runtime error, which also empties the stack.
+ */
+static bool callFunction(VM* vm, ParallelJob* job, int32_t argCount) {
+    if (interpretCall(vm, argCount) == INTERPRET_OK) return true;
+    failJob(job, JOB_CALL_FAILED);
+    return false;
+}
+
+/**
+ * @brief Folds values into the accumulator on top of the stack.
+ * @param vm The virtual machine.
+ * @param job The job.
+ * @param fn The function, called with the accumulator and the next value.
+ * @param values The values to fold into the accumulator.
+ * @param count The number of values.
+ * @return bool False on a runtime error.
+ */
+static bool foldValues(VM* vm, ParallelJob* job, Value fn,
+                       const Value* values, int32_t count) {
+    for (int32_t i = 0; i < count; i++) {
+        Value accumulator = vm->stackTop[-1];
+        push(vm, fn);
+        push(vm, accumulator);
+        push(vm, values[i]);
+        if (!callFunction(vm, job, 2)) return false;
+        vm->stackTop[-2] = pop(vm);
+    }
+    return true;
+}
+
+/**
+ * @brief Maps or folds one chunk.
+ * @param vm The virtual machine.
+ * @param job The job.
+ * @param fn The function, which must be on the stack.
+ * @param chunk The chunk.
+ * @return bool False if the chunk cannot be processed.
+ */
+static bool processChunk(VM* vm, ParallelJob* job, Value fn, int32_t chunk) {
+    Value elements;
+    if (!decodeMessage(vm, job->chunks[chunk], &elements)) return false;
+    push(vm, elements);
+    const ValueArray* items = &AS_LIST(elements)->items;
+
+    if (job->initial != NULL) {
+        // a chunk folds into its first element, the initial value is only
+        // used once, when the partial results are merged
+        push(vm, items->values[0]);
+        if (!foldValues(vm, job, fn, items->values + 1, items->count - 1)) {
+            return false;
+        }
+    } else {
+        ObjectList* mapped = newList(vm);
+        push(vm, OBJECT_VAL(mapped));
+        for (int32_t i = 0; i < items->count; i++) {
+            push(vm, fn);
+            push(vm, items->values[i]);
+            if (!callFunction(vm, job, 1)) return false;
+            writeValueArray(vm, &mapped->items, vm->stackTop[-1]);
+            pop(vm);
+        }
+    }
+
+    // the partial result or mapped list stays on the stack while encoded
+    job->results[chunk] = encodeMessage(vm, vm->stackTop[-1]);
+    pop(vm);
+    pop(vm);
+    return job->results[chunk] != NULL;
+}
+
+/**
+ * @brief Folds the partial results of a reduce, starting from its initial
+ * value.
+ * @param vm The virtual machine.
+ * @param job The job.
+ * @param fn The function, which must be on the stack.
+ * @return bool False if the partial results cannot be merged.
+ */
+static bool mergePartials(VM* vm, ParallelJob* job, Value fn) {
+    ObjectList* partials = newList(vm);
+    push(vm, OBJECT_VAL(partials));
+    for (int32_t i = 0; i < job->chunkCount; i++) {
+        Value partial;
+        if (!decodeMessage(vm, job->results[i], &partial)) return false;
+        push(vm, partial);
+        writeValueArray(vm, &partials->items, partial);
+        pop(vm);
+    }
+
+    Value initial;
+    if (!decodeMessage(vm, job->initial, &initial)) return false;
+    push(vm, initial);
+    if (!foldValues(vm, job, fn, partials->items.values,
+                    partials->items.count)) {
+        return false;
+    }
+    job->reduced = encodeMessage(vm, vm->stackTop[-1]);
+    return job->reduced != NULL;
+}
+
+/**
+ * @brief Runs a pool thread's share of a job.
+ *
+ * The last thread to run out of chunks merges the partial results of a
+ * reduce and tells the caller the job is done.
+ *
+ * @param vm The thread's virtual machine.
+ * @param pool The pool.
+ * @param job The job.
+ * @param index The index of the thread.
+ */
+static void runJobShare(VM* vm, WorkerPool* pool, ParallelJob* job,
+                        int32_t index) {
+    int32_t argCount;
+    bool working = decodeCall(vm, job->call, &argCount);
+    Value fn = vm->stackTop[-1];
+    while (working && !hasFailed(job)) {
+        int32_t chunk = takeChunk(job, index);
+        if (chunk < 0) break;
+        working = processChunk(vm, job, fn, chunk);
+    }
+    // a runtime error has already failed the job, for a better reason
+    if (!working) failJob(job, JOB_NOT_SENT);
+
+    bool last = atomic_fetch_sub(&job->running, 1) == 1;
+    if (last && job->initial != NULL && !hasFailed(job) &&
+        !mergePartials(vm, job, fn)) {
+        failJob(job, JOB_NOT_SENT);
+    }
+
+    // the VM waits for the next job with its output shown and its stack empty
+    flushOutput(&vm->output);
+    vm->stackTop = vm->stack;
+
+    if (last) {
+        pthread_mutex_lock(&pool->lock);
+        job->done = true;
+        pthread_cond_signal(&pool->finished);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/**
+ * @brief Runs a worker VM of the pool: the body of each pool thread.
+ *
+ * The thread takes part in every job posted to the pool that has a range for
+ * it, until the pool stops.
+ *
+ * @param argument The pool thread.
+ * @return void* NULL.
+ */
+static void* runPoolThread(void* argument) {
+    PoolThread* self = (PoolThread*)argument;
+    WorkerPool* pool = self->pool;
+
+    VM vm;
+    initVM(&vm);
+    bool fresh = true;
+    uint32_t generation = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stopping && pool->generation == generation) {
+            pthread_cond_wait(&pool->posted, &pool->lock);
+        }
+        if (pool->stopping) break;
+        generation = pool->generation;
+
+        // the caller waits for every thread taking part, so the job outlives
+        // the share of this one
+        ParallelJob* job = pool->job;
+        if (job == NULL || self->index >= job->threadCount) continue;
+        pthread_mutex_unlock(&pool->lock);
+
+        // a VM keeps the first image attached to it, so a job sent with a
+        // newer shared copy of the caller's code needs a new one
+        if (!fresh && vm.frozen != job->call->code) {
+            freeVM(&vm);
+            initVM(&vm);
+        }
+        fresh = false;
+        runJobShare(&vm, pool, job, self->index);
+        pthread_mutex_lock(&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    freeVM(&vm);
+    return NULL;
+}
+
+/**
+ * @brief Stops a pool's threads and frees it.
+ * @param pool The pool, whose threads must be waiting for a job.
+ */
+static void stopWorkerPool(WorkerPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->posted);
+    pthread_mutex_unlock(&pool->lock);
+    for (int32_t i = 0; i < pool->threadCount; i++) {
+        pthread_join(pool->threads[i].thread, NULL);
+    }
+
+    pthread_cond_destroy(&pool->finished);
+    pthread_cond_destroy(&pool->posted);
+    pthread_mutex_destroy(&pool->lock);
+    FREE_ARRAY(NULL, PoolThread, pool->threads, pool->threadCapacity);
+    FREE(NULL, WorkerPool, pool);
+}
+
+/**
+ * @brief Returns a VM's worker pool, starting it with a thread per core on
+ * first use.
+ *
+ * If only some of the threads start, the pool makes do with those.
+ *
+ * @param vm The virtual machine.
+ * @return WorkerPool* The pool, or NULL if no thread can start.
+ */
+static WorkerPool* getWorkerPool(VM* vm) {
+    if (vm->pool != NULL) return vm->pool;
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    WorkerPool* pool = ALLOCATE(NULL, WorkerPool, 1);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->posted, NULL);
+    pthread_cond_init(&pool->finished, NULL);
+    pool->job = NULL;
+    pool->generation = 0;
+    pool->stopping = false;
+    pool->threadCapacity = cores < 1 ? 1 : (int32_t)cores;
+    pool->threads = ALLOCATE(NULL, PoolThread, pool->threadCapacity);
+    pool->threadCount = 0;
+    for (int32_t i = 0; i < pool->threadCapacity; i++) {
+        PoolThread* thread = &pool->threads[i];
+        thread->pool = pool;
+        thread->index = i;
+        if (pthread_create(&thread->thread, NULL, runPoolThread, thread) !=
+            0) {
+            break;
+        }
+        pool->threadCount++;
+    }
+
+    if (pool->threadCount == 0) {
+        stopWorkerPool(pool);
+        return NULL;
+    }
+    vm->pool = pool;
+    return pool;
+}
+
+/**
+ * @brief Stops a VM's worker pool, if it has one, and frees its threads' VMs.
+ * @param vm The virtual machine.
+ */
+void freeWorkerPool(VM* vm) {
+    if (vm->pool == NULL) return;
+    stopWorkerPool(vm->pool);
+    vm->pool = NULL;
+}
+
+/**
+ * @brief Encodes a slice of a list as a list of its own.
+ * @param vm The virtual machine the list lives in.
+ * @param values The first element of the slice.
+ * @param count The number of elements.
+ * @return Message* The message, or NULL if an element cannot be sent.
+ */
+static Message* encodeSlice(VM* vm, const Value* values, int32_t count) {
+    MessageWriter writer;
+    bool encoded;
+    do {
+        initMessageWriter(&writer, vm);
+        // the slice is a new list when rebuilt, so it takes a number
+        writeValueArray(vm, &writer.objects, NIL_VAL);
+        writeTag(&writer, MESSAGE_LIST);
+        writeCount(&writer, count);
+        encoded = true;
+        for (int32_t i = 0; encoded && i < count; i++) {
+            encoded = encodeValue(&writer, values[i]);
+        }
+    } while (shouldEncodeAgain(&writer));
+    freeMessageWriter(&writer);
+
+    if (encoded) return writer.message;
+    freeMessage(writer.message);
+    return NULL;
+}
+
+/**
+ * @brief Frees the messages of a job.
+ * @param job The job.
+ */
+static void freeParallelJob(ParallelJob* job) {
+    for (int32_t i = 0; i < job->chunkCount; i++) {
+        freeMessage(job->chunks[i]);
+        freeMessage(job->results[i]);
+    }
+    FREE_ARRAY(NULL, Message*, job->chunks, job->chunkCount);
+    FREE_ARRAY(NULL, Message*, job->results, job->chunkCount);
+    FREE_ARRAY(NULL, ChunkRange, job->ranges, job->threadCount);
+    freeMessage(job->call);
+    freeMessage(job->initial);
+    freeMessage(job->reduced);
+}
+
+/**
+ * @brief Checks that a message refers to the latest frozen code of a VM, as
+ * the messages of a job must all refer to the same.
+ * @param vm The virtual machine.
+ * @param message The message.
+ * @return bool True if it does.
+ */
+static bool isCurrent(VM* vm, const Message* message) {
+    return message->code ==
+           (vm->frozen != NULL ? vm->frozen : vm->sharedCode);
+}
+
+/**
+ * @brief Encodes the call, the initial value and the chunks of a job.
+ *
+ * The list is split into `PARALLEL_CHUNKS_PER_THREAD` chunks per thread, so
+ * threads that finish early have chunks left to steal. A value holding
+ * functions of the VM's own may make a new shared copy, which the messages
+ * encoded before do not refer to: all of them are then encoded again.
+ *
+ * @param vm The virtual machine running the job.
+ * @param job The job.
+ * @param pool The pool that will run it.
+ * @param list The list.
+ * @param fn The function.
+ * @param initial The initial value of a reduce, or NULL.
+ * @return bool False after a runtime error if the function or a value cannot
+ * be sent.
+ */
+static bool encodeParallelJob(VM* vm, ParallelJob* job, const WorkerPool* pool,
+                              const ObjectList* list, Value fn,
+                              const Value* initial) {
+    int32_t count = list->items.count;
+    job->threadCount = pool->threadCount;
+    if (job->threadCount > count) job->threadCount = count;
+
+    int32_t chunkSize = 0;
+    if (count > 0) {
+        int32_t wanted = job->threadCount * PARALLEL_CHUNKS_PER_THREAD;
+        chunkSize = (count + wanted - 1) / wanted;
+        job->chunkCount = (count + chunkSize - 1) / chunkSize;
+    }
+    job->chunks = ALLOCATE(NULL, Message*, job->chunkCount);
+    job->results = ALLOCATE(NULL, Message*, job->chunkCount);
+    for (int32_t i = 0; i < job->chunkCount; i++) {
+        job->chunks[i] = NULL;
+        job->results[i] = NULL;
+    }
+    job->ranges = ALLOCATE(NULL, ChunkRange, job->threadCount);
+
+    if (!IS_CLOSURE(fn) && !IS_NATIVE(fn)) {
+        nativeError(vm, "Argument 2 of %s() must be a function.", job->name);
+        return false;
+    }
+
+    for (;;) {
+        job->call = encodeCall(vm, fn, 0, NULL);
+        if (job->call == NULL) {
+            nativeError(vm, "Can't send the function of %s() to a worker.",
+                        job->name);
+            return false;
+        }
+        if (initial != NULL) {
+            job->initial = encodeMessage(vm, *initial);
+            if (job->initial == NULL) {
+                nativeError(vm, "Can't send the initial value of %s() to a "
+                                "worker.",
+                            job->name);
+                return false;
+            }
+        }
+        for (int32_t i = 0; i < job->chunkCount; i++) {
+            int32_t start = i * chunkSize;
+            int32_t end = start + chunkSize < count ? start + chunkSize : count;
+            job->chunks[i] =
+                encodeSlice(vm, list->items.values + start, end - start);
+            if (job->chunks[i] == NULL) {
+                nativeError(vm, "Can't send an element of the list to a "
+                                "worker.");
+                return false;
+            }
+        }
+
+        bool current = isCurrent(vm, job->call) &&
+                       (job->initial == NULL || isCurrent(vm, job->initial));
+        for (int32_t i = 0; current && i < job->chunkCount; i++) {
+            current = isCurrent(vm, job->chunks[i]);
+        }
+        if (current) return true;
+
+        freeMessage(job->call);
+        freeMessage(job->initial);
+        job->call = NULL;
+        job->initial = NULL;
+        for (int32_t i = 0; i < job->chunkCount; i++) {
+            freeMessage(job->chunks[i]);
+            job->chunks[i] = NULL;
+        }
+    }
+}
+
+/**
+ * @brief Runs an encoded job on a VM's worker pool and waits for it.
+ * @param pool The pool.
+ * @param job The job.
+ * @return bool False if a chunk fails.
+ */
+static bool runParallelJob(WorkerPool* pool, ParallelJob* job) {
+    // each thread starts with an even share of consecutive chunks
+    for (int32_t i = 0; i < job->threadCount; i++) {
+        uint64_t first = (uint64_t)i * job->chunkCount / job->threadCount;
+        uint64_t end = (uint64_t)(i + 1) * job->chunkCount / job->threadCount;
+        atomic_init(&job->ranges[i].range, (end << 32) | first);
+    }
+    atomic_init(&job->running, job->threadCount);
+    atomic_init(&job->failure, JOB_OK);
+    job->done = false;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->job = job;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->posted);
+    while (!job->done) pthread_cond_wait(&pool->finished, &pool->lock);
+    pool->job = NULL;
+    pthread_mutex_unlock(&pool->lock);
+    return !hasFailed(job);
+}
+
+/**
+ * @brief Prepares an empty job.
+ * @param job The job.
+ * @param name The native running the job.
+ */
+static void initParallelJob(ParallelJob* job, const char* name) {
+    job->name = name;
+    job->call = NULL;
+    job->chunks = NULL;
+    job->results = NULL;
+    job->chunkCount = 0;
+    job->ranges = NULL;
+    job->threadCount = 0;
+    job->initial = NULL;
+    job->reduced = NULL;
+    job->done = false;
+}
+
+/**
+ * @brief Reports why a job failed as a runtime error.
+ * @param vm The virtual machine that ran the job.
+ * @param job The job.
+ */
+static void reportJobFailure(VM* vm, ParallelJob* job) {
+    switch ((JobFailure)atomic_load(&job->failure)) {
+        case JOB_CALL_FAILED:
+            nativeError(vm, "The function of %s() failed in a worker.",
+                        job->name);
+            break;
+        default:
+            nativeError(vm, "Can't send a result of %s() back from a worker.",
+                        job->name);
+            break;
+    }
+}
+
+/**
+ * @brief Applies a function to every element of a list on the VM's worker
+ * pool.
+ *
+ * The function runs in other VMs, so it must be sendable like the function
+ * of `spawnWorker`, and should be pure: it sees a copy of the globals and of
+ * each element. The pool's threads and VMs are started by the first call
+ * and kept for the next ones, but every call still copies the globals into
+ * each of them, so it pays off when the calls of the function outweigh
+ * that.
+ *
+ * @param vm The virtual machine.
+ * @param list The list.
+ * @param fn The function, called with one element at a time.
+ * @return Value A new list of the results in the order of the elements, or
+ * nil after a runtime error if the function, an element or a result cannot
+ * be sent, a call fails with a runtime error, or the pool cannot start.
+ */
+Value parallelMap(VM* vm, const ObjectList* list, Value fn) {
+    WorkerPool* pool = getWorkerPool(vm);
+    if (pool == NULL) {
+        nativeError(vm, "Can't start the threads of parallelMap().");
+        return NIL_VAL;
+    }
+
+    ParallelJob job;
+    initParallelJob(&job, "parallelMap");
+    if (!encodeParallelJob(vm, &job, pool, list, fn, NULL)) {
+        freeParallelJob(&job);
+        return NIL_VAL;
+    }
+    if (job.chunkCount > 0 && !runParallelJob(pool, &job)) {
+        reportJobFailure(vm, &job);
+        freeParallelJob(&job);
+        return NIL_VAL;
+    }
+
+    ObjectList* mapped = newList(vm);
+    push(vm, OBJECT_VAL(mapped));
+    for (int32_t i = 0; i < job.chunkCount; i++) {
+        Value results;
+        if (!decodeMessage(vm, job.results[i], &results)) {
+            failJob(&job, JOB_NOT_SENT);
+            reportJobFailure(vm, &job);
+            pop(vm);
+            freeParallelJob(&job);
+            return NIL_VAL;
+        }
+        push(vm, results);
+        const ValueArray* items = &AS_LIST(results)->items;
+        for (int32_t j = 0; j < items->count; j++) {
+            writeValueArray(vm, &mapped->items, items->values[j]);
+        }
+        pop(vm);
+    }
+    pop(vm);
+    freeParallelJob(&job);
+    return OBJECT_VAL(mapped);
+}
+
+/**
+ * @brief Combines the elements of a list with a function on the VM's worker
+ * pool.
+ *
+ * Each thread folds chunks of consecutive elements, and the partial results
+ * are then folded in order starting from `initial`, so the result is the
+ * same as a sequential fold only if the function is associative.
+ *
+ * @param vm The virtual machine.
+ * @param list The list.
+ * @param fn The function, called with the accumulated value and the next
+ * value.
+ * @param initial The value the fold starts from, returned for an empty list.
+ * @return Value The result, or nil after a runtime error if the function, a
+ * value or a result cannot be sent, a call fails with a runtime error, or the
+ * pool cannot start.
+ */
+Value parallelReduce(VM* vm, const ObjectList* list, Value fn,
+                     Value initial) {
+    if (list->items.count == 0) return initial;
+    WorkerPool* pool = getWorkerPool(vm);
+    if (pool == NULL) {
+        nativeError(vm, "Can't start the threads of parallelReduce().");
+        return NIL_VAL;
+    }
+
+    ParallelJob job;
+    initParallelJob(&job, "parallelReduce");
+    Value result = NIL_VAL;
+    if (encodeParallelJob(vm, &job, pool, list, fn, &initial)) {
+        if (!runParallelJob(pool, &job) ||
+            !decodeMessage(vm, job.reduced, &result)) {
+            failJob(&job, JOB_NOT_SENT);
+            reportJobFailure(vm, &job);
+        }
+    }
+    freeParallelJob(&job);
+    return result;
+}